@@ -37,6 +37,7 @@
 #include <linux/types.h>
 #include <linux/uio.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 #include <linux/module.h>
 #include <linux/compat.h>
 #include <sound/core.h>
@@ -53,6 +54,11 @@
 #define COMPR_CODEC_CAPS_OVERFLOW
 #endif
 
+/* commit data placed in the mmapped playback buffer, see snd_compr_ack() */
+#ifndef SNDRV_COMPRESS_ACK
+#define SNDRV_COMPRESS_ACK		_IOW('C', 0x40, __u32)
+#endif
+
 /* TODO:
  * - add substream support for multiple devices in case of
  *	SND_DYNAMIC_MINORS is not used
@@ -171,7 +177,7 @@ static int snd_compr_free(struct inode *inode, struct file *f)
 	}
 
 	data->stream.ops->free(&data->stream);
-	kfree(data->stream.runtime->buffer);
+	vfree(data->stream.runtime->buffer);
 	kfree(data->stream.runtime);
 	kfree(data);
 	return 0;
@@ -391,9 +397,44 @@ out:
 	return retval;
 }
 
+/*
+ * Map the core ring buffer of a playback stream so that userspace can
+ * place the compressed data in it directly and then commit it with
+ * SNDRV_COMPRESS_ACK instead of going through write().  Drivers which
+ * provide their own copy callback have no core buffer to map; they keep
+ * using write().
+ */
 static int snd_compr_mmap(struct file *f, struct vm_area_struct *vma)
 {
-	return -ENXIO;
+	struct snd_compr_file *data = f->private_data;
+	struct snd_compr_stream *stream;
+	struct snd_compr_runtime *runtime;
+	unsigned long size;
+	int retval;
+
+	if (snd_BUG_ON(!data))
+		return -EFAULT;
+
+	stream = &data->stream;
+	runtime = stream->runtime;
+	if (stream->direction != SND_COMPRESS_PLAYBACK || stream->ops->copy)
+		return -ENXIO;
+
+	mutex_lock(&stream->device->lock);
+	if (!runtime->buffer) {
+		/* no buffer until SNDRV_COMPRESS_SET_PARAMS */
+		retval = -EBADFD;
+		goto out;
+	}
+	size = vma->vm_end - vma->vm_start;
+	if (vma->vm_pgoff != 0 || size > PAGE_ALIGN(runtime->buffer_size)) {
+		retval = -EINVAL;
+		goto out;
+	}
+	retval = remap_vmalloc_range(vma, runtime->buffer, 0);
+out:
+	mutex_unlock(&stream->device->lock);
+	return retval;
 }
 
 static inline int snd_compr_get_poll(struct snd_compr_stream *stream)
@@ -514,7 +555,8 @@ static int snd_compr_allocate_buffer(struct snd_compr_stream *stream,
 		 * the data from core
 		 */
 	} else {
-		buffer = kmalloc(buffer_size, GFP_KERNEL);
+		/* page aligned and zeroed, so it can be mmapped */
+		buffer = vmalloc_user(buffer_size);
 		if (!buffer)
 			return -ENOMEM;
 	}
@@ -852,6 +894,43 @@ static int snd_compr_partial_drain(struct snd_compr_stream *stream)
 	return snd_compress_wait_for_drain(stream);
 }
 
+/*
+ * Commit @arg bytes which userspace has placed in the mmapped ring buffer
+ * at the current application pointer; the mmap counterpart of write().
+ */
+static int snd_compr_ack(struct snd_compr_stream *stream, unsigned long arg)
+{
+	struct snd_compr_runtime *runtime = stream->runtime;
+	__u32 count;
+
+	if (stream->direction != SND_COMPRESS_PLAYBACK || stream->ops->copy)
+		return -ENXIO;
+	if (get_user(count, (__u32 __user *)arg))
+		return -EFAULT;
+
+	switch (runtime->state) {
+	case SNDRV_PCM_STATE_SETUP:
+	case SNDRV_PCM_STATE_PREPARED:
+	case SNDRV_PCM_STATE_RUNNING:
+		break;
+	default:
+		return -EBADFD;
+	}
+
+	if (count > snd_compr_get_avail(stream))
+		return -EINVAL;
+	if (!count)
+		return 0;
+
+	if (stream->ops->ack)
+		stream->ops->ack(stream, count);
+	runtime->total_bytes_available += count;
+
+	if (runtime->state == SNDRV_PCM_STATE_SETUP)
+		runtime->state = SNDRV_PCM_STATE_PREPARED;
+	return 0;
+}
+
 static long snd_compr_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 {
 	struct snd_compr_file *data = f->private_data;
@@ -916,6 +995,9 @@ static long snd_compr_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 	case _IOC_NR(SNDRV_COMPRESS_NEXT_TRACK):
 		retval = snd_compr_next_track(stream);
 		break;
+	case _IOC_NR(SNDRV_COMPRESS_ACK):
+		retval = snd_compr_ack(stream, arg);
+		break;
 
 	}
 	mutex_unlock(&stream->device->lock);
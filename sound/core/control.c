@@ -25,6 +25,9 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/time.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/radix-tree.h>
 #include <sound/core.h>
 #include <sound/minors.h>
 #include <sound/info.h>
@@ -39,6 +42,31 @@ struct snd_kctl_ioctl {
 	snd_kctl_ioctl_func_t fioctl;
 };
 
+/*
+ * Per-card control lookup index: a hash of the controls keyed on their name
+ * and a radix tree mapping every numid to its control.  Only the name is
+ * hashed because several drivers still adjust device, subdevice or index
+ * after snd_ctl_add(); the full id is compared on every hit.  Both are only touched
+ * under card->controls_rwsem, like the controls list they mirror.  If an
+ * insertion ever fails, that index is abandoned and lookups walk the list.
+ */
+#define SND_CTL_HASH_BITS	9
+
+struct snd_ctl_hash_node {
+	struct hlist_node node;
+	struct snd_kcontrol *kctl;
+	u32 key;
+};
+
+struct snd_ctl_lookup {
+	DECLARE_HASHTABLE(ids, SND_CTL_HASH_BITS);
+	struct radix_tree_root numids;
+	bool ids_broken;
+	bool numids_broken;
+};
+
+static struct snd_ctl_lookup *snd_ctl_lookups[SNDRV_CARDS];
+
 static DECLARE_RWSEM(snd_ioctl_rwsem);
 static LIST_HEAD(snd_control_ioctls);
 #ifdef CONFIG_COMPAT
@@ -313,15 +341,124 @@ void snd_ctl_free_one(struct snd_kcontrol *kcontrol)
 }
 EXPORT_SYMBOL(snd_ctl_free_one);
 
+static inline struct snd_ctl_lookup *snd_ctl_get_lookup(struct snd_card *card)
+{
+	return snd_ctl_lookups[card->number];
+}
+
+static u32 snd_ctl_id_key(const struct snd_ctl_elem_id *id)
+{
+	return jhash(id->name, strnlen(id->name, sizeof(id->name)), 0);
+}
+
+static bool snd_ctl_id_match(const struct snd_kcontrol *kctl,
+			     const struct snd_ctl_elem_id *id)
+{
+	if (kctl->id.iface != id->iface)
+		return false;
+	if (kctl->id.device != id->device)
+		return false;
+	if (kctl->id.subdevice != id->subdevice)
+		return false;
+	if (strncmp(kctl->id.name, id->name, sizeof(kctl->id.name)))
+		return false;
+	if (kctl->id.index > id->index)
+		return false;
+	if (kctl->id.index + kctl->count <= id->index)
+		return false;
+	return true;
+}
+
+/* index a control that has just got its numid; write lock held */
+static void snd_ctl_lookup_add(struct snd_card *card, struct snd_kcontrol *kctl)
+{
+	struct snd_ctl_lookup *lookup = snd_ctl_get_lookup(card);
+	struct snd_ctl_hash_node *hn;
+	unsigned int idx;
+
+	if (!lookup)
+		return;
+
+	if (!lookup->ids_broken) {
+		hn = kmalloc(sizeof(*hn), GFP_KERNEL);
+		if (hn) {
+			hn->kctl = kctl;
+			hn->key = snd_ctl_id_key(&kctl->id);
+			hash_add(lookup->ids, &hn->node, hn->key);
+		} else {
+			lookup->ids_broken = true;
+		}
+	}
+
+	if (!lookup->numids_broken) {
+		for (idx = 0; idx < kctl->count; idx++) {
+			if (radix_tree_insert(&lookup->numids, kctl->id.numid + idx,
+					      kctl) < 0) {
+				lookup->numids_broken = true;
+				break;
+			}
+		}
+	}
+}
+
+/* drop a control from the index before its id changes or it goes away */
+static void snd_ctl_lookup_del(struct snd_card *card, struct snd_kcontrol *kctl)
+{
+	struct snd_ctl_lookup *lookup = snd_ctl_get_lookup(card);
+	struct snd_ctl_hash_node *hn;
+	struct hlist_node *tmp;
+	unsigned int idx;
+	u32 key;
+
+	if (!lookup)
+		return;
+
+	key = snd_ctl_id_key(&kctl->id);
+	hash_for_each_possible_safe(lookup->ids, hn, tmp, node, key) {
+		if (hn->kctl == kctl)
+			goto found;
+	}
+	/* the name was changed behind our back; never leave a stale entry */
+	hash_for_each_safe(lookup->ids, idx, tmp, hn, node) {
+		if (hn->kctl == kctl)
+			goto found;
+	}
+	hn = NULL;
+ found:
+	if (hn) {
+		hash_del(&hn->node);
+		kfree(hn);
+	}
+
+	/* also clears what a failed insertion left behind */
+	for (idx = 0; idx < kctl->count; idx++)
+		if (radix_tree_lookup(&lookup->numids, kctl->id.numid + idx) == kctl)
+			radix_tree_delete(&lookup->numids, kctl->id.numid + idx);
+}
+
 static bool snd_ctl_remove_numid_conflict(struct snd_card *card,
 					  unsigned int count)
 {
+	struct snd_ctl_lookup *lookup = snd_ctl_get_lookup(card);
 	struct snd_kcontrol *kctl;
+	unsigned int numid;
 
 	/* Make sure that the ids assigned to the control do not wrap around */
 	if (card->last_numid >= UINT_MAX - count)
 		card->last_numid = 0;
 
+	if (lookup && !lookup->numids_broken) {
+		for (numid = card->last_numid + 1;
+		     numid < card->last_numid + 1 + count; numid++) {
+			kctl = radix_tree_lookup(&lookup->numids, numid);
+			if (kctl) {
+				card->last_numid = kctl->id.numid + kctl->count - 1;
+				return true;
+			}
+		}
+		return false;
+	}
+
 	list_for_each_entry(kctl, &card->controls, list) {
 		if (kctl->id.numid < card->last_numid + 1 + count &&
 		    kctl->id.numid + kctl->count > card->last_numid + 1) {
@@ -396,6 +533,7 @@ int snd_ctl_add(struct snd_card *card, struct snd_kcontrol *kcontrol)
 	card->controls_count += kcontrol->count;
 	kcontrol->id.numid = card->last_numid + 1;
 	card->last_numid += kcontrol->count;
+	snd_ctl_lookup_add(card, kcontrol);
 	id = kcontrol->id;
 	count = kcontrol->count;
 	up_write(&card->controls_rwsem);
@@ -463,6 +601,7 @@ add:
 	card->controls_count += kcontrol->count;
 	kcontrol->id.numid = card->last_numid + 1;
 	card->last_numid += kcontrol->count;
+	snd_ctl_lookup_add(card, kcontrol);
 	id = kcontrol->id;
 	count = kcontrol->count;
 	up_write(&card->controls_rwsem);
@@ -494,6 +633,7 @@ int snd_ctl_remove(struct snd_card *card, struct snd_kcontrol *kcontrol)
 
 	if (snd_BUG_ON(!card || !kcontrol))
 		return -EINVAL;
+	snd_ctl_lookup_del(card, kcontrol);
 	list_del(&kcontrol->list);
 	card->controls_count -= kcontrol->count;
 	id = kcontrol->id;
@@ -642,9 +782,11 @@ int snd_ctl_rename_id(struct snd_card *card, struct snd_ctl_elem_id *src_id,
 		up_write(&card->controls_rwsem);
 		return -ENOENT;
 	}
+	snd_ctl_lookup_del(card, kctl);
 	kctl->id = *dst_id;
 	kctl->id.numid = card->last_numid + 1;
 	card->last_numid += kctl->count;
+	snd_ctl_lookup_add(card, kctl);
 	up_write(&card->controls_rwsem);
 	return 0;
 }
@@ -665,10 +807,14 @@ EXPORT_SYMBOL(snd_ctl_rename_id);
  */
 struct snd_kcontrol *snd_ctl_find_numid(struct snd_card *card, unsigned int numid)
 {
+	struct snd_ctl_lookup *lookup;
 	struct snd_kcontrol *kctl;
 
 	if (snd_BUG_ON(!card || !numid))
 		return NULL;
+	lookup = snd_ctl_get_lookup(card);
+	if (lookup && !lookup->numids_broken)
+		return radix_tree_lookup(&lookup->numids, numid);
 	list_for_each_entry(kctl, &card->controls, list) {
 		if (kctl->id.numid <= numid && kctl->id.numid + kctl->count > numid)
 			return kctl;
@@ -693,26 +839,27 @@ EXPORT_SYMBOL(snd_ctl_find_numid);
 struct snd_kcontrol *snd_ctl_find_id(struct snd_card *card,
 				     struct snd_ctl_elem_id *id)
 {
+	struct snd_ctl_lookup *lookup;
+	struct snd_ctl_hash_node *hn;
 	struct snd_kcontrol *kctl;
+	u32 key;
 
 	if (snd_BUG_ON(!card || !id))
 		return NULL;
 	if (id->numid != 0)
 		return snd_ctl_find_numid(card, id->numid);
+	lookup = snd_ctl_get_lookup(card);
+	if (lookup && !lookup->ids_broken) {
+		key = snd_ctl_id_key(id);
+		hash_for_each_possible(lookup->ids, hn, node, key) {
+			if (hn->key == key && snd_ctl_id_match(hn->kctl, id))
+				return hn->kctl;
+		}
+		return NULL;
+	}
 	list_for_each_entry(kctl, &card->controls, list) {
-		if (kctl->id.iface != id->iface)
-			continue;
-		if (kctl->id.device != id->device)
-			continue;
-		if (kctl->id.subdevice != id->subdevice)
-			continue;
-		if (strncmp(kctl->id.name, id->name, sizeof(kctl->id.name)))
-			continue;
-		if (kctl->id.index > id->index)
-			continue;
-		if (kctl->id.index + kctl->count <= id->index)
-			continue;
-		return kctl;
+		if (snd_ctl_id_match(kctl, id))
+			return kctl;
 	}
 	return NULL;
 }
@@ -1819,6 +1966,8 @@ static int snd_ctl_dev_free(struct snd_device *device)
 		control = snd_kcontrol(card->controls.next);
 		snd_ctl_remove(card, control);
 	}
+	kfree(snd_ctl_lookups[card->number]);
+	snd_ctl_lookups[card->number] = NULL;
 	up_write(&card->controls_rwsem);
 	put_device(&card->ctl_dev);
 	return 0;
@@ -1835,6 +1984,7 @@ int snd_ctl_create(struct snd_card *card)
 		.dev_register =	snd_ctl_dev_register,
 		.dev_disconnect = snd_ctl_dev_disconnect,
 	};
+	struct snd_ctl_lookup *lookup;
 	int err;
 
 	if (snd_BUG_ON(!card))
@@ -1845,9 +1995,20 @@ int snd_ctl_create(struct snd_card *card)
 	snd_device_initialize(&card->ctl_dev, card);
 	dev_set_name(&card->ctl_dev, "controlC%d", card->number);
 
+	/* without the index, lookups just walk the list */
+	lookup = kzalloc(sizeof(*lookup), GFP_KERNEL);
+	if (lookup) {
+		hash_init(lookup->ids);
+		INIT_RADIX_TREE(&lookup->numids, GFP_KERNEL);
+	}
+	snd_ctl_lookups[card->number] = lookup;
+
 	err = snd_device_new(card, SNDRV_DEV_CONTROL, card, &ops);
-	if (err < 0)
+	if (err < 0) {
+		snd_ctl_lookups[card->number] = NULL;
+		kfree(lookup);
 		put_device(&card->ctl_dev);
+	}
 	return err;
 }
 
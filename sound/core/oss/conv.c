@@ -0,0 +1,252 @@
+/*
+ *  Sample format conversion core for the OSS emulation plugins
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ */
+
+#include <linux/time.h>
+#include <sound/core.h>
+#include <sound/pcm.h>
+#include "pcm_plugin.h"
+
+/*
+ * A conversion is split into a load kernel for the source format and a
+ * store kernel for the destination format, which meet in a small buffer
+ * of signed 32 bit samples aligned to the MSB.  Each kernel is a plain
+ * loop over one format, with a variant for densely packed samples that
+ * the compiler can unroll and vectorize, so the (src, dst) pair is
+ * resolved once when the plugin is built rather than per sample.
+ * Interleaved buffers on both sides are converted as a single run.
+ */
+
+#define CONV_CHUNK	64	/* samples per load/store round */
+
+/*
+ *  Load kernels: native samples to MSB aligned s32
+ */
+
+#define CONV_GET(name, type, expr)					\
+static void get_##name(u32 *dst, const char *src, int step,		\
+		       unsigned int samples)				\
+{									\
+	unsigned int i;							\
+	type v;								\
+									\
+	if (step == sizeof(type)) {					\
+		const type *s = (const type *)src;			\
+		for (i = 0; i < samples; i++) {				\
+			v = s[i];					\
+			dst[i] = (expr);				\
+		}							\
+	} else {							\
+		for (i = 0; i < samples; i++, src += step) {		\
+			v = *(const type *)src;				\
+			dst[i] = (expr);				\
+		}							\
+	}								\
+}
+
+#define SIGN32	0x80000000U
+
+CONV_GET(s8, u8, (u32)v << 24)
+CONV_GET(u8, u8, ((u32)v << 24) ^ SIGN32)
+CONV_GET(s16_le, u16, (u32)le16_to_cpu((__force __le16)v) << 16)
+CONV_GET(s16_be, u16, (u32)be16_to_cpu((__force __be16)v) << 16)
+CONV_GET(u16_le, u16, ((u32)le16_to_cpu((__force __le16)v) << 16) ^ SIGN32)
+CONV_GET(u16_be, u16, ((u32)be16_to_cpu((__force __be16)v) << 16) ^ SIGN32)
+CONV_GET(s24_le, u32, le32_to_cpu((__force __le32)v) << 8)
+CONV_GET(s24_be, u32, be32_to_cpu((__force __be32)v) << 8)
+CONV_GET(u24_le, u32, (le32_to_cpu((__force __le32)v) << 8) ^ SIGN32)
+CONV_GET(u24_be, u32, (be32_to_cpu((__force __be32)v) << 8) ^ SIGN32)
+CONV_GET(s32_le, u32, le32_to_cpu((__force __le32)v))
+CONV_GET(s32_be, u32, be32_to_cpu((__force __be32)v))
+CONV_GET(u32_le, u32, le32_to_cpu((__force __le32)v) ^ SIGN32)
+CONV_GET(u32_be, u32, be32_to_cpu((__force __be32)v) ^ SIGN32)
+CONV_GET(mu_law, u8, (u32)(u16)snd_pcm_ulaw_dec_table[v] << 16)
+
+/*
+ *  Store kernels: MSB aligned s32 to native samples
+ */
+
+#define CONV_PUT(name, type, expr)					\
+static void put_##name(char *dst, int step, const u32 *src,		\
+		       unsigned int samples)				\
+{									\
+	unsigned int i;							\
+	u32 v;								\
+									\
+	if (step == sizeof(type)) {					\
+		type *d = (type *)dst;					\
+		for (i = 0; i < samples; i++) {				\
+			v = src[i];					\
+			d[i] = (expr);					\
+		}							\
+	} else {							\
+		for (i = 0; i < samples; i++, dst += step) {		\
+			v = src[i];					\
+			*(type *)dst = (expr);				\
+		}							\
+	}								\
+}
+
+CONV_PUT(s8, u8, v >> 24)
+CONV_PUT(u8, u8, (v ^ SIGN32) >> 24)
+CONV_PUT(s16_le, u16, (__force u16)cpu_to_le16(v >> 16))
+CONV_PUT(s16_be, u16, (__force u16)cpu_to_be16(v >> 16))
+CONV_PUT(u16_le, u16, (__force u16)cpu_to_le16((v ^ SIGN32) >> 16))
+CONV_PUT(u16_be, u16, (__force u16)cpu_to_be16((v ^ SIGN32) >> 16))
+CONV_PUT(s24_le, u32, (__force u32)cpu_to_le32((s32)v >> 8))
+CONV_PUT(s24_be, u32, (__force u32)cpu_to_be32((s32)v >> 8))
+CONV_PUT(u24_le, u32, (__force u32)cpu_to_le32((v ^ SIGN32) >> 8))
+CONV_PUT(u24_be, u32, (__force u32)cpu_to_be32((v ^ SIGN32) >> 8))
+CONV_PUT(s32_le, u32, (__force u32)cpu_to_le32(v))
+CONV_PUT(s32_be, u32, (__force u32)cpu_to_be32(v))
+CONV_PUT(u32_le, u32, (__force u32)cpu_to_le32(v ^ SIGN32))
+CONV_PUT(u32_be, u32, (__force u32)cpu_to_be32(v ^ SIGN32))
+CONV_PUT(mu_law, u8, snd_pcm_ulaw_encode((s16)(v >> 16)))
+
+static const struct {
+	snd_pcm_format_t format;
+	snd_pcm_conv_get_t get;
+	snd_pcm_conv_put_t put;
+} conv_kernels[] = {
+	{ SNDRV_PCM_FORMAT_S8,		get_s8,		put_s8 },
+	{ SNDRV_PCM_FORMAT_U8,		get_u8,		put_u8 },
+	{ SNDRV_PCM_FORMAT_S16_LE,	get_s16_le,	put_s16_le },
+	{ SNDRV_PCM_FORMAT_S16_BE,	get_s16_be,	put_s16_be },
+	{ SNDRV_PCM_FORMAT_U16_LE,	get_u16_le,	put_u16_le },
+	{ SNDRV_PCM_FORMAT_U16_BE,	get_u16_be,	put_u16_be },
+	{ SNDRV_PCM_FORMAT_S24_LE,	get_s24_le,	put_s24_le },
+	{ SNDRV_PCM_FORMAT_S24_BE,	get_s24_be,	put_s24_be },
+	{ SNDRV_PCM_FORMAT_U24_LE,	get_u24_le,	put_u24_le },
+	{ SNDRV_PCM_FORMAT_U24_BE,	get_u24_be,	put_u24_be },
+	{ SNDRV_PCM_FORMAT_S32_LE,	get_s32_le,	put_s32_le },
+	{ SNDRV_PCM_FORMAT_S32_BE,	get_s32_be,	put_s32_be },
+	{ SNDRV_PCM_FORMAT_U32_LE,	get_u32_le,	put_u32_le },
+	{ SNDRV_PCM_FORMAT_U32_BE,	get_u32_be,	put_u32_be },
+	{ SNDRV_PCM_FORMAT_MU_LAW,	get_mu_law,	put_mu_law },
+};
+
+/**
+ * snd_pcm_conv_init - pick the kernels for a format pair
+ * @conv: the conversion to set up
+ * @src_format: source sample format
+ * @dst_format: destination sample format
+ *
+ * Return: 0 on success, or -EINVAL if either format has no kernel, in
+ * which case the caller keeps its generic per-sample path.
+ */
+int snd_pcm_conv_init(struct snd_pcm_conv *conv, snd_pcm_format_t src_format,
+		      snd_pcm_format_t dst_format)
+{
+	unsigned int i;
+
+	conv->get = NULL;
+	conv->put = NULL;
+	for (i = 0; i < ARRAY_SIZE(conv_kernels); i++) {
+		if (conv_kernels[i].format == src_format)
+			conv->get = conv_kernels[i].get;
+		if (conv_kernels[i].format == dst_format)
+			conv->put = conv_kernels[i].put;
+	}
+	if (!conv->get || !conv->put)
+		return -EINVAL;
+	conv->src_width = snd_pcm_format_physical_width(src_format);
+	conv->dst_width = snd_pcm_format_physical_width(dst_format);
+	conv->dst_format = dst_format;
+	return 0;
+}
+
+/* convert samples spaced src_step and dst_step bytes apart */
+static void conv_run(const struct snd_pcm_conv *conv,
+		     char *dst, int dst_step, const char *src, int src_step,
+		     snd_pcm_uframes_t samples)
+{
+	u32 buf[CONV_CHUNK];
+	unsigned int n;
+
+	while (samples > 0) {
+		n = samples > CONV_CHUNK ? CONV_CHUNK : samples;
+		conv->get(buf, src, src_step, n);
+		conv->put(dst, dst_step, buf, n);
+		src += n * src_step;
+		dst += n * dst_step;
+		samples -= n;
+	}
+}
+
+/* do the channels form one contiguous interleaved block? */
+static bool conv_interleaved(const struct snd_pcm_plugin_channel *channels,
+			     unsigned int nchannels, unsigned int width)
+{
+	unsigned int channel;
+
+	for (channel = 0; channel < nchannels; channel++) {
+		if (channels[channel].area.addr != channels[0].area.addr ||
+		    channels[channel].area.first != channel * width ||
+		    channels[channel].area.step != nchannels * width)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * snd_pcm_conv_transfer - convert a block of plugin channels
+ * @conv: the conversion set up by snd_pcm_conv_init()
+ * @src_channels: source channel areas
+ * @dst_channels: destination channel areas
+ * @nchannels: number of channels on both sides
+ * @frames: number of frames to convert
+ *
+ * Disabled source channels are silenced in the destination if wanted,
+ * like the generic plugins do.  Areas must be byte aligned.
+ */
+void snd_pcm_conv_transfer(const struct snd_pcm_conv *conv,
+			   const struct snd_pcm_plugin_channel *src_channels,
+			   struct snd_pcm_plugin_channel *dst_channels,
+			   unsigned int nchannels, snd_pcm_uframes_t frames)
+{
+	unsigned int channel;
+	char *src, *dst;
+
+	for (channel = 0; channel < nchannels; channel++)
+		if (!src_channels[channel].enabled)
+			break;
+	if (channel == nchannels &&
+	    conv_interleaved(src_channels, nchannels, conv->src_width) &&
+	    conv_interleaved(dst_channels, nchannels, conv->dst_width)) {
+		for (channel = 0; channel < nchannels; channel++)
+			dst_channels[channel].enabled = 1;
+		conv_run(conv, dst_channels[0].area.addr, conv->dst_width / 8,
+			 src_channels[0].area.addr, conv->src_width / 8,
+			 frames * nchannels);
+		return;
+	}
+
+	for (channel = 0; channel < nchannels; channel++) {
+		if (!src_channels[channel].enabled) {
+			if (dst_channels[channel].wanted)
+				snd_pcm_area_silence(&dst_channels[channel].area, 0, frames, conv->dst_format);
+			dst_channels[channel].enabled = 0;
+			continue;
+		}
+		dst_channels[channel].enabled = 1;
+		src = src_channels[channel].area.addr + src_channels[channel].area.first / 8;
+		dst = dst_channels[channel].area.addr + dst_channels[channel].area.first / 8;
+		conv_run(conv, dst, dst_channels[channel].area.step / 8,
+			 src, src_channels[channel].area.step / 8, frames);
+	}
+}
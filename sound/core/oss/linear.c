@@ -37,6 +37,7 @@ struct linear_priv {
 	unsigned int dst_bytes;		/* byte size of destination format */
 	unsigned int copy_bytes;	/* bytes to copy per conversion */
 	unsigned int flip; /* MSB flip for signeness, done after endian conv */
+	struct snd_pcm_conv conv;	/* fast kernels, if the pair has them */
 };
 
 static inline void do_convert(struct linear_priv *data,
@@ -90,6 +91,8 @@ static snd_pcm_sframes_t linear_transfer(struct snd_pcm_plugin *plugin,
 			       struct snd_pcm_plugin_channel *dst_channels,
 			       snd_pcm_uframes_t frames)
 {
+	struct linear_priv *data;
+
 	if (snd_BUG_ON(!plugin || !src_channels || !dst_channels))
 		return -ENXIO;
 	if (frames == 0)
@@ -107,7 +110,12 @@ static snd_pcm_sframes_t linear_transfer(struct snd_pcm_plugin *plugin,
 		}
 	}
 #endif
-	convert(plugin, src_channels, dst_channels, frames);
+	data = (struct linear_priv *)plugin->extra_data;
+	if (data->conv.get)
+		snd_pcm_conv_transfer(&data->conv, src_channels, dst_channels,
+				      plugin->src_format.channels, frames);
+	else
+		convert(plugin, src_channels, dst_channels, frames);
 	return frames;
 }
 
@@ -172,6 +180,7 @@ int snd_pcm_plugin_build_linear(struct snd_pcm_substream *plug,
 		return err;
 	data = (struct linear_priv *)plugin->extra_data;
 	init_data(data, src_format->format, dst_format->format);
+	snd_pcm_conv_init(&data->conv, src_format->format, dst_format->format);
 	plugin->transfer = linear_transfer;
 	*r_plugin = plugin;
 	return 0;
@@ -22,6 +22,7 @@
  */
   
 #include <linux/time.h>
+#include <linux/init.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
 #include "pcm_plugin.h"
@@ -80,7 +81,7 @@ static inline int val_seg(int val)
  * For further information see John C. Bellamy's Digital Telephony, 1982,
  * John Wiley & Sons, pps 98-111 and 472-476.
  */
-static unsigned char linear2ulaw(int pcm_val)	/* 2's complement (16-bit range) */
+static unsigned char __init linear2ulaw(int pcm_val)	/* 2's complement (16-bit range) */
 {
 	int mask;
 	int seg;
@@ -117,7 +118,7 @@ static unsigned char linear2ulaw(int pcm_val)	/* 2's complement (16-bit range) *
  * Note that this function expects to be passed the complement of the
  * original code word. This is in keeping with ISDN conventions.
  */
-static int ulaw2linear(unsigned char u_val)
+static int __init ulaw2linear(unsigned char u_val)
 {
 	int t;
 
@@ -134,6 +135,29 @@ static int ulaw2linear(unsigned char u_val)
 	return ((u_val & SIGN_BIT) ? (BIAS - t) : (t - BIAS));
 }
 
+s16 snd_pcm_ulaw_dec_table[256];
+u8 snd_pcm_ulaw_enc_table[SND_PCM_ULAW_ENC_SIZE];
+
+/*
+ * The encoder never looks at the two lowest bits of the biased magnitude,
+ * so its table has one entry per group of four inputs; see
+ * snd_pcm_ulaw_encode() for the indexing.
+ */
+void __init snd_pcm_mulaw_init_tables(void)
+{
+	int i, pcm;
+
+	for (i = 0; i < 256; i++)
+		snd_pcm_ulaw_dec_table[i] = ulaw2linear(i);
+	for (i = 0; i < SND_PCM_ULAW_ENC_SIZE; i++) {
+		if (i < SND_PCM_ULAW_ENC_SIZE / 2)
+			pcm = (i - SND_PCM_ULAW_ENC_SIZE / 2) * 4 + 1;
+		else
+			pcm = (i - SND_PCM_ULAW_ENC_SIZE / 2) * 4;
+		snd_pcm_ulaw_enc_table[i] = linear2ulaw(pcm);
+	}
+}
+
 /*
  *  Basic Mu-Law plugin
  */
@@ -145,6 +169,7 @@ typedef void (*mulaw_f)(struct snd_pcm_plugin *plugin,
 
 struct mulaw_priv {
 	mulaw_f func;
+	struct snd_pcm_conv conv;	/* table kernels, if the format has them */
 	int cvt_endian;			/* need endian conversion? */
 	unsigned int native_ofs;	/* byte offset in native format */
 	unsigned int copy_ofs;		/* byte offset in s16 format */
@@ -191,7 +216,7 @@ static void mulaw_decode(struct snd_pcm_plugin *plugin,
 		dst_step = dst_channels[channel].area.step / 8;
 		frames1 = frames;
 		while (frames1-- > 0) {
-			signed short sample = ulaw2linear(*src);
+			signed short sample = snd_pcm_ulaw_decode(*src);
 			cvt_s16_to_native(data, dst, sample);
 			src += src_step;
 			dst += dst_step;
@@ -238,7 +263,7 @@ static void mulaw_encode(struct snd_pcm_plugin *plugin,
 		frames1 = frames;
 		while (frames1-- > 0) {
 			signed short sample = cvt_native_to_s16(data, src);
-			*dst = linear2ulaw(sample);
+			*dst = snd_pcm_ulaw_encode(sample);
 			src += src_step;
 			dst += dst_step;
 		}
@@ -270,7 +295,11 @@ static snd_pcm_sframes_t mulaw_transfer(struct snd_pcm_plugin *plugin,
 	}
 #endif
 	data = (struct mulaw_priv *)plugin->extra_data;
-	data->func(plugin, src_channels, dst_channels, frames);
+	if (data->conv.get)
+		snd_pcm_conv_transfer(&data->conv, src_channels, dst_channels,
+				      plugin->src_format.channels, frames);
+	else
+		data->func(plugin, src_channels, dst_channels, frames);
 	return frames;
 }
 
@@ -338,6 +367,7 @@ int snd_pcm_plugin_build_mulaw(struct snd_pcm_substream *plug,
 	data = (struct mulaw_priv *)plugin->extra_data;
 	data->func = func;
 	init_data(data, format->format);
+	snd_pcm_conv_init(&data->conv, src_format->format, dst_format->format);
 	plugin->transfer = mulaw_transfer;
 	*r_plugin = plugin;
 	return 0;
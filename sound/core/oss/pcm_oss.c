@@ -3110,6 +3110,9 @@ static int __init alsa_pcm_oss_init(void)
 			adsp_map[i] = 1;
 		}
 	}
+#ifdef CONFIG_SND_PCM_OSS_PLUGINS
+	snd_pcm_mulaw_init_tables();
+#endif
 	if ((err = snd_pcm_notify(&snd_pcm_oss_notify, 0)) < 0)
 		return err;
 	return 0;
@@ -154,6 +154,51 @@ int snd_pcm_area_copy(const struct snd_pcm_channel_area *src_channel,
 		      size_t dst_offset,
 		      size_t samples, snd_pcm_format_t format);
 
+/* sample format conversion core */
+typedef void (*snd_pcm_conv_get_t)(u32 *dst, const char *src, int step,
+				   unsigned int samples);
+typedef void (*snd_pcm_conv_put_t)(char *dst, int step, const u32 *src,
+				   unsigned int samples);
+
+struct snd_pcm_conv {
+	snd_pcm_conv_get_t get;		/* load to MSB aligned s32 */
+	snd_pcm_conv_put_t put;		/* store from MSB aligned s32 */
+	unsigned int src_width;		/* physical widths in bits */
+	unsigned int dst_width;
+	snd_pcm_format_t dst_format;
+};
+
+int snd_pcm_conv_init(struct snd_pcm_conv *conv, snd_pcm_format_t src_format,
+		      snd_pcm_format_t dst_format);
+void snd_pcm_conv_transfer(const struct snd_pcm_conv *conv,
+			   const struct snd_pcm_plugin_channel *src_channels,
+			   struct snd_pcm_plugin_channel *dst_channels,
+			   unsigned int nchannels, snd_pcm_uframes_t frames);
+
+/* Mu-Law tables, filled by snd_pcm_mulaw_init_tables() */
+#define SND_PCM_ULAW_ENC_SIZE	16384
+
+extern s16 snd_pcm_ulaw_dec_table[256];
+extern u8 snd_pcm_ulaw_enc_table[SND_PCM_ULAW_ENC_SIZE];
+
+void snd_pcm_mulaw_init_tables(void);
+
+static inline int snd_pcm_ulaw_decode(unsigned char u_val)
+{
+	return snd_pcm_ulaw_dec_table[u_val];
+}
+
+/* inputs are grouped by four on the biased magnitude: 4g..4g+3 above
+ * zero, 4g+1..4g+4 below it; -32768 shares the first group */
+static inline unsigned char snd_pcm_ulaw_encode(int pcm_val)
+{
+	int g = (pcm_val - (pcm_val < 0)) >> 2;
+
+	if (g < -SND_PCM_ULAW_ENC_SIZE / 2)
+		g = -SND_PCM_ULAW_ENC_SIZE / 2;
+	return snd_pcm_ulaw_enc_table[g + SND_PCM_ULAW_ENC_SIZE / 2];
+}
+
 void *snd_pcm_plug_buf_alloc(struct snd_pcm_substream *plug, snd_pcm_uframes_t size);
 void snd_pcm_plug_buf_unlock(struct snd_pcm_substream *plug, void *ptr);
 snd_pcm_sframes_t snd_pcm_oss_write3(struct snd_pcm_substream *substream,
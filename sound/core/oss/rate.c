@@ -20,6 +20,11 @@
  */
   
 #include <linux/time.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/gcd.h>
+#include <linux/math64.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
 #include "pcm_plugin.h"
@@ -28,6 +33,10 @@
 #define BITS	(1<<SHIFT)
 #define R_MASK	(BITS-1)
 
+static int rate_fir_taps = 16;
+module_param(rate_fir_taps, int, 0644);
+MODULE_PARM_DESC(rate_fir_taps, "Taps per output of the polyphase rate converter (0 = linear interpolation).");
+
 /*
  *  Basic rate conversion plugin
  */
@@ -42,11 +51,38 @@ typedef void (*rate_f)(struct snd_pcm_plugin *plugin,
 		       struct snd_pcm_plugin_channel *dst_channels,
 		       int src_frames, int dst_frames);
 
+/*
+ * Polyphase FIR resampler: the rate ratio is reduced to dst/src = L/M and
+ * output frame n is computed at input position n * M / L from a windowed
+ * sinc low-pass designed for that ratio, so the table holds L phases of
+ * taps coefficients each.  Downsampling stretches the filter over more
+ * input frames to keep the cut-off below the new Nyquist frequency.
+ */
+#define FIR_COEF_SHIFT	14		/* Q14 coefficients, each phase sums to 1 */
+#define FIR_MAX_TAPS	256
+#define FIR_MAX_COEFS	65536		/* L * taps */
+
+struct rate_fir {
+	unsigned int L, M;		/* dst/src rate ratio in lowest terms */
+	unsigned int taps;		/* input frames per output frame */
+	unsigned int phase;		/* next output, in 1/L frames past hpos */
+	unsigned int hpos;		/* newest frame in history */
+	snd_pcm_uframes_t last_src;	/* frames in and out of the last */
+	snd_pcm_uframes_t last_dst;	/* playback transfer */
+	s16 *coef;			/* L phases of taps coefficients */
+	s16 *hist;			/* 2 * taps samples per channel */
+	struct rate_fir_channel {
+		signed short *src, *dst;	/* NULL if disabled */
+		int src_step, dst_step;
+	} *chan;
+};
+
 struct rate_priv {
 	unsigned int pitch;
 	unsigned int pos;
 	rate_f func;
 	snd_pcm_sframes_t old_src_frames, old_dst_frames;
+	struct rate_fir *fir;
 	struct rate_channel channels[0];
 };
 
@@ -54,7 +90,17 @@ static void rate_init(struct snd_pcm_plugin *plugin)
 {
 	unsigned int channel;
 	struct rate_priv *data = (struct rate_priv *)plugin->extra_data;
+	struct rate_fir *fir = data->fir;
+
 	data->pos = 0;
+	if (fir) {
+		/* start with the history full of silence and one frame due */
+		fir->phase = fir->L;
+		fir->hpos = 0;
+		fir->last_src = fir->last_dst = 0;
+		memset(fir->hist, 0, 2 * fir->taps * plugin->src_format.channels *
+		       sizeof(*fir->hist));
+	}
 	for (channel = 0; channel < plugin->src_format.channels; channel++) {
 		data->channels[channel].last_S1 = 0;
 		data->channels[channel].last_S2 = 0;
@@ -180,6 +226,248 @@ static void resample_shrink(struct snd_pcm_plugin *plugin,
 	data->pos = pos;
 }
 
+/* sin(2 * pi * turn / 2^32) in Q30 */
+static s32 fir_sin(u32 turn)
+{
+	const s64 one = 1LL << 30;
+	const s64 half_pi = 1686629713LL;	/* pi/2 in Q30 */
+	u32 quad = turn >> 30;
+	s64 x, x2, s;
+
+	x = turn & 0x3fffffff;
+	if (quad & 1)
+		x = 0x40000000 - x;
+	/* radians in Q30, 0..pi/2 */
+	x = (x * half_pi) >> 30;
+	x2 = (x * x) >> 30;
+	/* Taylor series up to x^11, error below 1e-5 on the quadrant */
+	s = one - div_s64(x2, 110);
+	s = one - div_s64((x2 * s) >> 30, 72);
+	s = one - div_s64((x2 * s) >> 30, 42);
+	s = one - div_s64((x2 * s) >> 30, 20);
+	s = one - div_s64((x2 * s) >> 30, 6);
+	s = (x * s) >> 30;
+	return (quad & 2) ? -s : s;
+}
+
+/*
+ * Prototype filter: a Blackman windowed sinc at L times the source rate
+ * with its cut-off at the lower of the two Nyquist frequencies.  Tap k of
+ * phase p weighs the input k frames back from the newest one, which sits
+ * p / L frames before the output; that is offset p + k * L of the window.
+ */
+static s64 fir_tap(const struct rate_fir *fir, unsigned int j)
+{
+	unsigned int n = fir->L * fir->taps;		/* window length */
+	unsigned int K = max(fir->L, fir->M);		/* zero crossing spacing */
+	const s64 inv_pi = 341782638LL;			/* 1/pi in Q30 */
+	s32 t = (s32)j - (s32)(n / 2);
+	s64 h, w;
+
+	if (t == 0) {
+		h = 1LL << 30;
+	} else {
+		/* sin(pi t / K) / (pi t / K) */
+		h = fir_sin((u32)div_s64((s64)t << 31, K));
+		h = div_s64(((h * inv_pi) >> 30) * K, t);
+	}
+	/* 0.42 - 0.5 cos(2 pi j / n) + 0.08 cos(4 pi j / n) */
+	w = 450971566LL -
+		((536870912LL * fir_sin((u32)div_u64((u64)j << 32, n) + 0x40000000)) >> 30) +
+		((85899346LL * fir_sin((u32)div_u64((u64)j << 33, n) + 0x40000000)) >> 30);
+	return (h * w) >> 30;
+}
+
+static void fir_design(struct rate_fir *fir)
+{
+	unsigned int L = fir->L, taps = fir->taps;
+	unsigned int p, k;
+	s64 sum;
+
+	for (p = 0; p < L; p++) {
+		sum = 0;
+		for (k = 0; k < taps; k++)
+			sum += fir_tap(fir, p + k * L);
+		/* normalize every phase to unity gain; stored oldest tap first
+		 * to run in the same direction as the history */
+		for (k = 0; k < taps; k++)
+			fir->coef[p * taps + taps - 1 - k] =
+				div64_s64((fir_tap(fir, p + k * L) << FIR_COEF_SHIFT) +
+					  sum / 2, sum);
+	}
+}
+
+static struct rate_fir *fir_new(unsigned int src_rate, unsigned int dst_rate,
+				unsigned int channels)
+{
+	struct rate_fir *fir;
+	unsigned int g, taps;
+
+	if (rate_fir_taps <= 0)
+		return NULL;
+	g = gcd(src_rate, dst_rate);
+	taps = clamp(rate_fir_taps, 4, 64) & ~1;
+	/* spread the filter further when dropping the rate */
+	if (src_rate > dst_rate)
+		taps = DIV_ROUND_UP(taps * src_rate, dst_rate) & ~1;
+	if (taps > FIR_MAX_TAPS || (dst_rate / g) * taps > FIR_MAX_COEFS)
+		return NULL;
+
+	fir = kzalloc(sizeof(*fir), GFP_KERNEL);
+	if (!fir)
+		return NULL;
+	fir->L = dst_rate / g;
+	fir->M = src_rate / g;
+	fir->taps = taps;
+	fir->coef = vmalloc(fir->L * taps * sizeof(*fir->coef));
+	fir->hist = kcalloc(2 * taps * channels, sizeof(*fir->hist), GFP_KERNEL);
+	fir->chan = kcalloc(channels, sizeof(*fir->chan), GFP_KERNEL);
+	if (!fir->coef || !fir->hist || !fir->chan) {
+		vfree(fir->coef);
+		kfree(fir->hist);
+		kfree(fir->chan);
+		kfree(fir);
+		return NULL;
+	}
+	fir_design(fir);
+	return fir;
+}
+
+static void fir_free(struct rate_fir *fir)
+{
+	if (!fir)
+		return;
+	vfree(fir->coef);
+	kfree(fir->hist);
+	kfree(fir->chan);
+	kfree(fir);
+}
+
+/*
+ * Output frame i from now needs (phase + i * M) / L more input frames, so
+ * the number of outputs a block yields depends on the phase carried over
+ * from the previous block rather than on its length alone.
+ */
+static snd_pcm_uframes_t fir_dst_frames(const struct rate_fir *fir,
+					snd_pcm_uframes_t src_frames)
+{
+	u64 limit = (u64)(src_frames + 1) * fir->L;
+
+	if (limit <= fir->phase)
+		return 0;
+	return div_u64(limit - fir->phase + fir->M - 1, fir->M);
+}
+
+static snd_pcm_uframes_t fir_src_frames(const struct rate_fir *fir,
+					snd_pcm_uframes_t dst_frames)
+{
+	if (!dst_frames)
+		return 0;
+	return div_u64(fir->phase + (u64)(dst_frames - 1) * fir->M, fir->L);
+}
+
+/* shift one input frame into the history, or repeat the last one */
+static void fir_push(struct rate_fir *fir, unsigned int channels, bool input)
+{
+	struct rate_fir_channel *chan = fir->chan;
+	unsigned int taps = fir->taps;
+	unsigned int channel, last;
+	s16 *slot;
+
+	last = fir->hpos;
+	if (++fir->hpos == taps)
+		fir->hpos = 0;
+	slot = fir->hist + fir->hpos;
+	for (channel = 0; channel < channels; channel++, slot += 2 * taps) {
+		if (!chan[channel].src) {
+			slot[0] = 0;
+		} else if (input) {
+			slot[0] = *chan[channel].src;
+			chan[channel].src += chan[channel].src_step;
+		} else {
+			slot[0] = slot[(int)last - (int)fir->hpos];
+		}
+		slot[taps] = slot[0];
+	}
+}
+
+/*
+ * The filter runs over whole frames.  Every input sample is stored twice
+ * in the history of its channel, taps samples apart, so the newest taps
+ * samples are always contiguous and the dot product is a straight loop.
+ * Input left over after the last output of a block is taken into the
+ * history right away, so blocks of any length join without a glitch as
+ * long as dst_frames comes from fir_dst_frames().
+ */
+static void resample_fir(struct snd_pcm_plugin *plugin,
+			 const struct snd_pcm_plugin_channel *src_channels,
+			 struct snd_pcm_plugin_channel *dst_channels,
+			 int src_frames, int dst_frames)
+{
+	struct rate_priv *data = (struct rate_priv *)plugin->extra_data;
+	struct rate_fir *fir = data->fir;
+	struct rate_fir_channel *chan = fir->chan;
+	unsigned int channels = plugin->src_format.channels;
+	unsigned int taps = fir->taps;
+	unsigned int channel, k;
+	const s16 *coef, *win;
+	s32 acc;
+
+	for (channel = 0; channel < channels; channel++) {
+		chan[channel].src = NULL;
+		chan[channel].dst = NULL;
+		if (!src_channels[channel].enabled) {
+			if (dst_channels[channel].wanted)
+				snd_pcm_area_silence(&dst_channels[channel].area, 0, dst_frames, plugin->dst_format.format);
+			dst_channels[channel].enabled = 0;
+			continue;
+		}
+		dst_channels[channel].enabled = 1;
+		chan[channel].src = (signed short *)src_channels[channel].area.addr +
+			src_channels[channel].area.first / 8 / 2;
+		chan[channel].dst = (signed short *)dst_channels[channel].area.addr +
+			dst_channels[channel].area.first / 8 / 2;
+		chan[channel].src_step = src_channels[channel].area.step / 8 / 2;
+		chan[channel].dst_step = dst_channels[channel].area.step / 8 / 2;
+	}
+
+	while (dst_frames-- > 0) {
+		/* pull in the input frames this output needs */
+		while (fir->phase >= fir->L) {
+			fir->phase -= fir->L;
+			/* only short of input if dst_frames was clipped */
+			fir_push(fir, channels, src_frames > 0);
+			if (src_frames > 0)
+				src_frames--;
+		}
+
+		win = fir->hist + fir->hpos + 1;
+		coef = fir->coef + fir->phase * taps;
+		for (channel = 0; channel < channels; channel++, win += 2 * taps) {
+			if (!chan[channel].dst)
+				continue;
+			acc = 0;
+			for (k = 0; k < taps; k++)
+				acc += coef[k] * win[k];
+			acc = (acc + (1 << (FIR_COEF_SHIFT - 1))) >> FIR_COEF_SHIFT;
+			if (acc < -32768)
+				acc = -32768;
+			else if (acc > 32767)
+				acc = 32767;
+			*chan[channel].dst = acc;
+			chan[channel].dst += chan[channel].dst_step;
+		}
+		fir->phase += fir->M;
+	}
+
+	/* the next output needs at least what is left of this block */
+	while (fir->phase >= fir->L && src_frames > 0) {
+		fir->phase -= fir->L;
+		fir_push(fir, channels, true);
+		src_frames--;
+	}
+}
+
 static snd_pcm_sframes_t rate_src_frames(struct snd_pcm_plugin *plugin, snd_pcm_uframes_t frames)
 {
 	struct rate_priv *data;
@@ -190,7 +478,13 @@ static snd_pcm_sframes_t rate_src_frames(struct snd_pcm_plugin *plugin, snd_pcm_
 	if (frames == 0)
 		return 0;
 	data = (struct rate_priv *)plugin->extra_data;
-	if (plugin->src_format.rate < plugin->dst_format.rate) {
+	if (data->fir) {
+		/* playback converts the size of a transfer back afterwards */
+		if (plugin->stream == SNDRV_PCM_STREAM_PLAYBACK &&
+		    frames == data->fir->last_dst)
+			return data->fir->last_src;
+		return fir_src_frames(data->fir, frames);
+	} else if (plugin->src_format.rate < plugin->dst_format.rate) {
 		res = (((frames * data->pitch) + (BITS/2)) >> SHIFT);
 	} else {
 		res = (((frames << SHIFT) + (data->pitch / 2)) / data->pitch);		
@@ -223,7 +517,9 @@ static snd_pcm_sframes_t rate_dst_frames(struct snd_pcm_plugin *plugin, snd_pcm_
 	if (frames == 0)
 		return 0;
 	data = (struct rate_priv *)plugin->extra_data;
-	if (plugin->src_format.rate < plugin->dst_format.rate) {
+	if (data->fir) {
+		return fir_dst_frames(data->fir, frames);
+	} else if (plugin->src_format.rate < plugin->dst_format.rate) {
 		res = (((frames << SHIFT) + (data->pitch / 2)) / data->pitch);
 	} else {
 		res = (((frames * data->pitch) + (BITS/2)) >> SHIFT);
@@ -277,6 +573,10 @@ static snd_pcm_sframes_t rate_transfer(struct snd_pcm_plugin *plugin,
 		dst_frames = dst_channels[0].frames;
 	data = (struct rate_priv *)plugin->extra_data;
 	data->func(plugin, src_channels, dst_channels, frames, dst_frames);
+	if (data->fir) {
+		data->fir->last_src = frames;
+		data->fir->last_dst = dst_frames;
+	}
 	return dst_frames;
 }
 
@@ -297,6 +597,14 @@ static int rate_action(struct snd_pcm_plugin *plugin,
 	return 0;	/* silenty ignore other actions */
 }
 
+static void rate_free(struct snd_pcm_plugin *plugin)
+{
+	struct rate_priv *data = (struct rate_priv *)plugin->extra_data;
+
+	fir_free(data->fir);
+	data->fir = NULL;
+}
+
 int snd_pcm_plugin_build_rate(struct snd_pcm_substream *plug,
 			      struct snd_pcm_plugin_format *src_format,
 			      struct snd_pcm_plugin_format *dst_format,
@@ -336,6 +644,12 @@ int snd_pcm_plugin_build_rate(struct snd_pcm_substream *plug,
 		data->pitch = ((dst_format->rate << SHIFT) + (src_format->rate >> 1)) / src_format->rate;
 		data->func = resample_shrink;
 	}
+	data->fir = fir_new(src_format->rate, dst_format->rate,
+			    src_format->channels);
+	if (data->fir) {
+		data->func = resample_fir;
+		plugin->private_free = rate_free;
+	}
 	data->pos = 0;
 	rate_init(plugin);
 	data->old_src_frames = data->old_dst_frames = 0;
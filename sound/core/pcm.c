@@ -31,6 +31,8 @@
 #include <sound/control.h>
 #include <sound/info.h>
 
+#include "pcm_local.h"
+
 MODULE_AUTHOR("Jaroslav Kysela <perex@perex.cz>, Abramo Bagnara <abramo@alsa-project.org>");
 MODULE_DESCRIPTION("Midlevel PCM code for ALSA.");
 MODULE_LICENSE("GPL");
@@ -418,6 +420,12 @@ static void snd_pcm_substream_proc_hw_params_read(struct snd_info_entry *entry,
 	mutex_unlock(&substream->pcm->open_mutex);
 }
 
+static void snd_pcm_substream_proc_refine_read(struct snd_info_entry *entry,
+					       struct snd_info_buffer *buffer)
+{
+	snd_pcm_refine_proc_read(entry->private_data, buffer);
+}
+
 static void snd_pcm_substream_proc_sw_params_read(struct snd_info_entry *entry,
 						  struct snd_info_buffer *buffer)
 {
@@ -627,6 +635,15 @@ static int snd_pcm_substream_proc_init(struct snd_pcm_substream *substream)
 	}
 	substream->proc_status_entry = entry;
 
+	/* freed along with proc_root */
+	entry = snd_info_create_card_entry(card, "refine", substream->proc_root);
+	if (entry) {
+		snd_info_set_text_ops(entry, substream,
+				      snd_pcm_substream_proc_refine_read);
+		if (snd_info_register(entry) < 0)
+			snd_info_free_entry(entry);
+	}
+
 #ifdef CONFIG_SND_PCM_XRUN_DEBUG
 	entry = snd_info_create_card_entry(card, "xrun_injection",
 					   substream->proc_root);
@@ -870,6 +887,7 @@ static void snd_pcm_free_stream(struct snd_pcm_str * pstr)
 		substream_next = substream->next;
 		snd_pcm_timer_done(substream);
 		snd_pcm_substream_proc_done(substream);
+		snd_pcm_refine_free(substream);
 		kfree(substream);
 		substream = substream_next;
 	}
@@ -985,6 +1003,7 @@ int snd_pcm_attach_substream(struct snd_pcm *pcm, int stream,
 		return -ENOMEM;
 	}
 	memset((void*)runtime->status, 0, size);
+	BUILD_BUG_ON(sizeof(struct snd_pcm_mmap_status) > SNDRV_PCM_STATUS_SEQ_POS);
 
 	size = PAGE_ALIGN(sizeof(struct snd_pcm_mmap_control));
 	runtime->control = snd_malloc_pages(size, GFP_KERNEL);
@@ -1133,6 +1152,7 @@ static int snd_pcm_dev_disconnect(struct snd_device *device)
 			snd_pcm_stream_lock_irq(substream);
 			if (substream->runtime) {
 				substream->runtime->status->state = SNDRV_PCM_STATE_DISCONNECTED;
+				snd_pcm_status_seq_publish(substream);
 				wake_up(&substream->runtime->sleep);
 				wake_up(&substream->runtime->tsleep);
 			}
@@ -400,6 +400,75 @@ static int snd_pcm_ioctl_xferi_compat(struct snd_pcm_substream *substream,
 }
 
 
+/* snd_xferv needs remapping of the segment array and the state */
+struct snd_xferv_seg32 {
+	u32 buf;
+	u32 frames;
+};
+
+struct snd_xferv32 {
+	s32 result;
+	u32 segs;
+	u32 nsegs;
+	u32 pad;
+	u32 hw_ptr;
+	u32 appl_ptr;
+	u32 avail;
+	s32 delay;
+	struct compat_timespec tstamp;
+	struct compat_timespec audio_tstamp;
+	unsigned char reserved[32];
+} __attribute__((packed));
+
+static int snd_pcm_ioctl_xferv_compat(struct snd_pcm_substream *substream,
+				      int dir, struct snd_xferv32 __user *data32)
+{
+	struct snd_xferv xferv;
+	struct snd_xferv_seg *segs;
+	struct snd_xferv_seg32 __user *segs32;
+	u32 ptr, nsegs, buf, frames;
+	snd_pcm_sframes_t result;
+	unsigned int i;
+
+	if (! substream->runtime)
+		return -ENOTTY;
+	if (substream->stream != dir)
+		return -EINVAL;
+	if (substream->runtime->status->state == SNDRV_PCM_STATE_OPEN)
+		return -EBADFD;
+
+	if (get_user(ptr, &data32->segs) ||
+	    get_user(nsegs, &data32->nsegs))
+		return -EFAULT;
+	if (!nsegs || nsegs > SNDRV_PCM_XFERV_MAX)
+		return -EINVAL;
+	segs = kmalloc_array(nsegs, sizeof(*segs), GFP_KERNEL);
+	if (!segs)
+		return -ENOMEM;
+	segs32 = compat_ptr(ptr);
+	for (i = 0; i < nsegs; i++) {
+		if (get_user(buf, &segs32[i].buf) ||
+		    get_user(frames, &segs32[i].frames)) {
+			kfree(segs);
+			return -EFAULT;
+		}
+		segs[i].buf = compat_ptr(buf);
+		segs[i].frames = frames;
+	}
+	result = snd_pcm_xferv(substream, segs, nsegs, &xferv);
+	kfree(segs);
+
+	if (put_user(result, &data32->result) ||
+	    put_user(xferv.hw_ptr, &data32->hw_ptr) ||
+	    put_user(xferv.appl_ptr, &data32->appl_ptr) ||
+	    put_user(xferv.avail, &data32->avail) ||
+	    put_user(xferv.delay, &data32->delay) ||
+	    compat_put_timespec(&xferv.tstamp, &data32->tstamp) ||
+	    compat_put_timespec(&xferv.audio_tstamp, &data32->audio_tstamp))
+		return -EFAULT;
+	return result < 0 ? result : 0;
+}
+
 /* snd_xfern needs remapping of bufs */
 struct snd_xfern32 {
 	s32 result;
@@ -528,6 +597,7 @@ static int snd_pcm_ioctl_sync_ptr_compat(struct snd_pcm_substream *substream,
 	sstatus.tstamp = status->tstamp;
 	sstatus.suspended_state = status->suspended_state;
 	sstatus.audio_tstamp = status->audio_tstamp;
+	snd_pcm_status_seq_publish(substream);
 	snd_pcm_stream_unlock_irq(substream);
 	if (put_user(sstatus.state, &src->s.status.state) ||
 	    put_user(sstatus.hw_ptr, &src->s.status.hw_ptr) ||
@@ -616,6 +686,7 @@ static int snd_pcm_ioctl_sync_ptr_x32(struct snd_pcm_substream *substream,
 	sstatus.tstamp = status->tstamp;
 	sstatus.suspended_state = status->suspended_state;
 	sstatus.audio_tstamp = status->audio_tstamp;
+	snd_pcm_status_seq_publish(substream);
 	snd_pcm_stream_unlock_irq(substream);
 	if (put_user(sstatus.state, &src->s.status.state) ||
 	    put_user(sstatus.hw_ptr, &src->s.status.hw_ptr) ||
@@ -646,6 +717,8 @@ enum {
 	SNDRV_PCM_IOCTL_READI_FRAMES32 = _IOR('A', 0x51, struct snd_xferi32),
 	SNDRV_PCM_IOCTL_WRITEN_FRAMES32 = _IOW('A', 0x52, struct snd_xfern32),
 	SNDRV_PCM_IOCTL_READN_FRAMES32 = _IOR('A', 0x53, struct snd_xfern32),
+	SNDRV_PCM_IOCTL_WRITEV_FRAMES32 = _IOWR('A', 0x54, struct snd_xferv32),
+	SNDRV_PCM_IOCTL_READV_FRAMES32 = _IOWR('A', 0x55, struct snd_xferv32),
 	SNDRV_PCM_IOCTL_SYNC_PTR32 = _IOWR('A', 0x23, struct snd_pcm_sync_ptr32),
 #ifdef CONFIG_X86_X32
 	SNDRV_PCM_IOCTL_CHANNEL_INFO_X32 = _IOR('A', 0x32, struct snd_pcm_channel_info),
@@ -718,6 +791,10 @@ static long snd_pcm_ioctl_compat(struct file *file, unsigned int cmd, unsigned l
 		return snd_pcm_ioctl_xfern_compat(substream, SNDRV_PCM_STREAM_PLAYBACK, argp);
 	case SNDRV_PCM_IOCTL_READN_FRAMES32:
 		return snd_pcm_ioctl_xfern_compat(substream, SNDRV_PCM_STREAM_CAPTURE, argp);
+	case SNDRV_PCM_IOCTL_WRITEV_FRAMES32:
+		return snd_pcm_ioctl_xferv_compat(substream, SNDRV_PCM_STREAM_PLAYBACK, argp);
+	case SNDRV_PCM_IOCTL_READV_FRAMES32:
+		return snd_pcm_ioctl_xferv_compat(substream, SNDRV_PCM_STREAM_CAPTURE, argp);
 	case SNDRV_PCM_IOCTL_DELAY32:
 		return snd_pcm_ioctl_delay_compat(substream, argp);
 	case SNDRV_PCM_IOCTL_REWIND32:
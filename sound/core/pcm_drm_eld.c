@@ -9,6 +9,7 @@
 #include <drm/drm_edid.h>
 #include <sound/pcm.h>
 #include <sound/pcm_drm_eld.h>
+#include "pcm_local.h"
 
 static const unsigned int eld_rates[] = {
 	32000,
@@ -97,3 +98,9 @@ int snd_pcm_hw_constraint_eld(struct snd_pcm_runtime *runtime, void *eld)
 	return ret;
 }
 EXPORT_SYMBOL_GPL(snd_pcm_hw_constraint_eld);
+
+/* the ELD changes on hotplug, so these rules must not be cached */
+bool snd_pcm_hw_rule_is_eld(const struct snd_pcm_hw_rule *rule)
+{
+	return rule->func == eld_limit_rates || rule->func == eld_limit_channels;
+}
@@ -24,6 +24,9 @@
 #include <linux/time.h>
 #include <linux/math64.h>
 #include <linux/export.h>
+#include <linux/moduleparam.h>
+#include <linux/hrtimer.h>
+#include <linux/hashtable.h>
 #include <sound/core.h>
 #include <sound/control.h>
 #include <sound/tlv.h>
@@ -32,6 +35,8 @@
 #include <sound/pcm_params.h>
 #include <sound/timer.h>
 
+#include "pcm_local.h"
+
 #ifdef CONFIG_SND_PCM_XRUN_DEBUG
 #define CREATE_TRACE_POINTS
 #include "pcm_trace.h"
@@ -234,7 +239,8 @@ int snd_pcm_update_state(struct snd_pcm_substream *substream,
 
 static void update_audio_tstamp(struct snd_pcm_substream *substream,
 				struct timespec *curr_tstamp,
-				struct timespec *audio_tstamp)
+				struct timespec *audio_tstamp,
+				snd_pcm_uframes_t extra)
 {
 	struct snd_pcm_runtime *runtime = substream->runtime;
 	u64 audio_frames, audio_nsecs;
@@ -249,10 +255,12 @@ static void update_audio_tstamp(struct snd_pcm_substream *substream,
 
 		/*
 		 * provide audio timestamp derived from pointer position
+		 * and the estimated progress past it,
 		 * add delay only if requested
 		 */
 
-		audio_frames = runtime->hw_ptr_wrap + runtime->status->hw_ptr;
+		audio_frames = runtime->hw_ptr_wrap + runtime->status->hw_ptr +
+			extra;
 
 		if (runtime->audio_tstamp_config.report_delay) {
 			if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
@@ -277,11 +285,220 @@ static void update_audio_tstamp(struct snd_pcm_substream *substream,
 	runtime->driver_tstamp = driver_tstamp;
 }
 
+/*
+ * hw_ptr estimation
+ *
+ * With hw_ptr_dll set, each stream runs a second order delay-locked loop
+ * over the (hw_ptr, time) pairs the driver reports, as JACK does for its
+ * period clock, giving a filtered time for the last position and the
+ * actual duration of a frame.  It is used to
+ *
+ * - estimate how far BATCH hardware, whose pointer only moves once per
+ *   period, has got past the position it reports, never further than the
+ *   next period boundary.  hw_ptr itself stays at the reported position,
+ *   since the frames in between may not have been transferred yet; only
+ *   the default audio timestamp and the reported delay follow the
+ *   estimate;
+ * - wake up sleepers with an hrtimer at the time avail_min should be
+ *   reached, so streams with few or no period interrupts need no polling.
+ *
+ * The records live in a table keyed on the substream, looked up under RCU
+ * from the pointer update.  Nonatomic streams are left alone since the
+ * timer cannot take their stream lock.
+ */
+static bool hw_ptr_dll;
+module_param(hw_ptr_dll, bool, 0644);
+MODULE_PARM_DESC(hw_ptr_dll, "Estimate hw_ptr between updates and wake up on avail_min (for new streams).");
+
+#define DLL_FRAC	16	/* fraction bits of ns per frame */
+#define DLL_B_SHIFT	2	/* b = 1/4, c = 1/32: ~0.18 of the update rate */
+#define DLL_C_SHIFT	5
+
+struct snd_pcm_dll {
+	struct hlist_node node;
+	struct snd_pcm_substream *substream;
+	struct hrtimer timer;
+	bool locked;
+	snd_pcm_uframes_t pos;	/* driver position of the anchor */
+	snd_pcm_uframes_t extra; /* estimated progress past hw_ptr */
+	u64 frames;		/* hw_ptr_wrap + hw_ptr at the anchor */
+	u64 time;		/* filtered time of the anchor, ns */
+	u64 npf;		/* ns per frame, DLL_FRAC fixed point */
+	u64 npf_min, npf_max;
+};
+
+static DEFINE_HASHTABLE(snd_pcm_dlls, 6);
+static DEFINE_MUTEX(snd_pcm_dlls_mutex);
+
+/* call under rcu_read_lock() */
+static struct snd_pcm_dll *snd_pcm_dll_find(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_dll *dll;
+
+	hash_for_each_possible_rcu(snd_pcm_dlls, dll, node,
+				   (unsigned long)substream) {
+		if (dll->substream == substream)
+			return dll;
+	}
+	return NULL;
+}
+
+/* a new position read from the driver */
+static void snd_pcm_dll_feed(struct snd_pcm_dll *dll,
+			     struct snd_pcm_runtime *runtime,
+			     snd_pcm_uframes_t pos, u64 frames, u64 now)
+{
+	u64 n = frames - dll->frames;
+	u64 span, pred;
+	s64 e;
+
+	if (!dll->locked || n > runtime->buffer_size * 2)
+		goto anchor;
+	if (!n)
+		return;
+	span = (n * dll->npf) >> DLL_FRAC;
+	pred = dll->time + span;
+	e = (s64)(now - pred);
+	/* a stall or a pause rather than clock drift: start over from here */
+	if (abs(e) > span / 2 + NSEC_PER_MSEC)
+		goto anchor;
+
+	dll->time = pred + (e >> DLL_B_SHIFT);
+	dll->npf += div_s64(e * (1 << DLL_FRAC), (s32)n) >> DLL_C_SHIFT;
+	dll->npf = clamp(dll->npf, dll->npf_min, dll->npf_max);
+	dll->frames = frames;
+	dll->pos = pos;
+	return;
+
+ anchor:
+	dll->locked = true;
+	dll->time = now;
+	dll->frames = frames;
+	dll->pos = pos;
+}
+
+/* frames played or captured since the anchor, as of now */
+static u64 snd_pcm_dll_elapsed(struct snd_pcm_dll *dll, u64 now)
+{
+	if (now <= dll->time)
+		return 0;
+	return div64_u64((now - dll->time) << DLL_FRAC, dll->npf);
+}
+
+/*
+ * The delay to report, given the one derived from hw_ptr: playback has
+ * played and capture has captured the estimated frames past hw_ptr.
+ * Call with the stream lock held.
+ */
+snd_pcm_sframes_t snd_pcm_dll_delay(struct snd_pcm_substream *substream,
+				    snd_pcm_sframes_t delay)
+{
+	struct snd_pcm_dll *dll;
+	snd_pcm_sframes_t extra = 0;
+
+	rcu_read_lock();
+	dll = snd_pcm_dll_find(substream);
+	if (dll)
+		extra = dll->extra;
+	rcu_read_unlock();
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+		return delay > extra ? delay - extra : 0;
+	return delay + extra;
+}
+
+/* arm the wakeup for when avail reaches avail_min */
+static void snd_pcm_dll_arm(struct snd_pcm_dll *dll,
+			    struct snd_pcm_substream *substream, u64 now)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	snd_pcm_uframes_t avail, need;
+	u64 frames, when;
+
+	if (!dll->locked || !snd_pcm_running(substream))
+		return;
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+		avail = snd_pcm_playback_avail(runtime);
+	else
+		avail = snd_pcm_capture_avail(runtime);
+	need = runtime->twake ? runtime->twake : runtime->control->avail_min;
+	if (avail >= need)
+		return;
+
+	frames = runtime->hw_ptr_wrap + runtime->status->hw_ptr + need - avail;
+	when = dll->time + (((frames - dll->frames) * dll->npf) >> DLL_FRAC);
+	/* past already: BATCH hardware has to get there by interrupt */
+	if (when <= now)
+		return;
+	hrtimer_start(&dll->timer, ns_to_ktime(when), HRTIMER_MODE_ABS);
+}
+
 static int snd_pcm_update_hw_ptr0(struct snd_pcm_substream *substream,
-				  unsigned int in_interrupt)
+				  unsigned int in_interrupt);
+
+static enum hrtimer_restart snd_pcm_dll_wakeup(struct hrtimer *timer)
+{
+	struct snd_pcm_dll *dll = container_of(timer, struct snd_pcm_dll, timer);
+	struct snd_pcm_substream *substream = dll->substream;
+	unsigned long flags;
+
+	snd_pcm_stream_lock_irqsave(substream, flags);
+	if (snd_pcm_running(substream))
+		snd_pcm_update_hw_ptr0(substream, 0);
+	snd_pcm_stream_unlock_irqrestore(substream, flags);
+	return HRTIMER_NORESTART;
+}
+
+/* called from hw_params, once the rate is known */
+void snd_pcm_dll_setup(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_dll *dll;
+
+	snd_pcm_dll_free(substream);
+	if (!hw_ptr_dll || substream->pcm->nonatomic)
+		return;
+
+	dll = kzalloc(sizeof(*dll), GFP_KERNEL);
+	if (!dll)
+		return;
+	dll->substream = substream;
+	hrtimer_init(&dll->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	dll->timer.function = snd_pcm_dll_wakeup;
+	/* start from the nominal rate, allowing 3% either way */
+	dll->npf = div_u64((u64)NSEC_PER_SEC << DLL_FRAC,
+			   substream->runtime->rate);
+	dll->npf_min = dll->npf - dll->npf / 32;
+	dll->npf_max = dll->npf + dll->npf / 32;
+	mutex_lock(&snd_pcm_dlls_mutex);
+	hash_add_rcu(snd_pcm_dlls, &dll->node, (unsigned long)substream);
+	mutex_unlock(&snd_pcm_dlls_mutex);
+}
+
+void snd_pcm_dll_free(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_dll *dll;
+
+	mutex_lock(&snd_pcm_dlls_mutex);
+	rcu_read_lock();
+	dll = snd_pcm_dll_find(substream);
+	rcu_read_unlock();
+	if (dll)
+		hash_del_rcu(&dll->node);
+	mutex_unlock(&snd_pcm_dlls_mutex);
+	if (!dll)
+		return;
+
+	/* no pointer update can see it any more, so it won't be rearmed */
+	synchronize_rcu();
+	hrtimer_cancel(&dll->timer);
+	kfree(dll);
+}
+
+static int __snd_pcm_update_hw_ptr0(struct snd_pcm_substream *substream,
+				    unsigned int in_interrupt,
+				    struct snd_pcm_dll *dll, u64 now)
 {
 	struct snd_pcm_runtime *runtime = substream->runtime;
-	snd_pcm_uframes_t pos;
+	snd_pcm_uframes_t pos, extra = 0;
 	snd_pcm_uframes_t old_hw_ptr, new_hw_ptr, hw_base;
 	snd_pcm_sframes_t hdelta, delta;
 	unsigned long jdelta;
@@ -331,6 +548,16 @@ static int snd_pcm_update_hw_ptr0(struct snd_pcm_substream *substream,
 		pos = 0;
 	}
 	pos -= pos % runtime->min_align;
+	if (dll && dll->locked && !in_interrupt && pos == dll->pos &&
+	    (runtime->hw.info & SNDRV_PCM_INFO_BATCH)) {
+		/* the pointer has not moved since the last update */
+		extra = min_t(u64, snd_pcm_dll_elapsed(dll, now),
+			      runtime->period_size - pos % runtime->period_size -
+			      runtime->min_align);
+		extra -= extra % runtime->min_align;
+	}
+	if (dll)
+		dll->extra = extra;
 	trace_hwptr(substream, pos, in_interrupt);
 	hw_base = runtime->hw_ptr_base;
 	new_hw_ptr = hw_base + pos;
@@ -456,7 +683,9 @@ static int snd_pcm_update_hw_ptr0(struct snd_pcm_substream *substream,
 
  no_delta_check:
 	if (runtime->status->hw_ptr == new_hw_ptr) {
-		update_audio_tstamp(substream, &curr_tstamp, &audio_tstamp);
+		update_audio_tstamp(substream, &curr_tstamp, &audio_tstamp,
+				    extra);
+		snd_pcm_status_seq_publish(substream);
 		return 0;
 	}
 
@@ -481,11 +710,33 @@ static int snd_pcm_update_hw_ptr0(struct snd_pcm_substream *substream,
 		runtime->hw_ptr_wrap += runtime->boundary;
 	}
 
-	update_audio_tstamp(substream, &curr_tstamp, &audio_tstamp);
+	update_audio_tstamp(substream, &curr_tstamp, &audio_tstamp, extra);
+	snd_pcm_status_seq_publish(substream);
+	if (dll)
+		snd_pcm_dll_feed(dll, runtime, pos,
+				 runtime->hw_ptr_wrap + new_hw_ptr, now);
 
 	return snd_pcm_update_state(substream, runtime);
 }
 
+static int snd_pcm_update_hw_ptr0(struct snd_pcm_substream *substream,
+				  unsigned int in_interrupt)
+{
+	struct snd_pcm_dll *dll;
+	u64 now = 0;
+	int err;
+
+	rcu_read_lock();
+	dll = snd_pcm_dll_find(substream);
+	if (dll)
+		now = ktime_get_ns();
+	err = __snd_pcm_update_hw_ptr0(substream, in_interrupt, dll, now);
+	if (dll && err >= 0)
+		snd_pcm_dll_arm(dll, substream, now);
+	rcu_read_unlock();
+	return err;
+}
+
 /* CAUTION: call it with irq disabled */
 int snd_pcm_update_hw_ptr(struct snd_pcm_substream *substream)
 {
@@ -2089,6 +2340,7 @@ static snd_pcm_sframes_t snd_pcm_lib_write1(struct snd_pcm_substream *substream,
 		if (appl_ptr >= runtime->boundary)
 			appl_ptr -= runtime->boundary;
 		runtime->control->appl_ptr = appl_ptr;
+		snd_pcm_status_seq_publish(substream);
 		if (substream->ops->ack)
 			substream->ops->ack(substream);
 
@@ -2321,6 +2573,7 @@ static snd_pcm_sframes_t snd_pcm_lib_read1(struct snd_pcm_substream *substream,
 		if (appl_ptr >= runtime->boundary)
 			appl_ptr -= runtime->boundary;
 		runtime->control->appl_ptr = appl_ptr;
+		snd_pcm_status_seq_publish(substream);
 		if (substream->ops->ack)
 			substream->ops->ack(substream);
 
@@ -0,0 +1,61 @@
+/*
+ * pcm_local.h - a local header file for snd-pcm module.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+
+#ifndef __SOUND_CORE_PCM_LOCAL_H
+#define __SOUND_CORE_PCM_LOCAL_H
+
+struct snd_info_buffer;
+
+/* hw_params refinement cache, pcm_native.c */
+void snd_pcm_refine_free(struct snd_pcm_substream *substream);
+void snd_pcm_refine_proc_read(struct snd_pcm_substream *substream,
+			      struct snd_info_buffer *buffer);
+
+/*
+ * Seqlock-protected copy of the status, readable through its own mmap
+ * offset on every architecture.  It lives in the otherwise unused tail of
+ * the status page; the fields are fixed size so 32 and 64 bit readers see
+ * the same layout.  seq is odd while the kernel updates it.
+ */
+struct snd_pcm_mmap_status_seq {
+	__u32 seq;
+	__s32 state;
+	__s32 suspended_state;
+	__u32 pad;
+	__u64 hw_ptr;
+	__u64 appl_ptr;
+	__s64 tstamp_sec;
+	__s64 tstamp_nsec;
+	__s64 audio_tstamp_sec;
+	__s64 audio_tstamp_nsec;
+};
+
+#define SNDRV_PCM_MMAP_OFFSET_STATUS_SEQ	0x82000000
+#define SNDRV_PCM_STATUS_SEQ_POS		2048	/* in the status page */
+
+/* pcm_native.c, call with the stream lock held */
+void snd_pcm_status_seq_publish(struct snd_pcm_substream *substream);
+
+/* hw_ptr estimation, pcm_lib.c */
+void snd_pcm_dll_setup(struct snd_pcm_substream *substream);
+void snd_pcm_dll_free(struct snd_pcm_substream *substream);
+snd_pcm_sframes_t snd_pcm_dll_delay(struct snd_pcm_substream *substream,
+				    snd_pcm_sframes_t delay);
+
+/* rules whose result depends on more than the params, pcm_drm_eld.c */
+#ifdef CONFIG_SND_PCM_ELD
+bool snd_pcm_hw_rule_is_eld(const struct snd_pcm_hw_rule *rule);
+#else
+static inline bool snd_pcm_hw_rule_is_eld(const struct snd_pcm_hw_rule *rule)
+{
+	return false;
+}
+#endif
+
+#endif	/* __SOUND_CORE_PCM_LOCAL_H */
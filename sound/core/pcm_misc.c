@@ -21,6 +21,7 @@
   
 #include <linux/time.h>
 #include <linux/export.h>
+#include <asm/unaligned.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
 #define SND_PCM_FORMAT_UNKNOWN (-1)
@@ -391,6 +392,49 @@ const unsigned char *snd_pcm_format_silence_64(snd_pcm_format_t format)
 
 EXPORT_SYMBOL(snd_pcm_format_silence_64);
 
+/* is every byte of the sample pattern the same? */
+static bool pcm_silence_is_byte(const unsigned char *pat, unsigned int width)
+{
+	unsigned int i;
+
+	for (i = 1; i < width; i++)
+		if (pat[i] != pat[0])
+			return false;
+	return true;
+}
+
+/*
+ * Fill with a 2, 3, 4 or 8 byte sample pattern.  The pattern repeats
+ * every lcm(width, 8) bytes, so it is replicated into one or three
+ * 64 bit words and stored a word at a time; only the tail is copied
+ * byte-wise.  The destination is never read back, which matters for
+ * uncached DMA buffers.
+ */
+static void pcm_silence_fill(unsigned char *dst, unsigned int bytes,
+			     const unsigned char *pat, unsigned int width)
+{
+	unsigned char buf[24];
+	u64 w[3];
+	unsigned int i, period;
+
+	period = width == 3 ? 24 : 8;
+	for (i = 0; i < period; i++)
+		buf[i] = pat[i % width];
+	memcpy(w, buf, period);
+
+	if (period == 8) {
+		for (; bytes >= 8; bytes -= 8, dst += 8)
+			put_unaligned(w[0], (u64 *)dst);
+	} else {
+		for (; bytes >= 24; bytes -= 24, dst += 24) {
+			put_unaligned(w[0], (u64 *)dst);
+			put_unaligned(w[1], (u64 *)dst + 1);
+			put_unaligned(w[2], (u64 *)dst + 2);
+		}
+	}
+	memcpy(dst, buf, bytes);
+}
+
 /**
  * snd_pcm_format_set_silence - set the silence data on the buffer
  * @format: the PCM format
@@ -404,7 +448,8 @@ EXPORT_SYMBOL(snd_pcm_format_silence_64);
 int snd_pcm_format_set_silence(snd_pcm_format_t format, void *data, unsigned int samples)
 {
 	int width;
-	unsigned char *dst, *pat;
+	unsigned char *pat;
+	unsigned int bytes;
 
 	if ((INT)format < 0 || (INT)format > (INT)SNDRV_PCM_FORMAT_LAST)
 		return -EINVAL;
@@ -414,49 +459,13 @@ int snd_pcm_format_set_silence(snd_pcm_format_t format, void *data, unsigned int
 	pat = pcm_formats[(INT)format].silence;
 	if (! width)
 		return -EINVAL;
-	/* signed or 1 byte data */
-	if (pcm_formats[(INT)format].signd == 1 || width <= 8) {
-		unsigned int bytes = samples * width / 8;
+	bytes = samples * width / 8;
+	/* signed, 1 byte data or a single repeated byte (DSD) */
+	if (width <= 8 || pcm_silence_is_byte(pat, width / 8)) {
 		memset(data, *pat, bytes);
 		return 0;
 	}
-	/* non-zero samples, fill using a loop */
-	width /= 8;
-	dst = data;
-#if 0
-	while (samples--) {
-		memcpy(dst, pat, width);
-		dst += width;
-	}
-#else
-	/* a bit optimization for constant width */
-	switch (width) {
-	case 2:
-		while (samples--) {
-			memcpy(dst, pat, 2);
-			dst += 2;
-		}
-		break;
-	case 3:
-		while (samples--) {
-			memcpy(dst, pat, 3);
-			dst += 3;
-		}
-		break;
-	case 4:
-		while (samples--) {
-			memcpy(dst, pat, 4);
-			dst += 4;
-		}
-		break;
-	case 8:
-		while (samples--) {
-			memcpy(dst, pat, 8);
-			dst += 8;
-		}
-		break;
-	}
-#endif
+	pcm_silence_fill(data, bytes, pat, width / 8);
 	return 0;
 }
 
@@ -27,6 +27,7 @@
 #include <linux/pm_qos.h>
 #include <linux/io.h>
 #include <linux/dma-mapping.h>
+#include <linux/highmem.h>
 #include <sound/core.h>
 #include <sound/control.h>
 #include <sound/info.h>
@@ -35,6 +36,8 @@
 #include <sound/timer.h>
 #include <sound/minors.h>
 #include <linux/uio.h>
+#include <linux/hashtable.h>
+#include "pcm_local.h"
 
 /*
  *  Compatibility
@@ -67,6 +70,36 @@ static int snd_pcm_hw_params_old_user(struct snd_pcm_substream *substream,
 #endif
 static int snd_pcm_open(struct file *file, struct snd_pcm *pcm, int stream);
 
+/*
+ *  Batched read/write: several interleaved segments in one call, returning
+ *  the pointers, delay and timestamps after the last one.  Kept here until
+ *  it gets into the uapi header.
+ */
+
+struct snd_xferv_seg {
+	void __user *buf;
+	snd_pcm_uframes_t frames;
+};
+
+struct snd_xferv {
+	snd_pcm_sframes_t result;		/* frames transferred */
+	struct snd_xferv_seg __user *segs;
+	unsigned int nsegs;
+	unsigned int pad;
+	/* state after the last segment */
+	snd_pcm_uframes_t hw_ptr;
+	snd_pcm_uframes_t appl_ptr;
+	snd_pcm_uframes_t avail;
+	snd_pcm_sframes_t delay;
+	struct timespec tstamp;			/* of the hw_ptr update */
+	struct timespec audio_tstamp;
+	unsigned char reserved[32];
+};
+
+#define SNDRV_PCM_IOCTL_WRITEV_FRAMES	_IOWR('A', 0x54, struct snd_xferv)
+#define SNDRV_PCM_IOCTL_READV_FRAMES	_IOWR('A', 0x55, struct snd_xferv)
+#define SNDRV_PCM_XFERV_MAX		64
+
 /*
  *
  */
@@ -277,18 +310,222 @@ static const char * const snd_pcm_hw_param_names[] = {
 };
 #endif
 
-int snd_pcm_hw_refine(struct snd_pcm_substream *substream, 
-		      struct snd_pcm_hw_params *params)
+/*
+ * hw_params refinement cache
+ *
+ * Sound servers probe a lot of configurations when they start, and each
+ * HW_REFINE runs the rules to a fixpoint again.  Every substream that has
+ * been opened gets a small record here: the rules reading each parameter,
+ * so that a change only requeues the rules that depend on it, and the last
+ * few refine results keyed on the whole input.  A result is only reused
+ * while nothing on the card has opened, closed, prepared, or set or freed
+ * its hw_params, since rules may look at the other streams (aloop, and
+ * drivers whose streams share a clock).  Driver rules may also read chip
+ * or control state the core cannot see, so results are only cached for
+ * the drivers listed in hw_refine_cache, whose rules depend on nothing
+ * else.  Rules that read hotplug state (ELD) turn the cache off for the
+ * substream even then.
+ *
+ * struct snd_pcm_substream lives outside this tree, so the records are
+ * kept in a table keyed on the substream pointer.
+ */
+#define SND_PCM_REFINE_SLOTS	4
+
+static char *hw_refine_cache;
+module_param(hw_refine_cache, charp, 0444);
+MODULE_PARM_DESC(hw_refine_cache, "Card drivers (comma separated) whose identical hw_params refinements are reused.");
+
+struct snd_pcm_refine_slot {
+	bool valid;
+	unsigned int gen;
+	int err;
+	struct snd_pcm_hw_params in;
+	struct snd_pcm_hw_params out;
+};
+
+struct snd_pcm_refine {
+	struct hlist_node node;
+	struct snd_pcm_substream *substream;
+	struct mutex lock;
+	unsigned int rules_num;		/* rules deps was built for */
+	unsigned long *deps;		/* per parameter, the rules reading it */
+	bool nocache;
+	unsigned int next;		/* slot to replace next */
+	struct snd_pcm_refine_slot slots[SND_PCM_REFINE_SLOTS];
+	/* statistics over the life of the substream */
+	unsigned long calls;
+	unsigned long hits;
+	unsigned long rule_runs;
+	u64 time_ns;
+	u64 max_ns;
+};
+
+static DEFINE_HASHTABLE(snd_pcm_refines, 6);
+static DEFINE_MUTEX(snd_pcm_refines_mutex);
+static atomic_t snd_pcm_refine_gens[SNDRV_CARDS];
+
+static struct snd_pcm_refine *
+snd_pcm_refine_find(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_refine *ref;
+
+	mutex_lock(&snd_pcm_refines_mutex);
+	hash_for_each_possible(snd_pcm_refines, ref, node,
+			       (unsigned long)substream) {
+		if (ref->substream == substream)
+			goto found;
+	}
+	ref = NULL;
+ found:
+	mutex_unlock(&snd_pcm_refines_mutex);
+	return ref;
+}
+
+/* is the card driver listed in hw_refine_cache? */
+static bool snd_pcm_refine_cacheable(struct snd_card *card)
+{
+	const char *p = hw_refine_cache;
+	size_t len = strlen(card->driver);
+
+	while (len && p && *p) {
+		if (!strncmp(p, card->driver, len) && (!p[len] || p[len] == ','))
+			return true;
+		p = strchr(p, ',');
+		if (p)
+			p++;
+	}
+	return false;
+}
+
+/* something the rules of other streams may look at has changed */
+static void snd_pcm_refine_touch(struct snd_pcm_substream *substream)
+{
+	atomic_inc(&snd_pcm_refine_gens[substream->pcm->card->number]);
+}
+
+/* build the per parameter rule sets and drop the cached results */
+static void snd_pcm_refine_compile(struct snd_pcm_refine *ref,
+				   struct snd_pcm_hw_constraints *constrs)
+{
+	struct snd_card *card = ref->substream->pcm->card;
+	unsigned int longs = BITS_TO_LONGS(constrs->rules_num);
+	unsigned int k, d;
+
+	kfree(ref->deps);
+	ref->deps = NULL;
+	ref->rules_num = constrs->rules_num;
+	ref->nocache = !snd_pcm_refine_cacheable(card);
+	for (k = 0; k < SND_PCM_REFINE_SLOTS; k++)
+		ref->slots[k].valid = false;
+	ref->next = 0;
+
+	for (k = 0; k < constrs->rules_num; k++)
+		if (snd_pcm_hw_rule_is_eld(&constrs->rules[k]))
+			ref->nocache = true;
+
+	if (!longs)
+		return;
+	ref->deps = kcalloc((SNDRV_PCM_HW_PARAM_LAST_INTERVAL + 1) * longs,
+			    sizeof(*ref->deps), GFP_KERNEL);
+	if (!ref->deps)
+		return;	/* snd_pcm_refine_mark() scans the rules instead */
+	for (k = 0; k < constrs->rules_num; k++) {
+		struct snd_pcm_hw_rule *r = &constrs->rules[k];
+
+		for (d = 0; r->deps[d] >= 0; d++)
+			__set_bit(k, ref->deps + r->deps[d] * longs);
+	}
+}
+
+/* called once the driver and the core have added all their rules */
+static void snd_pcm_refine_setup(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_refine *ref = snd_pcm_refine_find(substream);
+
+	if (!ref) {
+		ref = kzalloc(sizeof(*ref), GFP_KERNEL);
+		if (!ref)
+			return;
+		mutex_init(&ref->lock);
+		ref->substream = substream;
+		mutex_lock(&snd_pcm_refines_mutex);
+		hash_add(snd_pcm_refines, &ref->node, (unsigned long)substream);
+		mutex_unlock(&snd_pcm_refines_mutex);
+	}
+	mutex_lock(&ref->lock);
+	snd_pcm_refine_compile(ref, &substream->runtime->hw_constraints);
+	mutex_unlock(&ref->lock);
+}
+
+void snd_pcm_refine_free(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_refine *ref = snd_pcm_refine_find(substream);
+
+	if (!ref)
+		return;
+	mutex_lock(&snd_pcm_refines_mutex);
+	hash_del(&ref->node);
+	mutex_unlock(&snd_pcm_refines_mutex);
+	kfree(ref->deps);
+	kfree(ref);
+}
+
+void snd_pcm_refine_proc_read(struct snd_pcm_substream *substream,
+			      struct snd_info_buffer *buffer)
+{
+	struct snd_pcm_refine *ref = snd_pcm_refine_find(substream);
+
+	if (!ref) {
+		snd_iprintf(buffer, "never opened\n");
+		return;
+	}
+	mutex_lock(&ref->lock);
+	snd_iprintf(buffer, "rules: %u%s\n", ref->rules_num,
+		    ref->nocache ? " (not cached)" : "");
+	snd_iprintf(buffer, "calls: %lu\n", ref->calls);
+	snd_iprintf(buffer, "cache_hits: %lu\n", ref->hits);
+	snd_iprintf(buffer, "rule_runs: %lu\n", ref->rule_runs);
+	snd_iprintf(buffer, "time_us: %llu\n",
+		    (unsigned long long)div_u64(ref->time_ns, NSEC_PER_USEC));
+	snd_iprintf(buffer, "max_us: %llu\n",
+		    (unsigned long long)div_u64(ref->max_ns, NSEC_PER_USEC));
+	mutex_unlock(&ref->lock);
+}
+
+/* queue every rule that reads var */
+static void snd_pcm_refine_mark(struct snd_pcm_refine *ref,
+				struct snd_pcm_hw_constraints *constrs,
+				unsigned long *pending, int var)
+{
+	unsigned int k, d;
+
+	if (ref && ref->deps) {
+		bitmap_or(pending, pending,
+			  ref->deps + var * BITS_TO_LONGS(constrs->rules_num),
+			  constrs->rules_num);
+		return;
+	}
+	for (k = 0; k < constrs->rules_num; k++) {
+		for (d = 0; constrs->rules[k].deps[d] >= 0; d++) {
+			if (constrs->rules[k].deps[d] == var) {
+				__set_bit(k, pending);
+				break;
+			}
+		}
+	}
+}
+
+static int snd_pcm_hw_refine_rules(struct snd_pcm_substream *substream,
+				   struct snd_pcm_hw_params *params,
+				   struct snd_pcm_refine *ref)
 {
 	unsigned int k;
 	struct snd_pcm_hardware *hw;
 	struct snd_interval *i = NULL;
 	struct snd_mask *m = NULL;
 	struct snd_pcm_hw_constraints *constrs = &substream->runtime->hw_constraints;
-	unsigned int rstamps[constrs->rules_num];
-	unsigned int vstamps[SNDRV_PCM_HW_PARAM_LAST_INTERVAL + 1];
-	unsigned int stamp = 2;
-	int changed, again;
+	unsigned long pending[BITS_TO_LONGS(constrs->rules_num)];
+	int changed;
 
 	params->info = 0;
 	params->fifo_size = 0;
@@ -350,72 +587,77 @@ int snd_pcm_hw_refine(struct snd_pcm_substream *substream,
 			return changed;
 	}
 
-	for (k = 0; k < constrs->rules_num; k++)
-		rstamps[k] = 0;
-	for (k = 0; k <= SNDRV_PCM_HW_PARAM_LAST_INTERVAL; k++) 
-		vstamps[k] = (params->rmask & (1 << k)) ? 1 : 0;
-	do {
-		again = 0;
-		for (k = 0; k < constrs->rules_num; k++) {
-			struct snd_pcm_hw_rule *r = &constrs->rules[k];
-			unsigned int d;
-			int doit = 0;
-			if (r->cond && !(r->cond & params->flags))
-				continue;
-			for (d = 0; r->deps[d] >= 0; d++) {
-				if (vstamps[r->deps[d]] > rstamps[k]) {
-					doit = 1;
-					break;
-				}
-			}
-			if (!doit)
-				continue;
+	/*
+	 * Run the rules reading a changed parameter, in index order and
+	 * wrapping around, until nothing changes.  A rule is not requeued
+	 * by its own change.
+	 */
+	bitmap_zero(pending, constrs->rules_num);
+	for (k = 0; k <= SNDRV_PCM_HW_PARAM_LAST_INTERVAL; k++)
+		if (params->rmask & (1 << k))
+			snd_pcm_refine_mark(ref, constrs, pending, k);
+	k = 0;
+	for (;;) {
+		struct snd_pcm_hw_rule *r;
+
+		k = find_next_bit(pending, constrs->rules_num, k);
+		if (k >= constrs->rules_num) {
+			k = find_first_bit(pending, constrs->rules_num);
+			if (k >= constrs->rules_num)
+				break;
+		}
+		__clear_bit(k, pending);
+		r = &constrs->rules[k];
+		if (r->cond && !(r->cond & params->flags)) {
+			k++;
+			continue;
+		}
 #ifdef RULES_DEBUG
-			pr_debug("Rule %d [%p]: ", k, r->func);
-			if (r->var >= 0) {
-				pr_cont("%s = ", snd_pcm_hw_param_names[r->var]);
-				if (hw_is_mask(r->var)) {
-					m = hw_param_mask(params, r->var);
-					pr_cont("%x", *m->bits);
-				} else {
-					i = hw_param_interval(params, r->var);
-					if (i->empty)
-						pr_cont("empty");
-					else
-						pr_cont("%c%u %u%c",
-						       i->openmin ? '(' : '[', i->min,
-						       i->max, i->openmax ? ')' : ']');
-				}
+		pr_debug("Rule %d [%p]: ", k, r->func);
+		if (r->var >= 0) {
+			pr_cont("%s = ", snd_pcm_hw_param_names[r->var]);
+			if (hw_is_mask(r->var)) {
+				m = hw_param_mask(params, r->var);
+				pr_cont("%x", *m->bits);
+			} else {
+				i = hw_param_interval(params, r->var);
+				if (i->empty)
+					pr_cont("empty");
+				else
+					pr_cont("%c%u %u%c",
+					       i->openmin ? '(' : '[', i->min,
+					       i->max, i->openmax ? ')' : ']');
 			}
+		}
 #endif
-			changed = r->func(params, r);
+		changed = r->func(params, r);
 #ifdef RULES_DEBUG
-			if (r->var >= 0) {
-				pr_cont(" -> ");
-				if (hw_is_mask(r->var))
-					pr_cont("%x", *m->bits);
-				else {
-					if (i->empty)
-						pr_cont("empty");
-					else
-						pr_cont("%c%u %u%c",
-						       i->openmin ? '(' : '[', i->min,
-						       i->max, i->openmax ? ')' : ']');
-				}
+		if (r->var >= 0) {
+			pr_cont(" -> ");
+			if (hw_is_mask(r->var))
+				pr_cont("%x", *m->bits);
+			else {
+				if (i->empty)
+					pr_cont("empty");
+				else
+					pr_cont("%c%u %u%c",
+					       i->openmin ? '(' : '[', i->min,
+					       i->max, i->openmax ? ')' : ']');
 			}
-			pr_cont("\n");
+		}
+		pr_cont("\n");
 #endif
-			rstamps[k] = stamp;
-			if (changed && r->var >= 0) {
-				params->cmask |= (1 << r->var);
-				vstamps[r->var] = stamp;
-				again = 1;
-			}
-			if (changed < 0)
-				return changed;
-			stamp++;
+		if (ref)
+			ref->rule_runs++;
+		if (changed && r->var >= 0) {
+			params->cmask |= (1 << r->var);
+			snd_pcm_refine_mark(ref, constrs, pending, r->var);
+			__clear_bit(k, pending);
 		}
-	} while (again);
+		if (changed < 0)
+			return changed;
+		k++;
+	}
 	if (!params->msbits) {
 		i = hw_param_interval(params, SNDRV_PCM_HW_PARAM_SAMPLE_BITS);
 		if (snd_interval_single(i))
@@ -453,6 +695,57 @@ int snd_pcm_hw_refine(struct snd_pcm_substream *substream,
 	return 0;
 }
 
+int snd_pcm_hw_refine(struct snd_pcm_substream *substream, 
+		      struct snd_pcm_hw_params *params)
+{
+	struct snd_pcm_hw_constraints *constrs = &substream->runtime->hw_constraints;
+	struct snd_pcm_refine *ref = snd_pcm_refine_find(substream);
+	struct snd_pcm_refine_slot *slot = NULL, *s;
+	unsigned int gen, k;
+	u64 start, delta;
+	int err;
+
+	if (!ref)
+		return snd_pcm_hw_refine_rules(substream, params, NULL);
+
+	mutex_lock(&ref->lock);
+	start = ktime_get_ns();
+	ref->calls++;
+	if (ref->rules_num != constrs->rules_num)
+		snd_pcm_refine_compile(ref, constrs);
+	if (!ref->nocache) {
+		gen = atomic_read(&snd_pcm_refine_gens[substream->pcm->card->number]);
+		for (k = 0; k < SND_PCM_REFINE_SLOTS; k++) {
+			s = &ref->slots[k];
+			if (s->valid && s->gen == gen &&
+			    !memcmp(&s->in, params, sizeof(*params))) {
+				*params = s->out;
+				err = s->err;
+				ref->hits++;
+				goto out;
+			}
+		}
+		slot = &ref->slots[ref->next];
+		ref->next = (ref->next + 1) % SND_PCM_REFINE_SLOTS;
+		slot->valid = false;
+		slot->gen = gen;
+		slot->in = *params;
+	}
+	err = snd_pcm_hw_refine_rules(substream, params, ref);
+	if (slot) {
+		slot->out = *params;
+		slot->err = err;
+		slot->valid = true;
+	}
+ out:
+	delta = ktime_get_ns() - start;
+	ref->time_ns += delta;
+	if (delta > ref->max_ns)
+		ref->max_ns = delta;
+	mutex_unlock(&ref->lock);
+	return err;
+}
+
 EXPORT_SYMBOL(snd_pcm_hw_refine);
 
 static int snd_pcm_hw_refine_user(struct snd_pcm_substream *substream,
@@ -495,6 +788,7 @@ static void snd_pcm_set_state(struct snd_pcm_substream *substream, int state)
 	snd_pcm_stream_lock_irq(substream);
 	if (substream->runtime->status->state != SNDRV_PCM_STATE_DISCONNECTED)
 		substream->runtime->status->state = state;
+	snd_pcm_status_seq_publish(substream);
 	snd_pcm_stream_unlock_irq(substream);
 }
 
@@ -598,6 +892,8 @@ static int snd_pcm_hw_params(struct snd_pcm_substream *substream,
 	if ((usecs = period_to_usecs(runtime)) >= 0)
 		pm_qos_add_request(&substream->latency_pm_qos_req,
 				   PM_QOS_CPU_DMA_LATENCY, usecs);
+	snd_pcm_refine_touch(substream);
+	snd_pcm_dll_setup(substream);
 	return 0;
  _error:
 	/* hardware might be unusable from this time,
@@ -606,6 +902,8 @@ static int snd_pcm_hw_params(struct snd_pcm_substream *substream,
 	snd_pcm_set_state(substream, SNDRV_PCM_STATE_OPEN);
 	if (substream->ops->hw_free != NULL)
 		substream->ops->hw_free(substream);
+	snd_pcm_refine_touch(substream);
+	snd_pcm_dll_free(substream);
 	return err;
 }
 
@@ -653,6 +951,8 @@ static int snd_pcm_hw_free(struct snd_pcm_substream *substream)
 		result = substream->ops->hw_free(substream);
 	snd_pcm_set_state(substream, SNDRV_PCM_STATE_OPEN);
 	pm_qos_remove_request(&substream->latency_pm_qos_req);
+	snd_pcm_refine_touch(substream);
+	snd_pcm_dll_free(substream);
 	return result;
 }
 
@@ -781,12 +1081,15 @@ int snd_pcm_status(struct snd_pcm_substream *substream,
 		    runtime->status->state == SNDRV_PCM_STATE_DRAINING) {
 			status->delay = runtime->buffer_size - status->avail;
 			status->delay += runtime->delay;
+			status->delay = snd_pcm_dll_delay(substream,
+							  status->delay);
 		} else
 			status->delay = 0;
 	} else {
 		status->avail = snd_pcm_capture_avail(runtime);
 		if (runtime->status->state == SNDRV_PCM_STATE_RUNNING)
-			status->delay = status->avail + runtime->delay;
+			status->delay = snd_pcm_dll_delay(substream,
+					status->avail + runtime->delay);
 		else
 			status->delay = 0;
 	}
@@ -1062,6 +1365,7 @@ static void snd_pcm_post_start(struct snd_pcm_substream *substream, int state)
 	runtime->hw_ptr_buffer_jiffies = (runtime->buffer_size * HZ) / 
 							    runtime->rate;
 	runtime->status->state = state;
+	snd_pcm_status_seq_publish(substream);
 	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK &&
 	    runtime->silence_size > 0)
 		snd_pcm_playback_silence(substream, ULONG_MAX);
@@ -1113,6 +1417,7 @@ static void snd_pcm_post_stop(struct snd_pcm_substream *substream, int state)
 	if (runtime->status->state != state) {
 		snd_pcm_trigger_tstamp(substream);
 		runtime->status->state = state;
+		snd_pcm_status_seq_publish(substream);
 		snd_pcm_timer_notify(substream, SNDRV_TIMER_EVENT_MSTOP);
 	}
 	wake_up(&runtime->sleep);
@@ -1234,6 +1539,7 @@ static void snd_pcm_post_pause(struct snd_pcm_substream *substream, int push)
 		runtime->status->state = SNDRV_PCM_STATE_RUNNING;
 		snd_pcm_timer_notify(substream, SNDRV_TIMER_EVENT_MCONTINUE);
 	}
+	snd_pcm_status_seq_publish(substream);
 }
 
 static const struct action_ops snd_pcm_action_pause = {
@@ -1280,6 +1586,7 @@ static void snd_pcm_post_suspend(struct snd_pcm_substream *substream, int state)
 	snd_pcm_trigger_tstamp(substream);
 	runtime->status->suspended_state = runtime->status->state;
 	runtime->status->state = SNDRV_PCM_STATE_SUSPENDED;
+	snd_pcm_status_seq_publish(substream);
 	snd_pcm_timer_notify(substream, SNDRV_TIMER_EVENT_MSUSPEND);
 	wake_up(&runtime->sleep);
 	wake_up(&runtime->tsleep);
@@ -1384,6 +1691,7 @@ static void snd_pcm_post_resume(struct snd_pcm_substream *substream, int state)
 	struct snd_pcm_runtime *runtime = substream->runtime;
 	snd_pcm_trigger_tstamp(substream);
 	runtime->status->state = runtime->status->suspended_state;
+	snd_pcm_status_seq_publish(substream);
 	snd_pcm_timer_notify(substream, SNDRV_TIMER_EVENT_MRESUME);
 }
 
@@ -1484,7 +1792,10 @@ static int snd_pcm_do_reset(struct snd_pcm_substream *substream, int state)
 static void snd_pcm_post_reset(struct snd_pcm_substream *substream, int state)
 {
 	struct snd_pcm_runtime *runtime = substream->runtime;
+	snd_pcm_stream_lock_irq(substream);
 	runtime->control->appl_ptr = runtime->status->hw_ptr;
+	snd_pcm_status_seq_publish(substream);
+	snd_pcm_stream_unlock_irq(substream);
 	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK &&
 	    runtime->silence_size > 0)
 		snd_pcm_playback_silence(substream, ULONG_MAX);
@@ -1564,6 +1875,8 @@ static int snd_pcm_prepare(struct snd_pcm_substream *substream,
 		res = snd_pcm_action_nonatomic(&snd_pcm_action_prepare,
 					       substream, f_flags);
 	snd_power_unlock(card);
+	/* drivers may adjust the hw of other streams here (aloop) */
+	snd_pcm_refine_touch(substream);
 	return res;
 }
 
@@ -1628,6 +1941,7 @@ static int snd_pcm_do_drain_init(struct snd_pcm_substream *substream, int state)
 
 static void snd_pcm_post_drain_init(struct snd_pcm_substream *substream, int state)
 {
+	snd_pcm_status_seq_publish(substream);
 }
 
 static const struct action_ops snd_pcm_action_drain_init = {
@@ -2219,6 +2533,8 @@ int snd_pcm_hw_constraints_complete(struct snd_pcm_substream *substream)
 	/* FIXME: this belong to lowlevel */
 	snd_pcm_hw_constraint_integer(runtime, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
 
+	snd_pcm_refine_setup(substream);
+	snd_pcm_refine_touch(substream);
 	return 0;
 }
 
@@ -2240,7 +2556,9 @@ void snd_pcm_release_substream(struct snd_pcm_substream *substream)
 			substream->ops->hw_free(substream);
 		substream->ops->close(substream);
 		substream->hw_opened = 0;
+		snd_pcm_refine_touch(substream);
 	}
+	snd_pcm_dll_free(substream);
 	if (pm_qos_request_active(&substream->latency_pm_qos_req))
 		pm_qos_remove_request(&substream->latency_pm_qos_req);
 	if (substream->pcm_release) {
@@ -2469,6 +2787,7 @@ static snd_pcm_sframes_t snd_pcm_playback_rewind(struct snd_pcm_substream *subst
 	if (appl_ptr < 0)
 		appl_ptr += runtime->boundary;
 	runtime->control->appl_ptr = appl_ptr;
+	snd_pcm_status_seq_publish(substream);
 	ret = frames;
  __end:
 	snd_pcm_stream_unlock_irq(substream);
@@ -2517,6 +2836,7 @@ static snd_pcm_sframes_t snd_pcm_capture_rewind(struct snd_pcm_substream *substr
 	if (appl_ptr < 0)
 		appl_ptr += runtime->boundary;
 	runtime->control->appl_ptr = appl_ptr;
+	snd_pcm_status_seq_publish(substream);
 	ret = frames;
  __end:
 	snd_pcm_stream_unlock_irq(substream);
@@ -2566,6 +2886,7 @@ static snd_pcm_sframes_t snd_pcm_playback_forward(struct snd_pcm_substream *subs
 	if (appl_ptr >= (snd_pcm_sframes_t)runtime->boundary)
 		appl_ptr -= runtime->boundary;
 	runtime->control->appl_ptr = appl_ptr;
+	snd_pcm_status_seq_publish(substream);
 	ret = frames;
  __end:
 	snd_pcm_stream_unlock_irq(substream);
@@ -2615,6 +2936,7 @@ static snd_pcm_sframes_t snd_pcm_capture_forward(struct snd_pcm_substream *subst
 	if (appl_ptr >= (snd_pcm_sframes_t)runtime->boundary)
 		appl_ptr -= runtime->boundary;
 	runtime->control->appl_ptr = appl_ptr;
+	snd_pcm_status_seq_publish(substream);
 	ret = frames;
  __end:
 	snd_pcm_stream_unlock_irq(substream);
@@ -2679,6 +3001,9 @@ static int snd_pcm_delay(struct snd_pcm_substream *substream,
 		else
 			n = snd_pcm_capture_avail(runtime);
 		n += runtime->delay;
+		if (runtime->status->state != SNDRV_PCM_STATE_PREPARED &&
+		    runtime->status->state != SNDRV_PCM_STATE_SUSPENDED)
+			n = snd_pcm_dll_delay(substream, n);
 		break;
 	case SNDRV_PCM_STATE_XRUN:
 		err = -EPIPE;
@@ -2729,6 +3054,7 @@ static int snd_pcm_sync_ptr(struct snd_pcm_substream *substream,
 	sync_ptr.s.status.hw_ptr = status->hw_ptr;
 	sync_ptr.s.status.tstamp = status->tstamp;
 	sync_ptr.s.status.suspended_state = status->suspended_state;
+	snd_pcm_status_seq_publish(substream);
 	snd_pcm_stream_unlock_irq(substream);
 	if (copy_to_user(_sync_ptr, &sync_ptr, sizeof(sync_ptr)))
 		return -EFAULT;
@@ -2818,6 +3144,89 @@ static int snd_pcm_common_ioctl1(struct file *file,
 	return -ENOTTY;
 }
 
+/*
+ * Transfer the segments in order, stopping at the first short one, then
+ * report the state like DELAY and STATUS would.  An error is only returned
+ * if nothing was transferred.
+ */
+static snd_pcm_sframes_t snd_pcm_xferv(struct snd_pcm_substream *substream,
+				       const struct snd_xferv_seg *segs,
+				       unsigned int nsegs,
+				       struct snd_xferv *xferv)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	snd_pcm_sframes_t result = 0, n = 0;
+	unsigned int i;
+
+	memset(&xferv->hw_ptr, 0, sizeof(*xferv) -
+	       offsetof(struct snd_xferv, hw_ptr));
+	for (i = 0; i < nsegs; i++) {
+		if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+			n = snd_pcm_lib_write(substream, segs[i].buf,
+					      segs[i].frames);
+		else
+			n = snd_pcm_lib_read(substream, segs[i].buf,
+					     segs[i].frames);
+		if (n < 0)
+			break;
+		result += n;
+		if (n < segs[i].frames)
+			break;
+	}
+	if (!result && n < 0)
+		return n;
+
+	snd_pcm_stream_lock_irq(substream);
+	if (runtime->status->state == SNDRV_PCM_STATE_RUNNING ||
+	    runtime->status->state == SNDRV_PCM_STATE_DRAINING)
+		snd_pcm_update_hw_ptr(substream);
+	xferv->hw_ptr = runtime->status->hw_ptr;
+	xferv->appl_ptr = runtime->control->appl_ptr;
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
+		xferv->avail = snd_pcm_playback_avail(runtime);
+		xferv->delay = snd_pcm_playback_hw_avail(runtime);
+	} else {
+		xferv->avail = snd_pcm_capture_avail(runtime);
+		xferv->delay = xferv->avail;
+	}
+	xferv->delay += runtime->delay;
+	if (runtime->status->state == SNDRV_PCM_STATE_RUNNING ||
+	    runtime->status->state == SNDRV_PCM_STATE_DRAINING)
+		xferv->delay = snd_pcm_dll_delay(substream, xferv->delay);
+	xferv->tstamp = runtime->status->tstamp;
+	xferv->audio_tstamp = runtime->status->audio_tstamp;
+	snd_pcm_stream_unlock_irq(substream);
+	return result;
+}
+
+static int snd_pcm_xferv_user(struct snd_pcm_substream *substream,
+			      struct snd_xferv __user *_xferv)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct snd_xferv xferv;
+	struct snd_xferv_seg *segs;
+	snd_pcm_sframes_t result;
+
+	if (runtime->status->state == SNDRV_PCM_STATE_OPEN)
+		return -EBADFD;
+	if (put_user(0, &_xferv->result))
+		return -EFAULT;
+	if (copy_from_user(&xferv, _xferv, sizeof(xferv)))
+		return -EFAULT;
+	if (!xferv.nsegs || xferv.nsegs > SNDRV_PCM_XFERV_MAX)
+		return -EINVAL;
+
+	segs = memdup_user(xferv.segs, sizeof(*segs) * xferv.nsegs);
+	if (IS_ERR(segs))
+		return PTR_ERR(segs);
+	result = snd_pcm_xferv(substream, segs, xferv.nsegs, &xferv);
+	kfree(segs);
+	xferv.result = result;
+	if (copy_to_user(_xferv, &xferv, sizeof(xferv)))
+		return -EFAULT;
+	return result < 0 ? result : 0;
+}
+
 static int snd_pcm_playback_ioctl1(struct file *file,
 				   struct snd_pcm_substream *substream,
 				   unsigned int cmd, void __user *arg)
@@ -2868,6 +3277,8 @@ static int snd_pcm_playback_ioctl1(struct file *file,
 		__put_user(result, &_xfern->result);
 		return result < 0 ? result : 0;
 	}
+	case SNDRV_PCM_IOCTL_WRITEV_FRAMES:
+		return snd_pcm_xferv_user(substream, arg);
 	case SNDRV_PCM_IOCTL_REWIND:
 	{
 		snd_pcm_uframes_t frames;
@@ -2948,6 +3359,8 @@ static int snd_pcm_capture_ioctl1(struct file *file,
 		__put_user(result, &_xfern->result);
 		return result < 0 ? result : 0;
 	}
+	case SNDRV_PCM_IOCTL_READV_FRAMES:
+		return snd_pcm_xferv_user(substream, arg);
 	case SNDRV_PCM_IOCTL_REWIND:
 	{
 		snd_pcm_uframes_t frames;
@@ -3237,6 +3650,75 @@ static unsigned int snd_pcm_capture_poll(struct file *file, poll_table * wait)
  * mmap support
  */
 
+/*
+ * seqlock-protected status record
+ *
+ * Written like the vDSO data page: the writer bumps seq to odd, stores the
+ * fields and bumps it back to even, readers retry while seq is odd or has
+ * changed under them.  Writers are serialized by the stream lock.  The page
+ * is flushed after each update so that the record is also valid where the
+ * status record itself cannot be mapped because of cache aliasing.
+ */
+static inline struct snd_pcm_mmap_status_seq *
+snd_pcm_status_seq(struct snd_pcm_runtime *runtime)
+{
+	return (void *)runtime->status + SNDRV_PCM_STATUS_SEQ_POS;
+}
+
+void snd_pcm_status_seq_publish(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct snd_pcm_mmap_status *status = runtime->status;
+	struct snd_pcm_mmap_status_seq *seq = snd_pcm_status_seq(runtime);
+
+	WRITE_ONCE(seq->seq, seq->seq + 1);
+	smp_wmb();
+	seq->state = status->state;
+	seq->suspended_state = status->suspended_state;
+	seq->hw_ptr = status->hw_ptr;
+	seq->appl_ptr = runtime->control->appl_ptr;
+	seq->tstamp_sec = status->tstamp.tv_sec;
+	seq->tstamp_nsec = status->tstamp.tv_nsec;
+	seq->audio_tstamp_sec = status->audio_tstamp.tv_sec;
+	seq->audio_tstamp_nsec = status->audio_tstamp.tv_nsec;
+	smp_wmb();
+	WRITE_ONCE(seq->seq, seq->seq + 1);
+	flush_dcache_page(virt_to_page(status));
+}
+
+static int snd_pcm_mmap_status_seq_fault(struct vm_area_struct *area,
+					 struct vm_fault *vmf)
+{
+	struct snd_pcm_substream *substream = area->vm_private_data;
+
+	if (substream == NULL)
+		return VM_FAULT_SIGBUS;
+	vmf->page = virt_to_page(substream->runtime->status);
+	get_page(vmf->page);
+	return 0;
+}
+
+static const struct vm_operations_struct snd_pcm_vm_ops_status_seq =
+{
+	.fault =	snd_pcm_mmap_status_seq_fault,
+};
+
+static int snd_pcm_mmap_status_seq(struct snd_pcm_substream *substream,
+				   struct file *file,
+				   struct vm_area_struct *area)
+{
+	if ((area->vm_flags & (VM_READ | VM_WRITE)) != VM_READ)
+		return -EINVAL;
+	if (area->vm_end - area->vm_start !=
+	    PAGE_ALIGN(sizeof(struct snd_pcm_mmap_status)))
+		return -EINVAL;
+	area->vm_ops = &snd_pcm_vm_ops_status_seq;
+	area->vm_private_data = substream;
+	area->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	area->vm_flags &= ~VM_MAYWRITE;
+	return 0;
+}
+
 /*
  * Only on coherent architectures, we can mmap the status and the control records
  * for effcient data transfer.  On others, we have to use HWSYNC ioctl...
@@ -3512,6 +3994,8 @@ static int snd_pcm_mmap(struct file *file, struct vm_area_struct *area)
 		if (pcm_file->no_compat_mmap)
 			return -ENXIO;
 		return snd_pcm_mmap_control(substream, file, area);
+	case SNDRV_PCM_MMAP_OFFSET_STATUS_SEQ:
+		return snd_pcm_mmap_status_seq(substream, file, area);
 	default:
 		return snd_pcm_mmap_data(substream, file, area);
 	}
@@ -3665,6 +4149,8 @@ static unsigned long snd_pcm_get_unmapped_area(struct file *file,
 		return (unsigned long)runtime->status;
 	case SNDRV_PCM_MMAP_OFFSET_CONTROL:
 		return (unsigned long)runtime->control;
+	case SNDRV_PCM_MMAP_OFFSET_STATUS_SEQ:
+		return (unsigned long)runtime->status;
 	default:
 		return (unsigned long)runtime->dma_area + offset;
 	}
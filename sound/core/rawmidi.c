@@ -29,6 +29,7 @@
 #include <linux/mutex.h>
 #include <linux/module.h>
 #include <linux/delay.h>
+#include <linux/uio.h>
 #include <sound/rawmidi.h>
 #include <sound/info.h>
 #include <sound/control.h>
@@ -85,18 +86,93 @@ static inline unsigned short snd_rawmidi_file_flags(struct file *file)
 	}
 }
 
+/*
+ * The runtime buffer is a single producer, single consumer ring.  The
+ * producer only moves its own pointer (hw_ptr for input, appl_ptr for
+ * output) and the consumer only the other one, both counting modulo twice
+ * the buffer size so that a full ring differs from an empty one.  The
+ * driver side still serializes on runtime->lock, the file side on the ring
+ * mutex, or on the ring lock for kernel writers that may be atomic, so the
+ * two sides never wait for each other.  The mutex and the lock do not
+ * exclude each other, so kernel writers are refused on append substreams,
+ * the only ones a file can share with them.  runtime->avail is not maintained;
+ * snd_rawmidi_avail() computes it from the pointers.
+ */
+struct snd_rawmidi_ring {
+	struct mutex mutex;		/* file side, may sleep */
+	spinlock_t lock;		/* file side of kernel writers */
+	unsigned long overruns;		/* input bytes dropped, never reset */
+	unsigned long overruns_reported;	/* up to the last status */
+	unsigned char data[];
+};
+
+static inline struct snd_rawmidi_ring *
+snd_rawmidi_ring(struct snd_rawmidi_runtime *runtime)
+{
+	return container_of((void *)runtime->buffer, struct snd_rawmidi_ring, data);
+}
+
+static unsigned char *snd_rawmidi_ring_alloc(size_t size)
+{
+	struct snd_rawmidi_ring *ring;
+
+	ring = kzalloc(sizeof(*ring) + size, GFP_KERNEL);
+	if (!ring)
+		return NULL;
+	mutex_init(&ring->mutex);
+	spin_lock_init(&ring->lock);
+	return ring->data;
+}
+
+static inline size_t snd_rawmidi_ring_pos(struct snd_rawmidi_runtime *runtime,
+					  size_t ptr)
+{
+	return ptr < runtime->buffer_size ? ptr : ptr - runtime->buffer_size;
+}
+
+static inline size_t snd_rawmidi_ring_add(struct snd_rawmidi_runtime *runtime,
+					  size_t ptr, size_t count)
+{
+	ptr += count;
+	if (ptr >= 2 * runtime->buffer_size)
+		ptr -= 2 * runtime->buffer_size;
+	return ptr;
+}
+
+/* bytes between the consumer pointer tail and the producer pointer head */
+static inline size_t snd_rawmidi_ring_used(struct snd_rawmidi_runtime *runtime,
+					   size_t head, size_t tail)
+{
+	return head >= tail ? head - tail : head + 2 * runtime->buffer_size - tail;
+}
+
+/* bytes to read for input, room to write for output */
+static size_t snd_rawmidi_avail(struct snd_rawmidi_substream *substream)
+{
+	struct snd_rawmidi_runtime *runtime = substream->runtime;
+	size_t hw_ptr = READ_ONCE(runtime->hw_ptr);
+	size_t appl_ptr = READ_ONCE(runtime->appl_ptr);
+
+	if (substream->stream == SNDRV_RAWMIDI_STREAM_INPUT)
+		return snd_rawmidi_ring_used(runtime, hw_ptr, appl_ptr);
+	return runtime->buffer_size -
+		snd_rawmidi_ring_used(runtime, appl_ptr, hw_ptr);
+}
+
 static inline int snd_rawmidi_ready(struct snd_rawmidi_substream *substream)
 {
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
-	return runtime->avail >= runtime->avail_min;
+	return snd_rawmidi_avail(substream) >= runtime->avail_min;
 }
 
 static inline int snd_rawmidi_ready_append(struct snd_rawmidi_substream *substream,
 					   size_t count)
 {
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
-	return runtime->avail >= runtime->avail_min &&
-	       (!substream->append || runtime->avail >= count);
+	size_t avail = snd_rawmidi_avail(substream);
+
+	return avail >= runtime->avail_min &&
+	       (!substream->append || avail >= count);
 }
 
 static void snd_rawmidi_input_event_work(struct work_struct *work)
@@ -120,11 +196,7 @@ static int snd_rawmidi_runtime_create(struct snd_rawmidi_substream *substream)
 	runtime->event = NULL;
 	runtime->buffer_size = PAGE_SIZE;
 	runtime->avail_min = 1;
-	if (substream->stream == SNDRV_RAWMIDI_STREAM_INPUT)
-		runtime->avail = 0;
-	else
-		runtime->avail = runtime->buffer_size;
-	if ((runtime->buffer = kmalloc(runtime->buffer_size, GFP_KERNEL)) == NULL) {
+	if ((runtime->buffer = snd_rawmidi_ring_alloc(runtime->buffer_size)) == NULL) {
 		kfree(runtime);
 		return -ENOMEM;
 	}
@@ -137,7 +209,7 @@ static int snd_rawmidi_runtime_free(struct snd_rawmidi_substream *substream)
 {
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
 
-	kfree(runtime->buffer);
+	kfree(snd_rawmidi_ring(runtime));
 	kfree(runtime);
 	substream->runtime = NULL;
 	return 0;
@@ -163,13 +235,20 @@ int snd_rawmidi_drop_output(struct snd_rawmidi_substream *substream)
 {
 	unsigned long flags;
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
+	struct snd_rawmidi_ring *ring = snd_rawmidi_ring(runtime);
 
 	snd_rawmidi_output_trigger(substream, 0);
 	runtime->drain = 0;
+	/* keep out the writers and the driver side, which must not ack
+	 * what is dropped under its feet
+	 */
+	mutex_lock(&ring->mutex);
 	spin_lock_irqsave(&runtime->lock, flags);
-	runtime->appl_ptr = runtime->hw_ptr = 0;
-	runtime->avail = runtime->buffer_size;
+	spin_lock(&ring->lock);
+	smp_store_release(&runtime->appl_ptr, runtime->hw_ptr);
+	spin_unlock(&ring->lock);
 	spin_unlock_irqrestore(&runtime->lock, flags);
+	mutex_unlock(&ring->mutex);
 	return 0;
 }
 EXPORT_SYMBOL(snd_rawmidi_drop_output);
@@ -183,14 +262,15 @@ int snd_rawmidi_drain_output(struct snd_rawmidi_substream *substream)
 	err = 0;
 	runtime->drain = 1;
 	timeout = wait_event_interruptible_timeout(runtime->sleep,
-				(runtime->avail >= runtime->buffer_size),
+				(snd_rawmidi_avail(substream) >= runtime->buffer_size),
 				10*HZ);
 	if (signal_pending(current))
 		err = -ERESTARTSYS;
-	if (runtime->avail < runtime->buffer_size && !timeout) {
+	if (snd_rawmidi_avail(substream) < runtime->buffer_size && !timeout) {
 		rmidi_warn(substream->rmidi,
 			   "rawmidi drain error (avail = %li, buffer_size = %li)\n",
-			   (long)runtime->avail, (long)runtime->buffer_size);
+			   (long)snd_rawmidi_avail(substream),
+			   (long)runtime->buffer_size);
 		err = -EIO;
 	}
 	runtime->drain = 0;
@@ -208,15 +288,15 @@ EXPORT_SYMBOL(snd_rawmidi_drain_output);
 
 int snd_rawmidi_drain_input(struct snd_rawmidi_substream *substream)
 {
-	unsigned long flags;
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
+	struct snd_rawmidi_ring *ring = snd_rawmidi_ring(runtime);
 
 	snd_rawmidi_input_trigger(substream, 0);
 	runtime->drain = 0;
-	spin_lock_irqsave(&runtime->lock, flags);
-	runtime->appl_ptr = runtime->hw_ptr = 0;
-	runtime->avail = 0;
-	spin_unlock_irqrestore(&runtime->lock, flags);
+	/* the consumer side alone drops what was received */
+	mutex_lock(&ring->mutex);
+	smp_store_release(&runtime->appl_ptr, smp_load_acquire(&runtime->hw_ptr));
+	mutex_unlock(&ring->mutex);
 	return 0;
 }
 EXPORT_SYMBOL(snd_rawmidi_drain_input);
@@ -632,11 +712,35 @@ static int snd_rawmidi_info_select_user(struct snd_card *card,
 	return 0;
 }
 
+/* replace the ring of a stopped and emptied substream */
+static int snd_rawmidi_resize_buffer(struct snd_rawmidi_substream *substream,
+				     size_t size)
+{
+	struct snd_rawmidi_runtime *runtime = substream->runtime;
+	struct snd_rawmidi_ring *ring;
+	unsigned char *newbuf, *oldbuf;
+
+	newbuf = snd_rawmidi_ring_alloc(size);
+	if (!newbuf)
+		return -ENOMEM;
+	oldbuf = runtime->buffer;
+	ring = container_of((void *)newbuf, struct snd_rawmidi_ring, data);
+	ring->overruns = snd_rawmidi_ring(runtime)->overruns;
+	ring->overruns_reported = snd_rawmidi_ring(runtime)->overruns_reported;
+	spin_lock_irq(&runtime->lock);
+	runtime->buffer = newbuf;
+	runtime->buffer_size = size;
+	runtime->appl_ptr = runtime->hw_ptr = 0;
+	spin_unlock_irq(&runtime->lock);
+	kfree(container_of((void *)oldbuf, struct snd_rawmidi_ring, data));
+	return 0;
+}
+
 int snd_rawmidi_output_params(struct snd_rawmidi_substream *substream,
 			      struct snd_rawmidi_params * params)
 {
-	char *newbuf;
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
+	int err;
 	
 	if (substream->append && substream->use_count > 1)
 		return -EBUSY;
@@ -648,13 +752,9 @@ int snd_rawmidi_output_params(struct snd_rawmidi_substream *substream,
 		return -EINVAL;
 	}
 	if (params->buffer_size != runtime->buffer_size) {
-		newbuf = krealloc(runtime->buffer, params->buffer_size,
-				  GFP_KERNEL);
-		if (!newbuf)
-			return -ENOMEM;
-		runtime->buffer = newbuf;
-		runtime->buffer_size = params->buffer_size;
-		runtime->avail = runtime->buffer_size;
+		err = snd_rawmidi_resize_buffer(substream, params->buffer_size);
+		if (err < 0)
+			return err;
 	}
 	runtime->avail_min = params->avail_min;
 	substream->active_sensing = !params->no_active_sensing;
@@ -665,8 +765,8 @@ EXPORT_SYMBOL(snd_rawmidi_output_params);
 int snd_rawmidi_input_params(struct snd_rawmidi_substream *substream,
 			     struct snd_rawmidi_params * params)
 {
-	char *newbuf;
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
+	int err;
 
 	snd_rawmidi_drain_input(substream);
 	if (params->buffer_size < 32 || params->buffer_size > 1024L * 1024L) {
@@ -676,12 +776,9 @@ int snd_rawmidi_input_params(struct snd_rawmidi_substream *substream,
 		return -EINVAL;
 	}
 	if (params->buffer_size != runtime->buffer_size) {
-		newbuf = krealloc(runtime->buffer, params->buffer_size,
-				  GFP_KERNEL);
-		if (!newbuf)
-			return -ENOMEM;
-		runtime->buffer = newbuf;
-		runtime->buffer_size = params->buffer_size;
+		err = snd_rawmidi_resize_buffer(substream, params->buffer_size);
+		if (err < 0)
+			return err;
 	}
 	runtime->avail_min = params->avail_min;
 	return 0;
@@ -691,28 +788,27 @@ EXPORT_SYMBOL(snd_rawmidi_input_params);
 static int snd_rawmidi_output_status(struct snd_rawmidi_substream *substream,
 				     struct snd_rawmidi_status * status)
 {
-	struct snd_rawmidi_runtime *runtime = substream->runtime;
-
 	memset(status, 0, sizeof(*status));
 	status->stream = SNDRV_RAWMIDI_STREAM_OUTPUT;
-	spin_lock_irq(&runtime->lock);
-	status->avail = runtime->avail;
-	spin_unlock_irq(&runtime->lock);
+	status->avail = snd_rawmidi_avail(substream);
 	return 0;
 }
 
 static int snd_rawmidi_input_status(struct snd_rawmidi_substream *substream,
 				    struct snd_rawmidi_status * status)
 {
-	struct snd_rawmidi_runtime *runtime = substream->runtime;
+	struct snd_rawmidi_ring *ring = snd_rawmidi_ring(substream->runtime);
+	unsigned long overruns;
 
 	memset(status, 0, sizeof(*status));
 	status->stream = SNDRV_RAWMIDI_STREAM_INPUT;
-	spin_lock_irq(&runtime->lock);
-	status->avail = runtime->avail;
-	status->xruns = runtime->xruns;
-	runtime->xruns = 0;
-	spin_unlock_irq(&runtime->lock);
+	status->avail = snd_rawmidi_avail(substream);
+	/* the total is the producer's, the report point the consumer's */
+	mutex_lock(&ring->mutex);
+	overruns = READ_ONCE(ring->overruns);
+	status->xruns = overruns - ring->overruns_reported;
+	ring->overruns_reported = overruns;
+	mutex_unlock(&ring->mutex);
 	return 0;
 }
 
@@ -884,7 +980,8 @@ int snd_rawmidi_receive(struct snd_rawmidi_substream *substream,
 			const unsigned char *buffer, int count)
 {
 	unsigned long flags;
-	int result = 0, count1;
+	int result, count1;
+	size_t head, tail, pos;
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
 
 	if (!substream->opened)
@@ -894,46 +991,33 @@ int snd_rawmidi_receive(struct snd_rawmidi_substream *substream,
 			  "snd_rawmidi_receive: input is not active!!!\n");
 		return -EINVAL;
 	}
+	if (count <= 0)
+		return 0;
+	/* only against other callers on the driver side */
 	spin_lock_irqsave(&runtime->lock, flags);
-	if (count == 1) {	/* special case, faster code */
-		substream->bytes++;
-		if (runtime->avail < runtime->buffer_size) {
-			runtime->buffer[runtime->hw_ptr++] = buffer[0];
-			runtime->hw_ptr %= runtime->buffer_size;
-			runtime->avail++;
-			result++;
-		} else {
-			runtime->xruns++;
-		}
-	} else {
-		substream->bytes += count;
-		count1 = runtime->buffer_size - runtime->hw_ptr;
-		if (count1 > count)
-			count1 = count;
-		if (count1 > (int)(runtime->buffer_size - runtime->avail))
-			count1 = runtime->buffer_size - runtime->avail;
-		memcpy(runtime->buffer + runtime->hw_ptr, buffer, count1);
-		runtime->hw_ptr += count1;
-		runtime->hw_ptr %= runtime->buffer_size;
-		runtime->avail += count1;
-		count -= count1;
-		result += count1;
-		if (count > 0) {
-			buffer += count1;
-			count1 = count;
-			if (count1 > (int)(runtime->buffer_size - runtime->avail)) {
-				count1 = runtime->buffer_size - runtime->avail;
-				runtime->xruns += count - count1;
-			}
-			if (count1 > 0) {
-				memcpy(runtime->buffer, buffer, count1);
-				runtime->hw_ptr = count1;
-				runtime->avail += count1;
-				result += count1;
-			}
-		}
+	substream->bytes += count;
+	head = runtime->hw_ptr;
+	tail = smp_load_acquire(&runtime->appl_ptr);
+	result = runtime->buffer_size - snd_rawmidi_ring_used(runtime, head, tail);
+	if (result > count)
+		result = count;
+	else if (result < count)
+		snd_rawmidi_ring(runtime)->overruns += count - result;
+	pos = snd_rawmidi_ring_pos(runtime, head);
+	if (result == 1) {	/* special case, faster code */
+		runtime->buffer[pos] = buffer[0];
+	} else if (result > 0) {
+		count1 = runtime->buffer_size - pos;
+		if (count1 > result)
+			count1 = result;
+		memcpy(runtime->buffer + pos, buffer, count1);
+		if (count1 < result)
+			memcpy(runtime->buffer, buffer + count1, result - count1);
 	}
 	if (result > 0) {
+		/* publish the data to the consumer */
+		smp_store_release(&runtime->hw_ptr,
+				  snd_rawmidi_ring_add(runtime, head, result));
 		if (runtime->event)
 			schedule_work(&runtime->event_work);
 		else if (snd_rawmidi_ready(substream))
@@ -945,42 +1029,42 @@ int snd_rawmidi_receive(struct snd_rawmidi_substream *substream,
 EXPORT_SYMBOL(snd_rawmidi_receive);
 
 static long snd_rawmidi_kernel_read1(struct snd_rawmidi_substream *substream,
-				     unsigned char __user *userbuf,
+				     struct iov_iter *to,
 				     unsigned char *kernelbuf, long count)
 {
-	unsigned long flags;
-	long result = 0, count1;
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
-	unsigned long appl_ptr;
-
-	spin_lock_irqsave(&runtime->lock, flags);
-	while (count > 0 && runtime->avail) {
-		count1 = runtime->buffer_size - runtime->appl_ptr;
-		if (count1 > count)
-			count1 = count;
-		if (count1 > (int)runtime->avail)
-			count1 = runtime->avail;
-
-		/* update runtime->appl_ptr before unlocking for userbuf */
-		appl_ptr = runtime->appl_ptr;
-		runtime->appl_ptr += count1;
-		runtime->appl_ptr %= runtime->buffer_size;
-		runtime->avail -= count1;
-
-		if (kernelbuf)
-			memcpy(kernelbuf + result, runtime->buffer + appl_ptr, count1);
-		if (userbuf) {
-			spin_unlock_irqrestore(&runtime->lock, flags);
-			if (copy_to_user(userbuf + result,
-					 runtime->buffer + appl_ptr, count1)) {
-				return result > 0 ? result : -EFAULT;
-			}
-			spin_lock_irqsave(&runtime->lock, flags);
-		}
-		result += count1;
-		count -= count1;
+	struct snd_rawmidi_ring *ring = snd_rawmidi_ring(runtime);
+	long result, count1, copied;
+	size_t head, tail, pos;
+
+	mutex_lock(&ring->mutex);
+	head = smp_load_acquire(&runtime->hw_ptr);
+	tail = runtime->appl_ptr;
+	result = snd_rawmidi_ring_used(runtime, head, tail);
+	if (result > count)
+		result = count;
+	pos = snd_rawmidi_ring_pos(runtime, tail);
+	count1 = runtime->buffer_size - pos;
+	if (count1 > result)
+		count1 = result;
+
+	if (kernelbuf) {
+		memcpy(kernelbuf, runtime->buffer + pos, count1);
+		memcpy(kernelbuf + count1, runtime->buffer, result - count1);
+	} else if (result > 0) {
+		/* the producer can't touch the data until appl_ptr moves */
+		copied = copy_to_iter(runtime->buffer + pos, count1, to);
+		if (copied == count1 && result > count1)
+			copied += copy_to_iter(runtime->buffer, result - count1, to);
+		if (!copied)
+			result = -EFAULT;
+		else
+			result = copied;
 	}
-	spin_unlock_irqrestore(&runtime->lock, flags);
+	if (result > 0)
+		smp_store_release(&runtime->appl_ptr,
+				  snd_rawmidi_ring_add(runtime, tail, result));
+	mutex_unlock(&ring->mutex);
 	return result;
 }
 
@@ -988,15 +1072,16 @@ long snd_rawmidi_kernel_read(struct snd_rawmidi_substream *substream,
 			     unsigned char *buf, long count)
 {
 	snd_rawmidi_input_trigger(substream, 1);
-	return snd_rawmidi_kernel_read1(substream, NULL/*userbuf*/, buf, count);
+	return snd_rawmidi_kernel_read1(substream, NULL/*to*/, buf, count);
 }
 EXPORT_SYMBOL(snd_rawmidi_kernel_read);
 
-static ssize_t snd_rawmidi_read(struct file *file, char __user *buf, size_t count,
-				loff_t *offset)
+static ssize_t snd_rawmidi_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
 	long result;
 	int count1;
+	size_t count = iov_iter_count(to);
+	struct file *file = iocb->ki_filp;
 	struct snd_rawmidi_file *rfile;
 	struct snd_rawmidi_substream *substream;
 	struct snd_rawmidi_runtime *runtime;
@@ -1009,36 +1094,30 @@ static ssize_t snd_rawmidi_read(struct file *file, char __user *buf, size_t coun
 	snd_rawmidi_input_trigger(substream, 1);
 	result = 0;
 	while (count > 0) {
-		spin_lock_irq(&runtime->lock);
 		while (!snd_rawmidi_ready(substream)) {
 			wait_queue_t wait;
-			if ((file->f_flags & O_NONBLOCK) != 0 || result > 0) {
-				spin_unlock_irq(&runtime->lock);
+			if ((file->f_flags & O_NONBLOCK) != 0 || result > 0)
 				return result > 0 ? result : -EAGAIN;
-			}
 			init_waitqueue_entry(&wait, current);
 			add_wait_queue(&runtime->sleep, &wait);
 			set_current_state(TASK_INTERRUPTIBLE);
-			spin_unlock_irq(&runtime->lock);
-			schedule();
+			/* no lock against the producer, so check again */
+			if (!snd_rawmidi_ready(substream))
+				schedule();
+			__set_current_state(TASK_RUNNING);
 			remove_wait_queue(&runtime->sleep, &wait);
 			if (rfile->rmidi->card->shutdown)
 				return -ENODEV;
 			if (signal_pending(current))
 				return result > 0 ? result : -ERESTARTSYS;
-			if (!runtime->avail)
+			if (!snd_rawmidi_avail(substream))
 				return result > 0 ? result : -EIO;
-			spin_lock_irq(&runtime->lock);
 		}
-		spin_unlock_irq(&runtime->lock);
-		count1 = snd_rawmidi_kernel_read1(substream,
-						  (unsigned char __user *)buf,
-						  NULL/*kernelbuf*/,
-						  count);
+		count1 = snd_rawmidi_kernel_read1(substream, to,
+						  NULL/*kernelbuf*/, count);
 		if (count1 < 0)
 			return result > 0 ? result : count1;
 		result += count1;
-		buf += count1;
 		count -= count1;
 	}
 	return result;
@@ -1053,18 +1132,13 @@ static ssize_t snd_rawmidi_read(struct file *file, char __user *buf, size_t coun
 int snd_rawmidi_transmit_empty(struct snd_rawmidi_substream *substream)
 {
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
-	int result;
-	unsigned long flags;
 
 	if (runtime->buffer == NULL) {
 		rmidi_dbg(substream->rmidi,
 			  "snd_rawmidi_transmit_empty: output is not active!!!\n");
 		return 1;
 	}
-	spin_lock_irqsave(&runtime->lock, flags);
-	result = runtime->avail >= runtime->buffer_size;
-	spin_unlock_irqrestore(&runtime->lock, flags);
-	return result;		
+	return snd_rawmidi_avail(substream) >= runtime->buffer_size;
 }
 EXPORT_SYMBOL(snd_rawmidi_transmit_empty);
 
@@ -1080,6 +1154,7 @@ int __snd_rawmidi_transmit_peek(struct snd_rawmidi_substream *substream,
 			      unsigned char *buffer, int count)
 {
 	int result, count1;
+	size_t head, tail, pos;
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
 
 	if (runtime->buffer == NULL) {
@@ -1087,29 +1162,25 @@ int __snd_rawmidi_transmit_peek(struct snd_rawmidi_substream *substream,
 			  "snd_rawmidi_transmit_peek: output is not active!!!\n");
 		return -EINVAL;
 	}
-	result = 0;
-	if (runtime->avail >= runtime->buffer_size) {
+	head = smp_load_acquire(&runtime->appl_ptr);
+	tail = runtime->hw_ptr;
+	result = snd_rawmidi_ring_used(runtime, head, tail);
+	if (!result) {
 		/* warning: lowlevel layer MUST trigger down the hardware */
 		goto __skip;
 	}
-	if (count == 1) {	/* special case, faster code */
-		*buffer = runtime->buffer[runtime->hw_ptr];
-		result++;
-	} else {
-		count1 = runtime->buffer_size - runtime->hw_ptr;
-		if (count1 > count)
-			count1 = count;
-		if (count1 > (int)(runtime->buffer_size - runtime->avail))
-			count1 = runtime->buffer_size - runtime->avail;
-		memcpy(buffer, runtime->buffer + runtime->hw_ptr, count1);
-		count -= count1;
-		result += count1;
-		if (count > 0) {
-			if (count > (int)(runtime->buffer_size - runtime->avail - count1))
-				count = runtime->buffer_size - runtime->avail - count1;
-			memcpy(buffer + count1, runtime->buffer, count);
-			result += count;
-		}
+	if (result > count)
+		result = count;
+	pos = snd_rawmidi_ring_pos(runtime, tail);
+	if (result == 1) {	/* special case, faster code */
+		*buffer = runtime->buffer[pos];
+	} else if (result > 0) {
+		count1 = runtime->buffer_size - pos;
+		if (count1 > result)
+			count1 = result;
+		memcpy(buffer, runtime->buffer + pos, count1);
+		if (count1 < result)
+			memcpy(buffer + count1, runtime->buffer, result - count1);
 	}
       __skip:
 	return result;
@@ -1154,16 +1225,20 @@ EXPORT_SYMBOL(snd_rawmidi_transmit_peek);
 int __snd_rawmidi_transmit_ack(struct snd_rawmidi_substream *substream, int count)
 {
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
+	size_t tail;
 
 	if (runtime->buffer == NULL) {
 		rmidi_dbg(substream->rmidi,
 			  "snd_rawmidi_transmit_ack: output is not active!!!\n");
 		return -EINVAL;
 	}
-	snd_BUG_ON(runtime->avail + count > runtime->buffer_size);
-	runtime->hw_ptr += count;
-	runtime->hw_ptr %= runtime->buffer_size;
-	runtime->avail += count;
+	tail = runtime->hw_ptr;
+	if (snd_BUG_ON(count > (int)snd_rawmidi_ring_used(runtime,
+				READ_ONCE(runtime->appl_ptr), tail)))
+		return -EINVAL;
+	/* hand the space back to the producer */
+	smp_store_release(&runtime->hw_ptr,
+			  snd_rawmidi_ring_add(runtime, tail, count));
 	substream->bytes += count;
 	if (count > 0) {
 		if (runtime->drain || snd_rawmidi_ready(substream))
@@ -1230,77 +1305,87 @@ int snd_rawmidi_transmit(struct snd_rawmidi_substream *substream,
 EXPORT_SYMBOL(snd_rawmidi_transmit);
 
 static long snd_rawmidi_kernel_write1(struct snd_rawmidi_substream *substream,
-				      const unsigned char __user *userbuf,
+				      struct iov_iter *from,
 				      const unsigned char *kernelbuf,
 				      long count)
 {
 	unsigned long flags;
-	long count1, result;
+	long count1, result, copied;
+	size_t head, tail, pos;
 	struct snd_rawmidi_runtime *runtime = substream->runtime;
-	unsigned long appl_ptr;
+	struct snd_rawmidi_ring *ring;
 
-	if (!kernelbuf && !userbuf)
+	if (!kernelbuf && !from)
 		return -EINVAL;
 	if (snd_BUG_ON(!runtime->buffer))
 		return -EINVAL;
 
-	result = 0;
-	spin_lock_irqsave(&runtime->lock, flags);
-	if (substream->append) {
-		if ((long)runtime->avail < count) {
-			spin_unlock_irqrestore(&runtime->lock, flags);
-			return -EAGAIN;
-		}
-	}
-	while (count > 0 && runtime->avail > 0) {
-		count1 = runtime->buffer_size - runtime->appl_ptr;
-		if (count1 > count)
-			count1 = count;
-		if (count1 > (long)runtime->avail)
-			count1 = runtime->avail;
-
-		/* update runtime->appl_ptr before unlocking for userbuf */
-		appl_ptr = runtime->appl_ptr;
-		runtime->appl_ptr += count1;
-		runtime->appl_ptr %= runtime->buffer_size;
-		runtime->avail -= count1;
-
-		if (kernelbuf)
-			memcpy(runtime->buffer + appl_ptr,
-			       kernelbuf + result, count1);
-		else if (userbuf) {
-			spin_unlock_irqrestore(&runtime->lock, flags);
-			if (copy_from_user(runtime->buffer + appl_ptr,
-					   userbuf + result, count1)) {
-				spin_lock_irqsave(&runtime->lock, flags);
-				result = result > 0 ? result : -EFAULT;
-				goto __end;
-			}
-			spin_lock_irqsave(&runtime->lock, flags);
-		}
-		result += count1;
-		count -= count1;
+	/* kernel writers may be atomic, file writers may fault */
+	ring = snd_rawmidi_ring(runtime);
+	if (kernelbuf)
+		spin_lock_irqsave(&ring->lock, flags);
+	else
+		mutex_lock(&ring->mutex);
+	head = runtime->appl_ptr;
+	tail = smp_load_acquire(&runtime->hw_ptr);
+	result = runtime->buffer_size - snd_rawmidi_ring_used(runtime, head, tail);
+	if ((substream->append || kernelbuf) && result < count) {
+		result = -EAGAIN;
+		goto __end;
+	}
+	if (result > count)
+		result = count;
+	pos = snd_rawmidi_ring_pos(runtime, head);
+	count1 = runtime->buffer_size - pos;
+	if (count1 > result)
+		count1 = result;
+
+	if (kernelbuf) {
+		memcpy(runtime->buffer + pos, kernelbuf, count1);
+		memcpy(runtime->buffer, kernelbuf + count1, result - count1);
+	} else if (result > 0) {
+		copied = copy_from_iter(runtime->buffer + pos, count1, from);
+		if (copied == count1 && result > count1)
+			copied += copy_from_iter(runtime->buffer, result - count1, from);
+		if (!copied)
+			result = -EFAULT;
+		else
+			result = copied;
 	}
+	if (result > 0)
+		smp_store_release(&runtime->appl_ptr,
+				  snd_rawmidi_ring_add(runtime, head, result));
       __end:
-	count1 = runtime->avail < runtime->buffer_size;
-	spin_unlock_irqrestore(&runtime->lock, flags);
-	if (count1)
+	if (kernelbuf)
+		spin_unlock_irqrestore(&ring->lock, flags);
+	else
+		mutex_unlock(&ring->mutex);
+	if (snd_rawmidi_avail(substream) < runtime->buffer_size)
 		snd_rawmidi_output_trigger(substream, 1);
 	return result;
 }
 
+/*
+ * Kernel writers pass whole messages, so unlike write() this never takes
+ * part of the buffer: it returns -EAGAIN unless all count bytes fit.  The
+ * substream must not be opened with SNDRV_RAWMIDI_LFLG_APPEND, since file
+ * writers sharing it would not be excluded; -EBUSY is returned then.
+ */
 long snd_rawmidi_kernel_write(struct snd_rawmidi_substream *substream,
 			      const unsigned char *buf, long count)
 {
+	if (substream->append)
+		return -EBUSY;
 	return snd_rawmidi_kernel_write1(substream, NULL, buf, count);
 }
 EXPORT_SYMBOL(snd_rawmidi_kernel_write);
 
-static ssize_t snd_rawmidi_write(struct file *file, const char __user *buf,
-				 size_t count, loff_t *offset)
+static ssize_t snd_rawmidi_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
 	long result, timeout;
 	int count1;
+	size_t count = iov_iter_count(from);
+	struct file *file = iocb->ki_filp;
 	struct snd_rawmidi_file *rfile;
 	struct snd_rawmidi_runtime *runtime;
 	struct snd_rawmidi_substream *substream;
@@ -1313,55 +1398,51 @@ static ssize_t snd_rawmidi_write(struct file *file, const char __user *buf,
 		return -EIO;
 	result = 0;
 	while (count > 0) {
-		spin_lock_irq(&runtime->lock);
 		while (!snd_rawmidi_ready_append(substream, count)) {
 			wait_queue_t wait;
-			if (file->f_flags & O_NONBLOCK) {
-				spin_unlock_irq(&runtime->lock);
+			if (file->f_flags & O_NONBLOCK)
 				return result > 0 ? result : -EAGAIN;
-			}
 			init_waitqueue_entry(&wait, current);
 			add_wait_queue(&runtime->sleep, &wait);
 			set_current_state(TASK_INTERRUPTIBLE);
-			spin_unlock_irq(&runtime->lock);
-			timeout = schedule_timeout(30 * HZ);
+			/* no lock against the consumer, so check again */
+			timeout = 1;
+			if (!snd_rawmidi_ready_append(substream, count))
+				timeout = schedule_timeout(30 * HZ);
+			__set_current_state(TASK_RUNNING);
 			remove_wait_queue(&runtime->sleep, &wait);
 			if (rfile->rmidi->card->shutdown)
 				return -ENODEV;
 			if (signal_pending(current))
 				return result > 0 ? result : -ERESTARTSYS;
-			if (!runtime->avail && !timeout)
+			if (!snd_rawmidi_avail(substream) && !timeout)
 				return result > 0 ? result : -EIO;
-			spin_lock_irq(&runtime->lock);
 		}
-		spin_unlock_irq(&runtime->lock);
-		count1 = snd_rawmidi_kernel_write1(substream, buf, NULL, count);
+		count1 = snd_rawmidi_kernel_write1(substream, from, NULL, count);
 		if (count1 < 0)
 			return result > 0 ? result : count1;
 		result += count1;
-		buf += count1;
 		if ((size_t)count1 < count && (file->f_flags & O_NONBLOCK))
 			break;
 		count -= count1;
 	}
 	if (file->f_flags & O_DSYNC) {
-		spin_lock_irq(&runtime->lock);
-		while (runtime->avail != runtime->buffer_size) {
+		while (snd_rawmidi_avail(substream) != runtime->buffer_size) {
 			wait_queue_t wait;
-			unsigned int last_avail = runtime->avail;
+			size_t last_avail = snd_rawmidi_avail(substream);
 			init_waitqueue_entry(&wait, current);
 			add_wait_queue(&runtime->sleep, &wait);
 			set_current_state(TASK_INTERRUPTIBLE);
-			spin_unlock_irq(&runtime->lock);
-			timeout = schedule_timeout(30 * HZ);
+			timeout = 1;
+			if (snd_rawmidi_avail(substream) == last_avail)
+				timeout = schedule_timeout(30 * HZ);
+			__set_current_state(TASK_RUNNING);
 			remove_wait_queue(&runtime->sleep, &wait);
 			if (signal_pending(current))
 				return result > 0 ? result : -ERESTARTSYS;
-			if (runtime->avail == last_avail && !timeout)
+			if (snd_rawmidi_avail(substream) == last_avail && !timeout)
 				return result > 0 ? result : -EIO;
-			spin_lock_irq(&runtime->lock);
 		}
-		spin_unlock_irq(&runtime->lock);
 	}
 	return result;
 }
@@ -1436,7 +1517,7 @@ static void snd_rawmidi_proc_info_read(struct snd_info_entry *entry,
 				    "  Avail        : %lu\n",
 				    runtime->oss ? "OSS compatible" : "native",
 				    (unsigned long) runtime->buffer_size,
-				    (unsigned long) runtime->avail);
+				    (unsigned long) snd_rawmidi_avail(substream));
 			}
 		}
 	}
@@ -1459,8 +1540,8 @@ static void snd_rawmidi_proc_info_read(struct snd_info_entry *entry,
 					    "  Avail        : %lu\n"
 					    "  Overruns     : %lu\n",
 					    (unsigned long) runtime->buffer_size,
-					    (unsigned long) runtime->avail,
-					    (unsigned long) runtime->xruns);
+					    (unsigned long) snd_rawmidi_avail(substream),
+					    snd_rawmidi_ring(runtime)->overruns);
 			}
 		}
 	}
@@ -1474,8 +1555,10 @@ static void snd_rawmidi_proc_info_read(struct snd_info_entry *entry,
 static const struct file_operations snd_rawmidi_f_ops =
 {
 	.owner =	THIS_MODULE,
-	.read =		snd_rawmidi_read,
-	.write =	snd_rawmidi_write,
+	.read_iter =	snd_rawmidi_read_iter,
+	.write_iter =	snd_rawmidi_write_iter,
+	.splice_read =	generic_file_splice_read,
+	.splice_write =	iter_file_splice_write,
 	.open =		snd_rawmidi_open,
 	.release =	snd_rawmidi_release,
 	.llseek =	no_llseek,
@@ -83,6 +83,7 @@ static int bounce_error_event(struct snd_seq_client *client,
 			      int err, int atomic, int hop);
 static int snd_seq_deliver_single_event(struct snd_seq_client *client,
 					struct snd_seq_event *event,
+					struct snd_seq_payload *payload,
 					int filter, int atomic, int hop);
 
 /*
@@ -327,6 +328,7 @@ static int snd_seq_open(struct inode *inode, struct file *file)
 	user = &client->data.user;
 	user->fifo = NULL;
 	user->fifo_pool_size = 0;
+	user->ring = NULL;
 
 	if (mode & SNDRV_SEQ_LFLG_INPUT) {
 		user->fifo_pool_size = SNDRV_SEQ_DEFAULT_CLIENT_EVENTS;
@@ -366,6 +368,7 @@ static int snd_seq_release(struct inode *inode, struct file *file)
 		seq_free_client(client);
 		if (client->data.user.fifo)
 			snd_seq_fifo_delete(&client->data.user.fifo);
+		snd_seq_ring_delete(&client->data.user.ring);
 		put_pid(client->data.user.owner);
 		kfree(client);
 	}
@@ -537,7 +540,8 @@ static int bounce_error_event(struct snd_seq_client *client,
 	bounce_ev.data.quote.origin = event->dest;
 	bounce_ev.data.quote.event = event;
 	bounce_ev.data.quote.value = -err; /* use positive value */
-	result = snd_seq_deliver_single_event(NULL, &bounce_ev, 0, atomic, hop + 1);
+	result = snd_seq_deliver_single_event(NULL, &bounce_ev, NULL, 0, atomic,
+					      hop + 1);
 	if (result < 0) {
 		client->event_lost++;
 		return result;
@@ -577,16 +581,20 @@ static int update_timestamp_of_queue(struct snd_seq_event *event,
 /*
  * deliver an event to the specified destination.
  * if filter is non-zero, client filter bitmap is tested.
+ * if payload is given, a user client queues the variable length data of
+ * the event by reference.
  *
  *  RETURN VALUE: 0 : if succeeded
  *		 <0 : error
  */
 static int snd_seq_deliver_single_event(struct snd_seq_client *client,
 					struct snd_seq_event *event,
+					struct snd_seq_payload *payload,
 					int filter, int atomic, int hop)
 {
 	struct snd_seq_client *dest = NULL;
 	struct snd_seq_client_port *dest_port = NULL;
+	struct snd_seq_ring *ring;
 	int result = -ENOENT;
 	int direct;
 
@@ -611,8 +619,13 @@ static int snd_seq_deliver_single_event(struct snd_seq_client *client,
 
 	switch (dest->type) {
 	case USER_CLIENT:
-		if (dest->data.user.fifo)
-			result = snd_seq_fifo_event_in(dest->data.user.fifo, event);
+		ring = READ_ONCE(dest->data.user.ring);
+		/* fixed length events bypass the cell pool with a ring */
+		if (ring && ring->in_size && !snd_seq_ev_is_variable(event))
+			result = snd_seq_ring_event_in(ring, event);
+		else if (dest->data.user.fifo)
+			result = snd_seq_fifo_event_in(dest->data.user.fifo,
+						       event, payload);
 		break;
 
 	case KERNEL_CLIENT:
@@ -651,6 +664,7 @@ static int deliver_to_subscribers(struct snd_seq_client *client,
 	struct snd_seq_event event_saved;
 	struct snd_seq_client_port *src_port;
 	struct snd_seq_port_subs_info *grp;
+	struct snd_seq_payload *payload = NULL;
 
 	src_port = snd_seq_port_use_ptr(client, event->source.port);
 	if (src_port == NULL)
@@ -664,6 +678,9 @@ static int deliver_to_subscribers(struct snd_seq_client *client,
 		read_lock(&grp->list_lock);
 	else
 		down_read_nested(&grp->list_mutex, hop);
+	/* copy the variable length data once for all subscribers */
+	if (grp->count > 1 && snd_seq_ev_is_variable(event))
+		payload = snd_seq_payload_new(event, atomic);
 	list_for_each_entry(subs, &grp->list_head, src_list) {
 		/* both ports ready? */
 		if (atomic_read(&subs->ref_count) != 2)
@@ -673,7 +690,7 @@ static int deliver_to_subscribers(struct snd_seq_client *client,
 			/* convert time according to flag with subscription */
 			update_timestamp_of_queue(event, subs->info.queue,
 						  subs->info.flags & SNDRV_SEQ_PORT_SUBS_TIME_REAL);
-		err = snd_seq_deliver_single_event(client, event,
+		err = snd_seq_deliver_single_event(client, event, payload,
 						   0, atomic, hop);
 		if (err < 0) {
 			/* save first error that occurs and continue */
@@ -689,6 +706,8 @@ static int deliver_to_subscribers(struct snd_seq_client *client,
 		read_unlock(&grp->list_lock);
 	else
 		up_read(&grp->list_mutex);
+	if (payload)
+		snd_seq_payload_put(payload);
 	*event = event_saved; /* restore */
 	snd_seq_port_unlock(src_port);
 	return (result < 0) ? result : num_ev;
@@ -715,7 +734,7 @@ static int port_broadcast_event(struct snd_seq_client *client,
 	list_for_each_entry(port, &dest_client->ports_list_head, list) {
 		event->dest.port = port->addr.port;
 		/* pass NULL as source client to avoid error bounce */
-		err = snd_seq_deliver_single_event(NULL, event,
+		err = snd_seq_deliver_single_event(NULL, event, NULL,
 						   SNDRV_SEQ_FILTER_BROADCAST,
 						   atomic, hop);
 		if (err < 0) {
@@ -755,7 +774,7 @@ static int broadcast_event(struct snd_seq_client *client,
 			err = port_broadcast_event(client, event, atomic, hop);
 		else
 			/* pass NULL as source client to avoid error bounce */
-			err = snd_seq_deliver_single_event(NULL, event,
+			err = snd_seq_deliver_single_event(NULL, event, NULL,
 							   SNDRV_SEQ_FILTER_BROADCAST,
 							   atomic, hop);
 		if (err < 0) {
@@ -815,7 +834,8 @@ static int snd_seq_deliver_event(struct snd_seq_client *client, struct snd_seq_e
 		result = port_broadcast_event(client, event, atomic, hop);
 #endif
 	else
-		result = snd_seq_deliver_single_event(client, event, 0, atomic, hop);
+		result = snd_seq_deliver_single_event(client, event, NULL, 0,
+						      atomic, hop);
 
 	return result;
 }
@@ -1085,6 +1105,7 @@ static ssize_t snd_seq_write(struct file *file, const char __user *buf,
 static unsigned int snd_seq_poll(struct file *file, poll_table * wait)
 {
 	struct snd_seq_client *client = file->private_data;
+	struct snd_seq_ring *ring;
 	unsigned int mask = 0;
 
 	/* check client structures are in place */
@@ -1097,6 +1118,10 @@ static unsigned int snd_seq_poll(struct file *file, poll_table * wait)
 		/* check if data is available in the outqueue */
 		if (snd_seq_fifo_poll_wait(client->data.user.fifo, file, wait))
 			mask |= POLLIN | POLLRDNORM;
+		/* or in the input ring */
+		ring = READ_ONCE(client->data.user.ring);
+		if (ring && snd_seq_ring_poll_wait(ring, file, wait))
+			mask |= POLLIN | POLLRDNORM;
 	}
 
 	if (snd_seq_file_flags(file) & SNDRV_SEQ_LFLG_OUTPUT) {
@@ -1111,6 +1136,24 @@ static unsigned int snd_seq_poll(struct file *file, poll_table * wait)
 }
 
 
+/*
+ * map the event rings
+ */
+static int snd_seq_mmap(struct file *file, struct vm_area_struct *area)
+{
+	struct snd_seq_client *client = file->private_data;
+	struct snd_seq_ring *ring;
+
+	if (snd_BUG_ON(!client))
+		return -ENXIO;
+
+	ring = READ_ONCE(client->data.user.ring);
+	if (!ring)
+		return -ENXIO;
+	return snd_seq_ring_mmap(ring, area);
+}
+
+
 /*-----------------------------------------------------*/
 
 static int snd_seq_ioctl_pversion(struct snd_seq_client *client, void *arg)
@@ -2039,6 +2082,90 @@ static int snd_seq_ioctl_query_next_port(struct snd_seq_client *client,
 	return 0;
 }
 
+/*
+ * set up the mmapped event rings of a user client, once
+ */
+static int snd_seq_ioctl_ring_setup(struct snd_seq_client *client, void *arg)
+{
+	struct snd_seq_ring_info *info = arg;
+	struct snd_seq_ring *ring;
+
+	if (client->type != USER_CLIENT)
+		return -ENXIO;
+	if ((info->input_size && !client->data.user.fifo) ||
+	    (info->output_size && !client->accept_output))
+		return -ENXIO;
+
+	ring = snd_seq_ring_new(info);
+	if (IS_ERR(ring))
+		return PTR_ERR(ring);
+	if (cmpxchg(&client->data.user.ring, NULL, ring)) {
+		snd_seq_ring_delete(&ring);
+		return -EBUSY;
+	}
+	return 0;
+}
+
+/*
+ * deliver the events queued in the output ring as write() does;
+ * returns the number of events taken, the one failing is left in the ring
+ */
+static int snd_seq_ioctl_ring_send(struct snd_seq_client *client, void *arg)
+{
+	struct snd_seq_ring *ring;
+	struct snd_seq_event event;
+	struct file *file;
+	int sent = 0, err = 0;
+
+	if (client->type != USER_CLIENT)
+		return -ENXIO;
+	ring = READ_ONCE(client->data.user.ring);
+	if (!ring || !ring->out_size)
+		return -ENXIO;
+	if (!client->accept_output || client->pool == NULL)
+		return -ENXIO;
+	file = client->data.user.file;
+
+	/* allocate the pool now if the pool is not allocated yet */
+	if (client->pool->size > 0 && !snd_seq_write_pool_allocated(client)) {
+		if (snd_seq_pool_init(client->pool) < 0)
+			return -ENOMEM;
+	}
+
+	mutex_lock(&ring->out_mutex);
+	while (snd_seq_ring_event_out(ring, &event)) {
+		event.source.client = client->number;	/* fill in client number */
+		/* the ring has no room for variable length data */
+		if (check_event_type_and_length(&event) ||
+		    snd_seq_ev_is_variable(&event)) {
+			err = -EINVAL;
+			break;
+		}
+		if (event.type != SNDRV_SEQ_EVENT_NONE) {
+			if (snd_seq_ev_is_reserved(&event)) {
+				err = -EINVAL;
+				break;
+			}
+#ifdef CONFIG_COMPAT
+			if (client->convert32 && snd_seq_ev_is_varusr(&event)) {
+				void *ptr = (void __force *)compat_ptr(event.data.raw32.d[1]);
+				event.data.ext.ptr = ptr;
+			}
+#endif
+			err = snd_seq_client_enqueue_event(client, &event, file,
+							   !(file->f_flags & O_NONBLOCK),
+							   0, 0);
+			if (err < 0)
+				break;
+		}
+		snd_seq_ring_event_done(ring);
+		sent++;
+	}
+	mutex_unlock(&ring->out_mutex);
+
+	return sent ? sent : err;
+}
+
 /* -------------------------------------------------------- */
 
 static const struct ioctl_handler {
@@ -2076,6 +2203,8 @@ static const struct ioctl_handler {
 	{ SNDRV_SEQ_IOCTL_QUERY_NEXT_PORT, snd_seq_ioctl_query_next_port },
 	{ SNDRV_SEQ_IOCTL_REMOVE_EVENTS, snd_seq_ioctl_remove_events },
 	{ SNDRV_SEQ_IOCTL_QUERY_SUBS, snd_seq_ioctl_query_subs },
+	{ SNDRV_SEQ_IOCTL_RING_SETUP, snd_seq_ioctl_ring_setup },
+	{ SNDRV_SEQ_IOCTL_RING_SEND, snd_seq_ioctl_ring_send },
 	{ 0, NULL },
 };
 
@@ -2100,6 +2229,7 @@ static long snd_seq_ioctl(struct file *file, unsigned int cmd,
 		struct snd_seq_client_pool	client_pool;
 		struct snd_seq_remove_events	remove_events;
 		struct snd_seq_query_subs	query_subs;
+		struct snd_seq_ring_info	ring_info;
 	} buf;
 	const struct ioctl_handler *handler;
 	unsigned long size;
@@ -2496,6 +2626,7 @@ static const struct file_operations snd_seq_f_ops =
 	.release =	snd_seq_release,
 	.llseek =	no_llseek,
 	.poll =		snd_seq_poll,
+	.mmap =		snd_seq_mmap,
 	.unlocked_ioctl =	snd_seq_ioctl,
 	.compat_ioctl =	snd_seq_ioctl_compat,
 };
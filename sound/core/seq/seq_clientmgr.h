@@ -24,6 +24,7 @@
 #include <sound/seq_kernel.h>
 #include <linux/bitops.h>
 #include "seq_fifo.h"
+#include "seq_ring.h"
 #include "seq_ports.h"
 #include "seq_lock.h"
 
@@ -38,6 +39,9 @@ struct snd_seq_user_client {
 	/* fifo */
 	struct snd_seq_fifo *fifo;	/* queue for incoming events */
 	int fifo_pool_size;
+
+	/* mmapped event rings, set up once on request */
+	struct snd_seq_ring *ring;
 };
 
 struct snd_seq_kernel_client {
@@ -113,7 +113,8 @@ void snd_seq_fifo_clear(struct snd_seq_fifo *f)
 
 /* enqueue event to fifo */
 int snd_seq_fifo_event_in(struct snd_seq_fifo *f,
-			  struct snd_seq_event *event)
+			  struct snd_seq_event *event,
+			  struct snd_seq_payload *payload)
 {
 	struct snd_seq_event_cell *cell;
 	unsigned long flags;
@@ -123,7 +124,11 @@ int snd_seq_fifo_event_in(struct snd_seq_fifo *f,
 		return -EINVAL;
 
 	snd_use_lock_use(&f->use_lock);
-	err = snd_seq_event_dup(f->pool, event, &cell, 1, NULL); /* always non-blocking */
+	/* always non-blocking */
+	if (payload)
+		err = snd_seq_event_share(f->pool, event, payload, &cell, 1);
+	else
+		err = snd_seq_event_dup(f->pool, event, &cell, 1, NULL);
 	if (err < 0) {
 		if ((err == -ENOMEM) || (err == -EAGAIN))
 			atomic_inc(&f->overflow);
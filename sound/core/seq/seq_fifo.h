@@ -46,8 +46,9 @@ struct snd_seq_fifo *snd_seq_fifo_new(int poolsize);
 void snd_seq_fifo_delete(struct snd_seq_fifo **f);
 
 
-/* enqueue event to fifo */
-int snd_seq_fifo_event_in(struct snd_seq_fifo *f, struct snd_seq_event *event);
+/* enqueue event to fifo, sharing the payload if given */
+int snd_seq_fifo_event_in(struct snd_seq_fifo *f, struct snd_seq_event *event,
+			  struct snd_seq_payload *payload);
 
 /* lock fifo from release */
 #define snd_seq_fifo_lock(fifo)		snd_use_lock_use(&(fifo)->use_lock)
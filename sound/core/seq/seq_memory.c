@@ -24,6 +24,8 @@
 #include <linux/export.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
 #include <sound/core.h>
 
 #include <sound/seq_kernel.h>
@@ -32,6 +34,41 @@
 #include "seq_info.h"
 #include "seq_lock.h"
 
+/*
+ * Free cell caches:
+ * Every pool keeps a short list of free cells per CPU in front of the
+ * shared free list, so that clients sending from several CPUs do not
+ * serialize on pool->lock for each event.  A cache is refilled from and
+ * drained to the shared list in batches of pool->batch cells.  When the
+ * shared list runs dry, the cells parked in all caches are reclaimed
+ * before an allocation may fail or sleep; while somebody sleeps on the
+ * pool, cells are freed to the shared list directly.  Pools too small to
+ * spread over the CPUs run with batch 0, i.e. without caches.
+ *
+ * Lock order is pool->lock, then cache->lock.
+ */
+#define SEQ_POOL_BATCH_MAX	16
+
+/*
+ * Shared payloads:
+ * A variable length event delivered to several subscribers is expanded
+ * once into a refcounted buffer, and every destination FIFO queues a
+ * single cell pointing to it as plain kernel data instead of a private
+ * chain of cells.  The buffers are not accounted in any pool, so their
+ * total size is capped; above the cap the delivery falls back to the
+ * per-destination copies.
+ */
+#define SEQ_PAYLOAD_MAX_BYTES	(4 * 1024 * 1024)
+
+static atomic_t payload_bytes = ATOMIC_INIT(0);
+
+struct snd_seq_pool_cache {
+	spinlock_t lock;
+	struct snd_seq_event_cell *free;
+	int count;
+	unsigned int alloc_success;
+};
+
 static inline int snd_seq_pool_available(struct snd_seq_pool *pool)
 {
 	return pool->total_elements - atomic_read(&pool->counter);
@@ -171,22 +208,130 @@ int snd_seq_expand_var_event(const struct snd_seq_event *event, int count, char
 
 EXPORT_SYMBOL(snd_seq_expand_var_event);
 
-/*
- * release this cell, free extended data if available
- */
+/* take pool->lock with irqs already disabled, counting contention */
+static inline void seq_pool_lock(struct snd_seq_pool *pool)
+{
+	if (!spin_trylock(&pool->lock)) {
+		spin_lock(&pool->lock);
+		pool->lock_contended++;
+	}
+}
+
+/* account cells taken from the pool and track the peak */
+static inline void seq_pool_count_used(struct snd_seq_pool *pool, int n)
+{
+	int used = atomic_add_return(n, &pool->counter);
+	int max = READ_ONCE(pool->max_used);
+	int old;
+
+	while (max < used) {
+		old = cmpxchg(&pool->max_used, max, used);
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
+/* wake up writers once enough cells are free; called with a pool or
+ * cache lock held, after the cells have been returned */
+static inline void seq_pool_wakeup(struct snd_seq_pool *pool)
+{
+	if (waitqueue_active(&pool->output_sleep)) {
+		/* has enough space now? */
+		if (snd_seq_output_ok(pool))
+			wake_up(&pool->output_sleep);
+	}
+}
+
+/* move all cached cells back to the free list; pool->lock held */
+static int seq_pool_reclaim(struct snd_seq_pool *pool)
+{
+	struct snd_seq_pool_cache *cache;
+	struct snd_seq_event_cell *cell;
+	int cpu, n = 0;
+
+	if (!pool->batch)
+		return 0;
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(pool->cache, cpu);
+		spin_lock(&cache->lock);
+		while ((cell = cache->free) != NULL) {
+			cache->free = cell->next;
+			cell->next = pool->free;
+			pool->free = cell;
+			n++;
+		}
+		cache->count = 0;
+		spin_unlock(&cache->lock);
+	}
+	if (n)
+		pool->cache_reclaims++;
+	return n;
+}
 
-static inline void free_cell(struct snd_seq_pool *pool,
-			     struct snd_seq_event_cell *cell)
+/* top up the local cache from the free list; pool->lock held, irqs off */
+static void seq_pool_refill(struct snd_seq_pool *pool)
 {
-	cell->next = pool->free;
-	pool->free = cell;
-	atomic_dec(&pool->counter);
+	struct snd_seq_pool_cache *cache;
+	struct snd_seq_event_cell *cell;
+
+	if (!pool->batch || !pool->free ||
+	    waitqueue_active(&pool->output_sleep))
+		return;
+	cache = this_cpu_ptr(pool->cache);
+	spin_lock(&cache->lock);
+	while (cache->count < pool->batch && (cell = pool->free) != NULL) {
+		pool->free = cell->next;
+		cell->next = cache->free;
+		cache->free = cell;
+		cache->count++;
+	}
+	spin_unlock(&cache->lock);
+	pool->cache_refills++;
 }
 
+/* give the excess of a cache back to the free list; both locks held */
+static void seq_pool_drain(struct snd_seq_pool *pool,
+			   struct snd_seq_pool_cache *cache)
+{
+	struct snd_seq_event_cell *cell;
+
+	while (cache->count > pool->batch) {
+		cell = cache->free;
+		cache->free = cell->next;
+		cell->next = pool->free;
+		pool->free = cell;
+		cache->count--;
+	}
+	pool->cache_drains++;
+}
+
+/* take a cell from the free list, reclaiming the caches if it is empty;
+ * pool->lock held */
+static struct snd_seq_event_cell *seq_pool_get(struct snd_seq_pool *pool)
+{
+	struct snd_seq_event_cell *cell;
+
+	if (pool->free == NULL)
+		seq_pool_reclaim(pool);
+	cell = pool->free;
+	if (cell)
+		pool->free = cell->next;
+	return cell;
+}
+
+/*
+ * release this cell, free extended data if available
+ */
+
 void snd_seq_cell_free(struct snd_seq_event_cell * cell)
 {
 	unsigned long flags;
 	struct snd_seq_pool *pool;
+	struct snd_seq_pool_cache *cache;
+	struct snd_seq_event_cell *last;
+	struct snd_seq_payload *payload = NULL;
+	int count = 1;
 
 	if (snd_BUG_ON(!cell))
 		return;
@@ -194,25 +339,54 @@ void snd_seq_cell_free(struct snd_seq_event_cell * cell)
 	if (snd_BUG_ON(!pool))
 		return;
 
-	spin_lock_irqsave(&pool->lock, flags);
-	free_cell(pool, cell);
-	if (snd_seq_ev_is_variable(&cell->event)) {
-		if (cell->event.data.ext.len & SNDRV_SEQ_EXT_CHAINED) {
-			struct snd_seq_event_cell *curp, *nextptr;
-			curp = cell->event.data.ext.ptr;
-			for (; curp; curp = nextptr) {
-				nextptr = curp->next;
-				curp->next = pool->free;
-				free_cell(pool, curp);
-			}
+	if (cell->shared) {
+		payload = container_of(cell->event.data.ext.ptr,
+				       struct snd_seq_payload, data);
+		cell->shared = false;
+	}
+
+	/* the cell and its chained data go back as one list */
+	last = cell;
+	if (snd_seq_ev_is_variable(&cell->event) &&
+	    (cell->event.data.ext.len & SNDRV_SEQ_EXT_CHAINED)) {
+		last->next = cell->event.data.ext.ptr;
+		while (last->next) {
+			last = last->next;
+			count++;
 		}
 	}
-	if (waitqueue_active(&pool->output_sleep)) {
-		/* has enough space now? */
-		if (snd_seq_output_ok(pool))
-			wake_up(&pool->output_sleep);
+
+	/* the pool may go away as soon as the counter drops, so every path
+	 * below releases the cells last and under a lock pool_done takes */
+	if (pool->batch && !waitqueue_active(&pool->output_sleep)) {
+		cache = raw_cpu_ptr(pool->cache);
+		spin_lock_irqsave(&cache->lock, flags);
+		last->next = cache->free;
+		cache->free = cell;
+		cache->count += count;
+		if (cache->count <= 2 * pool->batch) {
+			atomic_sub(count, &pool->counter);
+			seq_pool_wakeup(pool);
+			spin_unlock_irqrestore(&cache->lock, flags);
+			goto put;
+		}
+		spin_unlock(&cache->lock);
+		seq_pool_lock(pool);
+		spin_lock(&cache->lock);
+		seq_pool_drain(pool, cache);
+		spin_unlock(&cache->lock);
+	} else {
+		local_irq_save(flags);
+		seq_pool_lock(pool);
+		last->next = pool->free;
+		pool->free = cell;
 	}
+	atomic_sub(count, &pool->counter);
+	seq_pool_wakeup(pool);
 	spin_unlock_irqrestore(&pool->lock, flags);
+ put:
+	if (payload)
+		snd_seq_payload_put(payload);
 }
 
 
@@ -223,7 +397,8 @@ static int snd_seq_cell_alloc(struct snd_seq_pool *pool,
 			      struct snd_seq_event_cell **cellp,
 			      int nonblock, struct file *file)
 {
-	struct snd_seq_event_cell *cell;
+	struct snd_seq_pool_cache *cache;
+	struct snd_seq_event_cell *cell = NULL;
 	unsigned long flags;
 	int err = -EAGAIN;
 	wait_queue_t wait;
@@ -233,20 +408,46 @@ static int snd_seq_cell_alloc(struct snd_seq_pool *pool,
 
 	*cellp = NULL;
 
+	/* fast path: this CPU's cache */
+	if (pool->batch && !READ_ONCE(pool->closing)) {
+		cache = raw_cpu_ptr(pool->cache);
+		spin_lock_irqsave(&cache->lock, flags);
+		cell = cache->free;
+		if (cell) {
+			cache->free = cell->next;
+			cache->count--;
+			cache->alloc_success++;
+			seq_pool_count_used(pool, 1);
+		}
+		spin_unlock_irqrestore(&cache->lock, flags);
+		if (cell) {
+			cell->next = NULL;
+			*cellp = cell;
+			return 0;
+		}
+	}
+
 	init_waitqueue_entry(&wait, current);
-	spin_lock_irqsave(&pool->lock, flags);
+	local_irq_save(flags);
+	seq_pool_lock(pool);
 	if (pool->ptr == NULL) {	/* not initialized */
 		pr_debug("ALSA: seq: pool is not initialized\n");
 		err = -EINVAL;
 		goto __error;
 	}
-	while (pool->free == NULL && ! nonblock && ! pool->closing) {
+	while (! pool->closing && (cell = seq_pool_get(pool)) == NULL &&
+	       ! nonblock) {
 
 		set_current_state(TASK_INTERRUPTIBLE);
 		add_wait_queue(&pool->output_sleep, &wait);
-		spin_unlock_irq(&pool->lock);
-		schedule();
-		spin_lock_irq(&pool->lock);
+		/* catch cells cached by a free that missed us queueing up */
+		if (seq_pool_reclaim(pool)) {
+			__set_current_state(TASK_RUNNING);
+		} else {
+			spin_unlock_irq(&pool->lock);
+			schedule();
+			spin_lock_irq(&pool->lock);
+		}
 		remove_wait_queue(&pool->output_sleep, &wait);
 		/* interrupted? */
 		if (signal_pending(current)) {
@@ -259,15 +460,11 @@ static int snd_seq_cell_alloc(struct snd_seq_pool *pool,
 		goto __error;
 	}
 
-	cell = pool->free;
 	if (cell) {
-		int used;
-		pool->free = cell->next;
-		atomic_inc(&pool->counter);
-		used = atomic_read(&pool->counter);
-		if (pool->max_used < used)
-			pool->max_used = used;
+		seq_pool_count_used(pool, 1);
 		pool->event_alloc_success++;
+		/* bulk refill so the next events take the fast path */
+		seq_pool_refill(pool);
 		/* clear cell pointers */
 		cell->next = NULL;
 		err = 0;
@@ -365,6 +562,83 @@ __error:
 }
   
 
+/*
+ * expand a variable length event into a new shared payload.
+ * returns NULL if the data doesn't fit below the cap or can't be copied;
+ * the caller duplicates the event as usual then.
+ */
+struct snd_seq_payload *snd_seq_payload_new(const struct snd_seq_event *event,
+					    int atomic)
+{
+	struct snd_seq_payload *payload;
+	int len;
+
+	len = get_var_len(event);
+	if (len <= 0)
+		return NULL;
+	/* user data can't be copied in atomic context */
+	if (atomic && (event->data.ext.len & SNDRV_SEQ_EXT_USRPTR))
+		return NULL;
+	if (atomic_add_return(len, &payload_bytes) > SEQ_PAYLOAD_MAX_BYTES)
+		goto error;
+	payload = kmalloc(sizeof(*payload) + len,
+			  atomic ? GFP_ATOMIC : GFP_KERNEL);
+	if (!payload)
+		goto error;
+	if (snd_seq_expand_var_event(event, len, payload->data, 1, 0) != len) {
+		kfree(payload);
+		goto error;
+	}
+	atomic_set(&payload->ref, 1);
+	payload->len = len;
+	return payload;
+
+ error:
+	atomic_sub(len, &payload_bytes);
+	return NULL;
+}
+
+void snd_seq_payload_put(struct snd_seq_payload *payload)
+{
+	if (!atomic_dec_and_test(&payload->ref))
+		return;
+	atomic_sub(payload->len, &payload_bytes);
+	kfree(payload);
+}
+
+/*
+ * queue a variable length event as a single cell referring to the shared
+ * payload; the rest of the event record is copied as in snd_seq_event_dup()
+ */
+int snd_seq_event_share(struct snd_seq_pool *pool, struct snd_seq_event *event,
+			struct snd_seq_payload *payload,
+			struct snd_seq_event_cell **cellp, int nonblock)
+{
+	struct snd_seq_event_cell *cell;
+	int ncells, err;
+
+	*cellp = NULL;
+
+	/* the same limit as for a private copy */
+	ncells = DIV_ROUND_UP(payload->len, sizeof(struct snd_seq_event));
+	if (ncells >= pool->total_elements)
+		return -ENOMEM;
+
+	err = snd_seq_cell_alloc(pool, &cell, nonblock, NULL);
+	if (err < 0)
+		return err;
+
+	cell->event = *event;
+	cell->event.data.ext.len = payload->len;
+	cell->event.data.ext.ptr = payload->data;
+	atomic_inc(&payload->ref);
+	cell->shared = true;
+
+	*cellp = cell;
+	return 0;
+}
+
+
 /* poll wait */
 int snd_seq_pool_poll_wait(struct snd_seq_pool *pool, struct file *file,
 			   poll_table *wait)
@@ -402,10 +676,15 @@ int snd_seq_pool_init(struct snd_seq_pool *pool)
 	for (cell = 0; cell < pool->size; cell++) {
 		cellptr = pool->ptr + cell;
 		cellptr->pool = pool;
+		cellptr->shared = false;
 		cellptr->next = pool->free;
 		pool->free = cellptr;
 	}
 	pool->room = (pool->size + 1) / 2;
+	pool->batch = min_t(int, SEQ_POOL_BATCH_MAX,
+			    pool->size / (4 * num_possible_cpus()));
+	if (pool->batch < 2)
+		pool->batch = 0;
 
 	/* init statistics */
 	pool->max_used = 0;
@@ -446,6 +725,8 @@ int snd_seq_pool_done(struct snd_seq_pool *pool)
 	spin_lock_irqsave(&pool->lock, flags);
 	ptr = pool->ptr;
 	pool->ptr = NULL;
+	seq_pool_reclaim(pool);
+	pool->batch = 0;
 	pool->free = NULL;
 	pool->total_elements = 0;
 	spin_unlock_irqrestore(&pool->lock, flags);
@@ -464,11 +745,25 @@ int snd_seq_pool_done(struct snd_seq_pool *pool)
 struct snd_seq_pool *snd_seq_pool_new(int poolsize)
 {
 	struct snd_seq_pool *pool;
+	struct snd_seq_pool_cache *cache;
+	int cpu;
 
 	/* create pool block */
 	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
 	if (!pool)
 		return NULL;
+	pool->cache = alloc_percpu(struct snd_seq_pool_cache);
+	if (!pool->cache) {
+		kfree(pool);
+		return NULL;
+	}
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(pool->cache, cpu);
+		spin_lock_init(&cache->lock);
+		cache->free = NULL;
+		cache->count = 0;
+	}
+	pool->batch = 0;
 	spin_lock_init(&pool->lock);
 	pool->ptr = NULL;
 	pool->free = NULL;
@@ -494,6 +789,7 @@ int snd_seq_pool_delete(struct snd_seq_pool **ppool)
 		return 0;
 	snd_seq_pool_mark_closing(pool);
 	snd_seq_pool_done(pool);
+	free_percpu(pool->cache);
 	kfree(pool);
 	return 0;
 }
@@ -514,11 +810,22 @@ void __exit snd_sequencer_memory_done(void)
 void snd_seq_info_pool(struct snd_info_buffer *buffer,
 		       struct snd_seq_pool *pool, char *space)
 {
+	unsigned int success;
+	int cpu;
+
 	if (pool == NULL)
 		return;
+	success = pool->event_alloc_success;
+	for_each_possible_cpu(cpu)
+		success += per_cpu_ptr(pool->cache, cpu)->alloc_success;
 	snd_iprintf(buffer, "%sPool size          : %d\n", space, pool->total_elements);
 	snd_iprintf(buffer, "%sCells in use       : %d\n", space, atomic_read(&pool->counter));
 	snd_iprintf(buffer, "%sPeak cells in use  : %d\n", space, pool->max_used);
-	snd_iprintf(buffer, "%sAlloc success      : %d\n", space, pool->event_alloc_success);
+	snd_iprintf(buffer, "%sAlloc success      : %u\n", space, success);
 	snd_iprintf(buffer, "%sAlloc failures     : %d\n", space, pool->event_alloc_failures);
+	snd_iprintf(buffer, "%sCache batch        : %d\n", space, pool->batch);
+	snd_iprintf(buffer, "%sLock contended     : %u\n", space, pool->lock_contended);
+	snd_iprintf(buffer, "%sCache refills      : %u\n", space, pool->cache_refills);
+	snd_iprintf(buffer, "%sCache drains       : %u\n", space, pool->cache_drains);
+	snd_iprintf(buffer, "%sCache reclaims     : %u\n", space, pool->cache_reclaims);
 }
@@ -23,6 +23,7 @@
 
 #include <sound/seq_kernel.h>
 #include <linux/poll.h>
+#include <linux/rbtree.h>
 
 struct snd_info_buffer;
 
@@ -31,6 +32,16 @@ struct snd_seq_event_cell {
 	struct snd_seq_event event;
 	struct snd_seq_pool *pool;				/* used pool */
 	struct snd_seq_event_cell *next;	/* next cell */
+	struct rb_node node;			/* node in prioq */
+	unsigned int order;			/* prioq insertion order */
+	bool shared;				/* ext data is a shared payload */
+};
+
+/* variable length data shared by the cells of a multicast delivery */
+struct snd_seq_payload {
+	atomic_t ref;
+	unsigned int len;
+	char data[];
 };
 
 /* design note: the pool is a contiguous block of memory, if we dynamicly
@@ -38,10 +49,16 @@ struct snd_seq_event_cell {
    pool as we need to know the base address of the pool when releasing
    memory. */
 
+struct snd_seq_pool_cache;
+
 struct snd_seq_pool {
 	struct snd_seq_event_cell *ptr;	/* pointer to first event chunk */
 	struct snd_seq_event_cell *free;	/* pointer to the head of the free list */
 
+	/* per-CPU free cell caches in front of the free list */
+	struct snd_seq_pool_cache __percpu *cache;
+	int batch;		/* cells moved per refill/drain; 0 = no caching */
+
 	int total_elements;	/* pool size actually allocated */
 	atomic_t counter;	/* cells free */
 
@@ -55,6 +72,10 @@ struct snd_seq_pool {
 	int event_alloc_nopool;
 	int event_alloc_failures;
 	int event_alloc_success;
+	unsigned int lock_contended;
+	unsigned int cache_refills;
+	unsigned int cache_drains;
+	unsigned int cache_reclaims;
 
 	/* Write locking */
 	wait_queue_head_t output_sleep;
@@ -68,6 +89,13 @@ void snd_seq_cell_free(struct snd_seq_event_cell *cell);
 int snd_seq_event_dup(struct snd_seq_pool *pool, struct snd_seq_event *event,
 		      struct snd_seq_event_cell **cellp, int nonblock, struct file *file);
 
+struct snd_seq_payload *snd_seq_payload_new(const struct snd_seq_event *event,
+					    int atomic);
+void snd_seq_payload_put(struct snd_seq_payload *payload);
+int snd_seq_event_share(struct snd_seq_pool *pool, struct snd_seq_event *event,
+			struct snd_seq_payload *payload,
+			struct snd_seq_event_cell **cellp, int nonblock);
+
 /* return number of unused (free) cells */
 static inline int snd_seq_unused_cells(struct snd_seq_pool *pool)
 {
@@ -38,6 +38,7 @@ Possible options for midisynth module:
 #include <sound/seq_device.h>
 #include <sound/seq_midi_event.h>
 #include <sound/initval.h>
+#include "seq_midi_event.h"
 
 MODULE_AUTHOR("Frank van de Pol <fvdpol@coil.demon.nl>, Jaroslav Kysela <perex@perex.cz>");
 MODULE_DESCRIPTION("Advanced Linux Sound Architecture sequencer MIDI synth.");
@@ -76,9 +77,10 @@ static void snd_midi_input_event(struct snd_rawmidi_substream *substream)
 {
 	struct snd_rawmidi_runtime *runtime;
 	struct seq_midisynth *msynth;
-	struct snd_seq_event ev;
-	char buf[16], *pbuf;
+	struct snd_seq_event ev[8];
+	char buf[64], *pbuf;
 	long res, count;
+	int i, nevents;
 
 	if (substream == NULL)
 		return;
@@ -86,26 +88,22 @@ static void snd_midi_input_event(struct snd_rawmidi_substream *substream)
 	msynth = runtime->private_data;
 	if (msynth == NULL)
 		return;
-	memset(&ev, 0, sizeof(ev));
-	while (runtime->avail > 0) {
-		res = snd_rawmidi_kernel_read(substream, buf, sizeof(buf));
-		if (res <= 0)
-			continue;
+	while ((res = snd_rawmidi_kernel_read(substream, buf, sizeof(buf))) > 0) {
 		if (msynth->parser == NULL)
 			continue;
 		pbuf = buf;
 		while (res > 0) {
-			count = snd_midi_event_encode(msynth->parser, pbuf, res, &ev);
-			if (count < 0)
-				break;
+			/* clear events and reset headers */
+			memset(ev, 0, sizeof(ev));
+			nevents = ARRAY_SIZE(ev);
+			count = snd_midi_event_encode_bulk(msynth->parser, pbuf, res,
+							   ev, &nevents);
 			pbuf += count;
 			res -= count;
-			if (ev.type != SNDRV_SEQ_EVENT_NONE) {
-				ev.source.port = msynth->seq_port;
-				ev.dest.client = SNDRV_SEQ_ADDRESS_SUBSCRIBERS;
-				snd_seq_kernel_client_dispatch(msynth->seq_client, &ev, 1, 0);
-				/* clear event and reset header */
-				memset(&ev, 0, sizeof(ev));
+			for (i = 0; i < nevents; i++) {
+				ev[i].source.port = msynth->seq_port;
+				ev[i].dest.client = SNDRV_SEQ_ADDRESS_SUBSCRIBERS;
+				snd_seq_kernel_client_dispatch(msynth->seq_client, &ev[i], 1, 0);
 			}
 		}
 	}
@@ -113,19 +111,14 @@ static void snd_midi_input_event(struct snd_rawmidi_substream *substream)
 
 static int dump_midi(struct snd_rawmidi_substream *substream, const char *buf, int count)
 {
-	struct snd_rawmidi_runtime *runtime;
-	int tmp;
-
 	if (snd_BUG_ON(!substream || !buf))
 		return -EINVAL;
-	runtime = substream->runtime;
-	if ((tmp = runtime->avail) < count) {
+	/* all or nothing, a partial message would garble the stream */
+	if (snd_rawmidi_kernel_write(substream, buf, count) < 0) {
 		if (printk_ratelimit())
 			pr_err("ALSA: seq_midi: MIDI output buffer overrun\n");
 		return -ENOMEM;
 	}
-	if (snd_rawmidi_kernel_write(substream, buf, count) < count)
-		return -EINVAL;
 	return 0;
 }
 
@@ -27,6 +27,7 @@
 #include <sound/seq_kernel.h>
 #include <sound/seq_midi_event.h>
 #include <sound/asoundef.h>
+#include "seq_midi_event.h"
 
 MODULE_AUTHOR("Takashi Iwai <tiwai@suse.de>, Jaroslav Kysela <perex@perex.cz>");
 MODULE_DESCRIPTION("MIDI byte <-> sequencer event coder");
@@ -93,6 +94,25 @@ static struct status_event_list {
 	{SNDRV_SEQ_EVENT_RESET, 	 0, NULL, NULL}, /* 0xff */
 };
 
+/* status byte 0x80 - 0xff to index into status_event[] */
+static const unsigned char status_type[0x80] = {
+	[0x00 ... 0x0f] = 0,
+	[0x10 ... 0x1f] = 1,
+	[0x20 ... 0x2f] = 2,
+	[0x30 ... 0x3f] = 3,
+	[0x40 ... 0x4f] = 4,
+	[0x50 ... 0x5f] = 5,
+	[0x60 ... 0x6f] = 6,
+	[0x70] = ST_SPECIAL + 0x0, [0x71] = ST_SPECIAL + 0x1,
+	[0x72] = ST_SPECIAL + 0x2, [0x73] = ST_SPECIAL + 0x3,
+	[0x74] = ST_SPECIAL + 0x4, [0x75] = ST_SPECIAL + 0x5,
+	[0x76] = ST_SPECIAL + 0x6, [0x77] = ST_SPECIAL + 0x7,
+	[0x78] = ST_SPECIAL + 0x8, [0x79] = ST_SPECIAL + 0x9,
+	[0x7a] = ST_SPECIAL + 0xa, [0x7b] = ST_SPECIAL + 0xb,
+	[0x7c] = ST_SPECIAL + 0xc, [0x7d] = ST_SPECIAL + 0xd,
+	[0x7e] = ST_SPECIAL + 0xe, [0x7f] = ST_SPECIAL + 0xf,
+};
+
 static int extra_decode_ctrl14(struct snd_midi_event *dev, unsigned char *buf, int len,
 			       struct snd_seq_event *ev);
 static int extra_decode_xrpn(struct snd_midi_event *dev, unsigned char *buf, int count,
@@ -108,6 +128,12 @@ static struct extra_event_list {
 	{SNDRV_SEQ_EVENT_REGPARAM, extra_decode_xrpn},
 };
 
+/* sequencer event type to decoder, built at init: 0 for none,
+ * index + 1 into status_event[] or DECODE_EXTRA | index into extra_event[]
+ */
+#define DECODE_EXTRA	0x80
+static unsigned char decode_type[256];
+
 /*
  *  new/delete record
  */
@@ -216,36 +242,19 @@ int snd_midi_event_resize_buffer(struct snd_midi_event *dev, int bufsize)
 long snd_midi_event_encode(struct snd_midi_event *dev, unsigned char *buf, long count,
 			   struct snd_seq_event *ev)
 {
-	long result = 0;
-	int rc;
+	int nevents = 1;
 
 	ev->type = SNDRV_SEQ_EVENT_NONE;
-
-	while (count-- > 0) {
-		rc = snd_midi_event_encode_byte(dev, *buf++, ev);
-		result++;
-		if (rc < 0)
-			return rc;
-		else if (rc > 0)
-			return result;
-	}
-
-	return result;
+	return snd_midi_event_encode_bulk(dev, buf, count, ev, &nevents);
 }
 
 /*
- *  read one byte and encode to sequencer event:
- *  return 1 if MIDI bytes are encoded to an event
- *         0 data is not finished
- *         negative for error
+ *  read one byte and encode to sequencer event - dev->lock held
  */
-int snd_midi_event_encode_byte(struct snd_midi_event *dev, int c,
-			       struct snd_seq_event *ev)
+static int encode_byte(struct snd_midi_event *dev, int c,
+		       struct snd_seq_event *ev)
 {
 	int rc = 0;
-	unsigned long flags;
-
-	c &= 0xff;
 
 	if (c >= MIDI_CMD_COMMON_CLOCK) {
 		/* real-time event */
@@ -255,15 +264,11 @@ int snd_midi_event_encode_byte(struct snd_midi_event *dev, int c,
 		return ev->type != SNDRV_SEQ_EVENT_NONE;
 	}
 
-	spin_lock_irqsave(&dev->lock, flags);
 	if ((c & 0x80) &&
 	    (c != MIDI_CMD_COMMON_SYSEX_END || dev->type != ST_SYSEX)) {
 		/* new command */
 		dev->buf[0] = c;
-		if ((c & 0xf0) == 0xf0) /* system messages */
-			dev->type = (c & 0x0f) + ST_SPECIAL;
-		else
-			dev->type = (c >> 4) & 0x07;
+		dev->type = status_type[c & 0x7f];
 		dev->read = 1;
 		dev->qlen = status_event[dev->type].qlen;
 	} else {
@@ -304,10 +309,76 @@ int snd_midi_event_encode_byte(struct snd_midi_event *dev, int c,
 		}
 	}
 
+	return rc;
+}
+
+/*
+ *  read one byte and encode to sequencer event:
+ *  return 1 if MIDI bytes are encoded to an event
+ *         0 data is not finished
+ *         negative for error
+ */
+int snd_midi_event_encode_byte(struct snd_midi_event *dev, int c,
+			       struct snd_seq_event *ev)
+{
+	int rc;
+	unsigned long flags;
+
+	c &= 0xff;
+
+	if (c >= MIDI_CMD_COMMON_CLOCK)
+		return encode_byte(dev, c, ev);	/* real-time, no state */
+
+	spin_lock_irqsave(&dev->lock, flags);
+	rc = encode_byte(dev, c, ev);
 	spin_unlock_irqrestore(&dev->lock, flags);
 	return rc;
 }
 
+/*
+ *  read bytes and encode to an array of sequencer events in one pass:
+ *  *nevents gives the room in ev[] and returns the number of events,
+ *  the return value is the size of encoded bytes.  Only the type, flags
+ *  and data of the events are set.  A SysEx chunk points to the coder
+ *  buffer, so the pass ends with it and the chunk is valid until the
+ *  next call; SysEx data bytes are copied to the buffer a run at a time.
+ */
+long snd_midi_event_encode_bulk(struct snd_midi_event *dev, unsigned char *buf,
+				long count, struct snd_seq_event *ev, int *nevents)
+{
+	long result = 0, len, max;
+	int n = 0;
+	unsigned long flags;
+
+	if (*nevents <= 0)
+		return 0;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	while (result < count) {
+		if (dev->type == ST_SYSEX) {
+			/* leave the byte filling the buffer to encode_byte() */
+			max = min_t(long, count - result, dev->bufsize - dev->read - 1);
+			for (len = 0; len < max && !(buf[result + len] & 0x80); len++)
+				;
+			if (len > 0) {
+				memcpy(dev->buf + dev->read, buf + result, len);
+				dev->read += len;
+				result += len;
+				continue;
+			}
+		}
+		if (encode_byte(dev, buf[result++], &ev[n]) > 0) {
+			if (ev[n++].type == SNDRV_SEQ_EVENT_SYSEX ||
+			    n >= *nevents)
+				break;
+		}
+	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	*nevents = n;
+	return result;
+}
+
 /* encode note event */
 static void note_event(struct snd_midi_event *dev, struct snd_seq_event *ev)
 {
@@ -351,62 +422,98 @@ static void songpos_event(struct snd_midi_event *dev, struct snd_seq_event *ev)
 }
 
 /*
- * decode from a sequencer event to midi bytes
- * return the size of decoded midi events
+ * decode a non-SysEx event to midi bytes - dev->lock held;
+ * the running status is only updated when the bytes fit
  */
-long snd_midi_event_decode(struct snd_midi_event *dev, unsigned char *buf, long count,
-			   struct snd_seq_event *ev)
+static long decode_event(struct snd_midi_event *dev, unsigned char *buf, long count,
+			 struct snd_seq_event *ev, unsigned int type)
 {
-	unsigned int cmd, type;
-
-	if (ev->type == SNDRV_SEQ_EVENT_NONE)
-		return -ENOENT;
-
-	for (type = 0; type < ARRAY_SIZE(status_event); type++) {
-		if (ev->type == status_event[type].event)
-			goto __found;
-	}
-	for (type = 0; type < ARRAY_SIZE(extra_event); type++) {
-		if (ev->type == extra_event[type].event)
-			return extra_event[type].decode(dev, buf, count, ev);
-	}
-	return -ENOENT;
+	unsigned int cmd;
+	unsigned char xbuf[4];
+	int qlen;
 
-      __found:
 	if (type >= ST_SPECIAL)
 		cmd = 0xf0 + (type - ST_SPECIAL);
 	else
 		/* data.note.channel and data.control.channel is identical */
 		cmd = 0x80 | (type << 4) | (ev->data.note.channel & 0x0f);
 
-
-	if (cmd == MIDI_CMD_COMMON_SYSEX) {
-		snd_midi_event_reset_decode(dev);
-		return snd_seq_expand_var_event(ev, count, buf, 1, 0);
+	if ((cmd & 0xf0) == 0xf0 || dev->lastcmd != cmd || dev->nostat) {
+		qlen = status_event[type].qlen + 1;
+		if (count < qlen)
+			return -ENOMEM;
+		dev->lastcmd = cmd;
+		xbuf[0] = cmd;
+		if (status_event[type].decode)
+			status_event[type].decode(ev, xbuf + 1);
 	} else {
-		int qlen;
-		unsigned char xbuf[4];
-		unsigned long flags;
+		qlen = status_event[type].qlen;
+		if (count < qlen)
+			return -ENOMEM;
+		if (status_event[type].decode)
+			status_event[type].decode(ev, xbuf + 0);
+	}
+	memcpy(buf, xbuf, qlen);
+	return qlen;
+}
 
-		spin_lock_irqsave(&dev->lock, flags);
-		if ((cmd & 0xf0) == 0xf0 || dev->lastcmd != cmd || dev->nostat) {
-			dev->lastcmd = cmd;
+/*
+ * decode from a sequencer event to midi bytes
+ * return the size of decoded midi events
+ */
+long snd_midi_event_decode(struct snd_midi_event *dev, unsigned char *buf, long count,
+			   struct snd_seq_event *ev)
+{
+	int nevents = 1;
+
+	if (!decode_type[ev->type])
+		return -ENOENT;
+	return snd_midi_event_decode_bulk(dev, buf, count, ev, &nevents);
+}
+
+/*
+ * decode an array of sequencer events to midi bytes in one pass:
+ * *nevents gives the events in ev[] and returns the number of them
+ * taken, stopping at the first one that doesn't fit or can't be decoded;
+ * events without a midi form are taken and skipped.
+ * return the size of decoded midi bytes, or the error of the first
+ * event if none was taken
+ */
+long snd_midi_event_decode_bulk(struct snd_midi_event *dev, unsigned char *buf,
+				long count, struct snd_seq_event *ev, int *nevents)
+{
+	long result = 0, len = 0;
+	unsigned int type;
+	unsigned long flags;
+	int n;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	for (n = 0; n < *nevents; n++) {
+		type = decode_type[ev[n].type];
+		if (!type)
+			continue;
+		if (type == ST_SYSEX + 1) {
+			dev->lastcmd = 0xff;
+			/* the data may have to be copied from user space */
 			spin_unlock_irqrestore(&dev->lock, flags);
-			xbuf[0] = cmd;
-			if (status_event[type].decode)
-				status_event[type].decode(ev, xbuf + 1);
-			qlen = status_event[type].qlen + 1;
+			len = snd_seq_expand_var_event(&ev[n], count - result,
+						       buf + result, 1, 0);
+			spin_lock_irqsave(&dev->lock, flags);
+		} else if (type & DECODE_EXTRA) {
+			len = extra_event[type & ~DECODE_EXTRA].decode(dev, buf + result,
+								       count - result, &ev[n]);
 		} else {
-			spin_unlock_irqrestore(&dev->lock, flags);
-			if (status_event[type].decode)
-				status_event[type].decode(ev, xbuf + 0);
-			qlen = status_event[type].qlen;
+			len = decode_event(dev, buf + result, count - result,
+					   &ev[n], type - 1);
 		}
-		if (count < qlen)
-			return -ENOMEM;
-		memcpy(buf, xbuf, qlen);
-		return qlen;
+		if (len < 0)
+			break;
+		result += len;
 	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	*nevents = n;
+	return n ? result : len;
 }
 
 
@@ -536,9 +643,18 @@ EXPORT_SYMBOL(snd_midi_event_no_status);
 EXPORT_SYMBOL(snd_midi_event_encode);
 EXPORT_SYMBOL(snd_midi_event_encode_byte);
 EXPORT_SYMBOL(snd_midi_event_decode);
+EXPORT_SYMBOL(snd_midi_event_encode_bulk);
+EXPORT_SYMBOL(snd_midi_event_decode_bulk);
 
 static int __init alsa_seq_midi_event_init(void)
 {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(status_event); i++)
+		if (status_event[i].event != SNDRV_SEQ_EVENT_NONE)
+			decode_type[status_event[i].event] = i + 1;
+	for (i = 0; i < ARRAY_SIZE(extra_event); i++)
+		decode_type[extra_event[i].event] = DECODE_EXTRA | i;
 	return 0;
 }
 
@@ -0,0 +1,31 @@
+/*
+ *  MIDI byte <-> sequencer event coder, bulk interface
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ */
+#ifndef __SND_SEQ_MIDI_EVENT_BULK_H
+#define __SND_SEQ_MIDI_EVENT_BULK_H
+
+#include <sound/seq_midi_event.h>
+
+/* encode a byte buffer to an array of events, at most *nevents */
+long snd_midi_event_encode_bulk(struct snd_midi_event *dev, unsigned char *buf,
+				long count, struct snd_seq_event *ev, int *nevents);
+/* decode an array of events to a byte buffer, at most *nevents */
+long snd_midi_event_decode_bulk(struct snd_midi_event *dev, unsigned char *buf,
+				long count, struct snd_seq_event *ev, int *nevents);
+
+#endif
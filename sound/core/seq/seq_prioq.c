@@ -26,28 +26,17 @@
 #include "seq_prioq.h"
 
 
-/* Implementation is a simple linked list for now...
-
-   This priority queue orders the events on timestamp. For events with an
-   equeal timestamp the queue behaves as a FIFO. 
-
-   *
-   *           +-------+
-   *  Head --> | first |
-   *           +-------+
-   *                 |next
-   *           +-----v-+
-   *           |       |
-   *           +-------+
-   *                 |
-   *           +-----v-+
-   *           |       |
-   *           +-------+
-   *                 |
-   *           +-----v-+
-   *  Tail --> | last  |
-   *           +-------+
-   *
+/* Implementation is a red-black tree of cells.
+
+   This priority queue orders the events on timestamp.  Events flagged with
+   SNDRV_SEQ_PRIORITY_HIGH go ahead of normal events with an equal
+   timestamp; otherwise events with an equal timestamp are delivered in the
+   order they were queued (FIFO).  Each cell is stamped with an insertion
+   counter on the way in, which makes the ordering total.
+
+   The first and last cells are cached, so peeking at and dequeuing the
+   head never walks the tree, and ordered data is linked straight below the
+   tail.  Events arriving out of order cost O(log n).
 
  */
 
@@ -63,8 +52,10 @@ struct snd_seq_prioq *snd_seq_prioq_new(void)
 		return NULL;
 	
 	spin_lock_init(&f->lock);
+	f->root = RB_ROOT;
 	f->head = NULL;
 	f->tail = NULL;
+	f->order = 0;
 	f->cells = 0;
 	
 	return f;
@@ -96,20 +87,6 @@ void snd_seq_prioq_delete(struct snd_seq_prioq **fifo)
 
 
 
-/* compare timestamp between events */
-/* return 1 if a >= b; 0 */
-static inline int compare_timestamp(struct snd_seq_event *a,
-				    struct snd_seq_event *b)
-{
-	if ((a->flags & SNDRV_SEQ_TIME_STAMP_MASK) == SNDRV_SEQ_TIME_STAMP_TICK) {
-		/* compare ticks */
-		return (snd_seq_compare_tick_time(&a->time.tick, &b->time.tick));
-	} else {
-		/* compare real time */
-		return (snd_seq_compare_real_time(&a->time.time, &b->time.time));
-	}
-}
-
 /* compare timestamp between events */
 /* return negative if a < b;
  *        zero     if a = b;
@@ -142,72 +119,89 @@ static inline int compare_timestamp_rel(struct snd_seq_event *a,
 	}
 }
 
+/* order two cells of a prioq */
+/* return negative if a is to be delivered before b; positive otherwise */
+static inline int prioq_cmp(struct snd_seq_event_cell *a,
+			    struct snd_seq_event_cell *b)
+{
+	int rel = compare_timestamp_rel(&a->event, &b->event);
+
+	if (rel)
+		return rel;
+	/* equal schedule time: prior events go first */
+	if ((a->event.flags ^ b->event.flags) & SNDRV_SEQ_PRIORITY_MASK)
+		return (a->event.flags & SNDRV_SEQ_PRIORITY_MASK) ? -1 : 1;
+	/* then the order they were queued in; safe across wrap-around */
+	return (int)(a->order - b->order);
+}
+
+/* unlink cell from prioq, keeping head and tail up to date; lock held */
+static void prioq_erase(struct snd_seq_prioq *f,
+			struct snd_seq_event_cell *cell)
+{
+	struct rb_node *n;
+
+	if (f->head == cell) {
+		n = rb_next(&cell->node);
+		f->head = n ? rb_entry(n, struct snd_seq_event_cell, node) : NULL;
+	}
+	if (f->tail == cell) {
+		n = rb_prev(&cell->node);
+		f->tail = n ? rb_entry(n, struct snd_seq_event_cell, node) : NULL;
+	}
+	rb_erase(&cell->node, &f->root);
+	cell->next = NULL;
+	f->cells--;
+}
+
 /* enqueue cell to prioq */
 int snd_seq_prioq_cell_in(struct snd_seq_prioq * f,
 			  struct snd_seq_event_cell * cell)
 {
-	struct snd_seq_event_cell *cur, *prev;
+	struct snd_seq_event_cell *cur;
+	struct rb_node **link, *parent;
 	unsigned long flags;
-	int count;
-	int prior;
+	bool leftmost = true, rightmost = true;
 
 	if (snd_BUG_ON(!f || !cell))
 		return -EINVAL;
 	
-	/* check flags */
-	prior = (cell->event.flags & SNDRV_SEQ_PRIORITY_MASK);
-
 	spin_lock_irqsave(&f->lock, flags);
 
-	/* check if this element needs to inserted at the end (ie. ordered 
-	   data is inserted) This will be very likeley if a sequencer 
-	   application or midi file player is feeding us (sequential) data */
-	if (f->tail && !prior) {
-		if (compare_timestamp(&cell->event, &f->tail->event)) {
-			/* add new cell to tail of the fifo */
-			f->tail->next = cell;
-			f->tail = cell;
-			cell->next = NULL;
-			f->cells++;
-			spin_unlock_irqrestore(&f->lock, flags);
-			return 0;
-		}
-	}
-	/* traverse list of elements to find the place where the new cell is
-	   to be inserted... Note that this is a order n process ! */
-
-	prev = NULL;		/* previous cell */
-	cur = f->head;		/* cursor */
-
-	count = 10000; /* FIXME: enough big, isn't it? */
-	while (cur != NULL) {
-		/* compare timestamps */
-		int rel = compare_timestamp_rel(&cell->event, &cur->event);
-		if (rel < 0)
-			/* new cell has earlier schedule time, */
-			break;
-		else if (rel == 0 && prior)
-			/* equal schedule time and prior to others */
-			break;
-		/* new cell has equal or larger schedule time, */
-		/* move cursor to next cell */
-		prev = cur;
-		cur = cur->next;
-		if (! --count) {
-			spin_unlock_irqrestore(&f->lock, flags);
-			pr_err("ALSA: seq: cannot find a pointer.. infinite loop?\n");
-			return -EINVAL;
+	cell->order = f->order++;
+	cell->next = NULL;
+
+	if (f->tail && prioq_cmp(cell, f->tail) > 0) {
+		/* ordered data: this will be very likely if a sequencer
+		   application or midi file player is feeding us (sequential)
+		   data.  The tail never has a right child. */
+		parent = &f->tail->node;
+		link = &parent->rb_right;
+		leftmost = false;
+	} else {
+		/* walk down the tree to find the place where the new cell
+		   is to be inserted */
+		parent = NULL;
+		link = &f->root.rb_node;
+		rightmost = !f->tail;
+		while (*link) {
+			parent = *link;
+			cur = rb_entry(parent, struct snd_seq_event_cell, node);
+			if (prioq_cmp(cell, cur) < 0) {
+				link = &parent->rb_left;
+			} else {
+				link = &parent->rb_right;
+				leftmost = false;
+			}
 		}
 	}
 
-	/* insert it before cursor */
-	if (prev != NULL)
-		prev->next = cell;
-	cell->next = cur;
+	rb_link_node(&cell->node, parent, link);
+	rb_insert_color(&cell->node, &f->root);
 
-	if (f->head == cur) /* this is the first cell, set head to it */
+	if (leftmost) /* this is the first cell, set head to it */
 		f->head = cell;
-	if (cur == NULL) /* reached end of the list */
+	if (rightmost) /* this is the last cell */
 		f->tail = cell;
 	f->cells++;
 	spin_unlock_irqrestore(&f->lock, flags);
@@ -227,16 +221,8 @@ struct snd_seq_event_cell *snd_seq_prioq_cell_out(struct snd_seq_prioq *f)
 	spin_lock_irqsave(&f->lock, flags);
 
 	cell = f->head;
-	if (cell) {
-		f->head = cell->next;
-
-		/* reset tail if this was the last element */
-		if (f->tail == cell)
-			f->tail = NULL;
-
-		cell->next = NULL;
-		f->cells--;
-	}
+	if (cell)
+		prioq_erase(f, cell);
 
 	spin_unlock_irqrestore(&f->lock, flags);
 	return cell;
@@ -289,46 +275,27 @@ static inline int prioq_match(struct snd_seq_event_cell *cell,
 /* remove cells for left client */
 void snd_seq_prioq_leave(struct snd_seq_prioq * f, int client, int timestamp)
 {
-	register struct snd_seq_event_cell *cell, *next;
+	struct snd_seq_event_cell *cell;
+	struct rb_node *p, *next;
 	unsigned long flags;
-	struct snd_seq_event_cell *prev = NULL;
 	struct snd_seq_event_cell *freefirst = NULL, *freeprev = NULL, *freenext;
 
 	/* collect all removed cells */
 	spin_lock_irqsave(&f->lock, flags);
-	cell = f->head;
-	while (cell) {
-		next = cell->next;
-		if (prioq_match(cell, client, timestamp)) {
-			/* remove cell from prioq */
-			if (cell == f->head) {
-				f->head = cell->next;
-			} else {
-				prev->next = cell->next;
-			}
-			if (cell == f->tail)
-				f->tail = cell->next;
-			f->cells--;
-			/* add cell to free list */
-			cell->next = NULL;
-			if (freefirst == NULL) {
-				freefirst = cell;
-			} else {
-				freeprev->next = cell;
-			}
-			freeprev = cell;
+	for (p = rb_first(&f->root); p; p = next) {
+		next = rb_next(p);
+		cell = rb_entry(p, struct snd_seq_event_cell, node);
+		if (!prioq_match(cell, client, timestamp))
+			continue;
+		/* remove cell from prioq */
+		prioq_erase(f, cell);
+		/* add cell to free list */
+		if (freefirst == NULL) {
+			freefirst = cell;
 		} else {
-#if 0
-			pr_debug("ALSA: seq: type = %i, source = %i, dest = %i, "
-			       "client = %i\n",
-				cell->event.type,
-				cell->event.source.client,
-				cell->event.dest.client,
-				client);
-#endif
-			prev = cell;
+			freeprev->next = cell;
 		}
-		cell = next;		
+		freeprev = cell;
 	}
 	spin_unlock_irqrestore(&f->lock, flags);	
 
@@ -399,44 +366,31 @@ static int prioq_remove_match(struct snd_seq_remove_events *info,
 void snd_seq_prioq_remove_events(struct snd_seq_prioq * f, int client,
 				 struct snd_seq_remove_events *info)
 {
-	struct snd_seq_event_cell *cell, *next;
+	struct snd_seq_event_cell *cell;
+	struct rb_node *p, *next;
 	unsigned long flags;
-	struct snd_seq_event_cell *prev = NULL;
 	struct snd_seq_event_cell *freefirst = NULL, *freeprev = NULL, *freenext;
 
 	/* collect all removed cells */
 	spin_lock_irqsave(&f->lock, flags);
-	cell = f->head;
-
-	while (cell) {
-		next = cell->next;
-		if (cell->event.source.client == client &&
-			prioq_remove_match(info, &cell->event)) {
-
-			/* remove cell from prioq */
-			if (cell == f->head) {
-				f->head = cell->next;
-			} else {
-				prev->next = cell->next;
-			}
-
-			if (cell == f->tail)
-				f->tail = cell->next;
-			f->cells--;
-
-			/* add cell to free list */
-			cell->next = NULL;
-			if (freefirst == NULL) {
-				freefirst = cell;
-			} else {
-				freeprev->next = cell;
-			}
-
-			freeprev = cell;
+	for (p = rb_first(&f->root); p; p = next) {
+		next = rb_next(p);
+		cell = rb_entry(p, struct snd_seq_event_cell, node);
+		if (cell->event.source.client != client ||
+		    !prioq_remove_match(info, &cell->event))
+			continue;
+
+		/* remove cell from prioq */
+		prioq_erase(f, cell);
+
+		/* add cell to free list */
+		if (freefirst == NULL) {
+			freefirst = cell;
 		} else {
-			prev = cell;
+			freeprev->next = cell;
 		}
-		cell = next;		
+
+		freeprev = cell;
 	}
 	spin_unlock_irqrestore(&f->lock, flags);	
 
@@ -27,8 +27,10 @@
 /* === PRIOQ === */
 
 struct snd_seq_prioq {
+	struct rb_root root;		      /* cells ordered by timestamp */
 	struct snd_seq_event_cell *head;      /* pointer to head of prioq */
 	struct snd_seq_event_cell *tail;      /* pointer to tail of prioq */
+	unsigned int order;		      /* next insertion order */
 	int cells;
 	spinlock_t lock;
 };
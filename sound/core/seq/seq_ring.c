@@ -0,0 +1,170 @@
+/*
+ *   ALSA sequencer mmapped event ring
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ */
+
+#include <sound/core.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include "seq_ring.h"
+
+
+/* RING */
+
+static size_t ring_bytes(unsigned int size)
+{
+	return PAGE_ALIGN(size * sizeof(struct snd_seq_event));
+}
+
+/* create new ring */
+struct snd_seq_ring *snd_seq_ring_new(struct snd_seq_ring_info *info)
+{
+	struct snd_seq_ring *ring;
+	size_t out_offset;
+	int err;
+
+	if ((info->input_size && !is_power_of_2(info->input_size)) ||
+	    (info->output_size && !is_power_of_2(info->output_size)) ||
+	    info->input_size > SNDRV_SEQ_RING_MAX ||
+	    info->output_size > SNDRV_SEQ_RING_MAX ||
+	    (!info->input_size && !info->output_size))
+		return ERR_PTR(-EINVAL);
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return ERR_PTR(-ENOMEM);
+
+	if (info->eventfd >= 0) {
+		ring->eventfd = eventfd_ctx_fdget(info->eventfd);
+		if (IS_ERR(ring->eventfd)) {
+			err = PTR_ERR(ring->eventfd);
+			kfree(ring);
+			return ERR_PTR(err);
+		}
+	}
+
+	out_offset = PAGE_SIZE + ring_bytes(info->input_size);
+	ring->bytes = out_offset + ring_bytes(info->output_size);
+	ring->area = vmalloc_user(ring->bytes);
+	if (!ring->area) {
+		if (ring->eventfd)
+			eventfd_ctx_put(ring->eventfd);
+		kfree(ring);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	ring->in_size = info->input_size;
+	ring->out_size = info->output_size;
+	ring->in_ctl = ring->area;
+	ring->in_ctl->size = info->input_size;
+	ring->in_ctl->offset = PAGE_SIZE;
+	ring->in_ev = ring->area + PAGE_SIZE;
+	ring->out_ctl = ring->area + SNDRV_SEQ_RING_OUTPUT_CTL;
+	ring->out_ctl->size = info->output_size;
+	ring->out_ctl->offset = out_offset;
+	ring->out_ev = ring->area + out_offset;
+
+	spin_lock_init(&ring->lock);
+	mutex_init(&ring->out_mutex);
+	init_waitqueue_head(&ring->input_sleep);
+
+	info->mmap_size = ring->bytes;
+	return ring;
+}
+
+/* delete ring */
+void snd_seq_ring_delete(struct snd_seq_ring **pring)
+{
+	struct snd_seq_ring *ring = *pring;
+
+	*pring = NULL;
+	if (!ring)
+		return;
+	if (ring->eventfd)
+		eventfd_ctx_put(ring->eventfd);
+	vfree(ring->area);
+	kfree(ring);
+}
+
+/* enqueue event to the input ring; -ENOMEM and a counted overrun if full */
+int snd_seq_ring_event_in(struct snd_seq_ring *ring,
+			  struct snd_seq_event *event)
+{
+	struct snd_seq_ring_ctl *ctl = ring->in_ctl;
+	unsigned long flags;
+	u32 head, tail;
+
+	spin_lock_irqsave(&ring->lock, flags);
+	head = ring->in_head;
+	/* the tail comes from user space, any value only means full */
+	tail = smp_load_acquire(&ctl->tail);
+	if (head - tail >= ring->in_size) {
+		ctl->overrun++;
+		spin_unlock_irqrestore(&ring->lock, flags);
+		return -ENOMEM;
+	}
+	ring->in_ev[head & (ring->in_size - 1)] = *event;
+	ring->in_head = ++head;
+	smp_store_release(&ctl->head, head);
+	spin_unlock_irqrestore(&ring->lock, flags);
+
+	/* wakeup client */
+	if (waitqueue_active(&ring->input_sleep))
+		wake_up(&ring->input_sleep);
+	if (ring->eventfd)
+		eventfd_signal(ring->eventfd, 1);
+	return 0;
+}
+
+/* fetch the event at the output tail, if any */
+bool snd_seq_ring_event_out(struct snd_seq_ring *ring,
+			    struct snd_seq_event *event)
+{
+	struct snd_seq_ring_ctl *ctl = ring->out_ctl;
+	u32 tail = ring->out_tail;
+
+	/* a head beyond the size is as good as an empty ring */
+	if (smp_load_acquire(&ctl->head) - tail - 1 >= ring->out_size)
+		return false;
+	*event = ring->out_ev[tail & (ring->out_size - 1)];
+	return true;
+}
+
+/* release the event at the output tail to user space */
+void snd_seq_ring_event_done(struct snd_seq_ring *ring)
+{
+	ring->out_tail++;
+	smp_store_release(&ring->out_ctl->tail, ring->out_tail);
+}
+
+/* polling; return non-zero if the input ring has events */
+int snd_seq_ring_poll_wait(struct snd_seq_ring *ring, struct file *file,
+			   poll_table *wait)
+{
+	poll_wait(file, &ring->input_sleep, wait);
+	return ring->in_size &&
+		READ_ONCE(ring->in_ctl->tail) != READ_ONCE(ring->in_head);
+}
+
+/* map the whole ring area */
+int snd_seq_ring_mmap(struct snd_seq_ring *ring, struct vm_area_struct *area)
+{
+	if (area->vm_pgoff ||
+	    area->vm_end - area->vm_start > ring->bytes)
+		return -EINVAL;
+	return remap_vmalloc_range(area, ring->area, 0);
+}
@@ -0,0 +1,94 @@
+/*
+ *   ALSA sequencer mmapped event ring
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ */
+#ifndef __SND_SEQ_RING_H
+#define __SND_SEQ_RING_H
+
+#include <linux/eventfd.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <sound/seq_kernel.h>
+
+/* === mmapped event ring === */
+
+/*
+ * A user client may map a ring of fixed length events per direction.  The
+ * first page holds the control records, input at offset 0 and output at
+ * SNDRV_SEQ_RING_OUTPUT_CTL, followed by the input and the output entries
+ * at the page aligned offsets given in the records.  The producer only
+ * moves head and the consumer only tail, both counting entries without
+ * wrapping at the ring size.
+ */
+struct snd_seq_ring_ctl {
+	__u32 head;		/* next entry to be written */
+	__u32 tail;		/* next entry to be read */
+	__u32 size;		/* entries, a power of two */
+	__u32 offset;		/* of the entries in the mapping */
+	__u32 overrun;		/* input events dropped for a full ring */
+	__u32 reserved[3];
+};
+
+#define SNDRV_SEQ_RING_OUTPUT_CTL	64
+#define SNDRV_SEQ_RING_MAX		65536
+
+struct snd_seq_ring_info {
+	unsigned int input_size;	/* input entries, 0 for none */
+	unsigned int output_size;	/* output entries, 0 for none */
+	int eventfd;			/* signalled on input, -1 for none */
+	unsigned int mmap_size;		/* R: bytes to map at offset 0 */
+	unsigned char reserved[16];
+};
+
+#define SNDRV_SEQ_IOCTL_RING_SETUP	_IOWR('S', 0x60, struct snd_seq_ring_info)
+#define SNDRV_SEQ_IOCTL_RING_SEND	_IO('S', 0x61)
+
+struct snd_seq_ring {
+	void *area;			/* vmalloc'ed, mapped to user space */
+	size_t bytes;
+	struct snd_seq_ring_ctl *in_ctl, *out_ctl;
+	struct snd_seq_event *in_ev, *out_ev;
+	/* kernel copies, user space may scribble over the records */
+	u32 in_size, in_head;
+	u32 out_size, out_tail;
+	spinlock_t lock;		/* input producers */
+	struct mutex out_mutex;		/* output consumer */
+	wait_queue_head_t input_sleep;
+	struct eventfd_ctx *eventfd;
+};
+
+/* create a ring (constructor) */
+struct snd_seq_ring *snd_seq_ring_new(struct snd_seq_ring_info *info);
+
+/* delete ring (destructor) */
+void snd_seq_ring_delete(struct snd_seq_ring **ring);
+
+/* put a fixed length event to the input ring */
+int snd_seq_ring_event_in(struct snd_seq_ring *ring, struct snd_seq_event *event);
+
+/* peek the next output event and consume it - out_mutex held */
+bool snd_seq_ring_event_out(struct snd_seq_ring *ring, struct snd_seq_event *event);
+void snd_seq_ring_event_done(struct snd_seq_ring *ring);
+
+/* polling */
+int snd_seq_ring_poll_wait(struct snd_seq_ring *ring, struct file *file, poll_table *wait);
+
+/* map to user space */
+int snd_seq_ring_mmap(struct snd_seq_ring *ring, struct vm_area_struct *area);
+
+#endif
@@ -19,6 +19,7 @@
  *
  */
 
+#include <linux/bitops.h>
 #include <linux/delay.h>
 #include <linux/init.h>
 #include <linux/slab.h>
@@ -38,6 +39,40 @@
 /* internal flags */
 #define SNDRV_TIMER_IFLG_PAUSED		0x00010000
 
+/*
+ * Running master instances of a non-slave timer are kept in a hierarchical
+ * timer wheel instead of the plain active list, so that neither the
+ * interrupt nor the reschedule has to visit every instance.  The wheel has
+ * five levels of 64 slots; level n covers expiries up to 64^(n+1) ticks
+ * ahead, anything beyond that parks in the last level and is requeued when
+ * its slot comes around.  The 30 bits of range work on 32 bit, too.
+ *
+ * While an instance is queued, cticks holds its absolute expiry tick and
+ * pticks is kept relative to the wheel clock, i.e. the ticks passed since
+ * the last callback are pticks + now.  Both are converted back when the
+ * instance leaves the wheel.  Pending delayed starts stay on
+ * timer->active_list_head until the next reschedule.
+ */
+#define TIMER_WHEEL_BITS	6
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS	5
+#define TIMER_WHEEL_SPAN	(1UL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+struct snd_timer_wheel {
+	unsigned long now;		/* last processed tick */
+	unsigned int count;		/* queued instances */
+	/* slots which may be non-empty, cleared lazily */
+	DECLARE_BITMAP(pending[TIMER_WHEEL_LEVELS], TIMER_WHEEL_SLOTS);
+	struct list_head *slots;	/* allocated at the first open */
+};
+
+/* the wheel is allocated together with the timer, see snd_timer_new() */
+static inline struct snd_timer_wheel *snd_timer_wheel(struct snd_timer *timer)
+{
+	return (struct snd_timer_wheel *)(timer + 1);
+}
+
 #if IS_ENABLED(CONFIG_SND_HRTIMER)
 #define DEFAULT_TIMER_LIMIT 4
 #else
@@ -96,6 +131,206 @@ static int snd_timer_dev_disconnect(struct snd_device *device);
 
 static void snd_timer_reschedule(struct snd_timer * timer, unsigned long ticks_left);
 
+static int snd_timer_wheel_alloc(struct snd_timer *timer)
+{
+	struct list_head *slots;
+	int i;
+
+	slots = kmalloc_array(TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS,
+			      sizeof(*slots), GFP_KERNEL);
+	if (!slots)
+		return -ENOMEM;
+	for (i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i++)
+		INIT_LIST_HEAD(&slots[i]);
+	spin_lock_irq(&timer->lock);
+	snd_timer_wheel(timer)->slots = slots;
+	spin_unlock_irq(&timer->lock);
+	return 0;
+}
+
+/* queue an instance to expire cticks ticks from now */
+static void snd_timer_wheel_add(struct snd_timer_wheel *w,
+				struct snd_timer_instance *ti)
+{
+	unsigned long expires = w->now + ti->cticks;
+	unsigned long delta = ti->cticks;
+	unsigned int level, slot;
+
+	ti->cticks = expires;
+	if (delta >= TIMER_WHEEL_SPAN) {
+		expires = w->now + TIMER_WHEEL_SPAN - 1;
+		level = TIMER_WHEEL_LEVELS - 1;
+	} else {
+		for (level = 0; delta >> ((level + 1) * TIMER_WHEEL_BITS); level++)
+			;
+	}
+	slot = (expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+	list_move_tail(&ti->active_list,
+		       &w->slots[level * TIMER_WHEEL_SLOTS + slot]);
+	__set_bit(slot, w->pending[level]);
+	w->count++;
+}
+
+/* dequeue an instance, turning cticks and pticks back into tick counts */
+static void snd_timer_wheel_del(struct snd_timer_wheel *w,
+				struct snd_timer_instance *ti)
+{
+	if (list_empty(&ti->active_list))
+		return;
+	list_del_init(&ti->active_list);
+	w->count--;
+	ti->cticks -= w->now;
+	ti->pticks += w->now;
+}
+
+/*
+ * find the first non-empty slot of a level in expiry order and the tick at
+ * which it is due; for the upper levels that is the tick it cascades at
+ */
+static bool snd_timer_wheel_next(struct snd_timer_wheel *w, unsigned int level,
+				 unsigned int *slotp, unsigned long *tickp)
+{
+	unsigned int shift = level * TIMER_WHEEL_BITS;
+	unsigned long next = w->now + 1;
+	unsigned long block = next >> shift;
+	unsigned int start, slot;
+
+	/* the slot of the current block was already cascaded */
+	if (next & ((1UL << shift) - 1))
+		block++;
+	start = block & TIMER_WHEEL_MASK;
+	for (;;) {
+		slot = find_next_bit(w->pending[level], TIMER_WHEEL_SLOTS, start);
+		if (slot >= TIMER_WHEEL_SLOTS)
+			slot = find_first_bit(w->pending[level],
+					      TIMER_WHEEL_SLOTS);
+		if (slot >= TIMER_WHEEL_SLOTS)
+			return false;
+		if (!list_empty(&w->slots[level * TIMER_WHEEL_SLOTS + slot]))
+			break;
+		__clear_bit(slot, w->pending[level]);
+	}
+	*slotp = slot;
+	*tickp = (block + ((slot - start) & TIMER_WHEEL_MASK)) << shift;
+	return true;
+}
+
+/* ticks until the first queued instance expires, ~0UL if none */
+static unsigned long snd_timer_wheel_first(struct snd_timer_wheel *w)
+{
+	struct snd_timer_instance *ti;
+	unsigned long ticks = ~0UL, tick;
+	unsigned int level, slot;
+
+	if (!w->count)
+		return ticks;
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		if (!snd_timer_wheel_next(w, level, &slot, &tick))
+			continue;
+		if (!level) {
+			ticks = min(ticks, tick - w->now);
+			continue;
+		}
+		list_for_each_entry(ti, &w->slots[level * TIMER_WHEEL_SLOTS + slot],
+				    active_list)
+			ticks = min(ticks, ti->cticks - w->now);
+		/*
+		 * the last level may also hold far expiries parked in an
+		 * earlier slot; the next block bounds the ones queued behind
+		 */
+		if (level == TIMER_WHEEL_LEVELS - 1)
+			ticks = min(ticks, tick - w->now +
+				    (1UL << (level * TIMER_WHEEL_BITS)));
+	}
+	return ticks;
+}
+
+static void snd_timer_wheel_cascade(struct snd_timer_wheel *w,
+				    unsigned int level, unsigned int slot)
+{
+	struct snd_timer_instance *ti, *tmp;
+	LIST_HEAD(list);
+
+	list_splice_init(&w->slots[level * TIMER_WHEEL_SLOTS + slot], &list);
+	__clear_bit(slot, w->pending[level]);
+	list_for_each_entry_safe(ti, tmp, &list, active_list) {
+		w->count--;
+		ti->cticks -= w->now;
+		snd_timer_wheel_add(w, ti);
+	}
+}
+
+/*
+ * advance the wheel clock by the given ticks and move all instances expiring
+ * on the way to the expired list; only ticks with something to do are
+ * visited
+ */
+static void snd_timer_wheel_advance(struct snd_timer_wheel *w,
+				    unsigned long ticks,
+				    struct list_head *expired)
+{
+	struct snd_timer_instance *ti, *tmp;
+	unsigned long target = w->now + ticks;
+	unsigned long tick, t;
+	unsigned int level, slot;
+	struct list_head *head;
+
+	while (w->count) {
+		tick = target + 1;
+		for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+			if (snd_timer_wheel_next(w, level, &slot, &t) &&
+			    t - w->now < tick - w->now)
+				tick = t;
+		if (tick - w->now > target - w->now)
+			break;
+		/* requeue relative to this tick, its slots are processed */
+		w->now = tick;
+		for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+			if (tick & ((1UL << (level * TIMER_WHEEL_BITS)) - 1))
+				break;
+			snd_timer_wheel_cascade(w, level,
+				(tick >> (level * TIMER_WHEEL_BITS)) &
+				TIMER_WHEEL_MASK);
+		}
+		slot = tick & TIMER_WHEEL_MASK;
+		head = &w->slots[slot];
+		list_for_each_entry_safe(ti, tmp, head, active_list) {
+			list_move_tail(&ti->active_list, expired);
+			w->count--;
+		}
+		__clear_bit(slot, w->pending[0]);
+	}
+	w->now = target;
+}
+
+/* start counting the ticks of a running instance from the current tick */
+static void snd_timer_wheel_start(struct snd_timer *timer,
+				  struct snd_timer_instance *ti)
+{
+	struct snd_timer_wheel *w = snd_timer_wheel(timer);
+
+	ti->pticks = -w->now;
+	snd_timer_wheel_add(w, ti);
+}
+
+/* return and clear the ticks passed since the last callback */
+static unsigned long snd_timer_take_pticks(struct snd_timer_instance *ti)
+{
+	unsigned long ticks = ti->pticks;
+	struct snd_timer_wheel *w;
+
+	if (!(ti->flags & SNDRV_TIMER_IFLG_SLAVE) &&
+	    (ti->flags & SNDRV_TIMER_IFLG_RUNNING) && ti->timer) {
+		w = snd_timer_wheel(ti->timer);
+		if (w->slots) {
+			ti->pticks = -w->now;
+			return ticks + w->now;
+		}
+	}
+	ti->pticks = 0;
+	return ticks;
+}
+
 /*
  * create a timer instance with the given owner string.
  * when timer is not NULL, increments the module counter
@@ -287,6 +522,13 @@ int snd_timer_open(struct snd_timer_instance **ti,
 			return -EBUSY;
 		}
 	}
+	if (!(timer->hw.flags & SNDRV_TIMER_HW_SLAVE) &&
+	    !snd_timer_wheel(timer)->slots) {
+		if (snd_timer_wheel_alloc(timer) < 0) {
+			mutex_unlock(&register_mutex);
+			return -ENOMEM;
+		}
+	}
 	timeri = snd_timer_instance_new(owner, timer);
 	if (!timeri) {
 		mutex_unlock(&register_mutex);
@@ -472,6 +714,8 @@ static int snd_timer_start1(struct snd_timer_instance *timeri,
 	      __start_now:
 		timer->running++;
 		timeri->flags |= SNDRV_TIMER_IFLG_RUNNING;
+		if (snd_timer_wheel(timer)->slots)
+			snd_timer_wheel_start(timer, timeri);
 		result = 0;
 	}
 	snd_timer_notify1(timeri, start ? SNDRV_TIMER_EVENT_START :
@@ -522,7 +766,11 @@ static int snd_timer_stop1(struct snd_timer_instance *timeri, bool stop)
 		goto unlock;
 	}
 	list_del_init(&timeri->ack_list);
-	list_del_init(&timeri->active_list);
+	if ((timeri->flags & SNDRV_TIMER_IFLG_RUNNING) &&
+	    snd_timer_wheel(timer)->slots)
+		snd_timer_wheel_del(snd_timer_wheel(timer), timeri);
+	else
+		list_del_init(&timeri->active_list);
 	if (timer->card && timer->card->shutdown)
 		goto unlock;
 	if (stop) {
@@ -636,18 +884,31 @@ int snd_timer_pause(struct snd_timer_instance * timeri)
  */
 static void snd_timer_reschedule(struct snd_timer * timer, unsigned long ticks_left)
 {
-	struct snd_timer_instance *ti;
+	struct snd_timer_wheel *w = snd_timer_wheel(timer);
+	struct snd_timer_instance *ti, *tmp;
 	unsigned long ticks = ~0UL;
 
-	list_for_each_entry(ti, &timer->active_list_head, active_list) {
-		if (ti->flags & SNDRV_TIMER_IFLG_START) {
+	if (w->slots) {
+		/* only the pending starts are left on the active list */
+		list_for_each_entry_safe(ti, tmp, &timer->active_list_head,
+					 active_list) {
 			ti->flags &= ~SNDRV_TIMER_IFLG_START;
 			ti->flags |= SNDRV_TIMER_IFLG_RUNNING;
 			timer->running++;
+			snd_timer_wheel_start(timer, ti);
 		}
-		if (ti->flags & SNDRV_TIMER_IFLG_RUNNING) {
-			if (ticks > ti->cticks)
-				ticks = ti->cticks;
+		ticks = snd_timer_wheel_first(w);
+	} else {
+		list_for_each_entry(ti, &timer->active_list_head, active_list) {
+			if (ti->flags & SNDRV_TIMER_IFLG_START) {
+				ti->flags &= ~SNDRV_TIMER_IFLG_START;
+				ti->flags |= SNDRV_TIMER_IFLG_RUNNING;
+				timer->running++;
+			}
+			if (ti->flags & SNDRV_TIMER_IFLG_RUNNING) {
+				if (ticks > ti->cticks)
+					ticks = ti->cticks;
+			}
 		}
 	}
 	if (ticks == ~0UL) {
@@ -685,8 +946,7 @@ static void snd_timer_tasklet(unsigned long arg)
 		/* remove from ack_list and make empty */
 		list_del_init(p);
 
-		ticks = ti->pticks;
-		ti->pticks = 0;
+		ticks = snd_timer_take_pticks(ti);
 		resolution = ti->resolution;
 
 		ti->flags |= SNDRV_TIMER_IFLG_CALLBACK;
@@ -699,33 +959,35 @@ static void snd_timer_tasklet(unsigned long arg)
 	spin_unlock_irqrestore(&timer->lock, flags);
 }
 
-/*
- * timer interrupt
- *
- * ticks_left is usually equal to timer->sticks.
- *
- */
-void snd_timer_interrupt(struct snd_timer * timer, unsigned long ticks_left)
+/* queue the callbacks of an expired instance and of its slaves */
+static void snd_timer_queue_ack(struct snd_timer *timer,
+				struct snd_timer_instance *ti,
+				unsigned long pticks, unsigned long resolution)
 {
-	struct snd_timer_instance *ti, *ts, *tmp;
-	unsigned long resolution, ticks;
-	struct list_head *p, *ack_list_head;
-	unsigned long flags;
-	int use_tasklet = 0;
-
-	if (timer == NULL)
-		return;
-
-	if (timer->card && timer->card->shutdown)
-		return;
-
-	spin_lock_irqsave(&timer->lock, flags);
+	struct snd_timer_instance *ts;
+	struct list_head *ack_list_head;
 
-	/* remember the current resolution */
-	if (timer->hw.c_resolution)
-		resolution = timer->hw.c_resolution(timer);
+	if ((timer->hw.flags & SNDRV_TIMER_HW_TASKLET) ||
+	    (ti->flags & SNDRV_TIMER_IFLG_FAST))
+		ack_list_head = &timer->ack_list_head;
 	else
-		resolution = timer->hw.resolution;
+		ack_list_head = &timer->sack_list_head;
+	if (list_empty(&ti->ack_list))
+		list_add_tail(&ti->ack_list, ack_list_head);
+	list_for_each_entry(ts, &ti->slave_active_head, active_list) {
+		ts->pticks = pticks;
+		ts->resolution = resolution;
+		if (list_empty(&ts->ack_list))
+			list_add_tail(&ts->ack_list, ack_list_head);
+	}
+}
+
+/* the plain list walk for the timers without a wheel */
+static void snd_timer_list_expire(struct snd_timer *timer,
+				  unsigned long ticks_left,
+				  unsigned long resolution)
+{
+	struct snd_timer_instance *ti, *tmp;
 
 	/* loop for all active instances
 	 * Here we cannot use list_for_each_entry because the active_list of a
@@ -751,20 +1013,75 @@ void snd_timer_interrupt(struct snd_timer * timer, unsigned long ticks_left)
 			--timer->running;
 			list_del_init(&ti->active_list);
 		}
-		if ((timer->hw.flags & SNDRV_TIMER_HW_TASKLET) ||
-		    (ti->flags & SNDRV_TIMER_IFLG_FAST))
-			ack_list_head = &timer->ack_list_head;
-		else
-			ack_list_head = &timer->sack_list_head;
-		if (list_empty(&ti->ack_list))
-			list_add_tail(&ti->ack_list, ack_list_head);
-		list_for_each_entry(ts, &ti->slave_active_head, active_list) {
-			ts->pticks = ti->pticks;
-			ts->resolution = resolution;
-			if (list_empty(&ts->ack_list))
-				list_add_tail(&ts->ack_list, ack_list_head);
+		snd_timer_queue_ack(timer, ti, ti->pticks, resolution);
+	}
+}
+
+/*
+ * advance the timer wheel by ticks_left and handle the expired instances;
+ * the auto-reloaded ones are requeued relative to the new clock, as the
+ * list walk reloads cticks on the interrupt that expires them
+ */
+static void snd_timer_wheel_expire(struct snd_timer *timer,
+				   unsigned long ticks_left,
+				   unsigned long resolution)
+{
+	struct snd_timer_wheel *w = snd_timer_wheel(timer);
+	struct snd_timer_instance *ti, *tmp;
+	LIST_HEAD(expired);
+
+	snd_timer_wheel_advance(w, ticks_left, &expired);
+	list_for_each_entry_safe(ti, tmp, &expired, active_list) {
+		ti->resolution = resolution;
+		if (ti->flags & SNDRV_TIMER_IFLG_AUTO) {
+			ti->cticks = ti->ticks;
+			snd_timer_wheel_add(w, ti);
+		} else {
+			ti->flags &= ~SNDRV_TIMER_IFLG_RUNNING;
+			--timer->running;
+			list_del_init(&ti->active_list);
+			ti->cticks = 0;
+			ti->pticks += w->now;
 		}
+		snd_timer_queue_ack(timer, ti,
+				    ti->flags & SNDRV_TIMER_IFLG_RUNNING ?
+				    ti->pticks + w->now : ti->pticks,
+				    resolution);
 	}
+}
+
+/*
+ * timer interrupt
+ *
+ * ticks_left is usually equal to timer->sticks.
+ *
+ */
+void snd_timer_interrupt(struct snd_timer * timer, unsigned long ticks_left)
+{
+	struct snd_timer_instance *ti;
+	unsigned long resolution, ticks;
+	struct list_head *p;
+	unsigned long flags;
+	int use_tasklet = 0;
+
+	if (timer == NULL)
+		return;
+
+	if (timer->card && timer->card->shutdown)
+		return;
+
+	spin_lock_irqsave(&timer->lock, flags);
+
+	/* remember the current resolution */
+	if (timer->hw.c_resolution)
+		resolution = timer->hw.c_resolution(timer);
+	else
+		resolution = timer->hw.resolution;
+
+	if (snd_timer_wheel(timer)->slots)
+		snd_timer_wheel_expire(timer, ticks_left, resolution);
+	else
+		snd_timer_list_expire(timer, ticks_left, resolution);
 	if (timer->flags & SNDRV_TIMER_FLG_RESCHED)
 		snd_timer_reschedule(timer, timer->sticks);
 	if (timer->running) {
@@ -790,8 +1107,7 @@ void snd_timer_interrupt(struct snd_timer * timer, unsigned long ticks_left)
 		/* remove from ack_list and make empty */
 		list_del_init(p);
 
-		ticks = ti->pticks;
-		ti->pticks = 0;
+		ticks = snd_timer_take_pticks(ti);
 
 		ti->flags |= SNDRV_TIMER_IFLG_CALLBACK;
 		spin_unlock(&timer->lock);
@@ -828,7 +1144,9 @@ int snd_timer_new(struct snd_card *card, char *id, struct snd_timer_id *tid,
 		return -EINVAL;
 	if (rtimer)
 		*rtimer = NULL;
-	timer = kzalloc(sizeof(*timer), GFP_KERNEL);
+	/* the wheel state lives right behind the timer */
+	timer = kzalloc(sizeof(*timer) + sizeof(struct snd_timer_wheel),
+			GFP_KERNEL);
 	if (!timer)
 		return -ENOMEM;
 	timer->tmr_class = tid->dev_class;
@@ -880,6 +1198,7 @@ static int snd_timer_free(struct snd_timer *timer)
 
 	if (timer->private_free)
 		timer->private_free(timer);
+	kfree(snd_timer_wheel(timer)->slots);
 	kfree(timer);
 	return 0;
 }
@@ -31,7 +31,10 @@
 
 #include <linux/init.h>
 #include <linux/jiffies.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/time.h>
 #include <linux/wait.h>
 #include <linux/module.h>
@@ -54,6 +57,9 @@ static char *id[SNDRV_CARDS] = SNDRV_DEFAULT_STR;	/* ID for this card */
 static bool enable[SNDRV_CARDS] = {1, [1 ... (SNDRV_CARDS - 1)] = 0};
 static int pcm_substreams[SNDRV_CARDS] = {[0 ... (SNDRV_CARDS - 1)] = 8};
 static int pcm_notify[SNDRV_CARDS];
+static bool hrtimer[SNDRV_CARDS];
+static bool shared_buffer[SNDRV_CARDS];
+static int shared_delay[SNDRV_CARDS];
 
 module_param_array(index, int, NULL, 0444);
 MODULE_PARM_DESC(index, "Index value for loopback soundcard.");
@@ -65,24 +71,60 @@ module_param_array(pcm_substreams, int, NULL, 0444);
 MODULE_PARM_DESC(pcm_substreams, "PCM substreams # (1-8) for loopback driver.");
 module_param_array(pcm_notify, int, NULL, 0444);
 MODULE_PARM_DESC(pcm_notify, "Break capture when PCM format/rate/channels changes.");
+module_param_array(hrtimer, bool, NULL, 0444);
+MODULE_PARM_DESC(hrtimer, "Clock the cables by hrtimer in nanoseconds instead of jiffies.");
+module_param_array(shared_buffer, bool, NULL, 0444);
+MODULE_PARM_DESC(shared_buffer, "Capture reads the playback pages of a cable instead of a copy.");
+module_param_array(shared_delay, int, NULL, 0444);
+MODULE_PARM_DESC(shared_delay, "Frames the capture trails the playback by with shared_buffer.");
 
 #define NO_PITCH 100000
 
+#define CONV_MAX_CHANNELS	32	/* loopback_pcm_hardware.channels_max */
+#define CONV_FRAMES		64	/* frames converted per round */
+
 struct loopback_pcm;
 
 struct loopback_cable {
 	spinlock_t lock;
 	struct loopback_pcm *streams[2];
 	struct snd_pcm_hardware hw;
+	unsigned int number;	/* substream number of the cable */
 	/* flags */
 	unsigned int valid;
 	unsigned int running;
 	unsigned int pause;
+	bool hrtimer;		/* clocked in ns by hrtimer, else in jiffies */
+	/* both ends map these pages in shared buffer mode */
+	bool shared;
+	void *shared_area;
+	size_t shared_bytes;
+	unsigned int shared_users;
+	/* fan-out taps of the playback */
+	struct list_head taps;		/* loopback_pcm.tap_list */
+	struct list_head convs;		/* loopback_conv.list */
+};
+
+/* conversion shared by the taps of a cable that use the same format */
+struct loopback_conv {
+	struct list_head list;
+	struct list_head taps;		/* loopback_pcm.conv_list */
+	snd_pcm_format_t format;
+	unsigned int rate;
+	unsigned int channels;
+	unsigned int frame_bytes;
+	/* linear interpolation, reset when the source rate changes */
+	unsigned int src_rate;
+	unsigned int phase;		/* in 1/rate of a source frame */
+	s32 prev[CONV_MAX_CHANNELS];
+	s32 next[CONV_MAX_CHANNELS];
+	char buf[];			/* CONV_FRAMES output frames */
 };
 
 struct loopback_setup {
 	unsigned int notify: 1;
 	unsigned int rate_shift;
+	unsigned int source;	/* playback substream feeding the capture */
 	unsigned int format;
 	unsigned int rate;
 	unsigned int channels;
@@ -98,6 +140,9 @@ struct loopback {
 	struct loopback_cable *cables[MAX_PCM_SUBSTREAMS][2];
 	struct snd_pcm *pcm[2];
 	struct loopback_setup setup[MAX_PCM_SUBSTREAMS][2];
+	bool hrtimer;
+	bool shared;
+	unsigned int shared_delay;	/* frames */
 };
 
 struct loopback_pcm {
@@ -114,36 +159,78 @@ struct loopback_pcm {
 	unsigned int pcm_rate_shift;	/* rate shift value */
 	/* flags */
 	unsigned int period_update_pending :1;
-	/* timer stuff */
-	unsigned int irq_pos;		/* fractional IRQ position */
-	unsigned int period_size_frac;
+	unsigned int tap :1;
+	unsigned int tap_running :1;
+	unsigned int shared_xrun :1;	/* playback overwrote unread data */
+	unsigned int shared_delay;	/* bytes the capture trails by */
+	/* fan-out tap of another substream's playback */
+	struct loopback_conv *conv;
+	struct list_head tap_list;
+	struct list_head conv_list;
+	unsigned int tap_ahead;		/* bytes written past buf_pos */
+	unsigned int tap_lead;		/* bytes kept ahead after an underrun */
+	unsigned int tap_underruns;
+	unsigned int tap_overruns;
+	/* timer stuff, positions are in bytes * clock ticks */
+	u64 irq_pos;			/* fractional IRQ position */
+	u64 period_size_frac;
 	unsigned int last_drift;
-	unsigned long last_jiffies;
+	unsigned int pitch_rem;		/* ns carried by the hrtimer pitch */
+	u64 last_tick;			/* jiffies or ns */
 	struct timer_list timer;
+	struct hrtimer hrtimer;
 };
 
 static struct platform_device *devices[SNDRV_CARDS];
 
-static inline unsigned int byte_pos(struct loopback_pcm *dpcm, unsigned int x)
+/*
+ * The jiffies clock applies the pitch to the byte positions, while the
+ * hrtimer clock applies it to the elapsed time (see pitch_ns()) so that
+ * bytes * ns stays well inside 64 bits.
+ */
+static inline unsigned int byte_pos(struct loopback_pcm *dpcm, u64 x)
 {
-	if (dpcm->pcm_rate_shift == NO_PITCH) {
-		x /= HZ;
+	unsigned int pos;
+
+	if (dpcm->cable->hrtimer) {
+		pos = div_u64(x, NSEC_PER_SEC);
+	} else if (dpcm->pcm_rate_shift == NO_PITCH) {
+		pos = div_u64(x, HZ);
 	} else {
-		x = div_u64(NO_PITCH * (unsigned long long)x,
-			    HZ * (unsigned long long)dpcm->pcm_rate_shift);
+		pos = div_u64(NO_PITCH * x,
+			      HZ * (unsigned long long)dpcm->pcm_rate_shift);
 	}
-	return x - (x % dpcm->pcm_salign);
+	return pos - (pos % dpcm->pcm_salign);
 }
 
-static inline unsigned int frac_pos(struct loopback_pcm *dpcm, unsigned int x)
+static inline u64 frac_pos(struct loopback_pcm *dpcm, unsigned int x)
 {
-	if (dpcm->pcm_rate_shift == NO_PITCH) {	/* no pitch */
-		return x * HZ;
-	} else {
-		x = div_u64(dpcm->pcm_rate_shift * (unsigned long long)x * HZ,
-			    NO_PITCH);
-	}
-	return x;
+	if (dpcm->cable->hrtimer)
+		return (u64)x * NSEC_PER_SEC;
+	if (dpcm->pcm_rate_shift == NO_PITCH)	/* no pitch */
+		return (u64)x * HZ;
+	return div_u64(dpcm->pcm_rate_shift * (unsigned long long)x * HZ,
+		       NO_PITCH);
+}
+
+/* stream time for ns of wall time, keeping the remainder */
+static inline u64 pitch_ns(struct loopback_pcm *dpcm, u64 ns)
+{
+	u32 rem;
+
+	if (dpcm->pcm_rate_shift == NO_PITCH)
+		return ns;
+	ns = div_u64_rem(ns * NO_PITCH + dpcm->pitch_rem,
+			 dpcm->pcm_rate_shift, &rem);
+	dpcm->pitch_rem = rem;
+	return ns;
+}
+
+static inline u64 loopback_clock(struct loopback_cable *cable)
+{
+	if (cable->hrtimer)
+		return ktime_get_ns();
+	return get_jiffies_64();
 }
 
 static inline struct loopback_setup *get_setup(struct loopback_pcm *dpcm)
@@ -168,7 +255,7 @@ static inline unsigned int get_rate_shift(struct loopback_pcm *dpcm)
 /* call in cable->lock */
 static void loopback_timer_start(struct loopback_pcm *dpcm)
 {
-	unsigned long tick;
+	u64 tick;
 	unsigned int rate_shift = get_rate_shift(dpcm);
 
 	if (rate_shift != dpcm->pcm_rate_shift) {
@@ -176,21 +263,165 @@ static void loopback_timer_start(struct loopback_pcm *dpcm)
 		dpcm->period_size_frac = frac_pos(dpcm, dpcm->pcm_period_size);
 	}
 	if (dpcm->period_size_frac <= dpcm->irq_pos) {
-		dpcm->irq_pos %= dpcm->period_size_frac;
+		div64_u64_rem(dpcm->irq_pos, dpcm->period_size_frac,
+			      &dpcm->irq_pos);
 		dpcm->period_update_pending = 1;
 	}
 	tick = dpcm->period_size_frac - dpcm->irq_pos;
-	tick = (tick + dpcm->pcm_bps - 1) / dpcm->pcm_bps;
-	mod_timer(&dpcm->timer, jiffies + tick);
+	tick = div_u64(tick + dpcm->pcm_bps - 1, dpcm->pcm_bps);
+	if (dpcm->cable->hrtimer) {
+		/* back from stream time to wall time, rounding up */
+		if (dpcm->pcm_rate_shift != NO_PITCH)
+			tick = div_u64(tick * dpcm->pcm_rate_shift +
+				       NO_PITCH - 1, NO_PITCH);
+		hrtimer_start(&dpcm->hrtimer, ns_to_ktime(tick),
+			      HRTIMER_MODE_REL);
+		return;
+	}
+	mod_timer(&dpcm->timer, jiffies + (unsigned long)tick);
 }
 
 /* call in cable->lock */
 static inline void loopback_timer_stop(struct loopback_pcm *dpcm)
 {
+	if (dpcm->cable->hrtimer) {
+		/* this may run in the callback via snd_pcm_period_elapsed();
+		 * an expiry that slips through sees the stream stopped */
+		hrtimer_try_to_cancel(&dpcm->hrtimer);
+		return;
+	}
 	del_timer(&dpcm->timer);
 	dpcm->timer.expires = 0;
 }
 
+static inline void loopback_timer_sync(struct loopback_pcm *dpcm)
+{
+	if (dpcm->cable->hrtimer)
+		hrtimer_cancel(&dpcm->hrtimer);
+	else
+		del_timer_sync(&dpcm->timer);
+}
+
+/*
+ * Fan-out taps
+ *
+ * A capture substream whose "PCM Slave Substream" control names another
+ * substream is opened as a tap of that substream's cable.  Any number of
+ * taps may follow one playback, each in its own format, rate and channel
+ * count.  A tap keeps its own clock like any capture, and is fed from
+ * loopback_pos_update() whenever the playback advances: the data is
+ * converted once for all taps sharing a format (struct loopback_conv)
+ * and written ahead of each tap's position.  A tap that runs dry gets
+ * silence plus a short lead, which absorbs the rounding between the two
+ * clocks.
+ */
+
+/* IEEE754 single to s32 with 1.0 at 2^31, without the FPU */
+static s32 float_to_s32(u32 f)
+{
+	int shift = (int)((f >> 23) & 0xff) - 119;
+	u32 mant = (f & 0x7fffff) | 0x800000;
+	u32 v;
+
+	if (shift >= 8)
+		v = 0x7fffffff;
+	else if (shift >= 0)
+		v = mant << shift;
+	else if (shift > -24)
+		v = mant >> -shift;
+	else
+		v = 0;
+	return (f & 0x80000000) ? -v : v;
+}
+
+static u32 s32_to_float(s32 s)
+{
+	u32 mag = s < 0 ? -(u32)s : s;
+	int top;
+
+	if (!mag)
+		return 0;
+	top = fls(mag) - 1;
+	mag = top > 23 ? mag >> (top - 23) : mag << (23 - top);
+	return (s < 0 ? 0x80000000 : 0) | (u32)(top + 96) << 23 |
+		(mag & 0x7fffff);
+}
+
+/* one sample of the formats in loopback_pcm_hardware, MSB aligned */
+static s32 conv_get(snd_pcm_format_t format, const void *p)
+{
+	switch (format) {
+	case SNDRV_PCM_FORMAT_S16_LE:
+		return (u32)le16_to_cpup(p) << 16;
+	case SNDRV_PCM_FORMAT_S16_BE:
+		return (u32)be16_to_cpup(p) << 16;
+	case SNDRV_PCM_FORMAT_S32_LE:
+		return le32_to_cpup(p);
+	case SNDRV_PCM_FORMAT_S32_BE:
+		return be32_to_cpup(p);
+	case SNDRV_PCM_FORMAT_FLOAT_LE:
+		return float_to_s32(le32_to_cpup(p));
+	case SNDRV_PCM_FORMAT_FLOAT_BE:
+		return float_to_s32(be32_to_cpup(p));
+	default:
+		return 0;
+	}
+}
+
+static void conv_put(snd_pcm_format_t format, void *p, s32 v)
+{
+	switch (format) {
+	case SNDRV_PCM_FORMAT_S16_LE:
+		*(__le16 *)p = cpu_to_le16(v >> 16);
+		break;
+	case SNDRV_PCM_FORMAT_S16_BE:
+		*(__be16 *)p = cpu_to_be16(v >> 16);
+		break;
+	case SNDRV_PCM_FORMAT_S32_LE:
+		*(__le32 *)p = cpu_to_le32(v);
+		break;
+	case SNDRV_PCM_FORMAT_S32_BE:
+		*(__be32 *)p = cpu_to_be32(v);
+		break;
+	case SNDRV_PCM_FORMAT_FLOAT_LE:
+		*(__le32 *)p = cpu_to_le32(s32_to_float(v));
+		break;
+	case SNDRV_PCM_FORMAT_FLOAT_BE:
+		*(__be32 *)p = cpu_to_be32(s32_to_float(v));
+		break;
+	default:
+		break;
+	}
+}
+
+/* call in cable->lock: append data, or silence if src is NULL */
+static void tap_fill(struct loopback_pcm *tap, const char *src,
+		     unsigned int bytes)
+{
+	struct snd_pcm_runtime *runtime = tap->substream->runtime;
+	char *dst = runtime->dma_area;
+	unsigned int dst_off, size;
+
+	dst_off = (tap->buf_pos + tap->tap_ahead) % tap->pcm_buffer_size;
+	tap->tap_ahead += bytes;
+	while (bytes) {
+		size = bytes;
+		if (dst_off + size > tap->pcm_buffer_size)
+			size = tap->pcm_buffer_size - dst_off;
+		if (src) {
+			memcpy(dst + dst_off, src, size);
+			src += size;
+		} else {
+			snd_pcm_format_set_silence(runtime->format,
+						   dst + dst_off,
+						   bytes_to_frames(runtime, size) *
+						   runtime->channels);
+		}
+		bytes -= size;
+		dst_off = 0;
+	}
+}
+
 #define CABLE_VALID_PLAYBACK	(1 << SNDRV_PCM_STREAM_PLAYBACK)
 #define CABLE_VALID_CAPTURE	(1 << SNDRV_PCM_STREAM_CAPTURE)
 #define CABLE_VALID_BOTH	(CABLE_VALID_PLAYBACK|CABLE_VALID_CAPTURE)
@@ -252,6 +483,45 @@ static void loopback_active_notify(struct loopback_pcm *dpcm)
 		       &get_setup(dpcm)->active_id);
 }
 
+static int loopback_tap_trigger(struct loopback_pcm *dpcm, int cmd)
+{
+	struct loopback_cable *cable = dpcm->cable;
+
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+		dpcm->pcm_rate_shift = 0;
+		dpcm->pitch_rem = 0;
+		dpcm->last_drift = 0;
+		spin_lock(&cable->lock);
+		dpcm->last_tick = loopback_clock(cable);
+		dpcm->tap_running = 1;
+		dpcm->tap_ahead = 0;
+		tap_fill(dpcm, NULL, dpcm->tap_lead);
+		loopback_timer_start(dpcm);
+		spin_unlock(&cable->lock);
+		break;
+	case SNDRV_PCM_TRIGGER_STOP:
+	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+	case SNDRV_PCM_TRIGGER_SUSPEND:
+		spin_lock(&cable->lock);
+		dpcm->tap_running = 0;
+		loopback_timer_stop(dpcm);
+		spin_unlock(&cable->lock);
+		break;
+	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+	case SNDRV_PCM_TRIGGER_RESUME:
+		spin_lock(&cable->lock);
+		dpcm->last_tick = loopback_clock(cable);
+		dpcm->tap_running = 1;
+		loopback_timer_start(dpcm);
+		spin_unlock(&cable->lock);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
 static int loopback_trigger(struct snd_pcm_substream *substream, int cmd)
 {
 	struct snd_pcm_runtime *runtime = substream->runtime;
@@ -259,13 +529,17 @@ static int loopback_trigger(struct snd_pcm_substream *substream, int cmd)
 	struct loopback_cable *cable = dpcm->cable;
 	int err, stream = 1 << substream->stream;
 
+	if (dpcm->tap)
+		return loopback_tap_trigger(dpcm, cmd);
+
 	switch (cmd) {
 	case SNDRV_PCM_TRIGGER_START:
 		err = loopback_check_format(cable, substream->stream);
 		if (err < 0)
 			return err;
-		dpcm->last_jiffies = jiffies;
+		dpcm->last_tick = loopback_clock(cable);
 		dpcm->pcm_rate_shift = 0;
+		dpcm->pitch_rem = 0;
 		dpcm->last_drift = 0;
 		spin_lock(&cable->lock);	
 		cable->running |= stream;
@@ -294,7 +568,7 @@ static int loopback_trigger(struct snd_pcm_substream *substream, int cmd)
 	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
 	case SNDRV_PCM_TRIGGER_RESUME:
 		spin_lock(&cable->lock);
-		dpcm->last_jiffies = jiffies;
+		dpcm->last_tick = loopback_clock(cable);
 		cable->pause &= ~stream;
 		loopback_timer_start(dpcm);
 		spin_unlock(&cable->lock);
@@ -335,6 +609,67 @@ static void params_change(struct snd_pcm_substream *substream)
 				runtime);
 }
 
+/* call in cable->lock */
+static void loopback_tap_detach(struct loopback_pcm *dpcm)
+{
+	struct loopback_conv *conv = dpcm->conv;
+
+	if (!conv)
+		return;
+	list_del(&dpcm->conv_list);
+	dpcm->conv = NULL;
+	if (list_empty(&conv->taps)) {
+		list_del(&conv->list);
+		kfree(conv);
+	}
+}
+
+/* join the conversion for the tap's format, creating it if needed */
+static int loopback_tap_prepare(struct loopback_pcm *dpcm)
+{
+	struct snd_pcm_runtime *runtime = dpcm->substream->runtime;
+	struct loopback_cable *cable = dpcm->cable;
+	struct loopback_conv *conv, *new = NULL;
+
+	dpcm->tap_ahead = 0;
+	dpcm->tap_lead = frames_to_bytes(runtime,
+					 max(runtime->rate / 1000, 1U));
+	dpcm->tap_underruns = 0;
+	dpcm->tap_overruns = 0;
+
+	mutex_lock(&dpcm->loopback->cable_lock);
+	list_for_each_entry(conv, &cable->convs, list) {
+		if (conv->format == runtime->format &&
+		    conv->rate == runtime->rate &&
+		    conv->channels == runtime->channels)
+			goto found;
+	}
+	new = kzalloc(sizeof(*new) + frames_to_bytes(runtime, CONV_FRAMES),
+		      GFP_KERNEL);
+	if (!new) {
+		mutex_unlock(&dpcm->loopback->cable_lock);
+		return -ENOMEM;
+	}
+	INIT_LIST_HEAD(&new->taps);
+	new->format = runtime->format;
+	new->rate = runtime->rate;
+	new->channels = runtime->channels;
+	new->frame_bytes = frames_to_bytes(runtime, 1);
+	conv = new;
+ found:
+	spin_lock_irq(&cable->lock);
+	if (dpcm->conv != conv) {
+		loopback_tap_detach(dpcm);
+		if (new)
+			list_add_tail(&new->list, &cable->convs);
+		list_add_tail(&dpcm->conv_list, &conv->taps);
+		dpcm->conv = conv;
+	}
+	spin_unlock_irq(&cable->lock);
+	mutex_unlock(&dpcm->loopback->cable_lock);
+	return 0;
+}
+
 static int loopback_prepare(struct snd_pcm_substream *substream)
 {
 	struct snd_pcm_runtime *runtime = substream->runtime;
@@ -350,7 +685,16 @@ static int loopback_prepare(struct snd_pcm_substream *substream)
 
 	dpcm->buf_pos = 0;
 	dpcm->pcm_buffer_size = frames_to_bytes(runtime, runtime->buffer_size);
-	if (substream->stream == SNDRV_PCM_STREAM_CAPTURE) {
+	dpcm->shared_xrun = 0;
+	if (cable->shared && !dpcm->tap) {
+		/* the pages hold the playback data, leave them alone */
+		if (substream->stream == SNDRV_PCM_STREAM_CAPTURE)
+			dpcm->shared_delay = frames_to_bytes(runtime,
+				min_t(snd_pcm_uframes_t,
+				      dpcm->loopback->shared_delay,
+				      runtime->buffer_size -
+				      runtime->period_size));
+	} else if (substream->stream == SNDRV_PCM_STREAM_CAPTURE) {
 		/* clear capture buffer */
 		dpcm->silent_size = dpcm->pcm_buffer_size;
 		snd_pcm_format_set_silence(runtime->format, runtime->dma_area,
@@ -363,6 +707,9 @@ static int loopback_prepare(struct snd_pcm_substream *substream)
 	dpcm->pcm_salign = salign;
 	dpcm->pcm_period_size = frames_to_bytes(runtime, runtime->period_size);
 
+	if (dpcm->tap)
+		return loopback_tap_prepare(dpcm);
+
 	mutex_lock(&dpcm->loopback->cable_lock);
 	if (!(cable->valid & ~(1 << substream->stream)) ||
             (get_setup(dpcm)->notify &&
@@ -400,16 +747,11 @@ static void clear_capture_buf(struct loopback_pcm *dpcm, unsigned int bytes)
 	}
 }
 
-static void copy_play_buf(struct loopback_pcm *play,
-			  struct loopback_pcm *capt,
-			  unsigned int bytes)
+/* how many of the next bytes hold playback data */
+static unsigned int play_valid_bytes(struct loopback_pcm *play,
+				     unsigned int bytes)
 {
 	struct snd_pcm_runtime *runtime = play->substream->runtime;
-	char *src = runtime->dma_area;
-	char *dst = capt->substream->runtime->dma_area;
-	unsigned int src_off = play->buf_pos;
-	unsigned int dst_off = capt->buf_pos;
-	unsigned int clear_bytes = 0;
 
 	/* check if playback is draining, trim the capture copy size
 	 * when our pointer is at the end of playback ring buffer */
@@ -422,11 +764,25 @@ static void copy_play_buf(struct loopback_pcm *play,
 		if (appl_ptr < appl_ptr1)
 			appl_ptr1 -= runtime->buffer_size;
 		diff = (appl_ptr - appl_ptr1) * play->pcm_salign;
-		if (diff < bytes) {
-			clear_bytes = bytes - diff;
+		if (diff < bytes)
 			bytes = diff;
-		}
 	}
+	return bytes;
+}
+
+static void copy_play_buf(struct loopback_pcm *play,
+			  struct loopback_pcm *capt,
+			  unsigned int bytes)
+{
+	struct snd_pcm_runtime *runtime = play->substream->runtime;
+	char *src = runtime->dma_area;
+	char *dst = capt->substream->runtime->dma_area;
+	unsigned int src_off = play->buf_pos;
+	unsigned int dst_off = capt->buf_pos;
+	unsigned int clear_bytes;
+
+	clear_bytes = bytes - play_valid_bytes(play, bytes);
+	bytes -= clear_bytes;
 
 	for (;;) {
 		unsigned int size = bytes;
@@ -450,19 +806,22 @@ static void copy_play_buf(struct loopback_pcm *play,
 }
 
 static inline unsigned int bytepos_delta(struct loopback_pcm *dpcm,
-					 unsigned int jiffies_delta)
+					 u64 tick_delta)
 {
 	unsigned long last_pos;
 	unsigned int delta;
 
+	if (dpcm->cable->hrtimer)
+		tick_delta = pitch_ns(dpcm, tick_delta);
 	last_pos = byte_pos(dpcm, dpcm->irq_pos);
-	dpcm->irq_pos += jiffies_delta * dpcm->pcm_bps;
+	dpcm->irq_pos += tick_delta * dpcm->pcm_bps;
 	delta = byte_pos(dpcm, dpcm->irq_pos) - last_pos;
 	if (delta >= dpcm->last_drift)
 		delta -= dpcm->last_drift;
 	dpcm->last_drift = 0;
 	if (dpcm->irq_pos >= dpcm->period_size_frac) {
-		dpcm->irq_pos %= dpcm->period_size_frac;
+		div64_u64_rem(dpcm->irq_pos, dpcm->period_size_frac,
+			      &dpcm->irq_pos);
 		dpcm->period_update_pending = 1;
 	}
 	return delta;
@@ -475,6 +834,236 @@ static inline void bytepos_finish(struct loopback_pcm *dpcm,
 	dpcm->buf_pos %= dpcm->pcm_buffer_size;
 }
 
+/* call in cable->lock: feed data into the taps, dropping what overruns */
+static void tap_write(struct loopback_pcm *tap, const char *src,
+		      unsigned int bytes)
+{
+	unsigned int room = tap->pcm_period_size + tap->tap_lead;
+
+	if (!tap->tap_running)
+		return;
+	if (tap->tap_ahead + bytes > room) {
+		tap->tap_overruns++;
+		if (tap->tap_ahead >= room)
+			return;
+		bytes = room - tap->tap_ahead;
+	}
+	tap_fill(tap, src, bytes);
+}
+
+/* one source frame to conv->channels samples, folding or repeating */
+static void conv_load(struct loopback_conv *conv, s32 *dst, const char *src,
+		      snd_pcm_format_t format, unsigned int channels,
+		      unsigned int width)
+{
+	unsigned int c, i, n;
+	s64 sum;
+
+	if (conv->channels >= channels) {
+		for (c = 0; c < conv->channels; c++)
+			dst[c] = conv_get(format, src + (c % channels) * width);
+		return;
+	}
+	for (c = 0; c < conv->channels; c++) {
+		sum = 0;
+		for (i = c, n = 0; i < channels; i += conv->channels, n++)
+			sum += conv_get(format, src + i * width);
+		dst[c] = div_s64(sum, n);
+	}
+}
+
+/* store a frame into conv->buf, passing full buffers to the taps */
+static void conv_emit(struct loopback_conv *conv, const s32 *frame,
+		      unsigned int *frames)
+{
+	unsigned int width = conv->frame_bytes / conv->channels;
+	char *dst = conv->buf + *frames * conv->frame_bytes;
+	struct loopback_pcm *tap;
+	unsigned int c;
+
+	for (c = 0; c < conv->channels; c++, dst += width)
+		conv_put(conv->format, dst, frame[c]);
+	if (++*frames < CONV_FRAMES)
+		return;
+	list_for_each_entry(tap, &conv->taps, conv_list)
+		tap_write(tap, conv->buf, *frames * conv->frame_bytes);
+	*frames = 0;
+}
+
+static void loopback_feed_conv(struct loopback_conv *conv,
+			       struct loopback_pcm *play, unsigned int bytes)
+{
+	struct snd_pcm_runtime *runtime = play->substream->runtime;
+	unsigned int width = snd_pcm_format_physical_width(runtime->format) / 8;
+	unsigned int src_off = play->buf_pos;
+	unsigned int count = bytes / play->pcm_salign;
+	unsigned int frames = 0, c, w;
+	struct loopback_pcm *tap;
+	s32 out[CONV_MAX_CHANNELS];
+
+	if (conv->src_rate != runtime->rate) {
+		conv->src_rate = runtime->rate;
+		conv->phase = 0;
+		memset(conv->next, 0, sizeof(conv->next));
+	}
+
+	for (; count; count--) {
+		if (conv->rate == conv->src_rate) {
+			conv_load(conv, out, runtime->dma_area + src_off,
+				  runtime->format, runtime->channels, width);
+			conv_emit(conv, out, &frames);
+		} else {
+			/* outputs between the previous and this frame */
+			memcpy(conv->prev, conv->next,
+			       conv->channels * sizeof(s32));
+			conv_load(conv, conv->next, runtime->dma_area + src_off,
+				  runtime->format, runtime->channels, width);
+			for (; conv->phase < conv->rate;
+			     conv->phase += conv->src_rate) {
+				w = div_u64((u64)conv->phase << 15, conv->rate);
+				for (c = 0; c < conv->channels; c++)
+					out[c] = conv->prev[c] +
+						(((s64)conv->next[c] -
+						  conv->prev[c]) * w >> 15);
+				conv_emit(conv, out, &frames);
+			}
+			conv->phase -= conv->rate;
+		}
+		src_off += play->pcm_salign;
+		if (src_off >= play->pcm_buffer_size)
+			src_off = 0;
+	}
+
+	list_for_each_entry(tap, &conv->taps, conv_list)
+		tap_write(tap, conv->buf, frames * conv->frame_bytes);
+}
+
+static void loopback_feed_raw(struct loopback_conv *conv,
+			      struct loopback_pcm *play, unsigned int bytes)
+{
+	char *src = play->substream->runtime->dma_area;
+	unsigned int src_off = play->buf_pos;
+	struct loopback_pcm *tap;
+	unsigned int size;
+
+	while (bytes) {
+		size = bytes;
+		if (src_off + size > play->pcm_buffer_size)
+			size = play->pcm_buffer_size - src_off;
+		list_for_each_entry(tap, &conv->taps, conv_list)
+			tap_write(tap, src + src_off, size);
+		bytes -= size;
+		src_off = 0;
+	}
+}
+
+/* call in cable->lock, before the playback advances over bytes */
+static void loopback_feed_taps(struct loopback_cable *cable,
+			       struct loopback_pcm *play, unsigned int bytes)
+{
+	struct snd_pcm_runtime *runtime = play->substream->runtime;
+	struct loopback_conv *conv;
+	struct loopback_pcm *tap;
+
+	if (list_empty(&cable->convs))
+		return;
+	bytes = play_valid_bytes(play, bytes);
+	list_for_each_entry(conv, &cable->convs, list) {
+		list_for_each_entry(tap, &conv->taps, conv_list) {
+			if (tap->tap_running)
+				goto active;
+		}
+		continue;
+ active:
+		if (conv->format == runtime->format &&
+		    conv->rate == runtime->rate &&
+		    conv->channels == runtime->channels)
+			loopback_feed_raw(conv, play, bytes);
+		else
+			loopback_feed_conv(conv, play, bytes);
+	}
+}
+
+/* call in cable->lock */
+static void loopback_taps_update(struct loopback_cable *cable, u64 now,
+				 bool playing)
+{
+	struct loopback_pcm *tap;
+	unsigned int count;
+	u64 delta;
+
+	list_for_each_entry(tap, &cable->taps, tap_list) {
+		if (!tap->tap_running)
+			continue;
+		delta = now - tap->last_tick;
+		tap->last_tick += delta;
+		if (!delta)
+			continue;
+		count = bytepos_delta(tap, delta);
+		if (count > tap->tap_ahead) {
+			if (playing)
+				tap->tap_underruns++;
+			tap_fill(tap, NULL,
+				 count - tap->tap_ahead + tap->tap_lead);
+		}
+		tap->tap_ahead -= count;
+		bytepos_finish(tap, count);
+	}
+}
+
+/* call in cable->lock: where a shared capture should be */
+static unsigned int shared_capture_pos(struct loopback_cable *cable,
+				       struct loopback_pcm *capt)
+{
+	struct loopback_pcm *play = cable->streams[SNDRV_PCM_STREAM_PLAYBACK];
+
+	if (!play || !(cable->valid & CABLE_VALID_PLAYBACK))
+		return capt->buf_pos;
+	return (play->buf_pos + capt->pcm_buffer_size - capt->shared_delay) %
+		capt->pcm_buffer_size;
+}
+
+/*
+ * call in cable->lock
+ *
+ * In shared buffer mode nothing is copied: the capture pointer trails
+ * the playback pointer by shared_delay in the same pages, and its own
+ * clock only paces the period wakeups.  As the playback application
+ * refills the pages behind its pointer, the capture overruns once the
+ * queued playback data reaches what the capture has not read yet.
+ */
+static void loopback_shared_update(struct loopback_cable *cable,
+				   u64 delta_play, u64 delta_capt)
+{
+	struct loopback_pcm *dpcm_play =
+			cable->streams[SNDRV_PCM_STREAM_PLAYBACK];
+	struct loopback_pcm *dpcm_capt =
+			cable->streams[SNDRV_PCM_STREAM_CAPTURE];
+	struct snd_pcm_runtime *play_rt, *capt_rt;
+	unsigned int count;
+
+	if (delta_play) {
+		count = bytepos_delta(dpcm_play, delta_play);
+		loopback_feed_taps(cable, dpcm_play, count);
+		bytepos_finish(dpcm_play, count);
+	}
+	if (!delta_capt)
+		return;
+	bytepos_delta(dpcm_capt, delta_capt);
+	dpcm_capt->buf_pos = shared_capture_pos(cable, dpcm_capt);
+
+	if (!dpcm_play || !(cable->valid & CABLE_VALID_PLAYBACK))
+		return;
+	play_rt = dpcm_play->substream->runtime;
+	capt_rt = dpcm_capt->substream->runtime;
+	if (snd_pcm_playback_hw_avail(play_rt) +
+	    bytes_to_frames(capt_rt, dpcm_capt->shared_delay) +
+	    snd_pcm_capture_avail(capt_rt) > capt_rt->buffer_size) {
+		dpcm_capt->shared_xrun = 1;
+		dpcm_capt->period_update_pending = 1;
+	}
+}
+
 /* call in cable->lock */
 static unsigned int loopback_pos_update(struct loopback_cable *cable)
 {
@@ -482,18 +1071,25 @@ static unsigned int loopback_pos_update(struct loopback_cable *cable)
 			cable->streams[SNDRV_PCM_STREAM_PLAYBACK];
 	struct loopback_pcm *dpcm_capt =
 			cable->streams[SNDRV_PCM_STREAM_CAPTURE];
-	unsigned long delta_play = 0, delta_capt = 0;
+	u64 delta_play = 0, delta_capt = 0, now;
 	unsigned int running, count1, count2;
 
+	/* sample the clock once so that both streams see the same time */
+	now = loopback_clock(cable);
 	running = cable->running ^ cable->pause;
 	if (running & (1 << SNDRV_PCM_STREAM_PLAYBACK)) {
-		delta_play = jiffies - dpcm_play->last_jiffies;
-		dpcm_play->last_jiffies += delta_play;
+		delta_play = now - dpcm_play->last_tick;
+		dpcm_play->last_tick += delta_play;
 	}
 
 	if (running & (1 << SNDRV_PCM_STREAM_CAPTURE)) {
-		delta_capt = jiffies - dpcm_capt->last_jiffies;
-		dpcm_capt->last_jiffies += delta_capt;
+		delta_capt = now - dpcm_capt->last_tick;
+		dpcm_capt->last_tick += delta_capt;
+	}
+
+	if (cable->shared) {
+		loopback_shared_update(cable, delta_play, delta_capt);
+		goto unlock;
 	}
 
 	if (delta_play == 0 && delta_capt == 0)
@@ -501,6 +1097,7 @@ static unsigned int loopback_pos_update(struct loopback_cable *cable)
 		
 	if (delta_play > delta_capt) {
 		count1 = bytepos_delta(dpcm_play, delta_play - delta_capt);
+		loopback_feed_taps(cable, dpcm_play, count1);
 		bytepos_finish(dpcm_play, count1);
 		delta_play = delta_capt;
 	} else if (delta_play < delta_capt) {
@@ -523,19 +1120,25 @@ static unsigned int loopback_pos_update(struct loopback_cable *cable)
 		dpcm_play->last_drift = count1 - count2;
 	}
 	copy_play_buf(dpcm_play, dpcm_capt, count1);
+	loopback_feed_taps(cable, dpcm_play, count1);
 	bytepos_finish(dpcm_play, count1);
 	bytepos_finish(dpcm_capt, count1);
  unlock:
+	loopback_taps_update(cable, now,
+			     running & (1 << SNDRV_PCM_STREAM_PLAYBACK));
 	return running;
 }
 
 static void loopback_timer_function(unsigned long data)
 {
 	struct loopback_pcm *dpcm = (struct loopback_pcm *)data;
+	unsigned int running;
 	unsigned long flags;
 
 	spin_lock_irqsave(&dpcm->cable->lock, flags);
-	if (loopback_pos_update(dpcm->cable) & (1 << dpcm->substream->stream)) {
+	running = loopback_pos_update(dpcm->cable);
+	if (dpcm->tap ? dpcm->tap_running :
+	    running & (1 << dpcm->substream->stream)) {
 		loopback_timer_start(dpcm);
 		if (dpcm->period_update_pending) {
 			dpcm->period_update_pending = 0;
@@ -548,6 +1151,16 @@ static void loopback_timer_function(unsigned long data)
 	spin_unlock_irqrestore(&dpcm->cable->lock, flags);
 }
 
+/* loopback_timer_start() rearms the timer if the stream is still running */
+static enum hrtimer_restart loopback_hrtimer_function(struct hrtimer *timer)
+{
+	struct loopback_pcm *dpcm = container_of(timer, struct loopback_pcm,
+						 hrtimer);
+
+	loopback_timer_function((unsigned long)dpcm);
+	return HRTIMER_NORESTART;
+}
+
 static snd_pcm_uframes_t loopback_pointer(struct snd_pcm_substream *substream)
 {
 	struct snd_pcm_runtime *runtime = substream->runtime;
@@ -557,10 +1170,40 @@ static snd_pcm_uframes_t loopback_pointer(struct snd_pcm_substream *substream)
 	spin_lock(&dpcm->cable->lock);
 	loopback_pos_update(dpcm->cable);
 	pos = dpcm->buf_pos;
+	if (dpcm->shared_xrun)
+		pos = SNDRV_PCM_POS_XRUN;
 	spin_unlock(&dpcm->cable->lock);
+	if (pos == SNDRV_PCM_POS_XRUN)
+		return pos;
 	return bytes_to_frames(runtime, pos);
 }
 
+static int loopback_ioctl(struct snd_pcm_substream *substream,
+			  unsigned int cmd, void *arg)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct loopback_pcm *dpcm = runtime->private_data;
+	struct loopback_cable *cable = dpcm->cable;
+	unsigned long flags;
+	int err;
+
+	err = snd_pcm_lib_ioctl(substream, cmd, arg);
+	if (err < 0 || cmd != SNDRV_PCM_IOCTL1_RESET ||
+	    !cable->shared || dpcm->tap ||
+	    substream->stream != SNDRV_PCM_STREAM_CAPTURE ||
+	    snd_pcm_running(substream))
+		return err;
+
+	/* a shared capture starts out trailing the playback, with nothing
+	 * to read yet, rather than at the start of the pages */
+	spin_lock_irqsave(&cable->lock, flags);
+	dpcm->buf_pos = shared_capture_pos(cable, dpcm);
+	spin_unlock_irqrestore(&cable->lock, flags);
+	runtime->status->hw_ptr = bytes_to_frames(runtime, dpcm->buf_pos);
+	runtime->control->appl_ptr = runtime->status->hw_ptr;
+	return 0;
+}
+
 static struct snd_pcm_hardware loopback_pcm_hardware =
 {
 	.info =		(SNDRV_PCM_INFO_INTERLEAVED | SNDRV_PCM_INFO_MMAP |
@@ -590,11 +1233,58 @@ static void loopback_runtime_free(struct snd_pcm_runtime *runtime)
 	kfree(dpcm);
 }
 
+/* call in loopback->cable_lock */
+static void loopback_shared_release(struct loopback_pcm *dpcm)
+{
+	struct snd_pcm_runtime *runtime = dpcm->substream->runtime;
+	struct loopback_cable *cable = dpcm->cable;
+
+	if (!runtime->dma_area)
+		return;
+	runtime->dma_area = NULL;
+	runtime->dma_bytes = 0;
+	if (!--cable->shared_users) {
+		vfree(cable->shared_area);
+		cable->shared_area = NULL;
+	}
+}
+
 static int loopback_hw_params(struct snd_pcm_substream *substream,
 			      struct snd_pcm_hw_params *params)
 {
-	return snd_pcm_lib_alloc_vmalloc_buffer(substream,
-						params_buffer_bytes(params));
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct loopback_pcm *dpcm = runtime->private_data;
+	struct loopback_cable *cable = dpcm->cable;
+	size_t size = params_buffer_bytes(params);
+	int err = 0;
+
+	if (!cable->shared || dpcm->tap)
+		return snd_pcm_lib_alloc_vmalloc_buffer(substream, size);
+
+	mutex_lock(&dpcm->loopback->cable_lock);
+	if (runtime->dma_area) {
+		if (runtime->dma_bytes == size)
+			goto unlock;
+		loopback_shared_release(dpcm);
+	}
+	if (!cable->shared_area) {
+		cable->shared_area = vzalloc(size);
+		if (!cable->shared_area) {
+			err = -ENOMEM;
+			goto unlock;
+		}
+		cable->shared_bytes = size;
+	} else if (cable->shared_bytes != size) {
+		/* the other end already set the size */
+		err = -EINVAL;
+		goto unlock;
+	}
+	cable->shared_users++;
+	runtime->dma_area = cable->shared_area;
+	runtime->dma_bytes = size;
+ unlock:
+	mutex_unlock(&dpcm->loopback->cable_lock);
+	return err;
 }
 
 static int loopback_hw_free(struct snd_pcm_substream *substream)
@@ -604,7 +1294,18 @@ static int loopback_hw_free(struct snd_pcm_substream *substream)
 	struct loopback_cable *cable = dpcm->cable;
 
 	mutex_lock(&dpcm->loopback->cable_lock);
-	cable->valid &= ~(1 << substream->stream);
+	if (dpcm->tap) {
+		spin_lock_irq(&cable->lock);
+		loopback_tap_detach(dpcm);
+		spin_unlock_irq(&cable->lock);
+	} else {
+		cable->valid &= ~(1 << substream->stream);
+		if (cable->shared) {
+			loopback_shared_release(dpcm);
+			mutex_unlock(&dpcm->loopback->cable_lock);
+			return 0;
+		}
+	}
 	mutex_unlock(&dpcm->loopback->cable_lock);
 	return snd_pcm_lib_free_vmalloc_buffer(substream);
 }
@@ -666,6 +1367,7 @@ static int loopback_open(struct snd_pcm_substream *substream)
 	struct loopback_cable *cable;
 	int err = 0;
 	int dev = get_cable_index(substream);
+	int number = substream->number;
 
 	mutex_lock(&loopback->cable_lock);
 	dpcm = kzalloc(sizeof(*dpcm), GFP_KERNEL);
@@ -677,8 +1379,13 @@ static int loopback_open(struct snd_pcm_substream *substream)
 	dpcm->substream = substream;
 	setup_timer(&dpcm->timer, loopback_timer_function,
 		    (unsigned long)dpcm);
+	hrtimer_init(&dpcm->hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dpcm->hrtimer.function = loopback_hrtimer_function;
 
-	cable = loopback->cables[substream->number][dev];
+	/* a capture following another substream's playback is a tap */
+	if (substream->stream == SNDRV_PCM_STREAM_CAPTURE)
+		number = get_setup(dpcm)->source;
+	cable = loopback->cables[number][dev];
 	if (!cable) {
 		cable = kzalloc(sizeof(*cable), GFP_KERNEL);
 		if (!cable) {
@@ -688,10 +1395,22 @@ static int loopback_open(struct snd_pcm_substream *substream)
 		}
 		spin_lock_init(&cable->lock);
 		cable->hw = loopback_pcm_hardware;
-		loopback->cables[substream->number][dev] = cable;
+		cable->number = number;
+		cable->hrtimer = loopback->hrtimer;
+		cable->shared = loopback->shared;
+		INIT_LIST_HEAD(&cable->taps);
+		INIT_LIST_HEAD(&cable->convs);
+		loopback->cables[number][dev] = cable;
 	}
 	dpcm->cable = cable;
-	cable->streams[substream->stream] = dpcm;
+	if (number != substream->number) {
+		dpcm->tap = 1;
+		spin_lock_irq(&cable->lock);
+		list_add_tail(&dpcm->tap_list, &cable->taps);
+		spin_unlock_irq(&cable->lock);
+	} else {
+		cable->streams[substream->stream] = dpcm;
+	}
 
 	snd_pcm_hw_constraint_integer(runtime, SNDRV_PCM_HW_PARAM_PERIODS);
 
@@ -719,7 +1438,17 @@ static int loopback_open(struct snd_pcm_substream *substream)
 
 	runtime->private_data = dpcm;
 	runtime->private_free = loopback_runtime_free;
-	if (get_notify(dpcm))
+	/* both ends of a shared cable need the same buffer size */
+	if (cable->shared_area && !dpcm->tap) {
+		err = snd_pcm_hw_constraint_minmax(runtime,
+						   SNDRV_PCM_HW_PARAM_BUFFER_BYTES,
+						   cable->shared_bytes,
+						   cable->shared_bytes);
+		if (err < 0)
+			goto unlock;
+	}
+
+	if (get_notify(dpcm) || dpcm->tap)
 		runtime->hw = loopback_pcm_hardware;
 	else
 		runtime->hw = cable->hw;
@@ -732,18 +1461,23 @@ static int loopback_close(struct snd_pcm_substream *substream)
 {
 	struct loopback *loopback = substream->private_data;
 	struct loopback_pcm *dpcm = substream->runtime->private_data;
-	struct loopback_cable *cable;
+	struct loopback_cable *cable = dpcm->cable;
 	int dev = get_cable_index(substream);
 
-	loopback_timer_stop(dpcm);
+	loopback_timer_sync(dpcm);
 	mutex_lock(&loopback->cable_lock);
-	cable = loopback->cables[substream->number][dev];
-	if (cable->streams[!substream->stream]) {
-		/* other stream is still alive */
-		cable->streams[substream->stream] = NULL;
+	if (dpcm->tap) {
+		spin_lock_irq(&cable->lock);
+		loopback_tap_detach(dpcm);
+		list_del(&dpcm->tap_list);
+		spin_unlock_irq(&cable->lock);
 	} else {
+		cable->streams[substream->stream] = NULL;
+	}
+	if (!cable->streams[0] && !cable->streams[1] &&
+	    list_empty(&cable->taps)) {
 		/* free the cable */
-		loopback->cables[substream->number][dev] = NULL;
+		loopback->cables[cable->number][dev] = NULL;
 		kfree(cable);
 	}
 	mutex_unlock(&loopback->cable_lock);
@@ -753,7 +1487,7 @@ static int loopback_close(struct snd_pcm_substream *substream)
 static struct snd_pcm_ops loopback_playback_ops = {
 	.open =		loopback_open,
 	.close =	loopback_close,
-	.ioctl =	snd_pcm_lib_ioctl,
+	.ioctl =	loopback_ioctl,
 	.hw_params =	loopback_hw_params,
 	.hw_free =	loopback_hw_free,
 	.prepare =	loopback_prepare,
@@ -766,7 +1500,7 @@ static struct snd_pcm_ops loopback_playback_ops = {
 static struct snd_pcm_ops loopback_capture_ops = {
 	.open =		loopback_open,
 	.close =	loopback_close,
-	.ioctl =	snd_pcm_lib_ioctl,
+	.ioctl =	loopback_ioctl,
 	.hw_params =	loopback_hw_params,
 	.hw_free =	loopback_hw_free,
 	.prepare =	loopback_prepare,
@@ -842,6 +1576,55 @@ static int loopback_rate_shift_put(struct snd_kcontrol *kcontrol,
 	return change;
 }
 
+static int loopback_source_info(struct snd_kcontrol *kcontrol,
+				struct snd_ctl_elem_info *uinfo)
+{
+	struct loopback *loopback = snd_kcontrol_chip(kcontrol);
+	struct snd_pcm *pcm = loopback->pcm[kcontrol->id.device ^ 1];
+
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max =
+		pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream_count - 1;
+	uinfo->value.integer.step = 1;
+	return 0;
+}
+
+static int loopback_source_get(struct snd_kcontrol *kcontrol,
+			       struct snd_ctl_elem_value *ucontrol)
+{
+	struct loopback *loopback = snd_kcontrol_chip(kcontrol);
+
+	ucontrol->value.integer.value[0] =
+		loopback->setup[kcontrol->id.subdevice]
+			       [kcontrol->id.device].source;
+	return 0;
+}
+
+/* takes effect when the capture substream is opened next */
+static int loopback_source_put(struct snd_kcontrol *kcontrol,
+			       struct snd_ctl_elem_value *ucontrol)
+{
+	struct loopback *loopback = snd_kcontrol_chip(kcontrol);
+	struct snd_pcm *pcm = loopback->pcm[kcontrol->id.device ^ 1];
+	unsigned int val;
+	int change = 0;
+
+	val = ucontrol->value.integer.value[0];
+	if (val >= pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream_count)
+		return -EINVAL;
+	mutex_lock(&loopback->cable_lock);
+	if (val != loopback->setup[kcontrol->id.subdevice]
+				  [kcontrol->id.device].source) {
+		loopback->setup[kcontrol->id.subdevice]
+			       [kcontrol->id.device].source = val;
+		change = 1;
+	}
+	mutex_unlock(&loopback->cable_lock);
+	return change;
+}
+
 static int loopback_notify_get(struct snd_kcontrol *kcontrol,
 			       struct snd_ctl_elem_value *ucontrol)
 {
@@ -997,6 +1780,13 @@ static struct snd_kcontrol_new loopback_controls[]  = {
 	.name =         "PCM Slave Channels",
 	.info =         loopback_channels_info,
 	.get =          loopback_channels_get
+},
+{
+	.iface =        SNDRV_CTL_ELEM_IFACE_PCM,
+	.name =         "PCM Slave Substream",
+	.info =         loopback_source_info,
+	.get =          loopback_source_get,
+	.put =          loopback_source_put,
 }
 };
 
@@ -1017,6 +1807,7 @@ static int loopback_mixer_new(struct loopback *loopback, int notify)
 			setup = &loopback->setup[substr][dev];
 			setup->notify = notify;
 			setup->rate_shift = NO_PITCH;
+			setup->source = substr;
 			setup->format = SNDRV_PCM_FORMAT_S16_LE;
 			setup->rate = 48000;
 			setup->channels = 2;
@@ -1071,11 +1862,27 @@ static void print_dpcm_info(struct snd_info_buffer *buffer,
 	snd_iprintf(buffer, "    rate_shift:\t\t%u\n", dpcm->pcm_rate_shift);
 	snd_iprintf(buffer, "    update_pending:\t%u\n",
 						dpcm->period_update_pending);
-	snd_iprintf(buffer, "    irq_pos:\t\t%u\n", dpcm->irq_pos);
-	snd_iprintf(buffer, "    period_frac:\t%u\n", dpcm->period_size_frac);
-	snd_iprintf(buffer, "    last_jiffies:\t%lu (%lu)\n",
-					dpcm->last_jiffies, jiffies);
-	snd_iprintf(buffer, "    timer_expires:\t%lu\n", dpcm->timer.expires);
+	snd_iprintf(buffer, "    irq_pos:\t\t%llu\n", dpcm->irq_pos);
+	snd_iprintf(buffer, "    period_frac:\t%llu\n", dpcm->period_size_frac);
+	if (dpcm->cable->shared && !dpcm->tap)
+		snd_iprintf(buffer, "    shared_delay:\t%u\n",
+			    dpcm->shared_delay);
+	if (dpcm->tap) {
+		snd_iprintf(buffer, "    tap_ahead:\t\t%u\n", dpcm->tap_ahead);
+		snd_iprintf(buffer, "    tap_lead:\t\t%u\n", dpcm->tap_lead);
+		snd_iprintf(buffer, "    tap_underruns:\t%u\n",
+			    dpcm->tap_underruns);
+		snd_iprintf(buffer, "    tap_overruns:\t%u\n",
+			    dpcm->tap_overruns);
+	}
+	snd_iprintf(buffer, "    last_tick:\t\t%llu (%llu)\n",
+		    dpcm->last_tick, loopback_clock(dpcm->cable));
+	if (dpcm->cable->hrtimer)
+		snd_iprintf(buffer, "    timer_expires:\t%lld\n",
+			    ktime_to_ns(hrtimer_get_expires(&dpcm->hrtimer)));
+	else
+		snd_iprintf(buffer, "    timer_expires:\t%lu\n",
+			    dpcm->timer.expires);
 }
 
 static void print_substream_info(struct snd_info_buffer *buffer,
@@ -1084,6 +1891,8 @@ static void print_substream_info(struct snd_info_buffer *buffer,
 				 int num)
 {
 	struct loopback_cable *cable = loopback->cables[sub][num];
+	struct loopback_pcm *tap;
+	char id[32];
 
 	snd_iprintf(buffer, "Cable %i substream %i:\n", num, sub);
 	if (cable == NULL) {
@@ -1093,8 +1902,17 @@ static void print_substream_info(struct snd_info_buffer *buffer,
 	snd_iprintf(buffer, "  valid: %u\n", cable->valid);
 	snd_iprintf(buffer, "  running: %u\n", cable->running);
 	snd_iprintf(buffer, "  pause: %u\n", cable->pause);
+	snd_iprintf(buffer, "  clock: %s\n", cable->hrtimer ? "hrtimer" : "jiffies");
+	if (cable->shared)
+		snd_iprintf(buffer, "  shared: %zu bytes, %u users\n",
+			    cable->shared_bytes, cable->shared_users);
 	print_dpcm_info(buffer, cable->streams[0], "Playback");
 	print_dpcm_info(buffer, cable->streams[1], "Capture");
+	list_for_each_entry(tap, &cable->taps, tap_list) {
+		snprintf(id, sizeof(id), "Tap (substream %i)",
+			 tap->substream->number);
+		print_dpcm_info(buffer, tap, id);
+	}
 }
 
 static void print_cable_info(struct snd_info_entry *entry,
@@ -1145,6 +1963,9 @@ static int loopback_probe(struct platform_device *devptr)
 		pcm_substreams[dev] = MAX_PCM_SUBSTREAMS;
 	
 	loopback->card = card;
+	loopback->hrtimer = hrtimer[dev];
+	loopback->shared = shared_buffer[dev];
+	loopback->shared_delay = max(shared_delay[dev], 0);
 	mutex_init(&loopback->cable_lock);
 
 	err = loopback_pcm_new(loopback, 0, pcm_substreams[dev]);
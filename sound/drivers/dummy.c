@@ -33,6 +33,9 @@
 #include <sound/tlv.h>
 #include <sound/pcm.h>
 #include <sound/rawmidi.h>
+#ifdef CONFIG_SND_DUMMY_COMPRESS
+#include <sound/compress_driver.h>
+#endif
 #include <sound/info.h>
 #include <sound/initval.h>
 
@@ -69,6 +72,11 @@ static int pcm_substreams[SNDRV_CARDS] = {[0 ... (SNDRV_CARDS - 1)] = 8};
 static bool hrtimer = 1;
 #endif
 static bool fake_buffer = 1;
+#ifdef CONFIG_SND_DUMMY_COMPRESS
+static bool compress[SNDRV_CARDS] = {[0 ... (SNDRV_CARDS - 1)] = 1};
+#endif
+static int vclock;
+static int bench_ctls;
 
 module_param_array(index, int, NULL, 0444);
 MODULE_PARM_DESC(index, "Index value for dummy soundcard.");
@@ -86,10 +94,18 @@ MODULE_PARM_DESC(pcm_substreams, "PCM substreams # (1-128) for dummy driver.");
 //MODULE_PARM_DESC(midi_devs, "MIDI devices # (0-2) for dummy driver.");
 module_param(fake_buffer, bool, 0444);
 MODULE_PARM_DESC(fake_buffer, "Fake buffer allocations.");
+#ifdef CONFIG_SND_DUMMY_COMPRESS
+module_param_array(compress, bool, NULL, 0444);
+MODULE_PARM_DESC(compress, "Create a compressed playback device.");
+#endif
 #ifdef CONFIG_HIGH_RES_TIMERS
 module_param(hrtimer, bool, 0644);
 MODULE_PARM_DESC(hrtimer, "Use hrtimer as the timer source.");
 #endif
+module_param(vclock, int, 0644);
+MODULE_PARM_DESC(vclock, "Virtual clock (0 = off, 1 = follow the application, 2 = step by control).");
+module_param(bench_ctls, int, 0444);
+MODULE_PARM_DESC(bench_ctls, "Extra mixer controls to register for lookup benchmarks (0-65536).");
 
 static struct platform_device *devices[SNDRV_CARDS];
 
@@ -107,6 +123,7 @@ struct dummy_timer_ops {
 	int (*start)(struct snd_pcm_substream *);
 	int (*stop)(struct snd_pcm_substream *);
 	snd_pcm_uframes_t (*pointer)(struct snd_pcm_substream *);
+	int (*ack)(struct snd_pcm_substream *);		/* optional */
 };
 
 #define get_dummy_ops(substream) \
@@ -140,6 +157,11 @@ struct snd_dummy {
 	int iobox;
 	struct snd_kcontrol *cd_volume_ctl;
 	struct snd_kcontrol *cd_switch_ctl;
+	struct mutex vclock_mutex;
+	struct list_head vclock_list;	/* open virtual clock streams */
+#ifdef CONFIG_SND_DUMMY_COMPRESS
+	struct snd_compr compr;
+#endif
 };
 
 /*
@@ -493,6 +515,212 @@ static const struct dummy_timer_ops dummy_hrtimer_ops = {
 
 #endif /* CONFIG_HIGH_RES_TIMERS */
 
+/*
+ * virtual clock interface
+ *
+ * The position does not depend on wall time at all, so the throughput
+ * is bound by the PCM core alone.  In follow mode it runs ahead of the
+ * application, leaving one period queued (playback) or free (capture)
+ * so that the stream never runs dry; the ack after each read/write
+ * kicks the tasklet, and a one jiffy tick covers drain and poll.  The
+ * position is only taken from appl_ptr when the core asks for it, so
+ * mmap clients whose control record is mapped must hwsync (or sync_ptr)
+ * before waiting, or they advance once per tick.  In
+ * step mode the position only moves when a frame count is written to
+ * the "Virtual Clock Step" control.
+ */
+
+#define DUMMY_VCLOCK_FOLLOW	1
+#define DUMMY_VCLOCK_STEP	2
+
+struct dummy_vclock_pcm {
+	/* ops must be the first item */
+	const struct dummy_timer_ops *timer_ops;
+	spinlock_t lock;
+	int mode;
+	atomic_t running;
+	snd_pcm_uframes_t pos;		/* step mode position */
+	struct timer_list timer;	/* follow mode fallback tick */
+	struct tasklet_struct tasklet;
+	struct list_head list;		/* in snd_dummy.vclock_list */
+	struct snd_pcm_substream *substream;
+};
+
+/* how far the follow mode position may run past hw_ptr right now */
+static snd_pcm_uframes_t dummy_vclock_ahead(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	snd_pcm_sframes_t ahead;
+
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
+		ahead = snd_pcm_playback_hw_avail(runtime);
+		if (runtime->status->state == SNDRV_PCM_STATE_DRAINING)
+			return ahead > 0 ? ahead : 0;
+	} else {
+		ahead = runtime->buffer_size - snd_pcm_capture_avail(runtime);
+	}
+	ahead -= runtime->period_size;
+	if (ahead <= 0)
+		return 0;
+	return ahead - ahead % runtime->period_size;
+}
+
+static void dummy_vclock_pcm_elapsed(unsigned long priv)
+{
+	struct dummy_vclock_pcm *dpcm = (struct dummy_vclock_pcm *)priv;
+	struct snd_pcm_substream *substream = dpcm->substream;
+	snd_pcm_uframes_t ahead;
+	unsigned long flags;
+
+	if (!atomic_read(&dpcm->running))
+		return;
+	/* an interrupt without progress would look like a lost buffer */
+	snd_pcm_stream_lock_irqsave(substream, flags);
+	ahead = dummy_vclock_ahead(substream);
+	snd_pcm_stream_unlock_irqrestore(substream, flags);
+	if (ahead)
+		snd_pcm_period_elapsed(substream);
+}
+
+static void dummy_vclock_tick(unsigned long data)
+{
+	struct dummy_vclock_pcm *dpcm = (struct dummy_vclock_pcm *)data;
+
+	if (!atomic_read(&dpcm->running))
+		return;
+	tasklet_schedule(&dpcm->tasklet);
+	mod_timer(&dpcm->timer, jiffies + 1);
+}
+
+/* advance a step mode stream, one period boundary at a time */
+static void dummy_vclock_step(struct dummy_vclock_pcm *dpcm,
+			      unsigned int frames)
+{
+	struct snd_pcm_runtime *runtime = dpcm->substream->runtime;
+	snd_pcm_uframes_t n;
+	bool elapsed;
+
+	while (frames && atomic_read(&dpcm->running)) {
+		spin_lock_irq(&dpcm->lock);
+		n = runtime->period_size - dpcm->pos % runtime->period_size;
+		if (n > frames)
+			n = frames;
+		dpcm->pos += n;
+		if (dpcm->pos >= runtime->buffer_size)
+			dpcm->pos -= runtime->buffer_size;
+		elapsed = !(dpcm->pos % runtime->period_size);
+		spin_unlock_irq(&dpcm->lock);
+		frames -= n;
+		if (elapsed)
+			snd_pcm_period_elapsed(dpcm->substream);
+	}
+}
+
+static int dummy_vclock_start(struct snd_pcm_substream *substream)
+{
+	struct dummy_vclock_pcm *dpcm = substream->runtime->private_data;
+
+	atomic_set(&dpcm->running, 1);
+	if (dpcm->mode == DUMMY_VCLOCK_FOLLOW) {
+		tasklet_schedule(&dpcm->tasklet);
+		mod_timer(&dpcm->timer, jiffies + 1);
+	}
+	return 0;
+}
+
+static int dummy_vclock_stop(struct snd_pcm_substream *substream)
+{
+	struct dummy_vclock_pcm *dpcm = substream->runtime->private_data;
+
+	atomic_set(&dpcm->running, 0);
+	del_timer(&dpcm->timer);
+	return 0;
+}
+
+static int dummy_vclock_prepare(struct snd_pcm_substream *substream)
+{
+	struct dummy_vclock_pcm *dpcm = substream->runtime->private_data;
+
+	spin_lock_irq(&dpcm->lock);
+	dpcm->pos = 0;
+	spin_unlock_irq(&dpcm->lock);
+	return 0;
+}
+
+static snd_pcm_uframes_t
+dummy_vclock_pointer(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct dummy_vclock_pcm *dpcm = runtime->private_data;
+	snd_pcm_uframes_t pos;
+
+	if (dpcm->mode == DUMMY_VCLOCK_STEP) {
+		spin_lock(&dpcm->lock);
+		pos = dpcm->pos;
+		spin_unlock(&dpcm->lock);
+		return pos;
+	}
+	pos = runtime->status->hw_ptr;
+	if (atomic_read(&dpcm->running))
+		pos += dummy_vclock_ahead(substream);
+	return pos % runtime->buffer_size;
+}
+
+static int dummy_vclock_ack(struct snd_pcm_substream *substream)
+{
+	struct dummy_vclock_pcm *dpcm = substream->runtime->private_data;
+
+	if (dpcm->mode == DUMMY_VCLOCK_FOLLOW && atomic_read(&dpcm->running))
+		tasklet_schedule(&dpcm->tasklet);
+	return 0;
+}
+
+static int dummy_vclock_create(struct snd_pcm_substream *substream)
+{
+	struct snd_dummy *dummy = snd_pcm_substream_chip(substream);
+	struct dummy_vclock_pcm *dpcm;
+
+	dpcm = kzalloc(sizeof(*dpcm), GFP_KERNEL);
+	if (!dpcm)
+		return -ENOMEM;
+	substream->runtime->private_data = dpcm;
+	spin_lock_init(&dpcm->lock);
+	dpcm->mode = vclock == DUMMY_VCLOCK_STEP ?
+		DUMMY_VCLOCK_STEP : DUMMY_VCLOCK_FOLLOW;
+	atomic_set(&dpcm->running, 0);
+	setup_timer(&dpcm->timer, dummy_vclock_tick, (unsigned long)dpcm);
+	tasklet_init(&dpcm->tasklet, dummy_vclock_pcm_elapsed,
+		     (unsigned long)dpcm);
+	dpcm->substream = substream;
+	mutex_lock(&dummy->vclock_mutex);
+	list_add_tail(&dpcm->list, &dummy->vclock_list);
+	mutex_unlock(&dummy->vclock_mutex);
+	return 0;
+}
+
+static void dummy_vclock_free(struct snd_pcm_substream *substream)
+{
+	struct snd_dummy *dummy = snd_pcm_substream_chip(substream);
+	struct dummy_vclock_pcm *dpcm = substream->runtime->private_data;
+
+	mutex_lock(&dummy->vclock_mutex);
+	list_del(&dpcm->list);
+	mutex_unlock(&dummy->vclock_mutex);
+	del_timer_sync(&dpcm->timer);
+	tasklet_kill(&dpcm->tasklet);
+	kfree(dpcm);
+}
+
+static const struct dummy_timer_ops dummy_vclock_ops = {
+	.create =	dummy_vclock_create,
+	.free =		dummy_vclock_free,
+	.prepare =	dummy_vclock_prepare,
+	.start =	dummy_vclock_start,
+	.stop =		dummy_vclock_stop,
+	.pointer =	dummy_vclock_pointer,
+	.ack =		dummy_vclock_ack,
+};
+
 /*
  * PCM interface
  */
@@ -520,6 +748,13 @@ static snd_pcm_uframes_t dummy_pcm_pointer(struct snd_pcm_substream *substream)
 	return get_dummy_ops(substream)->pointer(substream);
 }
 
+static int dummy_pcm_ack(struct snd_pcm_substream *substream)
+{
+	const struct dummy_timer_ops *ops = get_dummy_ops(substream);
+
+	return ops->ack ? ops->ack(substream) : 0;
+}
+
 static struct snd_pcm_hardware dummy_pcm_hardware = {
 	.info =			(SNDRV_PCM_INFO_MMAP |
 				 SNDRV_PCM_INFO_INTERLEAVED |
@@ -571,6 +806,8 @@ static int dummy_pcm_open(struct snd_pcm_substream *substream)
 	if (hrtimer)
 		ops = &dummy_hrtimer_ops;
 #endif
+	if (vclock)
+		ops = &dummy_vclock_ops;
 
 	err = ops->create(substream);
 	if (err < 0)
@@ -586,6 +823,22 @@ static int dummy_pcm_open(struct snd_pcm_substream *substream)
 		runtime->hw.info &= ~(SNDRV_PCM_INFO_MMAP |
 				      SNDRV_PCM_INFO_MMAP_VALID);
 
+	if (ops == &dummy_vclock_ops) {
+		/* one period is always held back, and wakeups land on
+		 * period boundaries
+		 */
+		err = snd_pcm_hw_constraint_integer(runtime,
+						    SNDRV_PCM_HW_PARAM_PERIODS);
+		if (err >= 0)
+			err = snd_pcm_hw_constraint_minmax(runtime,
+						SNDRV_PCM_HW_PARAM_PERIODS,
+						2, UINT_MAX);
+		if (err < 0) {
+			ops->free(substream);
+			return err;
+		}
+	}
+
 	if (model == NULL)
 		return 0;
 
@@ -672,6 +925,7 @@ static struct snd_pcm_ops dummy_pcm_ops = {
 	.prepare =	dummy_pcm_prepare,
 	.trigger =	dummy_pcm_trigger,
 	.pointer =	dummy_pcm_pointer,
+	.ack =		dummy_pcm_ack,
 };
 
 static struct snd_pcm_ops dummy_pcm_ops_no_buf = {
@@ -683,6 +937,7 @@ static struct snd_pcm_ops dummy_pcm_ops_no_buf = {
 	.prepare =	dummy_pcm_prepare,
 	.trigger =	dummy_pcm_trigger,
 	.pointer =	dummy_pcm_pointer,
+	.ack =		dummy_pcm_ack,
 	.copy =		dummy_pcm_copy,
 	.silence =	dummy_pcm_silence,
 	.page =		dummy_pcm_page,
@@ -718,6 +973,274 @@ static int snd_card_dummy_pcm(struct snd_dummy *dummy, int device,
 	return 0;
 }
 
+#ifdef CONFIG_SND_DUMMY_COMPRESS
+/*
+ * compressed playback interface
+ *
+ * A fake DSP which takes the data out of the core ring buffer at the bit
+ * rate given in the codec parameters.  Nothing is decoded; the point is
+ * to exercise write() and the mmap/SNDRV_COMPRESS_ACK path of the
+ * compress offload core.
+ */
+
+#define DUMMY_COMPR_MIN_FRAGMENT_SIZE	512
+#define DUMMY_COMPR_MAX_FRAGMENT_SIZE	(256*1024)
+#define DUMMY_COMPR_MIN_FRAGMENTS	2
+#define DUMMY_COMPR_MAX_FRAGMENTS	64
+#define DUMMY_COMPR_BIT_RATE		128000	/* used when none is given */
+
+struct dummy_compr {
+	spinlock_t lock;
+	struct timer_list timer;
+	struct snd_compr_stream *stream;
+	struct snd_codec codec;
+	unsigned int byte_rate;
+	unsigned int fragment_size;
+	unsigned long base_time;
+	unsigned int frac_rest;		/* bytes * HZ not yet consumed */
+	u64 committed;			/* bytes handed over by the core */
+	u64 consumed;			/* bytes taken by the "DSP" */
+	unsigned int running:1;
+	unsigned int draining:1;
+};
+
+static void dummy_compr_rearm(struct dummy_compr *dc)
+{
+	mod_timer(&dc->timer, jiffies + max(1UL, msecs_to_jiffies(10)));
+}
+
+/* advance the consumer position; returns the number of fragments done */
+static int dummy_compr_update(struct dummy_compr *dc)
+{
+	unsigned long delta;
+	u64 pos, frac;
+	u32 rest;
+
+	delta = jiffies - dc->base_time;
+	if (!delta)
+		return 0;
+	dc->base_time += delta;
+	frac = (u64)delta * dc->byte_rate + dc->frac_rest;
+	pos = dc->consumed + div_u64_rem(frac, HZ, &rest);
+	dc->frac_rest = rest;
+	if (pos >= dc->committed) {
+		/* starved: the DSP idles until more data is committed */
+		pos = dc->committed;
+		dc->frac_rest = 0;
+	}
+	delta = div_u64(pos, dc->fragment_size) -
+		div_u64(dc->consumed, dc->fragment_size);
+	dc->consumed = pos;
+	return delta;
+}
+
+static void dummy_compr_callback(unsigned long data)
+{
+	struct dummy_compr *dc = (struct dummy_compr *)data;
+	unsigned long flags;
+	int elapsed, drained = 0;
+
+	spin_lock_irqsave(&dc->lock, flags);
+	if (!dc->running) {
+		spin_unlock_irqrestore(&dc->lock, flags);
+		return;
+	}
+	elapsed = dummy_compr_update(dc);
+	if (dc->draining && dc->consumed == dc->committed) {
+		dc->running = 0;
+		dc->draining = 0;
+		drained = 1;
+	} else {
+		dummy_compr_rearm(dc);
+	}
+	spin_unlock_irqrestore(&dc->lock, flags);
+	if (elapsed)
+		snd_compr_fragment_elapsed(dc->stream);
+	if (drained)
+		snd_compr_drain_notify(dc->stream);
+}
+
+static int dummy_compr_open(struct snd_compr_stream *stream)
+{
+	struct dummy_compr *dc;
+
+	dc = kzalloc(sizeof(*dc), GFP_KERNEL);
+	if (!dc)
+		return -ENOMEM;
+	spin_lock_init(&dc->lock);
+	setup_timer(&dc->timer, dummy_compr_callback, (unsigned long)dc);
+	dc->stream = stream;
+	stream->runtime->private_data = dc;
+	return 0;
+}
+
+static int dummy_compr_free(struct snd_compr_stream *stream)
+{
+	struct dummy_compr *dc = stream->runtime->private_data;
+
+	del_timer_sync(&dc->timer);
+	kfree(dc);
+	return 0;
+}
+
+static int dummy_compr_set_params(struct snd_compr_stream *stream,
+				  struct snd_compr_params *params)
+{
+	struct dummy_compr *dc = stream->runtime->private_data;
+
+	if (params->codec.id != SND_AUDIOCODEC_MP3 &&
+	    params->codec.id != SND_AUDIOCODEC_AAC)
+		return -EINVAL;
+	if (params->buffer.fragment_size < DUMMY_COMPR_MIN_FRAGMENT_SIZE ||
+	    params->buffer.fragment_size > DUMMY_COMPR_MAX_FRAGMENT_SIZE ||
+	    params->buffer.fragments < DUMMY_COMPR_MIN_FRAGMENTS ||
+	    params->buffer.fragments > DUMMY_COMPR_MAX_FRAGMENTS)
+		return -EINVAL;
+	dc->codec = params->codec;
+	if (!dc->codec.bit_rate)
+		dc->codec.bit_rate = DUMMY_COMPR_BIT_RATE;
+	dc->byte_rate = dc->codec.bit_rate / 8;
+	dc->fragment_size = params->buffer.fragment_size;
+	return 0;
+}
+
+static int dummy_compr_get_params(struct snd_compr_stream *stream,
+				  struct snd_codec *params)
+{
+	struct dummy_compr *dc = stream->runtime->private_data;
+
+	*params = dc->codec;
+	return 0;
+}
+
+static int dummy_compr_trigger(struct snd_compr_stream *stream, int cmd)
+{
+	struct dummy_compr *dc = stream->runtime->private_data;
+	int err = 0;
+
+	spin_lock_bh(&dc->lock);
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+		dc->running = 1;
+		dc->base_time = jiffies;
+		dummy_compr_rearm(dc);
+		break;
+	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+		dummy_compr_update(dc);
+		dc->running = 0;
+		del_timer(&dc->timer);
+		break;
+	case SNDRV_PCM_TRIGGER_STOP:
+		/* the core restarts its byte counters from zero */
+		dc->running = 0;
+		dc->draining = 0;
+		dc->committed = 0;
+		dc->consumed = 0;
+		dc->frac_rest = 0;
+		del_timer(&dc->timer);
+		break;
+	case SND_COMPR_TRIGGER_DRAIN:
+	case SND_COMPR_TRIGGER_PARTIAL_DRAIN:
+		/* no gapless support: a partial drain waits for everything */
+		dc->draining = 1;
+		break;
+	case SND_COMPR_TRIGGER_NEXT_TRACK:
+		break;
+	default:
+		err = -EINVAL;
+	}
+	spin_unlock_bh(&dc->lock);
+	return err;
+}
+
+static int dummy_compr_pointer(struct snd_compr_stream *stream,
+			       struct snd_compr_tstamp *tstamp)
+{
+	struct dummy_compr *dc = stream->runtime->private_data;
+	u32 offset;
+
+	spin_lock_bh(&dc->lock);
+	if (dc->running)
+		dummy_compr_update(dc);
+	div_u64_rem(dc->consumed, stream->runtime->buffer_size, &offset);
+	tstamp->byte_offset = offset;
+	tstamp->copied_total = dc->consumed;
+	tstamp->sampling_rate = dc->codec.sample_rate;
+	spin_unlock_bh(&dc->lock);
+	return 0;
+}
+
+/* called for both write() and SNDRV_COMPRESS_ACK on the mmapped buffer */
+static int dummy_compr_ack(struct snd_compr_stream *stream, size_t bytes)
+{
+	struct dummy_compr *dc = stream->runtime->private_data;
+
+	spin_lock_bh(&dc->lock);
+	if (dc->running)
+		dummy_compr_update(dc);
+	dc->committed += bytes;
+	spin_unlock_bh(&dc->lock);
+	return 0;
+}
+
+static int dummy_compr_get_caps(struct snd_compr_stream *stream,
+				struct snd_compr_caps *caps)
+{
+	caps->direction = SND_COMPRESS_PLAYBACK;
+	caps->min_fragment_size = DUMMY_COMPR_MIN_FRAGMENT_SIZE;
+	caps->max_fragment_size = DUMMY_COMPR_MAX_FRAGMENT_SIZE;
+	caps->min_fragments = DUMMY_COMPR_MIN_FRAGMENTS;
+	caps->max_fragments = DUMMY_COMPR_MAX_FRAGMENTS;
+	caps->num_codecs = 2;
+	caps->codecs[0] = SND_AUDIOCODEC_MP3;
+	caps->codecs[1] = SND_AUDIOCODEC_AAC;
+	return 0;
+}
+
+static int dummy_compr_get_codec_caps(struct snd_compr_stream *stream,
+				      struct snd_compr_codec_caps *codec)
+{
+	struct snd_codec_desc *desc = &codec->descriptor[0];
+
+	if (codec->codec != SND_AUDIOCODEC_MP3 &&
+	    codec->codec != SND_AUDIOCODEC_AAC)
+		return -EINVAL;
+	codec->num_descriptors = 1;
+	desc->max_ch = 2;
+	desc->sample_rates[0] = 48000;
+	desc->sample_rates[1] = 44100;
+	desc->num_sample_rates = 2;
+	desc->bit_rate[0] = 320;
+	desc->bit_rate[1] = 128;
+	desc->num_bitrates = 2;
+	return 0;
+}
+
+static struct snd_compr_ops dummy_compr_ops = {
+	.open =		dummy_compr_open,
+	.free =		dummy_compr_free,
+	.set_params =	dummy_compr_set_params,
+	.get_params =	dummy_compr_get_params,
+	.trigger =	dummy_compr_trigger,
+	.pointer =	dummy_compr_pointer,
+	.ack =		dummy_compr_ack,
+	.get_caps =	dummy_compr_get_caps,
+	.get_codec_caps = dummy_compr_get_codec_caps,
+};
+
+static int snd_card_dummy_compr(struct snd_dummy *dummy, int device)
+{
+	struct snd_compr *compr = &dummy->compr;
+
+	compr->ops = &dummy_compr_ops;
+	compr->private_data = dummy;
+	mutex_init(&compr->lock);
+	return snd_compress_new(dummy->card, device, SND_COMPRESS_PLAYBACK,
+				"Dummy Compress", compr);
+}
+#endif /* CONFIG_SND_DUMMY_COMPRESS */
+
 /*
  * mixer interface
  */
@@ -871,6 +1394,50 @@ static int snd_dummy_iobox_put(struct snd_kcontrol *kcontrol,
 	return changed;
 }
 
+static int snd_dummy_vclock_step_info(struct snd_kcontrol *kcontrol,
+				      struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = INT_MAX;
+	return 0;
+}
+
+static int snd_dummy_vclock_step_get(struct snd_kcontrol *kcontrol,
+				     struct snd_ctl_elem_value *ucontrol)
+{
+	ucontrol->value.integer.value[0] = 0;
+	return 0;
+}
+
+/* advance every running step mode stream by the given frames */
+static int snd_dummy_vclock_step_put(struct snd_kcontrol *kcontrol,
+				     struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_dummy *dummy = snd_kcontrol_chip(kcontrol);
+	struct dummy_vclock_pcm *dpcm;
+	long frames = ucontrol->value.integer.value[0];
+
+	if (frames < 0 || frames > INT_MAX)
+		return -EINVAL;
+	mutex_lock(&dummy->vclock_mutex);
+	list_for_each_entry(dpcm, &dummy->vclock_list, list) {
+		if (dpcm->mode == DUMMY_VCLOCK_STEP)
+			dummy_vclock_step(dpcm, frames);
+	}
+	mutex_unlock(&dummy->vclock_mutex);
+	return 0;
+}
+
+static struct snd_kcontrol_new snd_dummy_vclock_step = {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name  = "Virtual Clock Step",
+	.info  = snd_dummy_vclock_step_info,
+	.get   = snd_dummy_vclock_step_get,
+	.put   = snd_dummy_vclock_step_put,
+};
+
 static struct snd_kcontrol_new snd_dummy_controls[] = {
 DUMMY_VOLUME("Master Volume", 0, MIXER_ADDR_MASTER),
 DUMMY_CAPSRC("Master Capture Switch", 0, MIXER_ADDR_MASTER),
@@ -891,6 +1458,12 @@ DUMMY_CAPSRC("CD Capture Switch", 0, MIXER_ADDR_CD),
 },
 };
 
+#define MAX_BENCH_CTLS		65536
+
+/* registered bench_ctls times as "Bench <n> Playback Volume" */
+static struct snd_kcontrol_new snd_dummy_bench_control =
+DUMMY_VOLUME("Bench Playback Volume", 0, MIXER_ADDR_MASTER);
+
 static int snd_card_dummy_new_mixer(struct snd_dummy *dummy)
 {
 	struct snd_card *card = dummy->card;
@@ -913,6 +1486,22 @@ static int snd_card_dummy_new_mixer(struct snd_dummy *dummy)
 			dummy->cd_switch_ctl = kcontrol;
 
 	}
+	if (vclock) {
+		err = snd_ctl_add(card, snd_ctl_new1(&snd_dummy_vclock_step,
+						     dummy));
+		if (err < 0)
+			return err;
+	}
+	for (idx = 0; idx < bench_ctls && idx < MAX_BENCH_CTLS; idx++) {
+		kcontrol = snd_ctl_new1(&snd_dummy_bench_control, dummy);
+		if (!kcontrol)
+			return -ENOMEM;
+		snprintf(kcontrol->id.name, sizeof(kcontrol->id.name),
+			 "Bench %u Playback Volume", idx);
+		err = snd_ctl_add(card, kcontrol);
+		if (err < 0)
+			return err;
+	}
 	return 0;
 }
 
@@ -1060,6 +1649,8 @@ static int snd_dummy_probe(struct platform_device *devptr)
 		return err;
 	dummy = card->private_data;
 	dummy->card = card;
+	mutex_init(&dummy->vclock_mutex);
+	INIT_LIST_HEAD(&dummy->vclock_list);
 	for (mdl = dummy_models; *mdl && model[dev]; mdl++) {
 		if (strcmp(model[dev], (*mdl)->name) == 0) {
 			printk(KERN_INFO
@@ -1105,6 +1696,14 @@ static int snd_dummy_probe(struct platform_device *devptr)
 			dummy->pcm_hw.channels_max = m->channels_max;
 	}
 
+#ifdef CONFIG_SND_DUMMY_COMPRESS
+	if (compress[dev]) {
+		err = snd_card_dummy_compr(dummy, 0);
+		if (err < 0)
+			goto __nodev;
+	}
+#endif
+
 	err = snd_card_dummy_new_mixer(dummy);
 	if (err < 0)
 		goto __nodev;
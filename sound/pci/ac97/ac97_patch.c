@@ -311,11 +311,13 @@ static int patch_yamaha_ymf7x3_3d(struct snd_ac97 *ac97)
 	int err;
 
 	kctl = snd_ac97_cnew(&snd_ac97_controls_3d[0], ac97);
+	if (!kctl)
+		return -ENOMEM;
+	strcpy(kctl->id.name, "3D Control - Wide");
+	kctl->private_value = AC97_SINGLE_VALUE(AC97_3D_CONTROL, 9, 7, 0);
 	err = snd_ctl_add(ac97->bus->card, kctl);
 	if (err < 0)
 		return err;
-	strcpy(kctl->id.name, "3D Control - Wide");
-	kctl->private_value = AC97_SINGLE_VALUE(AC97_3D_CONTROL, 9, 7, 0);
 	snd_ac97_write_cache(ac97, AC97_3D_CONTROL, 0x0000);
 	err = snd_ctl_add(ac97->bus->card,
 			  snd_ac97_cnew(&snd_ac97_ymf7x3_controls_speaker,
@@ -898,10 +900,13 @@ static int patch_sigmatel_stac9700_3d(struct snd_ac97 * ac97)
 	struct snd_kcontrol *kctl;
 	int err;
 
-	if ((err = snd_ctl_add(ac97->bus->card, kctl = snd_ac97_cnew(&snd_ac97_controls_3d[0], ac97))) < 0)
-		return err;
+	kctl = snd_ac97_cnew(&snd_ac97_controls_3d[0], ac97);
+	if (!kctl)
+		return -ENOMEM;
 	strcpy(kctl->id.name, "3D Control Sigmatel - Depth");
 	kctl->private_value = AC97_SINGLE_VALUE(AC97_3D_CONTROL, 2, 3, 0);
+	if ((err = snd_ctl_add(ac97->bus->card, kctl)) < 0)
+		return err;
 	snd_ac97_write_cache(ac97, AC97_3D_CONTROL, 0x0000);
 	return 0;
 }
@@ -911,14 +916,20 @@ static int patch_sigmatel_stac9708_3d(struct snd_ac97 * ac97)
 	struct snd_kcontrol *kctl;
 	int err;
 
-	if ((err = snd_ctl_add(ac97->bus->card, kctl = snd_ac97_cnew(&snd_ac97_controls_3d[0], ac97))) < 0)
-		return err;
+	kctl = snd_ac97_cnew(&snd_ac97_controls_3d[0], ac97);
+	if (!kctl)
+		return -ENOMEM;
 	strcpy(kctl->id.name, "3D Control Sigmatel - Depth");
 	kctl->private_value = AC97_SINGLE_VALUE(AC97_3D_CONTROL, 0, 3, 0);
-	if ((err = snd_ctl_add(ac97->bus->card, kctl = snd_ac97_cnew(&snd_ac97_controls_3d[0], ac97))) < 0)
+	if ((err = snd_ctl_add(ac97->bus->card, kctl)) < 0)
 		return err;
+	kctl = snd_ac97_cnew(&snd_ac97_controls_3d[0], ac97);
+	if (!kctl)
+		return -ENOMEM;
 	strcpy(kctl->id.name, "3D Control Sigmatel - Rear Depth");
 	kctl->private_value = AC97_SINGLE_VALUE(AC97_3D_CONTROL, 2, 3, 0);
+	if ((err = snd_ctl_add(ac97->bus->card, kctl)) < 0)
+		return err;
 	snd_ac97_write_cache(ac97, AC97_3D_CONTROL, 0x0000);
 	return 0;
 }
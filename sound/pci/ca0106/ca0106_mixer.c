@@ -733,11 +733,14 @@ static struct snd_kcontrol *ctl_find(struct snd_card *card, const char *name)
 static int rename_ctl(struct snd_card *card, const char *src, const char *dst)
 {
 	struct snd_kcontrol *kctl = ctl_find(card, src);
-	if (kctl) {
-		strcpy(kctl->id.name, dst);
-		return 0;
-	}
-	return -ENOENT;
+	struct snd_ctl_elem_id src_id, dst_id;
+
+	if (!kctl)
+		return -ENOENT;
+	/* go through the core so that the control is found by its new name */
+	src_id = dst_id = kctl->id;
+	strlcpy(dst_id.name, dst, sizeof(dst_id.name));
+	return snd_ctl_rename_id(card, &src_id, &dst_id);
 }
 
 #define ADD_CTLS(emu, ctls)						\
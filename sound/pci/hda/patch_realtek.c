@@ -4655,6 +4655,17 @@ static void asus_tx300_automute(struct hda_codec *codec)
 		spec->gen.mute_bits |= (1ULL << 0x14);
 }
 
+/* rename an already added control; the core keeps its lookup by name */
+static void alc_rename_ctl(struct hda_codec *codec, struct snd_kcontrol *kctl,
+			   const char *name)
+{
+	struct snd_ctl_elem_id src_id, dst_id;
+
+	src_id = dst_id = kctl->id;
+	strlcpy(dst_id.name, name, sizeof(dst_id.name));
+	snd_ctl_rename_id(codec->card, &src_id, &dst_id);
+}
+
 static void alc282_fixup_asus_tx300(struct hda_codec *codec,
 				    const struct hda_fixup *fix, int action)
 {
@@ -4687,10 +4698,10 @@ static void alc282_fixup_asus_tx300(struct hda_codec *codec,
 		 */
 		kctl = snd_hda_find_mixer_ctl(codec, "Speaker Playback Switch");
 		if (kctl)
-			strcpy(kctl->id.name, "Dock Speaker Playback Switch");
+			alc_rename_ctl(codec, kctl, "Dock Speaker Playback Switch");
 		kctl = snd_hda_find_mixer_ctl(codec, "Bass Speaker Playback Switch");
 		if (kctl)
-			strcpy(kctl->id.name, "Speaker Playback Switch");
+			alc_rename_ctl(codec, kctl, "Speaker Playback Switch");
 		break;
 	}
 }
@@ -0,0 +1,1063 @@
+/* convert.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERT_X86
+#include <immintrin.h>
+#define CONVERT_SSE2 __attribute__((target("sse2")))
+#define CONVERT_AVX2 __attribute__((target("avx2")))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+/* Kernels that have vector versions.  Fan out works on whole input frames, so
+ * only the frame size matters, not the format; mixing is done in float for the
+ * formats where that is exact. */
+struct convert_ops {
+    const char *name;
+    void (*replicate32)(uint32_t *dst, const uint32_t *src, unsigned int frames,
+                        unsigned int k);
+    void (*replicate64)(uint64_t *dst, const uint64_t *src, unsigned int frames,
+                        unsigned int k);
+    void (*mix_s16)(int16_t *dst, unsigned int out_ch, const int16_t *src,
+                    unsigned int in_ch, const float *cols, unsigned int frames);
+    void (*mix_s24)(int32_t *dst, unsigned int out_ch, const int32_t *src,
+                    unsigned int in_ch, const float *cols, unsigned int frames);
+    void (*deinterleave16x2)(int16_t *l, int16_t *r, const int16_t *src,
+                             unsigned int frames);
+    void (*interleave16x2)(int16_t *dst, const int16_t *l, const int16_t *r,
+                           unsigned int frames);
+    void (*deinterleave32x2)(int32_t *l, int32_t *r, const int32_t *src,
+                             unsigned int frames);
+    void (*interleave32x2)(int32_t *dst, const int32_t *l, const int32_t *r,
+                           unsigned int frames);
+};
+
+/* gains are rearranged into columns padded to this many outputs, so a vector
+ * of outputs can be accumulated one input channel at a time */
+#define MIX_PAD 8
+#define MIX_COLS_SIZE (PCM_CONVERT_MAX_CHANNELS * PCM_CONVERT_MAX_CHANNELS)
+
+#define S16_MIN -32768.0f
+#define S16_MAX 32767.0f
+#define S24_MIN -8388608.0f
+#define S24_MAX 8388607.0f
+
+static unsigned int convert_sample_bytes(enum pcm_format format)
+{
+    switch (format) {
+    case PCM_FORMAT_S8:
+        return 1;
+    case PCM_FORMAT_S16_LE:
+        return 2;
+    case PCM_FORMAT_S24_3LE:
+        return 3;
+    case PCM_FORMAT_S24_LE:
+    case PCM_FORMAT_S32_LE:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static inline int32_t sample_get(enum pcm_format format, const uint8_t *p)
+{
+    switch (format) {
+    case PCM_FORMAT_S8:
+        return *(const int8_t *)p;
+    case PCM_FORMAT_S16_LE:
+        return *(const int16_t *)p;
+    case PCM_FORMAT_S24_3LE:
+        return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 |
+                         (uint32_t)p[2] << 24) >> 8;
+    case PCM_FORMAT_S24_LE:
+        return (int32_t)(*(const uint32_t *)p << 8) >> 8;
+    default:
+        return *(const int32_t *)p;
+    }
+}
+
+static inline void sample_put(enum pcm_format format, uint8_t *p, double v)
+{
+    switch (format) {
+    case PCM_FORMAT_S8:
+        *(int8_t *)p = (int8_t)lrint(fmin(fmax(v, -128.0), 127.0));
+        break;
+    case PCM_FORMAT_S16_LE:
+        *(int16_t *)p = (int16_t)lrint(fmin(fmax(v, S16_MIN), S16_MAX));
+        break;
+    case PCM_FORMAT_S24_3LE: {
+        int32_t s = (int32_t)lrint(fmin(fmax(v, S24_MIN), S24_MAX));
+        p[0] = s;
+        p[1] = s >> 8;
+        p[2] = s >> 16;
+        break;
+    }
+    case PCM_FORMAT_S24_LE:
+        *(int32_t *)p = (int32_t)lrint(fmin(fmax(v, S24_MIN), S24_MAX));
+        break;
+    default:
+        *(int32_t *)p = (int32_t)llrint(fmin(fmax(v, -2147483648.0), 2147483647.0));
+        break;
+    }
+}
+
+/*
+ * Portable kernels
+ */
+
+static void replicate32_scalar(uint32_t *dst, const uint32_t *src,
+                               unsigned int frames, unsigned int k)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < frames; i++) {
+        uint32_t v = src[i];
+        for (j = 0; j < k; j++)
+            *dst++ = v;
+    }
+}
+
+static void replicate64_scalar(uint64_t *dst, const uint64_t *src,
+                               unsigned int frames, unsigned int k)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < frames; i++) {
+        uint64_t v = src[i];
+        for (j = 0; j < k; j++)
+            *dst++ = v;
+    }
+}
+
+static void mix_s16_scalar(int16_t *dst, unsigned int out_ch, const int16_t *src,
+                           unsigned int in_ch, const float *cols, unsigned int frames)
+{
+    unsigned int pad = (out_ch + MIX_PAD - 1) & ~(MIX_PAD - 1);
+    unsigned int f, i, o;
+
+    for (f = 0; f < frames; f++, src += in_ch, dst += out_ch) {
+        for (o = 0; o < out_ch; o++) {
+            float acc = 0.0f;
+            for (i = 0; i < in_ch; i++)
+                acc += cols[i * pad + o] * src[i];
+            dst[o] = (int16_t)lrintf(fminf(fmaxf(acc, S16_MIN), S16_MAX));
+        }
+    }
+}
+
+static void mix_s24_scalar(int32_t *dst, unsigned int out_ch, const int32_t *src,
+                           unsigned int in_ch, const float *cols, unsigned int frames)
+{
+    unsigned int pad = (out_ch + MIX_PAD - 1) & ~(MIX_PAD - 1);
+    unsigned int f, i, o;
+
+    for (f = 0; f < frames; f++, src += in_ch, dst += out_ch) {
+        for (o = 0; o < out_ch; o++) {
+            float acc = 0.0f;
+            for (i = 0; i < in_ch; i++)
+                acc += cols[i * pad + o] * ((int32_t)((uint32_t)src[i] << 8) >> 8);
+            dst[o] = (int32_t)lrintf(fminf(fmaxf(acc, S24_MIN), S24_MAX));
+        }
+    }
+}
+
+static void deinterleave16x2_scalar(int16_t *l, int16_t *r, const int16_t *src,
+                                    unsigned int frames)
+{
+    unsigned int i;
+
+    for (i = 0; i < frames; i++) {
+        l[i] = src[2 * i];
+        r[i] = src[2 * i + 1];
+    }
+}
+
+static void interleave16x2_scalar(int16_t *dst, const int16_t *l, const int16_t *r,
+                                  unsigned int frames)
+{
+    unsigned int i;
+
+    for (i = 0; i < frames; i++) {
+        dst[2 * i] = l[i];
+        dst[2 * i + 1] = r[i];
+    }
+}
+
+static void deinterleave32x2_scalar(int32_t *l, int32_t *r, const int32_t *src,
+                                    unsigned int frames)
+{
+    unsigned int i;
+
+    for (i = 0; i < frames; i++) {
+        l[i] = src[2 * i];
+        r[i] = src[2 * i + 1];
+    }
+}
+
+static void interleave32x2_scalar(int32_t *dst, const int32_t *l, const int32_t *r,
+                                  unsigned int frames)
+{
+    unsigned int i;
+
+    for (i = 0; i < frames; i++) {
+        dst[2 * i] = l[i];
+        dst[2 * i + 1] = r[i];
+    }
+}
+
+static const struct convert_ops scalar_ops = {
+    .name = "scalar",
+    .replicate32 = replicate32_scalar,
+    .replicate64 = replicate64_scalar,
+    .mix_s16 = mix_s16_scalar,
+    .mix_s24 = mix_s24_scalar,
+    .deinterleave16x2 = deinterleave16x2_scalar,
+    .interleave16x2 = interleave16x2_scalar,
+    .deinterleave32x2 = deinterleave32x2_scalar,
+    .interleave32x2 = interleave32x2_scalar,
+};
+
+#ifdef CONVERT_X86
+
+/*
+ * SSE2 kernels
+ */
+
+CONVERT_SSE2
+static void replicate32_sse2(uint32_t *dst, const uint32_t *src,
+                             unsigned int frames, unsigned int k)
+{
+    unsigned int i = 0, j;
+
+    if (k == 2) {
+        for (; i + 4 <= frames; i += 4, dst += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi32(v, v));
+        }
+    } else if (!(k & 3)) {
+        for (; i + 4 <= frames; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i b[4];
+
+            b[0] = _mm_shuffle_epi32(v, 0x00);
+            b[1] = _mm_shuffle_epi32(v, 0x55);
+            b[2] = _mm_shuffle_epi32(v, 0xaa);
+            b[3] = _mm_shuffle_epi32(v, 0xff);
+            for (j = 0; j < 4; j++) {
+                unsigned int n;
+                for (n = 0; n < k; n += 4, dst += 4)
+                    _mm_storeu_si128((__m128i *)dst, b[j]);
+            }
+        }
+    }
+    replicate32_scalar(dst, src + i, frames - i, k);
+}
+
+CONVERT_SSE2
+static void replicate64_sse2(uint64_t *dst, const uint64_t *src,
+                             unsigned int frames, unsigned int k)
+{
+    unsigned int i = 0, n;
+
+    if (!(k & 1)) {
+        for (; i + 2 <= frames; i += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i b0 = _mm_unpacklo_epi64(v, v);
+            __m128i b1 = _mm_unpackhi_epi64(v, v);
+
+            for (n = 0; n < k; n += 2, dst += 2)
+                _mm_storeu_si128((__m128i *)dst, b0);
+            for (n = 0; n < k; n += 2, dst += 2)
+                _mm_storeu_si128((__m128i *)dst, b1);
+        }
+    }
+    replicate64_scalar(dst, src + i, frames - i, k);
+}
+
+/* float saturation before conversion, cvtps rounds to nearest like lrintf */
+CONVERT_SSE2
+static inline __m128i mix_block_sse2(const float *x, unsigned int in_ch,
+                                     const float *cols, unsigned int pad,
+                                     float lo, float hi)
+{
+    __m128 acc = _mm_setzero_ps();
+    unsigned int i;
+
+    for (i = 0; i < in_ch; i++)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(x[i]),
+                                         _mm_loadu_ps(cols + i * pad)));
+    acc = _mm_min_ps(_mm_max_ps(acc, _mm_set1_ps(lo)), _mm_set1_ps(hi));
+    return _mm_cvtps_epi32(acc);
+}
+
+CONVERT_SSE2
+static void mix_s16_sse2(int16_t *dst, unsigned int out_ch, const int16_t *src,
+                         unsigned int in_ch, const float *cols, unsigned int frames)
+{
+    unsigned int pad = (out_ch + MIX_PAD - 1) & ~(MIX_PAD - 1);
+    float x[PCM_CONVERT_MAX_CHANNELS];
+    unsigned int f, i, o;
+
+    for (f = 0; f < frames; f++, src += in_ch, dst += out_ch) {
+        for (i = 0; i < in_ch; i++)
+            x[i] = src[i];
+        for (o = 0; o < out_ch; o += 4) {
+            __m128i v = mix_block_sse2(x, in_ch, cols + o, pad, S16_MIN, S16_MAX);
+            v = _mm_packs_epi32(v, v);
+            if (o + 4 <= out_ch) {
+                _mm_storel_epi64((__m128i *)(dst + o), v);
+            } else {
+                int16_t tmp[8];
+                _mm_storeu_si128((__m128i *)tmp, v);
+                memcpy(dst + o, tmp, (out_ch - o) * sizeof(*dst));
+            }
+        }
+    }
+}
+
+CONVERT_SSE2
+static void mix_s24_sse2(int32_t *dst, unsigned int out_ch, const int32_t *src,
+                         unsigned int in_ch, const float *cols, unsigned int frames)
+{
+    unsigned int pad = (out_ch + MIX_PAD - 1) & ~(MIX_PAD - 1);
+    float x[PCM_CONVERT_MAX_CHANNELS];
+    unsigned int f, i, o;
+
+    for (f = 0; f < frames; f++, src += in_ch, dst += out_ch) {
+        for (i = 0; i < in_ch; i++)
+            x[i] = (int32_t)((uint32_t)src[i] << 8) >> 8;
+        for (o = 0; o < out_ch; o += 4) {
+            __m128i v = mix_block_sse2(x, in_ch, cols + o, pad, S24_MIN, S24_MAX);
+            if (o + 4 <= out_ch) {
+                _mm_storeu_si128((__m128i *)(dst + o), v);
+            } else {
+                int32_t tmp[4];
+                _mm_storeu_si128((__m128i *)tmp, v);
+                memcpy(dst + o, tmp, (out_ch - o) * sizeof(*dst));
+            }
+        }
+    }
+}
+
+CONVERT_SSE2
+static void deinterleave16x2_sse2(int16_t *l, int16_t *r, const int16_t *src,
+                                  unsigned int frames)
+{
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 8));
+        /* left is the low half of each 32 bit frame: sign extend both halves
+         * and pack them back, nothing can saturate */
+        __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+
+        _mm_storeu_si128((__m128i *)(l + i), _mm_packs_epi32(la, lb));
+        _mm_storeu_si128((__m128i *)(r + i),
+                         _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+    }
+    deinterleave16x2_scalar(l + i, r + i, src + 2 * i, frames - i);
+}
+
+CONVERT_SSE2
+static void interleave16x2_sse2(int16_t *dst, const int16_t *l, const int16_t *r,
+                                unsigned int frames)
+{
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8) {
+        __m128i vl = _mm_loadu_si128((const __m128i *)(l + i));
+        __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi16(vl, vr));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 8), _mm_unpackhi_epi16(vl, vr));
+    }
+    interleave16x2_scalar(dst + 2 * i, l + i, r + i, frames - i);
+}
+
+CONVERT_SSE2
+static void deinterleave32x2_sse2(int32_t *l, int32_t *r, const int32_t *src,
+                                  unsigned int frames)
+{
+    unsigned int i = 0;
+
+    for (; i + 4 <= frames; i += 4) {
+        __m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(src + 2 * i)));
+        __m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(src + 2 * i + 4)));
+
+        _mm_storeu_si128((__m128i *)(l + i),
+                         _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))));
+        _mm_storeu_si128((__m128i *)(r + i),
+                         _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+    deinterleave32x2_scalar(l + i, r + i, src + 2 * i, frames - i);
+}
+
+CONVERT_SSE2
+static void interleave32x2_sse2(int32_t *dst, const int32_t *l, const int32_t *r,
+                                unsigned int frames)
+{
+    unsigned int i = 0;
+
+    for (; i + 4 <= frames; i += 4) {
+        __m128i vl = _mm_loadu_si128((const __m128i *)(l + i));
+        __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi32(vl, vr));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 4), _mm_unpackhi_epi32(vl, vr));
+    }
+    interleave32x2_scalar(dst + 2 * i, l + i, r + i, frames - i);
+}
+
+static const struct convert_ops sse2_ops = {
+    .name = "sse2",
+    .replicate32 = replicate32_sse2,
+    .replicate64 = replicate64_sse2,
+    .mix_s16 = mix_s16_sse2,
+    .mix_s24 = mix_s24_sse2,
+    .deinterleave16x2 = deinterleave16x2_sse2,
+    .interleave16x2 = interleave16x2_sse2,
+    .deinterleave32x2 = deinterleave32x2_sse2,
+    .interleave32x2 = interleave32x2_sse2,
+};
+
+/*
+ * AVX2 kernels
+ */
+
+/* output vector j of a k-fold fan out of eight frames holds frames
+ * (8j + m) / k, so one permute per output vector covers any k */
+CONVERT_AVX2
+static void replicate32_avx2(uint32_t *dst, const uint32_t *src,
+                             unsigned int frames, unsigned int k)
+{
+    __m256i idx[PCM_CONVERT_MAX_CHANNELS];
+    unsigned int i = 0, j;
+
+    if (k > PCM_CONVERT_MAX_CHANNELS) {
+        replicate32_scalar(dst, src, frames, k);
+        return;
+    }
+
+    for (j = 0; j < k; j++)
+        idx[j] = _mm256_setr_epi32((8 * j) / k, (8 * j + 1) / k, (8 * j + 2) / k,
+                                   (8 * j + 3) / k, (8 * j + 4) / k, (8 * j + 5) / k,
+                                   (8 * j + 6) / k, (8 * j + 7) / k);
+
+    for (; i + 8 <= frames; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        for (j = 0; j < k; j++, dst += 8)
+            _mm256_storeu_si256((__m256i *)dst, _mm256_permutevar8x32_epi32(v, idx[j]));
+    }
+    replicate32_scalar(dst, src + i, frames - i, k);
+}
+
+/* as above with four 64 bit frames, moved as pairs of 32 bit lanes */
+CONVERT_AVX2
+static void replicate64_avx2(uint64_t *dst, const uint64_t *src,
+                             unsigned int frames, unsigned int k)
+{
+    __m256i idx[PCM_CONVERT_MAX_CHANNELS];
+    unsigned int i = 0, j;
+
+    if (k > PCM_CONVERT_MAX_CHANNELS) {
+        replicate64_scalar(dst, src, frames, k);
+        return;
+    }
+
+    for (j = 0; j < k; j++) {
+        int f0 = (4 * j) / k, f1 = (4 * j + 1) / k;
+        int f2 = (4 * j + 2) / k, f3 = (4 * j + 3) / k;
+        idx[j] = _mm256_setr_epi32(2 * f0, 2 * f0 + 1, 2 * f1, 2 * f1 + 1,
+                                   2 * f2, 2 * f2 + 1, 2 * f3, 2 * f3 + 1);
+    }
+
+    for (; i + 4 <= frames; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        for (j = 0; j < k; j++, dst += 4)
+            _mm256_storeu_si256((__m256i *)dst, _mm256_permutevar8x32_epi32(v, idx[j]));
+    }
+    replicate64_scalar(dst, src + i, frames - i, k);
+}
+
+CONVERT_AVX2
+static inline __m256i mix_block_avx2(const float *x, unsigned int in_ch,
+                                     const float *cols, unsigned int pad,
+                                     float lo, float hi)
+{
+    __m256 acc = _mm256_setzero_ps();
+    unsigned int i;
+
+    for (i = 0; i < in_ch; i++)
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(x[i]),
+                                               _mm256_loadu_ps(cols + i * pad)));
+    acc = _mm256_min_ps(_mm256_max_ps(acc, _mm256_set1_ps(lo)), _mm256_set1_ps(hi));
+    return _mm256_cvtps_epi32(acc);
+}
+
+CONVERT_AVX2
+static void mix_s16_avx2(int16_t *dst, unsigned int out_ch, const int16_t *src,
+                         unsigned int in_ch, const float *cols, unsigned int frames)
+{
+    unsigned int pad = (out_ch + MIX_PAD - 1) & ~(MIX_PAD - 1);
+    float x[PCM_CONVERT_MAX_CHANNELS];
+    unsigned int f, i, o;
+
+    for (f = 0; f < frames; f++, src += in_ch, dst += out_ch) {
+        for (i = 0; i < in_ch; i++)
+            x[i] = src[i];
+        for (o = 0; o < out_ch; o += 8) {
+            __m256i v = mix_block_avx2(x, in_ch, cols + o, pad, S16_MIN, S16_MAX);
+            __m128i s = _mm_packs_epi32(_mm256_castsi256_si128(v),
+                                        _mm256_extracti128_si256(v, 1));
+            if (o + 8 <= out_ch) {
+                _mm_storeu_si128((__m128i *)(dst + o), s);
+            } else {
+                int16_t tmp[8];
+                _mm_storeu_si128((__m128i *)tmp, s);
+                memcpy(dst + o, tmp, (out_ch - o) * sizeof(*dst));
+            }
+        }
+    }
+}
+
+CONVERT_AVX2
+static void mix_s24_avx2(int32_t *dst, unsigned int out_ch, const int32_t *src,
+                         unsigned int in_ch, const float *cols, unsigned int frames)
+{
+    unsigned int pad = (out_ch + MIX_PAD - 1) & ~(MIX_PAD - 1);
+    float x[PCM_CONVERT_MAX_CHANNELS];
+    unsigned int f, i, o;
+
+    for (f = 0; f < frames; f++, src += in_ch, dst += out_ch) {
+        for (i = 0; i < in_ch; i++)
+            x[i] = (int32_t)((uint32_t)src[i] << 8) >> 8;
+        for (o = 0; o < out_ch; o += 8) {
+            __m256i v = mix_block_avx2(x, in_ch, cols + o, pad, S24_MIN, S24_MAX);
+            if (o + 8 <= out_ch) {
+                _mm256_storeu_si256((__m256i *)(dst + o), v);
+            } else {
+                int32_t tmp[8];
+                _mm256_storeu_si256((__m256i *)tmp, v);
+                memcpy(dst + o, tmp, (out_ch - o) * sizeof(*dst));
+            }
+        }
+    }
+}
+
+/* interleaving is load/store bound, the SSE2 versions are kept */
+static const struct convert_ops avx2_ops = {
+    .name = "avx2",
+    .replicate32 = replicate32_avx2,
+    .replicate64 = replicate64_avx2,
+    .mix_s16 = mix_s16_avx2,
+    .mix_s24 = mix_s24_avx2,
+    .deinterleave16x2 = deinterleave16x2_sse2,
+    .interleave16x2 = interleave16x2_sse2,
+    .deinterleave32x2 = deinterleave32x2_sse2,
+    .interleave32x2 = interleave32x2_sse2,
+};
+
+#endif /* CONVERT_X86 */
+
+#ifdef CONVERT_NEON
+
+/*
+ * NEON kernels
+ */
+
+static void replicate32_neon(uint32_t *dst, const uint32_t *src,
+                             unsigned int frames, unsigned int k)
+{
+    unsigned int i = 0, j, n;
+
+    if (k == 2) {
+        for (; i + 4 <= frames; i += 4, dst += 8) {
+            uint32x4_t v = vld1q_u32(src + i);
+            uint32x4x2_t z = vzipq_u32(v, v);
+            vst1q_u32(dst, z.val[0]);
+            vst1q_u32(dst + 4, z.val[1]);
+        }
+    } else if (!(k & 3)) {
+        for (; i + 4 <= frames; i += 4) {
+            uint32x4_t b[4];
+
+            b[0] = vdupq_n_u32(src[i]);
+            b[1] = vdupq_n_u32(src[i + 1]);
+            b[2] = vdupq_n_u32(src[i + 2]);
+            b[3] = vdupq_n_u32(src[i + 3]);
+            for (j = 0; j < 4; j++)
+                for (n = 0; n < k; n += 4, dst += 4)
+                    vst1q_u32(dst, b[j]);
+        }
+    }
+    replicate32_scalar(dst, src + i, frames - i, k);
+}
+
+static void replicate64_neon(uint64_t *dst, const uint64_t *src,
+                             unsigned int frames, unsigned int k)
+{
+    unsigned int i = 0, n;
+
+    if (!(k & 1)) {
+        for (; i + 2 <= frames; i += 2) {
+            uint64x2_t v = vld1q_u64(src + i);
+            uint64x2_t b0 = vcombine_u64(vget_low_u64(v), vget_low_u64(v));
+            uint64x2_t b1 = vcombine_u64(vget_high_u64(v), vget_high_u64(v));
+
+            for (n = 0; n < k; n += 2, dst += 2)
+                vst1q_u64(dst, b0);
+            for (n = 0; n < k; n += 2, dst += 2)
+                vst1q_u64(dst, b1);
+        }
+    }
+    replicate64_scalar(dst, src + i, frames - i, k);
+}
+
+/* vcvtq rounds towards zero, add the sign-matched half first */
+static inline int32x4_t mix_block_neon(const float *x, unsigned int in_ch,
+                                       const float *cols, unsigned int pad,
+                                       float lo, float hi)
+{
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    uint32x4_t sign;
+    unsigned int i;
+
+    for (i = 0; i < in_ch; i++)
+        acc = vmlaq_n_f32(acc, vld1q_f32(cols + i * pad), x[i]);
+    acc = vminq_f32(vmaxq_f32(acc, vdupq_n_f32(lo)), vdupq_n_f32(hi));
+    sign = vandq_u32(vreinterpretq_u32_f32(acc), vdupq_n_u32(0x80000000));
+    acc = vaddq_f32(acc, vreinterpretq_f32_u32(vorrq_u32(sign,
+                                vreinterpretq_u32_f32(vdupq_n_f32(0.5f)))));
+    return vcvtq_s32_f32(acc);
+}
+
+static void mix_s16_neon(int16_t *dst, unsigned int out_ch, const int16_t *src,
+                         unsigned int in_ch, const float *cols, unsigned int frames)
+{
+    unsigned int pad = (out_ch + MIX_PAD - 1) & ~(MIX_PAD - 1);
+    float x[PCM_CONVERT_MAX_CHANNELS];
+    unsigned int f, i, o;
+
+    for (f = 0; f < frames; f++, src += in_ch, dst += out_ch) {
+        for (i = 0; i < in_ch; i++)
+            x[i] = src[i];
+        for (o = 0; o < out_ch; o += 4) {
+            int16x4_t v = vqmovn_s32(mix_block_neon(x, in_ch, cols + o, pad,
+                                                    S16_MIN, S16_MAX));
+            if (o + 4 <= out_ch) {
+                vst1_s16(dst + o, v);
+            } else {
+                int16_t tmp[4];
+                vst1_s16(tmp, v);
+                memcpy(dst + o, tmp, (out_ch - o) * sizeof(*dst));
+            }
+        }
+    }
+}
+
+static void mix_s24_neon(int32_t *dst, unsigned int out_ch, const int32_t *src,
+                         unsigned int in_ch, const float *cols, unsigned int frames)
+{
+    unsigned int pad = (out_ch + MIX_PAD - 1) & ~(MIX_PAD - 1);
+    float x[PCM_CONVERT_MAX_CHANNELS];
+    unsigned int f, i, o;
+
+    for (f = 0; f < frames; f++, src += in_ch, dst += out_ch) {
+        for (i = 0; i < in_ch; i++)
+            x[i] = (int32_t)((uint32_t)src[i] << 8) >> 8;
+        for (o = 0; o < out_ch; o += 4) {
+            int32x4_t v = mix_block_neon(x, in_ch, cols + o, pad, S24_MIN, S24_MAX);
+            if (o + 4 <= out_ch) {
+                vst1q_s32(dst + o, v);
+            } else {
+                int32_t tmp[4];
+                vst1q_s32(tmp, v);
+                memcpy(dst + o, tmp, (out_ch - o) * sizeof(*dst));
+            }
+        }
+    }
+}
+
+static void deinterleave16x2_neon(int16_t *l, int16_t *r, const int16_t *src,
+                                  unsigned int frames)
+{
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t v = vld2q_s16(src + 2 * i);
+        vst1q_s16(l + i, v.val[0]);
+        vst1q_s16(r + i, v.val[1]);
+    }
+    deinterleave16x2_scalar(l + i, r + i, src + 2 * i, frames - i);
+}
+
+static void interleave16x2_neon(int16_t *dst, const int16_t *l, const int16_t *r,
+                                unsigned int frames)
+{
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t v;
+        v.val[0] = vld1q_s16(l + i);
+        v.val[1] = vld1q_s16(r + i);
+        vst2q_s16(dst + 2 * i, v);
+    }
+    interleave16x2_scalar(dst + 2 * i, l + i, r + i, frames - i);
+}
+
+static void deinterleave32x2_neon(int32_t *l, int32_t *r, const int32_t *src,
+                                  unsigned int frames)
+{
+    unsigned int i = 0;
+
+    for (; i + 4 <= frames; i += 4) {
+        int32x4x2_t v = vld2q_s32(src + 2 * i);
+        vst1q_s32(l + i, v.val[0]);
+        vst1q_s32(r + i, v.val[1]);
+    }
+    deinterleave32x2_scalar(l + i, r + i, src + 2 * i, frames - i);
+}
+
+static void interleave32x2_neon(int32_t *dst, const int32_t *l, const int32_t *r,
+                                unsigned int frames)
+{
+    unsigned int i = 0;
+
+    for (; i + 4 <= frames; i += 4) {
+        int32x4x2_t v;
+        v.val[0] = vld1q_s32(l + i);
+        v.val[1] = vld1q_s32(r + i);
+        vst2q_s32(dst + 2 * i, v);
+    }
+    interleave32x2_scalar(dst + 2 * i, l + i, r + i, frames - i);
+}
+
+static const struct convert_ops neon_ops = {
+    .name = "neon",
+    .replicate32 = replicate32_neon,
+    .replicate64 = replicate64_neon,
+    .mix_s16 = mix_s16_neon,
+    .mix_s24 = mix_s24_neon,
+    .deinterleave16x2 = deinterleave16x2_neon,
+    .interleave16x2 = interleave16x2_neon,
+    .deinterleave32x2 = deinterleave32x2_neon,
+    .interleave32x2 = interleave32x2_neon,
+};
+
+#endif /* CONVERT_NEON */
+
+/*
+ * Runtime selection
+ */
+
+static const struct convert_ops *convert_ops = &scalar_ops;
+static pthread_once_t convert_once = PTHREAD_ONCE_INIT;
+
+static int convert_ops_supported(const struct convert_ops *ops)
+{
+#ifdef CONVERT_X86
+    __builtin_cpu_init();
+    if (ops == &avx2_ops)
+        return __builtin_cpu_supports("avx2");
+    if (ops == &sse2_ops)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+static const struct convert_ops * const all_ops[] = {
+#ifdef CONVERT_X86
+    &avx2_ops,
+    &sse2_ops,
+#endif
+#ifdef CONVERT_NEON
+    &neon_ops,
+#endif
+    &scalar_ops,
+};
+
+static void convert_init(void)
+{
+    unsigned int i;
+
+    /* best first */
+    for (i = 0; i < sizeof(all_ops) / sizeof(all_ops[0]); i++) {
+        if (convert_ops_supported(all_ops[i])) {
+            convert_ops = all_ops[i];
+            return;
+        }
+    }
+}
+
+static inline const struct convert_ops *convert_get_ops(void)
+{
+    pthread_once(&convert_once, convert_init);
+    return convert_ops;
+}
+
+const char *pcm_convert_get_impl(void)
+{
+    return convert_get_ops()->name;
+}
+
+int pcm_convert_set_impl(const char *name)
+{
+    unsigned int i;
+
+    convert_get_ops();
+    for (i = 0; i < sizeof(all_ops) / sizeof(all_ops[0]); i++) {
+        if (!strcmp(all_ops[i]->name, name)) {
+            if (!convert_ops_supported(all_ops[i]))
+                return -EINVAL;
+            convert_ops = all_ops[i];
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+/*
+ * Public API
+ */
+
+static int convert_check(enum pcm_format format, unsigned int a, unsigned int b)
+{
+    if (!convert_sample_bytes(format) ||
+        !a || a > PCM_CONVERT_MAX_CHANNELS ||
+        !b || b > PCM_CONVERT_MAX_CHANNELS)
+        return -EINVAL;
+    return 0;
+}
+
+int pcm_convert_fanout(enum pcm_format format, void *dst, unsigned int out_channels,
+                       const void *src, unsigned int in_channels, unsigned int frames)
+{
+    const struct convert_ops *ops = convert_get_ops();
+    unsigned int bytes = convert_sample_bytes(format);
+    unsigned int in_frame = in_channels * bytes;
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+    unsigned int i, c;
+
+    if (convert_check(format, in_channels, out_channels))
+        return -EINVAL;
+
+    /* whole input frames repeated, e.g. stereo s16 to 8 channels */
+    if (out_channels % in_channels == 0) {
+        unsigned int k = out_channels / in_channels;
+
+        if (in_frame == 4) {
+            ops->replicate32(dst, src, frames, k);
+            return 0;
+        }
+        if (in_frame == 8) {
+            ops->replicate64(dst, src, frames, k);
+            return 0;
+        }
+    }
+
+    switch (bytes) {
+    case 2: {
+        const int16_t *s16 = src;
+        int16_t *d16 = dst;
+        for (i = 0; i < frames; i++, s16 += in_channels)
+            for (c = 0; c < out_channels; c++)
+                *d16++ = s16[c % in_channels];
+        break;
+    }
+    case 4: {
+        const int32_t *s32 = src;
+        int32_t *d32 = dst;
+        for (i = 0; i < frames; i++, s32 += in_channels)
+            for (c = 0; c < out_channels; c++)
+                *d32++ = s32[c % in_channels];
+        break;
+    }
+    case 3:
+        for (i = 0; i < frames; i++, s += in_frame) {
+            for (c = 0; c < out_channels; c++, d += 3) {
+                const uint8_t *p = s + (c % in_channels) * 3;
+                d[0] = p[0];
+                d[1] = p[1];
+                d[2] = p[2];
+            }
+        }
+        break;
+    default:
+        for (i = 0; i < frames; i++, s += in_frame)
+            for (c = 0; c < out_channels; c++)
+                *d++ = s[c % in_channels];
+        break;
+    }
+    return 0;
+}
+
+int pcm_convert_mix(enum pcm_format format, void *dst, unsigned int out_channels,
+                    const void *src, unsigned int in_channels,
+                    const float *gains, unsigned int frames)
+{
+    const struct convert_ops *ops = convert_get_ops();
+    unsigned int bytes = convert_sample_bytes(format);
+    unsigned int pad = (out_channels + MIX_PAD - 1) & ~(MIX_PAD - 1);
+    float cols[MIX_COLS_SIZE];
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+    unsigned int f, i, o;
+
+    if (convert_check(format, in_channels, out_channels) || !gains)
+        return -EINVAL;
+
+    switch (format) {
+    case PCM_FORMAT_S16_LE:
+    case PCM_FORMAT_S24_LE:
+        memset(cols, 0, sizeof(float) * pad * in_channels);
+        for (o = 0; o < out_channels; o++)
+            for (i = 0; i < in_channels; i++)
+                cols[i * pad + o] = gains[o * in_channels + i];
+
+        if (format == PCM_FORMAT_S16_LE)
+            ops->mix_s16(dst, out_channels, src, in_channels, cols, frames);
+        else
+            ops->mix_s24(dst, out_channels, src, in_channels, cols, frames);
+        return 0;
+    default:
+        break;
+    }
+
+    /* float cannot hold 32 bit samples, accumulate in double */
+    for (f = 0; f < frames; f++, s += in_channels * bytes) {
+        for (o = 0; o < out_channels; o++, d += bytes) {
+            double acc = 0.0;
+            for (i = 0; i < in_channels; i++)
+                acc += (double)gains[o * in_channels + i] *
+                       sample_get(format, s + i * bytes);
+            sample_put(format, d, acc);
+        }
+    }
+    return 0;
+}
+
+int pcm_convert_deinterleave(enum pcm_format format, void * const *dst,
+                             const void *src, unsigned int channels,
+                             unsigned int frames)
+{
+    const struct convert_ops *ops = convert_get_ops();
+    unsigned int bytes = convert_sample_bytes(format);
+    unsigned int frame_bytes = channels * bytes;
+    unsigned int f, c;
+
+    if (convert_check(format, channels, channels) || !dst)
+        return -EINVAL;
+
+    if (channels == 2 && bytes == 2) {
+        ops->deinterleave16x2(dst[0], dst[1], src, frames);
+        return 0;
+    }
+    if (channels == 2 && bytes == 4) {
+        ops->deinterleave32x2(dst[0], dst[1], src, frames);
+        return 0;
+    }
+
+    for (c = 0; c < channels; c++) {
+        const uint8_t *s = (const uint8_t *)src + c * bytes;
+        uint8_t *d = dst[c];
+
+        switch (bytes) {
+        case 2:
+            for (f = 0; f < frames; f++, s += frame_bytes)
+                ((int16_t *)d)[f] = *(const int16_t *)s;
+            break;
+        case 4:
+            for (f = 0; f < frames; f++, s += frame_bytes)
+                ((int32_t *)d)[f] = *(const int32_t *)s;
+            break;
+        default:
+            for (f = 0; f < frames; f++, s += frame_bytes, d += bytes)
+                memcpy(d, s, bytes);
+            break;
+        }
+    }
+    return 0;
+}
+
+int pcm_convert_interleave(enum pcm_format format, void *dst,
+                           const void * const *src, unsigned int channels,
+                           unsigned int frames)
+{
+    const struct convert_ops *ops = convert_get_ops();
+    unsigned int bytes = convert_sample_bytes(format);
+    unsigned int frame_bytes = channels * bytes;
+    unsigned int f, c;
+
+    if (convert_check(format, channels, channels) || !src)
+        return -EINVAL;
+
+    if (channels == 2 && bytes == 2) {
+        ops->interleave16x2(dst, src[0], src[1], frames);
+        return 0;
+    }
+    if (channels == 2 && bytes == 4) {
+        ops->interleave32x2(dst, src[0], src[1], frames);
+        return 0;
+    }
+
+    for (c = 0; c < channels; c++) {
+        const uint8_t *s = src[c];
+        uint8_t *d = (uint8_t *)dst + c * bytes;
+
+        switch (bytes) {
+        case 2:
+            for (f = 0; f < frames; f++, d += frame_bytes)
+                *(int16_t *)d = ((const int16_t *)s)[f];
+            break;
+        case 4:
+            for (f = 0; f < frames; f++, d += frame_bytes)
+                *(int32_t *)d = ((const int32_t *)s)[f];
+            break;
+        default:
+            for (f = 0; f < frames; f++, s += bytes, d += frame_bytes)
+                memcpy(d, s, bytes);
+            break;
+        }
+    }
+    return 0;
+}
@@ -32,92 +32,24 @@
 #include <stdint.h>
 #include <string.h>
 #include <signal.h>
-#include <semaphore.h>
+#include <unistd.h>
 
-static int close = 0;
+static int closing = 0;
 struct j6 {
     struct pcm_config speakerConfig;
     struct pcm_config fmConfig;
     struct pcm *speaker ;	
     struct pcm *fm ;
-    int *buffer[2];
-    int *buffer1[2];
-    int size;
-	int proc_int;
-	int play_int;
-    pthread_t proc_thread;
-    pthread_t play_thread;
-	sem_t proc_sem;
-	sem_t play_sem;
-	int proc_id;
-	int play_id;
+    struct pcm_route *route;
 };
 
 void fm_sample(struct j6 *dev,  unsigned int period_size,unsigned int period_count);
 
-static void *proc_func(void *arg)
-{
-    struct j6 *dev = (struct j6 *)arg;
-    int ret = 0; 
-	int i=0;
-	int proc_id=0;
-	int play_id=0;
-	int len=0;
-	int buffer1_len=0;
-	int j = 0;
-    int *buffer;
-    int *buffer1;
-	sem_t * sem=NULL;
-	len = (dev->size)/4; 
-	buffer1_len = (dev->size)*4;
-	sem=&(dev->proc_sem);
-	while(!close){
-		sem_wait(sem);
-		proc_id=dev->play_id;
-	 	play_id=dev->play_id+1;
-		play_id=play_id%2;
-		for(i=0;i<len;i++)	{
-			for(j=0;j<4;j++){
-				dev->buffer1[play_id][i*4+j]=dev->buffer[proc_id][i];
-			}
-			dev->play_id=play_id;
-			sem_post(&(dev->play_sem));
-		}	
-	}
-    return (void*)ret;
-}
-
-static void *play_func(void *arg)
-{
-    struct j6 *dev = (struct j6 *)arg;
-	int len=0;
-	int buffer1_len=0;
-    int ret = 0; 
-    struct pcm *speaker ;	
-    struct pcm *fm ;  
-	int *buffer;
-    int *buffer1;
-	int play_id = 0;
-	sem_t * sem=NULL;
-	len = (dev->size)/4; 
-	buffer1_len = (dev->size)*4;
-	speaker= dev->speaker;
-	sem=&(dev->play_sem);
-	while(!close){
-		sem_wait(sem);
-		play_id=dev->play_id;
-		
-		fprintf(stderr,"play_func play_id:%d\n",play_id);
-		pcm_write(speaker, dev->buffer1[play_id],buffer1_len);
-	}
-    return (void*)ret;
-}
-
 void stream_close(int sig)
 {
     /* allow the stream to be closed gracefully */
     signal(sig, SIG_IGN);
-    close = 1;
+    closing = 1;
 }
 
 int main(int argc, char **argv)
@@ -125,9 +57,6 @@ int main(int argc, char **argv)
     unsigned int period_size = 1024;
     unsigned int period_count = 4;
 	struct j6 dev;
-	int ret=0;
-	sem_init(&(dev.play_sem), 0,0);
-	sem_init(&(dev.proc_sem), 0,0);
     fm_sample(&dev, period_size, period_count);
     return 0;
 }
@@ -183,14 +112,9 @@ int sample_is_playable(unsigned int card, unsigned int device, unsigned int chan
 void fm_sample(struct j6 *dev, unsigned int period_size,
                  unsigned int period_count)
 {
-    int ret;
-	int i;
-	int j;
-	int len;
-	int buffer1_len;
-	int k=0;
-	int proc_id=0;
-	sem_t * sem;
+    struct pcm_route_stats stats;
+
+    dev->route = NULL;
     memset(&dev->speakerConfig, 0, sizeof(dev->speakerConfig));
     memset(&dev->fmConfig, 0, sizeof(dev->fmConfig));
     dev->speakerConfig.channels = 8;
@@ -225,48 +149,37 @@ void fm_sample(struct j6 *dev, unsigned int period_size,
     if (!dev->fm || !pcm_is_ready(dev->fm)) {
         fprintf(stderr, "Unable to open fm device (%s)\n",
                 pcm_get_error(dev->fm));
+        pcm_close(dev->speaker);
         return ;
     }
 
-    dev->size = pcm_frames_to_bytes(dev->speaker, pcm_get_buffer_size(dev->speaker));
-	for(i=0;i<2;i++){
-    	dev->buffer[i] = malloc(dev->size);
-    	if (!dev->buffer[i]) {
-       	 	fprintf(stderr, "Unable to allocate %d bytes\n", dev->size);
-        	pcm_close(dev->speaker);
-        	return;
-    	}
-	}
-	
-	for(i=0;i<2;i++){
-    	dev->buffer1[i] = malloc(dev->size*4);
-    	if (!dev->buffer1[i]) {
-        	fprintf(stderr, "Unable to allocate %d bytes for buffer1\n", dev->size*4);
-        	pcm_close(dev->speaker);
-        	return;
-    	}
-	}
-    printf("Playing sample: 8 ch, 44100 hz, 16 bit,dev->size:%d\n",dev->size);
-	ret = pthread_create(&(dev->proc_thread), NULL, proc_func, dev);
-	ret = pthread_create(&(dev->play_thread), NULL, play_func, dev);
+    /* fm capture -> ring -> 2 to 8 channel fan out -> speaker */
+    dev->route = pcm_route_open(dev->fm, dev->speaker, period_count);
+    if (!dev->route) {
+        fprintf(stderr, "Unable to create fm route\n");
+        goto out;
+    }
 
+    printf("Playing sample: 8 ch, 44100 hz, 16 bit\n");
     /* catch ctrl-c to shutdown cleanly */
     signal(SIGINT, stream_close);
-	len = dev->size/4; 
-	buffer1_len = dev->size*4;
-	sem=&(dev->proc_sem);
-    do {
-		proc_id=dev->proc_id+1;
-		proc_id=proc_id%2;
-		fprintf(stderr,"read proc_id:%d\n",proc_id);
-        pcm_read(dev->fm, dev->buffer[proc_id], dev->size);
-		dev->proc_id=proc_id;
-		sem_post(sem);
-	
-    } while (!close);
-    free(dev->buffer1);
-    free(dev->buffer);
+
+    if (pcm_route_start(dev->route) < 0) {
+        fprintf(stderr, "Unable to start fm route\n");
+        goto out;
+    }
+
+    while (!closing)
+        sleep(1);
+
+    pcm_route_stop(dev->route);
+    pcm_route_get_stats(dev->route, &stats);
+    printf("periods in %llu out %llu, max fill %u/%u, overruns %u underruns %u errors %u\n",
+           stats.periods_in, stats.periods_out, stats.max_fill, stats.depth,
+           stats.overruns, stats.underruns, stats.pcm_errors);
+
+out:
+    pcm_route_close(dev->route);
     pcm_close(dev->fm);
 	pcm_close(dev->speaker);
 }
-
@@ -76,6 +76,11 @@ enum pcm_format {
     PCM_FORMAT_S8,          /* 8-bit signed */
     PCM_FORMAT_S24_LE,      /* 24-bits in 4-bytes */
     PCM_FORMAT_S24_3LE,     /* 24-bits in 3-bytes */
+    PCM_FORMAT_U8,          /* 8-bit unsigned */
+    PCM_FORMAT_U16_LE,      /* 16-bit unsigned */
+    PCM_FORMAT_U24_LE,      /* 24-bits unsigned in 4-bytes */
+    PCM_FORMAT_U24_3LE,     /* 24-bits unsigned in 3-bytes */
+    PCM_FORMAT_U32_LE,      /* 32-bit unsigned */
 
     PCM_FORMAT_MAX,
 };
@@ -233,6 +238,34 @@ int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail,
 int pcm_write(struct pcm *pcm, const void *data, unsigned int count);
 int pcm_read(struct pcm *pcm, void *data, unsigned int count);
 
+/* Batched transfers.
+ * The segments are written (or read) in order in a single call, like as
+ * many pcm_write (pcm_read) calls back to back, and the stream state after
+ * the last one is returned in status, which may be NULL.  Start and xrun
+ * handling follow pcm_write and pcm_read.  At most PCM_XFER_MAX_SEGS
+ * segments may be passed.
+ */
+#define PCM_XFER_MAX_SEGS 64
+
+struct pcm_xfer_seg {
+    void *data;
+    unsigned int count;        /* bytes */
+};
+
+struct pcm_xfer_status {
+    unsigned int frames;       /* frames transferred by the call */
+    unsigned int hw_ptr;
+    unsigned int avail;        /* as for pcm_get_htimestamp */
+    int delay;                 /* frames until the next one is heard/was captured */
+    struct timespec tstamp;    /* of the hw_ptr update */
+    struct timespec audio_tstamp;
+};
+
+int pcm_writev(struct pcm *pcm, const struct pcm_xfer_seg *segs,
+               unsigned int nsegs, struct pcm_xfer_status *status);
+int pcm_readv(struct pcm *pcm, const struct pcm_xfer_seg *segs,
+              unsigned int nsegs, struct pcm_xfer_status *status);
+
 /*
  * mmap() support.
  */
@@ -243,6 +276,24 @@ int pcm_mmap_begin(struct pcm *pcm, void **areas, unsigned int *offset,
 int pcm_mmap_commit(struct pcm *pcm, unsigned int offset, unsigned int frames);
 int pcm_mmap_avail(struct pcm *pcm);
 
+/*
+ * Callback driven streaming on top of mmap().
+ *
+ * The callback is run from a dedicated realtime thread and is handed a pointer
+ * straight into the mmapped ring buffer, so playback data is rendered (and
+ * capture data consumed) in place without an intermediate copy.  frames is at
+ * most one period and never crosses the end of the ring.  The callback returns
+ * the number of frames it has rendered/consumed, which are then committed, or
+ * a negative value to end the stream.
+ * Only accepted if the pcm was opened with PCM_MMAP.
+ */
+typedef int (*pcm_stream_cb)(struct pcm *pcm, void *buffer, unsigned int frames,
+                             void *user);
+
+int pcm_stream_start(struct pcm *pcm, pcm_stream_cb cb, void *user);
+/* Stops the streaming thread and the pcm; returns the callback's last error, if any */
+int pcm_stream_stop(struct pcm *pcm);
+
 /* Prepare the PCM substream to be triggerable */
 int pcm_prepare(struct pcm *pcm);
 /* Start and stop a PCM channel that doesn't transfer data */
@@ -261,6 +312,73 @@ int pcm_get_poll_fd(struct pcm *pcm);
  */
 int pcm_set_avail_min(struct pcm *pcm, int avail_min);
 
+/*
+ * Channel conversion API
+ *
+ * Kernels for interleaved sample data, with SSE2, AVX2 and NEON versions
+ * picked at runtime and a portable fallback.  Channel counts are limited to
+ * PCM_CONVERT_MAX_CHANNELS.  All return 0 on success or -EINVAL.
+ */
+
+#define PCM_CONVERT_MAX_CHANNELS 32
+
+/* Fans in_channels out to out_channels, output channel c takes input channel
+ * c % in_channels; e.g. 2 to 8 channels gives L R L R L R L R. */
+int pcm_convert_fanout(enum pcm_format format, void *dst, unsigned int out_channels,
+                       const void *src, unsigned int in_channels, unsigned int frames);
+
+/* Mixes through an out_channels x in_channels gain matrix, stored row major
+ * (gains[out * in_channels + in]).  Results saturate to the format range. */
+int pcm_convert_mix(enum pcm_format format, void *dst, unsigned int out_channels,
+                    const void *src, unsigned int in_channels,
+                    const float *gains, unsigned int frames);
+
+/* Split interleaved data into one buffer per channel, and back */
+int pcm_convert_deinterleave(enum pcm_format format, void * const *dst,
+                             const void *src, unsigned int channels,
+                             unsigned int frames);
+int pcm_convert_interleave(enum pcm_format format, void *dst,
+                           const void * const *src, unsigned int channels,
+                           unsigned int frames);
+
+/* Name of the kernels in use ("scalar", "sse2", "avx2" or "neon").  The
+ * selection can be overridden, e.g. for benchmarking; only implementations
+ * supported by the running cpu are accepted. */
+const char *pcm_convert_get_impl(void);
+int pcm_convert_set_impl(const char *name);
+
+/*
+ * Route API
+ *
+ * Moves audio from a capture pcm to a playback pcm through a lock-free single
+ * producer/single consumer ring of whole periods.  A capture thread fills the
+ * ring, a playback thread drains it, fanning the capture channels out to the
+ * playback channel count on the way.  Both pcms must be opened without
+ * PCM_MMAP, with the same format, rate and period size.
+ */
+
+struct pcm_route;
+
+struct pcm_route_stats {
+    unsigned int depth;        /* ring size, in periods */
+    unsigned int fill;         /* periods currently queued */
+    unsigned int max_fill;     /* high-water mark of fill */
+    unsigned int overruns;     /* captured periods dropped, ring was full */
+    unsigned int underruns;    /* silent periods played, ring was empty */
+    unsigned int pcm_errors;   /* failed pcm_read()/pcm_write() calls */
+    unsigned long long periods_in;
+    unsigned long long periods_out;
+};
+
+/* depth is the ring size in periods; playback starts once half of it is
+ * filled, which fixes the route latency.  Use 0 for the default of 4. */
+struct pcm_route *pcm_route_open(struct pcm *in, struct pcm *out,
+                                 unsigned int depth);
+void pcm_route_close(struct pcm_route *route);
+int pcm_route_start(struct pcm_route *route);
+int pcm_route_stop(struct pcm_route *route);
+int pcm_route_get_stats(struct pcm_route *route, struct pcm_route_stats *stats);
+
 /*
  * MIXER API
  */
@@ -305,6 +423,61 @@ int mixer_ctl_set_value(struct mixer_ctl *ctl, unsigned int id, int value);
 int mixer_ctl_set_array(struct mixer_ctl *ctl, const void *array, size_t count);
 int mixer_ctl_set_enum_by_string(struct mixer_ctl *ctl, const char *string);
 
+/*
+ * Mixer transactions
+ *
+ * Collect value changes for any number of controls and apply them together.
+ * Changes to the same control are merged into a single ELEM_WRITE, and
+ * controls whose new value matches the library's cached copy of the last
+ * value read or written are not written at all.  Look controls up once with
+ * mixer_get_ctl_by_name(), which is hashed.
+ */
+struct mixer_txn;
+
+/* mixer_txn_get_result() value for a control that did not need writing */
+#define MIXER_TXN_UNCHANGED 1
+
+struct mixer_txn *mixer_txn_begin(struct mixer *mixer);
+void mixer_txn_free(struct mixer_txn *txn);
+int mixer_txn_set_value(struct mixer_txn *txn, struct mixer_ctl *ctl,
+                        unsigned int id, int value);
+int mixer_txn_set_enum_by_string(struct mixer_txn *txn, struct mixer_ctl *ctl,
+                                 const char *string);
+/* Returns the number of controls that failed, see mixer_txn_get_result() */
+int mixer_txn_commit(struct mixer_txn *txn);
+/* Per control outcome of the commit, in the order controls were first set:
+ * 0 if written, MIXER_TXN_UNCHANGED, or a negative errno */
+unsigned int mixer_txn_get_num_ctls(struct mixer_txn *txn);
+int mixer_txn_get_result(struct mixer_txn *txn, unsigned int n,
+                         struct mixer_ctl **ctl);
+
+/*
+ * Mixer events
+ *
+ * Once subscribed, the kernel queues an event whenever a control changes.
+ * Wait for them with mixer_wait_event() or by polling mixer_get_poll_fd() for
+ * POLLIN, then drain them with mixer_read_event().  Cached control state is
+ * refreshed as events are read.
+ */
+#define MIXER_EVENT_VALUE   0x01
+#define MIXER_EVENT_INFO    0x02
+#define MIXER_EVENT_ADD     0x04
+#define MIXER_EVENT_TLV     0x08
+#define MIXER_EVENT_REMOVE  0x10
+
+struct mixer_ctl_event {
+    unsigned int numid;
+    unsigned int mask;     /* MIXER_EVENT_* */
+    struct mixer_ctl *ctl; /* NULL for controls added after mixer_open() */
+};
+
+int mixer_subscribe_events(struct mixer *mixer, int subscribe);
+int mixer_get_poll_fd(struct mixer *mixer);
+/* Returns 1 if events are pending, 0 on timeout (ms, -1 waits forever) */
+int mixer_wait_event(struct mixer *mixer, int timeout);
+/* Returns 1 and fills event, 0 if the queue is empty, or a negative errno */
+int mixer_read_event(struct mixer *mixer, struct mixer_ctl_event *event);
+
 /* Determe range of integer mixer controls */
 int mixer_ctl_get_range_min(struct mixer_ctl *ctl);
 int mixer_ctl_get_range_max(struct mixer_ctl *ctl);
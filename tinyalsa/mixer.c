@@ -33,6 +33,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <ctype.h>
+#include <poll.h>
 
 #include <sys/ioctl.h>
 
@@ -48,6 +49,9 @@ struct mixer_ctl {
     struct mixer *mixer;
     struct snd_ctl_elem_info *info;
     char **ename;
+    /* last value read from or written to the control, see mixer_txn */
+    struct snd_ctl_elem_value *shadow;
+    int shadow_valid;
 };
 
 struct mixer {
@@ -56,8 +60,117 @@ struct mixer {
     struct snd_ctl_elem_info *elem_info;
     struct mixer_ctl *ctl;
     unsigned int count;
+    /* open addressed name index into ctl, -1 marks a free slot */
+    int *name_hash;
+    unsigned int name_hash_size;
+    /* events read from the kernel but not yet handed out */
+    int subscribed;
+    struct snd_ctl_event events[16];
+    unsigned int event_pos;
+    unsigned int event_count;
 };
 
+struct mixer_txn_entry {
+    struct mixer_ctl *ctl;
+    struct snd_ctl_elem_value value;
+    int result;
+};
+
+struct mixer_txn {
+    struct mixer *mixer;
+    /* entry index per control, -1 when the control is not in the transaction */
+    int *slot;
+    struct mixer_txn_entry *entries;
+    unsigned int count;
+    unsigned int size;
+};
+
+static unsigned int mixer_name_hash(const char *name)
+{
+    /* FNV-1a */
+    unsigned int h = 2166136261u;
+
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int mixer_build_name_hash(struct mixer *mixer)
+{
+    unsigned int n, size = 16;
+
+    while (size < mixer->count * 2)
+        size <<= 1;
+
+    mixer->name_hash = malloc(size * sizeof(*mixer->name_hash));
+    if (!mixer->name_hash)
+        return -ENOMEM;
+    memset(mixer->name_hash, 0xff, size * sizeof(*mixer->name_hash));
+    mixer->name_hash_size = size;
+
+    /* linear probing in control order keeps the first control of a given
+     * name first in its probe sequence, as the old linear scan did */
+    for (n = 0; n < mixer->count; n++) {
+        unsigned int h = mixer_name_hash((char *)mixer->elem_info[n].id.name);
+
+        while (mixer->name_hash[h & (size - 1)] >= 0)
+            h++;
+        mixer->name_hash[h & (size - 1)] = n;
+    }
+    return 0;
+}
+
+static int mixer_ctl_cacheable(struct mixer_ctl *ctl)
+{
+    return !(ctl->info->access & SNDRV_CTL_ELEM_ACCESS_VOLATILE);
+}
+
+static void mixer_ctl_cache(struct mixer_ctl *ctl, const struct snd_ctl_elem_value *ev)
+{
+    if (!mixer_ctl_cacheable(ctl))
+        return;
+
+    if (!ctl->shadow) {
+        ctl->shadow = malloc(sizeof(*ctl->shadow));
+        if (!ctl->shadow)
+            return;
+    }
+    memcpy(ctl->shadow, ev, sizeof(*ev));
+    ctl->shadow_valid = 1;
+}
+
+static int mixer_ctl_read(struct mixer_ctl *ctl, struct snd_ctl_elem_value *ev)
+{
+    int ret;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->id.numid = ctl->info->id.numid;
+    ret = ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_READ, ev);
+    if (ret < 0)
+        return ret;
+
+    mixer_ctl_cache(ctl, ev);
+    return 0;
+}
+
+static int mixer_ctl_write(struct mixer_ctl *ctl, struct snd_ctl_elem_value *ev)
+{
+    int ret;
+
+    ev->id.numid = ctl->info->id.numid;
+    ret = ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, ev);
+    if (ret < 0) {
+        /* the driver may have applied part of it */
+        ctl->shadow_valid = 0;
+        return ret;
+    }
+
+    mixer_ctl_cache(ctl, ev);
+    return 0;
+}
+
 void mixer_close(struct mixer *mixer)
 {
     unsigned int n,m;
@@ -76,10 +189,13 @@ void mixer_close(struct mixer *mixer)
                     free(mixer->ctl[n].ename[m]);
                 free(mixer->ctl[n].ename);
             }
+            free(mixer->ctl[n].shadow);
         }
         free(mixer->ctl);
     }
 
+    free(mixer->name_hash);
+
     if (mixer->elem_info)
         free(mixer->elem_info);
 
@@ -155,6 +271,9 @@ struct mixer *mixer_open(unsigned int card)
         }
     }
 
+    if (mixer_build_name_hash(mixer) < 0)
+        goto fail;
+
     free(eid);
     return mixer;
 
@@ -192,12 +311,14 @@ struct mixer_ctl *mixer_get_ctl(struct mixer *mixer, unsigned int id)
 
 struct mixer_ctl *mixer_get_ctl_by_name(struct mixer *mixer, const char *name)
 {
-    unsigned int n;
+    unsigned int h, mask;
+    int n;
 
-    if (!mixer)
+    if (!mixer || !name)
         return NULL;
 
-    for (n = 0; n < mixer->count; n++)
+    mask = mixer->name_hash_size - 1;
+    for (h = mixer_name_hash(name); (n = mixer->name_hash[h & mask]) >= 0; h++)
         if (!strcmp(name, (char*) mixer->elem_info[n].id.name))
             return mixer->ctl + n;
 
@@ -305,9 +426,7 @@ int mixer_ctl_get_value(struct mixer_ctl *ctl, unsigned int id)
     if (!ctl || (id >= ctl->info->count))
         return -EINVAL;
 
-    memset(&ev, 0, sizeof(ev));
-    ev.id.numid = ctl->info->id.numid;
-    ret = ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_READ, &ev);
+    ret = mixer_ctl_read(ctl, &ev);
     if (ret < 0)
         return ret;
 
@@ -341,10 +460,7 @@ int mixer_ctl_get_array(struct mixer_ctl *ctl, void *array, size_t count)
     if (!ctl || (count > ctl->info->count) || !count || !array)
         return -EINVAL;
 
-    memset(&ev, 0, sizeof(ev));
-    ev.id.numid = ctl->info->id.numid;
-
-    ret = ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_READ, &ev);
+    ret = mixer_ctl_read(ctl, &ev);
     if (ret < 0)
         return ret;
 
@@ -382,9 +498,7 @@ int mixer_ctl_set_value(struct mixer_ctl *ctl, unsigned int id, int value)
     if (!ctl || (id >= ctl->info->count))
         return -EINVAL;
 
-    memset(&ev, 0, sizeof(ev));
-    ev.id.numid = ctl->info->id.numid;
-    ret = ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_READ, &ev);
+    ret = mixer_ctl_read(ctl, &ev);
     if (ret < 0)
         return ret;
 
@@ -405,7 +519,7 @@ int mixer_ctl_set_value(struct mixer_ctl *ctl, unsigned int id, int value)
         return -EINVAL;
     }
 
-    return ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, &ev);
+    return mixer_ctl_write(ctl, &ev);
 }
 
 int mixer_ctl_set_array(struct mixer_ctl *ctl, const void *array, size_t count)
@@ -443,7 +557,7 @@ int mixer_ctl_set_array(struct mixer_ctl *ctl, const void *array, size_t count)
 
     memcpy(dest, array, size * count);
 
-    return ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, &ev);
+    return mixer_ctl_write(ctl, &ev);
 }
 
 int mixer_ctl_get_range_min(struct mixer_ctl *ctl)
@@ -494,8 +608,7 @@ int mixer_ctl_set_enum_by_string(struct mixer_ctl *ctl, const char *string)
         if (!strcmp(string, ctl->ename[i])) {
             memset(&ev, 0, sizeof(ev));
             ev.value.enumerated.item[0] = i;
-            ev.id.numid = ctl->info->id.numid;
-            ret = ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, &ev);
+            ret = mixer_ctl_write(ctl, &ev);
             if (ret < 0)
                 return ret;
             return 0;
@@ -505,6 +618,311 @@ int mixer_ctl_set_enum_by_string(struct mixer_ctl *ctl, const char *string)
     return -EINVAL;
 }
 
+struct mixer_txn *mixer_txn_begin(struct mixer *mixer)
+{
+    struct mixer_txn *txn;
+
+    if (!mixer)
+        return NULL;
+
+    txn = calloc(1, sizeof(*txn));
+    if (!txn)
+        return NULL;
+
+    txn->slot = malloc(mixer->count * sizeof(*txn->slot));
+    if (!txn->slot && mixer->count) {
+        free(txn);
+        return NULL;
+    }
+    memset(txn->slot, 0xff, mixer->count * sizeof(*txn->slot));
+    txn->mixer = mixer;
+    return txn;
+}
+
+void mixer_txn_free(struct mixer_txn *txn)
+{
+    if (!txn)
+        return;
+
+    free(txn->entries);
+    free(txn->slot);
+    free(txn);
+}
+
+/* Returns the pending value of ctl, starting from its shadow (read once if
+ * there is none) so that several changes to one control become one write. */
+static struct mixer_txn_entry *mixer_txn_get_entry(struct mixer_txn *txn,
+                                                   struct mixer_ctl *ctl)
+{
+    struct mixer_txn_entry *e;
+    unsigned int n;
+
+    if (!ctl || ctl->mixer != txn->mixer)
+        return NULL;
+
+    n = ctl - txn->mixer->ctl;
+    if (txn->slot[n] >= 0)
+        return txn->entries + txn->slot[n];
+
+    if (txn->count == txn->size) {
+        unsigned int size = txn->size ? txn->size * 2 : 16;
+        e = realloc(txn->entries, size * sizeof(*e));
+        if (!e)
+            return NULL;
+        txn->entries = e;
+        txn->size = size;
+    }
+
+    e = txn->entries + txn->count;
+    e->ctl = ctl;
+    e->result = 0;
+    if (ctl->shadow_valid) {
+        memcpy(&e->value, ctl->shadow, sizeof(e->value));
+    } else if (mixer_ctl_read(ctl, &e->value) < 0) {
+        /* remembered, and reported by the commit */
+        memset(&e->value, 0, sizeof(e->value));
+        e->result = -errno;
+    }
+
+    txn->slot[n] = txn->count++;
+    return e;
+}
+
+int mixer_txn_set_value(struct mixer_txn *txn, struct mixer_ctl *ctl,
+                        unsigned int id, int value)
+{
+    struct mixer_txn_entry *e;
+
+    if (!txn || !ctl || (id >= ctl->info->count))
+        return -EINVAL;
+
+    switch (ctl->info->type) {
+    case SNDRV_CTL_ELEM_TYPE_BOOLEAN:
+    case SNDRV_CTL_ELEM_TYPE_INTEGER:
+    case SNDRV_CTL_ELEM_TYPE_ENUMERATED:
+        break;
+    case SNDRV_CTL_ELEM_TYPE_BYTES:
+        if (id >= sizeof(e->value.value.bytes.data))
+            return -EINVAL;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    e = mixer_txn_get_entry(txn, ctl);
+    if (!e)
+        return -ENOMEM;
+
+    switch (ctl->info->type) {
+    case SNDRV_CTL_ELEM_TYPE_BOOLEAN:
+        e->value.value.integer.value[id] = !!value;
+        break;
+    case SNDRV_CTL_ELEM_TYPE_INTEGER:
+        e->value.value.integer.value[id] = value;
+        break;
+    case SNDRV_CTL_ELEM_TYPE_ENUMERATED:
+        e->value.value.enumerated.item[id] = value;
+        break;
+    default:
+        e->value.value.bytes.data[id] = value;
+        break;
+    }
+    return 0;
+}
+
+int mixer_txn_set_enum_by_string(struct mixer_txn *txn, struct mixer_ctl *ctl,
+                                 const char *string)
+{
+    unsigned int i;
+
+    if (!txn || !ctl || !string || (ctl->info->type != SNDRV_CTL_ELEM_TYPE_ENUMERATED))
+        return -EINVAL;
+
+    for (i = 0; i < ctl->info->value.enumerated.items; i++)
+        if (!strcmp(string, ctl->ename[i]))
+            return mixer_txn_set_value(txn, ctl, 0, i);
+
+    return -EINVAL;
+}
+
+int mixer_txn_commit(struct mixer_txn *txn)
+{
+    unsigned int n;
+    int failed = 0;
+
+    if (!txn)
+        return -EINVAL;
+
+    for (n = 0; n < txn->count; n++) {
+        struct mixer_txn_entry *e = txn->entries + n;
+        struct mixer_ctl *ctl = e->ctl;
+
+        if (e->result < 0) {
+            failed++;
+            continue;
+        }
+
+        if (ctl->shadow_valid &&
+            !memcmp(&ctl->shadow->value, &e->value.value, sizeof(e->value.value))) {
+            e->result = MIXER_TXN_UNCHANGED;
+            continue;
+        }
+
+        if (mixer_ctl_write(ctl, &e->value) < 0) {
+            e->result = -errno;
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+unsigned int mixer_txn_get_num_ctls(struct mixer_txn *txn)
+{
+    if (!txn)
+        return 0;
+
+    return txn->count;
+}
+
+int mixer_txn_get_result(struct mixer_txn *txn, unsigned int n,
+                         struct mixer_ctl **ctl)
+{
+    if (!txn || (n >= txn->count))
+        return -EINVAL;
+
+    if (ctl)
+        *ctl = txn->entries[n].ctl;
+    return txn->entries[n].result;
+}
+
+int mixer_subscribe_events(struct mixer *mixer, int subscribe)
+{
+    int flags;
+
+    if (!mixer)
+        return -EINVAL;
+
+    subscribe = !!subscribe;
+    if (ioctl(mixer->fd, SNDRV_CTL_IOCTL_SUBSCRIBE_EVENTS, &subscribe) < 0)
+        return -errno;
+
+    /* reads must not block, mixer_read_event() reports an empty queue */
+    flags = fcntl(mixer->fd, F_GETFL);
+    if (flags >= 0)
+        fcntl(mixer->fd, F_SETFL, subscribe ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+
+    mixer->subscribed = subscribe;
+    mixer->event_pos = mixer->event_count = 0;
+    return 0;
+}
+
+int mixer_get_poll_fd(struct mixer *mixer)
+{
+    if (!mixer)
+        return -EINVAL;
+
+    return mixer->fd;
+}
+
+int mixer_wait_event(struct mixer *mixer, int timeout)
+{
+    struct pollfd pfd;
+    int err;
+
+    if (!mixer || !mixer->subscribed)
+        return -EINVAL;
+
+    if (mixer->event_pos < mixer->event_count)
+        return 1;
+
+    pfd.fd = mixer->fd;
+    pfd.events = POLLIN | POLLERR | POLLNVAL;
+
+    for (;;) {
+        err = poll(&pfd, 1, timeout);
+        if (err < 0 && errno == EINTR)
+            continue;
+        if (err < 0)
+            return -errno;
+        if (err == 0)
+            return 0;
+        if (pfd.revents & (POLLERR | POLLNVAL))
+            return -EIO;
+        return 1;
+    }
+}
+
+/* numids are handed out in increasing order as controls are added, which is
+ * also the order of the element list */
+static struct mixer_ctl *mixer_get_ctl_by_numid(struct mixer *mixer,
+                                                unsigned int numid)
+{
+    unsigned int lo = 0, hi = mixer->count, n;
+
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        if (mixer->elem_info[mid].id.numid < numid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < mixer->count && mixer->elem_info[lo].id.numid == numid)
+        return mixer->ctl + lo;
+
+    for (n = 0; n < mixer->count; n++)
+        if (mixer->elem_info[n].id.numid == numid)
+            return mixer->ctl + n;
+
+    return NULL;
+}
+
+int mixer_read_event(struct mixer *mixer, struct mixer_ctl_event *event)
+{
+    struct snd_ctl_event *ev;
+    struct mixer_ctl *ctl;
+
+    if (!mixer || !event || !mixer->subscribed)
+        return -EINVAL;
+
+    do {
+        if (mixer->event_pos == mixer->event_count) {
+            ssize_t bytes = read(mixer->fd, mixer->events, sizeof(mixer->events));
+            if (bytes < 0)
+                return (errno == EAGAIN) ? 0 : -errno;
+            mixer->event_pos = 0;
+            mixer->event_count = bytes / sizeof(mixer->events[0]);
+            if (!mixer->event_count)
+                return 0;
+        }
+        ev = mixer->events + mixer->event_pos++;
+    } while (ev->type != SNDRV_CTL_EVENT_ELEM);
+
+    ctl = mixer_get_ctl_by_numid(mixer, ev->data.elem.id.numid);
+
+    event->numid = ev->data.elem.id.numid;
+    event->ctl = ctl;
+    if (ev->data.elem.mask == SNDRV_CTL_EVENT_MASK_REMOVE) {
+        event->mask = MIXER_EVENT_REMOVE;
+        if (ctl)
+            ctl->shadow_valid = 0;
+        return 1;
+    }
+    event->mask = ev->data.elem.mask & (MIXER_EVENT_VALUE | MIXER_EVENT_INFO |
+                                        MIXER_EVENT_ADD | MIXER_EVENT_TLV);
+
+    /* keep the cached state current, so pollers need not read it back */
+    if (ctl && (event->mask & MIXER_EVENT_INFO))
+        mixer_ctl_update(ctl);
+    if (ctl && (event->mask & MIXER_EVENT_VALUE) && ctl->shadow_valid) {
+        struct snd_ctl_elem_value value;
+        if (mixer_ctl_read(ctl, &value) < 0)
+            ctl->shadow_valid = 0;
+    }
+
+    return 1;
+}
+
 #ifdef OMAP_ENHANCEMENT
 int mixer_get_card_name(int card, char *str, size_t strlen)
 {
@@ -34,6 +34,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -51,6 +53,51 @@
 #define PARAM_MAX SNDRV_PCM_HW_PARAM_LAST_INTERVAL
 #define SNDRV_PCM_HW_PARAMS_NO_PERIOD_WAKEUP (1<<2)
 
+/* batched transfers; not in the uapi header yet, see pcm_native.c */
+#ifndef SNDRV_PCM_IOCTL_WRITEV_FRAMES
+struct snd_xferv_seg {
+    void *buf;
+    snd_pcm_uframes_t frames;
+};
+
+struct snd_xferv {
+    snd_pcm_sframes_t result;
+    struct snd_xferv_seg *segs;
+    unsigned int nsegs;
+    unsigned int pad;
+    snd_pcm_uframes_t hw_ptr;
+    snd_pcm_uframes_t appl_ptr;
+    snd_pcm_uframes_t avail;
+    snd_pcm_sframes_t delay;
+    struct timespec tstamp;
+    struct timespec audio_tstamp;
+    unsigned char reserved[32];
+};
+
+#define SNDRV_PCM_IOCTL_WRITEV_FRAMES _IOWR('A', 0x54, struct snd_xferv)
+#define SNDRV_PCM_IOCTL_READV_FRAMES _IOWR('A', 0x55, struct snd_xferv)
+#endif
+
+/* seqlock-protected status record, mappable where the status record itself
+ * is not; see pcm_sync_status() */
+#ifndef SNDRV_PCM_MMAP_OFFSET_STATUS_SEQ
+struct snd_pcm_mmap_status_seq {
+    __u32 seq;
+    __s32 state;
+    __s32 suspended_state;
+    __u32 pad;
+    __u64 hw_ptr;
+    __u64 appl_ptr;
+    __s64 tstamp_sec;
+    __s64 tstamp_nsec;
+    __s64 audio_tstamp_sec;
+    __s64 audio_tstamp_nsec;
+};
+
+#define SNDRV_PCM_MMAP_OFFSET_STATUS_SEQ 0x82000000
+#define SNDRV_PCM_STATUS_SEQ_POS 2048
+#endif
+
 /* Logs information into a string; follows snprintf() in that
  * offset may be greater than size, and though no characters are copied
  * into string, characters are still counted into offset. */
@@ -246,6 +293,7 @@ struct pcm {
     unsigned int flags;
     int running:1;
     int prepared:1;
+    int no_xferv:1;     /* kernel lacks WRITEV/READV_FRAMES */
     int underruns;
     unsigned int buffer_size;
     unsigned int boundary;
@@ -254,9 +302,17 @@ struct pcm {
     struct snd_pcm_mmap_status *mmap_status;
     struct snd_pcm_mmap_control *mmap_control;
     struct snd_pcm_sync_ptr *sync_ptr;
+    void *status_seq_page;
+    const volatile struct snd_pcm_mmap_status_seq *status_seq;
     void *mmap_buffer;
     unsigned int noirq_frames_per_msec;
     int wait_for_avail_min;
+    /* callback streaming, see pcm_stream_start() */
+    pthread_t stream_thread;
+    pcm_stream_cb stream_cb;
+    void *stream_user;
+    volatile int stream_active;
+    int stream_error;
 };
 
 unsigned int pcm_get_buffer_size(struct pcm *pcm)
@@ -264,6 +320,15 @@ unsigned int pcm_get_buffer_size(struct pcm *pcm)
     return pcm->buffer_size;
 }
 
+int pcm_get_config(struct pcm *pcm, struct pcm_config *config)
+{
+    if (!pcm || !config)
+        return -EINVAL;
+
+    *config = pcm->config;
+    return 0;
+}
+
 const char* pcm_get_error(struct pcm *pcm)
 {
     return pcm->error;
@@ -296,6 +361,16 @@ static unsigned int pcm_format_to_alsa(enum pcm_format format)
         return SNDRV_PCM_FORMAT_S24_3LE;
     case PCM_FORMAT_S24_LE:
         return SNDRV_PCM_FORMAT_S24_LE;
+    case PCM_FORMAT_U8:
+        return SNDRV_PCM_FORMAT_U8;
+    case PCM_FORMAT_U16_LE:
+        return SNDRV_PCM_FORMAT_U16_LE;
+    case PCM_FORMAT_U24_LE:
+        return SNDRV_PCM_FORMAT_U24_LE;
+    case PCM_FORMAT_U24_3LE:
+        return SNDRV_PCM_FORMAT_U24_3LE;
+    case PCM_FORMAT_U32_LE:
+        return SNDRV_PCM_FORMAT_U32_LE;
     default:
     case PCM_FORMAT_S16_LE:
         return SNDRV_PCM_FORMAT_S16_LE;
@@ -307,9 +382,15 @@ unsigned int pcm_format_to_bits(enum pcm_format format)
     switch (format) {
     case PCM_FORMAT_S32_LE:
     case PCM_FORMAT_S24_LE:
+    case PCM_FORMAT_U32_LE:
+    case PCM_FORMAT_U24_LE:
         return 32;
     case PCM_FORMAT_S24_3LE:
+    case PCM_FORMAT_U24_3LE:
         return 24;
+    case PCM_FORMAT_S8:
+    case PCM_FORMAT_U8:
+        return 8;
     default:
     case PCM_FORMAT_S16_LE:
         return 16;
@@ -337,6 +418,38 @@ static int pcm_sync_ptr(struct pcm *pcm, int flags) {
     return 0;
 }
 
+/* Refreshes the status in sync_ptr mode.  A hwsync asks the driver for the
+ * current position, so it always goes through SYNC_PTR.  Otherwise, if the
+ * kernel has the status record mapped, this is a lockless read of it; the
+ * control record is not pushed to the kernel in that case, which is what
+ * pcm_mmap_commit() does, and the hardware pointer is the one from the last
+ * update, as with a mapped status record. */
+static int pcm_sync_status(struct pcm *pcm, int flags)
+{
+    const volatile struct snd_pcm_mmap_status_seq *s = pcm->status_seq;
+    struct snd_pcm_mmap_status *status = pcm->mmap_status;
+    unsigned int seq;
+
+    if (!s || (flags & SNDRV_PCM_SYNC_PTR_HWSYNC))
+        return pcm_sync_ptr(pcm, flags);
+
+    do {
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        status->state = s->state;
+        status->suspended_state = s->suspended_state;
+        status->hw_ptr = s->hw_ptr;
+        status->tstamp.tv_sec = s->tstamp_sec;
+        status->tstamp.tv_nsec = s->tstamp_nsec;
+        status->audio_tstamp.tv_sec = s->audio_tstamp_sec;
+        status->audio_tstamp.tv_nsec = s->audio_tstamp_nsec;
+        if (flags & SNDRV_PCM_SYNC_PTR_APPL)
+            pcm->mmap_control->appl_ptr = s->appl_ptr;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != s->seq);
+
+    return 0;
+}
+
 static int pcm_hw_mmap_status(struct pcm *pcm) {
 
     if (pcm->sync_ptr)
@@ -380,6 +493,15 @@ mmap_error:
 
     pcm_sync_ptr(pcm, 0);
 
+    /* older kernels don't have it, and then every refresh is an ioctl */
+    pcm->status_seq_page = mmap(NULL, page_size, PROT_READ, MAP_FILE | MAP_SHARED,
+                                pcm->fd, SNDRV_PCM_MMAP_OFFSET_STATUS_SEQ);
+    if (pcm->status_seq_page == MAP_FAILED)
+        pcm->status_seq_page = NULL;
+    else
+        pcm->status_seq = (void *)((char *)pcm->status_seq_page +
+                                   SNDRV_PCM_STATUS_SEQ_POS);
+
     return 0;
 }
 
@@ -387,6 +509,10 @@ static void pcm_hw_munmap_status(struct pcm *pcm) {
     if (pcm->sync_ptr) {
         free(pcm->sync_ptr);
         pcm->sync_ptr = NULL;
+        if (pcm->status_seq_page)
+            munmap(pcm->status_seq_page, sysconf(_SC_PAGE_SIZE));
+        pcm->status_seq_page = NULL;
+        pcm->status_seq = NULL;
     } else {
         int page_size = sysconf(_SC_PAGE_SIZE);
         if (pcm->mmap_status)
@@ -452,7 +578,7 @@ int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail,
     if (!pcm_is_ready(pcm))
         return -1;
 
-    rc = pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_APPL|SNDRV_PCM_SYNC_PTR_HWSYNC);
+    rc = pcm_sync_status(pcm, SNDRV_PCM_SYNC_PTR_APPL|SNDRV_PCM_SYNC_PTR_HWSYNC);
     if (rc < 0)
         return -1;
 
@@ -551,6 +677,131 @@ int pcm_read(struct pcm *pcm, void *data, unsigned int count)
     }
 }
 
+/* Older kernels: one transfer per segment, then the state from STATUS */
+static int pcm_xferv_fallback(struct pcm *pcm, const struct pcm_xfer_seg *segs,
+                              unsigned int nsegs, struct pcm_xfer_status *status)
+{
+    struct snd_pcm_status s;
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < nsegs; i++) {
+        if (pcm->flags & PCM_IN)
+            ret = pcm_read(pcm, segs[i].data, segs[i].count);
+        else
+            ret = pcm_write(pcm, segs[i].data, segs[i].count);
+        if (ret)
+            return ret;
+        if (status)
+            status->frames += pcm_bytes_to_frames(pcm, segs[i].count);
+    }
+    if (!status)
+        return 0;
+
+    memset(&s, 0, sizeof(s));
+    if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_STATUS, &s))
+        return oops(pcm, errno, "cannot get stream status");
+    status->hw_ptr = s.hw_ptr;
+    status->avail = s.avail;
+    status->delay = s.delay;
+    status->tstamp = s.tstamp;
+    status->audio_tstamp = s.audio_tstamp;
+    return 0;
+}
+
+static int pcm_xferv(struct pcm *pcm, const struct pcm_xfer_seg *segs,
+                     unsigned int nsegs, struct pcm_xfer_status *status)
+{
+    struct snd_xferv_seg xsegs[PCM_XFER_MAX_SEGS];
+    struct snd_xferv x;
+    unsigned int i, frames = 0;
+    int in = pcm->flags & PCM_IN;
+    int cmd = in ? SNDRV_PCM_IOCTL_READV_FRAMES : SNDRV_PCM_IOCTL_WRITEV_FRAMES;
+
+    if (!nsegs || nsegs > PCM_XFER_MAX_SEGS)
+        return -EINVAL;
+    if (status)
+        memset(status, 0, sizeof(*status));
+    if (pcm->no_xferv)
+        return pcm_xferv_fallback(pcm, segs, nsegs, status);
+
+    for (i = 0; i < nsegs; i++) {
+        xsegs[i].buf = segs[i].data;
+        xsegs[i].frames = pcm_bytes_to_frames(pcm, segs[i].count);
+        frames += xsegs[i].frames;
+    }
+    memset(&x, 0, sizeof(x));
+    x.segs = xsegs;
+    x.nsegs = nsegs;
+
+    for (;;) {
+        if (!pcm->running) {
+            if (in) {
+                if (pcm_start(pcm) < 0) {
+                    fprintf(stderr, "start error");
+                    return -errno;
+                }
+            } else {
+                int prepare_error = pcm_prepare(pcm);
+                if (prepare_error)
+                    return prepare_error;
+            }
+        }
+        if (ioctl(pcm->fd, cmd, &x)) {
+            if (errno == ENOTTY) {
+                pcm->no_xferv = 1;
+                return pcm_xferv_fallback(pcm, segs, nsegs, status);
+            }
+            pcm->prepared = 0;
+            pcm->running = 0;
+            if (errno == EPIPE) {
+                /* we failed to make our window -- try to restart if we are
+                 * allowed to do so */
+                pcm->underruns++;
+                if (!in && (pcm->flags & PCM_NORESTART))
+                    return -EPIPE;
+                continue;
+            }
+            return oops(pcm, errno, in ? "cannot read stream data" :
+                        "cannot write stream data");
+        }
+        /* a playback stream starts on its own once start_threshold is met */
+        pcm->running = 1;
+        break;
+    }
+
+    if (status) {
+        status->frames = x.result;
+        status->hw_ptr = x.hw_ptr;
+        status->avail = x.avail;
+        status->delay = x.delay;
+        status->tstamp = x.tstamp;
+        status->audio_tstamp = x.audio_tstamp;
+    }
+    /* interrupted by a signal or an xrun part way through */
+    if ((unsigned int)x.result < frames)
+        return -EINTR;
+    return 0;
+}
+
+int pcm_writev(struct pcm *pcm, const struct pcm_xfer_seg *segs,
+               unsigned int nsegs, struct pcm_xfer_status *status)
+{
+    if (pcm->flags & PCM_IN)
+        return -EINVAL;
+
+    return pcm_xferv(pcm, segs, nsegs, status);
+}
+
+int pcm_readv(struct pcm *pcm, const struct pcm_xfer_seg *segs,
+              unsigned int nsegs, struct pcm_xfer_status *status)
+{
+    if (!(pcm->flags & PCM_IN))
+        return -EINVAL;
+
+    return pcm_xferv(pcm, segs, nsegs, status);
+}
+
 static struct pcm bad_pcm = {
     .fd = -1,
 };
@@ -819,6 +1070,9 @@ int pcm_close(struct pcm *pcm)
     if (pcm == &bad_pcm)
         return 0;
 
+    if (pcm->stream_cb)
+        pcm_stream_stop(pcm);
+
     pcm_hw_munmap_status(pcm);
 
     if (pcm->flags & PCM_MMAP) {
@@ -1061,7 +1315,7 @@ static inline int pcm_mmap_capture_avail(struct pcm *pcm)
 
 int pcm_mmap_avail(struct pcm *pcm)
 {
-    pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_HWSYNC);
+    pcm_sync_status(pcm, SNDRV_PCM_SYNC_PTR_HWSYNC);
     if (pcm->flags & PCM_IN)
         return pcm_mmap_capture_avail(pcm);
     else
@@ -1117,13 +1371,12 @@ int pcm_mmap_commit(struct pcm *pcm, unsigned int offset, unsigned int frames)
 
 int pcm_avail_update(struct pcm *pcm)
 {
-    pcm_sync_ptr(pcm, 0);
     return pcm_mmap_avail(pcm);
 }
 
 int pcm_state(struct pcm *pcm)
 {
-    int err = pcm_sync_ptr(pcm, 0);
+    int err = pcm_sync_status(pcm, 0);
     if (err < 0)
         return err;
 
@@ -1145,7 +1398,7 @@ int pcm_wait(struct pcm *pcm, int timeout)
     int err;
 
     pfd.fd = pcm->fd;
-    pfd.events = POLLOUT | POLLERR | POLLNVAL;
+    pfd.events = (pcm->flags & PCM_IN ? POLLIN : POLLOUT) | POLLERR | POLLNVAL;
 
     do {
         /* let's wait for avail or timeout */
@@ -1289,6 +1542,166 @@ int pcm_mmap_read(struct pcm *pcm, void *data, unsigned int count)
     return pcm_mmap_transfer(pcm, data, count);
 }
 
+/* Recovers from an xrun seen by the streaming thread: re-prepare the stream and
+ * pick up the pointers the kernel reset. */
+static int pcm_stream_recover(struct pcm *pcm)
+{
+    int err;
+
+    pcm->prepared = 0;
+    pcm->running = 0;
+    pcm->underruns++;
+
+    err = pcm_prepare(pcm);
+    if (err < 0)
+        return err;
+    if (pcm_sync_ptr(pcm, SNDRV_PCM_SYNC_PTR_APPL) < 0)
+        return oops(pcm, errno, "cannot sync pointers after xrun");
+
+    if (pcm->flags & PCM_IN)
+        return pcm_start(pcm);
+    return 0;
+}
+
+static void *pcm_stream_thread(void *arg)
+{
+    struct pcm *pcm = arg;
+    unsigned int period = pcm->config.period_size;
+    int timeout, avail, err = 0;
+
+    /* a wakeup is due every period; allow two before declaring the stream stuck,
+     * but come back regularly so pcm_stream_stop() is noticed */
+    timeout = (int)(period * 2000ULL / pcm->config.rate) + 1;
+
+    if ((pcm->flags & PCM_IN) && pcm_start(pcm) < 0) {
+        pcm->stream_error = -errno;
+        return NULL;
+    }
+
+    while (pcm->stream_active) {
+        void *areas;
+        unsigned int offset, frames;
+
+        avail = pcm_avail_update(pcm);
+        if (avail < 0) {
+            err = avail;
+            break;
+        }
+
+        if (pcm->mmap_status->state == PCM_STATE_XRUN) {
+            err = pcm_stream_recover(pcm);
+            if (err < 0)
+                break;
+            continue;
+        }
+
+        if ((unsigned int)avail < period) {
+            /* a playback stream that is not running yet will never free up room */
+            if (!(pcm->flags & PCM_IN) && !pcm->running) {
+                if (pcm_start(pcm) < 0) {
+                    err = -errno;
+                    break;
+                }
+                continue;
+            }
+            err = pcm_wait(pcm, timeout);
+            if (err == -EPIPE) {
+                err = pcm_stream_recover(pcm);
+                if (err < 0)
+                    break;
+                continue;
+            }
+            if (err < 0)
+                break;
+            err = 0;
+            continue;
+        }
+
+        frames = period;
+        pcm_mmap_begin(pcm, &areas, &offset, &frames);
+        if (!frames)
+            continue;
+
+        /* hand the ring region to the application, no copy */
+        err = pcm->stream_cb(pcm, (char *)areas + pcm_frames_to_bytes(pcm, offset),
+                             frames, pcm->stream_user);
+        if (err < 0)
+            break;
+        if ((unsigned int)err > frames)
+            err = frames;
+
+        err = pcm_mmap_commit(pcm, offset, err);
+        if (err < 0)
+            break;
+        err = 0;
+
+        if (!(pcm->flags & PCM_IN) && !pcm->running &&
+            pcm->buffer_size - pcm_mmap_playback_avail(pcm) >= pcm->config.start_threshold) {
+            if (pcm_start(pcm) < 0) {
+                err = -errno;
+                break;
+            }
+        }
+    }
+
+    pcm->stream_error = err;
+    pcm->stream_active = 0;
+    return NULL;
+}
+
+int pcm_stream_start(struct pcm *pcm, pcm_stream_cb cb, void *user)
+{
+    pthread_attr_t attr;
+    struct sched_param sched;
+    int err;
+
+    if (!pcm_is_ready(pcm) || !cb)
+        return -EINVAL;
+    if (!(pcm->flags & PCM_MMAP))
+        return -ENOSYS;
+    if (pcm->stream_cb)
+        return -EBUSY;
+
+    pcm->stream_cb = cb;
+    pcm->stream_user = user;
+    pcm->stream_error = 0;
+    pcm->stream_active = 1;
+
+    /* prefer a realtime thread; fall back to a normal one without privileges */
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    memset(&sched, 0, sizeof(sched));
+    sched.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+    pthread_attr_setschedparam(&attr, &sched);
+
+    err = pthread_create(&pcm->stream_thread, &attr, pcm_stream_thread, pcm);
+    if (err == EPERM)
+        err = pthread_create(&pcm->stream_thread, NULL, pcm_stream_thread, pcm);
+    pthread_attr_destroy(&attr);
+
+    if (err) {
+        pcm->stream_active = 0;
+        pcm->stream_cb = NULL;
+        pcm->stream_user = NULL;
+        return oops(pcm, err, "cannot create stream thread");
+    }
+    return 0;
+}
+
+int pcm_stream_stop(struct pcm *pcm)
+{
+    if (!pcm->stream_cb)
+        return 0;
+
+    pcm->stream_active = 0;
+    pthread_join(pcm->stream_thread, NULL);
+    pcm->stream_cb = NULL;
+    pcm_stop(pcm);
+
+    return pcm->stream_error;
+}
+
 int pcm_ioctl(struct pcm *pcm, int request, ...)
 {
     va_list ap;
@@ -0,0 +1,82 @@
+/* kernel.h
+**
+** Just enough of the kernel API to build sound/core/oss/rate.c in user
+** space for tinyratebench.  Every header rate.c includes from linux/ and
+** sound/ resolves to this file through include/.
+*/
+
+#ifndef __RATEBENCH_KERNEL_H
+#define __RATEBENCH_KERNEL_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONFIG_SND_PCM_OSS_PLUGINS 1
+
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef unsigned long snd_pcm_uframes_t;
+typedef long snd_pcm_sframes_t;
+typedef int snd_pcm_format_t;
+typedef int snd_pcm_access_t;
+
+#define SNDRV_PCM_FORMAT_S16        2 /* S16_LE */
+#define SNDRV_PCM_STREAM_PLAYBACK   0
+#define SNDRV_PCM_STREAM_CAPTURE    1
+
+struct snd_pcm_substream;
+struct snd_pcm_hw_params;
+struct snd_mask;
+
+#define module_param(name, type, perm)
+#define MODULE_PARM_DESC(name, desc)
+
+#define GFP_KERNEL 0
+#define kzalloc(size, gfp) calloc(1, size)
+#define kcalloc(n, size, gfp) calloc(n, size)
+#define kfree free
+#define vmalloc malloc
+#define vfree free
+
+#define snd_BUG_ON(cond) (cond)
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define clamp(val, lo, hi) ((val) < (lo) ? (lo) : (val) > (hi) ? (hi) : (val))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+
+static inline s64 div_s64(s64 dividend, s32 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline s64 div64_s64(s64 dividend, s64 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline unsigned long gcd(unsigned long a, unsigned long b)
+{
+    while (b) {
+        unsigned long t = a % b;
+
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+#endif
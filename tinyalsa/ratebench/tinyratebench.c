@@ -0,0 +1,268 @@
+/* tinyratebench.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+/* Builds the OSS emulation's rate plugin from the kernel tree in user space
+ * and checks the polyphase FIR for a few common rate pairs.  A stereo sine
+ * is fed through the plugin in blocks of one period the way pcm_oss does
+ * it, and the output is checked for THD+N against a fitted sine, so block
+ * joins that drop or repeat frames show up in the figure.  The time is per
+ * output frame.  The old linear interpolator (-t 0) is only timed: it runs
+ * at the rounded pitch and slips frames at block joins, so neither the fit
+ * nor the expected frame count applies to it.
+ *
+ *   gcc -O2 -Iratebench/include -o tinyratebench ratebench/tinyratebench.c -lm
+ *
+ * from the tinyalsa directory. */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../../sound/core/oss/rate.c"
+
+#define CHANNELS 2
+
+int snd_pcm_plugin_build(struct snd_pcm_substream *handle, const char *name,
+                         struct snd_pcm_plugin_format *src_format,
+                         struct snd_pcm_plugin_format *dst_format,
+                         size_t extra, struct snd_pcm_plugin **ret)
+{
+    struct snd_pcm_plugin *plugin;
+
+    plugin = calloc(1, sizeof(*plugin) + extra);
+    if (!plugin)
+        return -ENOMEM;
+    plugin->name = name;
+    plugin->src_format = *src_format;
+    plugin->dst_format = *dst_format;
+    *ret = plugin;
+    return 0;
+}
+
+int snd_pcm_area_silence(const struct snd_pcm_channel_area *dst_channel,
+                         size_t dst_offset, size_t samples, snd_pcm_format_t format)
+{
+    return 0;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* residual power against the least squares fit of a sine of frequency f,
+ * relative to the power of the fit, in dB; skip leaves out the filter's
+ * start-up */
+static double thd_n(const s16 *x, long n, long skip, double f, double rate)
+{
+    double ss = 0, cc = 0, sc = 0, xs = 0, xc = 0, det, a, b, err = 0, pwr = 0;
+    long i;
+
+    for (i = skip; i < n; i++) {
+        double w = 2 * M_PI * f * i / rate, s = sin(w), c = cos(w);
+
+        ss += s * s;
+        cc += c * c;
+        sc += s * c;
+        xs += x[i * CHANNELS] * s;
+        xc += x[i * CHANNELS] * c;
+    }
+    det = ss * cc - sc * sc;
+    a = (xs * cc - xc * sc) / det;
+    b = (xc * ss - xs * sc) / det;
+    for (i = skip; i < n; i++) {
+        double w = 2 * M_PI * f * i / rate, y = a * sin(w) + b * cos(w);
+
+        err += (x[i * CHANNELS] - y) * (x[i * CHANNELS] - y);
+        pwr += y * y;
+    }
+    return 10 * log10(err / pwr);
+}
+
+static void set_areas(struct snd_pcm_plugin_channel *ch, s16 *buf, snd_pcm_uframes_t frames)
+{
+    int c;
+
+    for (c = 0; c < CHANNELS; c++) {
+        memset(&ch[c], 0, sizeof(ch[c]));
+        ch[c].area.addr = buf;
+        ch[c].area.first = c * 16;
+        ch[c].area.step = CHANNELS * 16;
+        ch[c].frames = frames;
+        ch[c].enabled = 1;
+        ch[c].wanted = 1;
+    }
+}
+
+/* returns the number of block size mismatches */
+static int run(unsigned int src_rate, unsigned int dst_rate, double f, int taps,
+               unsigned int period, unsigned int periods, int stream)
+{
+    struct snd_pcm_plugin_format src_format = { SNDRV_PCM_FORMAT_S16, src_rate, CHANNELS };
+    struct snd_pcm_plugin_format dst_format = { SNDRV_PCM_FORMAT_S16, dst_rate, CHANNELS };
+    struct snd_pcm_plugin_channel src_ch[CHANNELS], dst_ch[CHANNELS];
+    struct snd_pcm_plugin *plugin;
+    s16 *in, *out;
+    long in_pos = 0, out_pos = 0, max_out;
+    unsigned int p, i, c;
+    int mismatches = 0;
+    double t = 0;
+
+    rate_fir_taps = taps;
+    if (snd_pcm_plugin_build_rate(NULL, &src_format, &dst_format, &plugin) < 0) {
+        fprintf(stderr, "unable to build the plugin\n");
+        return 1;
+    }
+    plugin->stream = stream;
+
+    /* with capture a period is counted on the output side */
+    max_out = ((long)period * (dst_rate > src_rate ? dst_rate : src_rate) /
+               (dst_rate < src_rate ? dst_rate : src_rate) + 2) * periods;
+    in = malloc(max_out * CHANNELS * sizeof(*in));
+    out = malloc(max_out * CHANNELS * sizeof(*out));
+    if (!in || !out) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (p = 0; p < periods; p++) {
+        snd_pcm_uframes_t src_frames, dst_frames;
+        snd_pcm_sframes_t got;
+        double t0;
+
+        if (stream == SNDRV_PCM_STREAM_PLAYBACK) {
+            src_frames = period;
+            dst_frames = plugin->dst_frames(plugin, src_frames);
+        } else {
+            dst_frames = period;
+            src_frames = plugin->src_frames(plugin, dst_frames);
+        }
+        for (i = 0; i < src_frames; i++)
+            for (c = 0; c < CHANNELS; c++)
+                in[i * CHANNELS + c] = lrint(20000 * sin(2 * M_PI * f * (in_pos + i) / src_rate));
+        in_pos += src_frames;
+        set_areas(src_ch, in, src_frames);
+        set_areas(dst_ch, out + out_pos * CHANNELS, dst_frames);
+
+        t0 = now_ns();
+        got = plugin->transfer(plugin, src_ch, dst_ch, src_frames);
+        t += now_ns() - t0;
+        if (got < 0) {
+            fprintf(stderr, "transfer failed: %ld\n", got);
+            break;
+        }
+        out_pos += got;
+        /* pcm_oss maps a playback transfer back to the frames it took */
+        if (stream == SNDRV_PCM_STREAM_PLAYBACK &&
+            plugin->src_frames(plugin, got) != (snd_pcm_sframes_t)src_frames)
+            mismatches++;
+    }
+
+    printf("%5u -> %5u %s %5.0f Hz, %2d taps: ",
+           src_rate, dst_rate, stream == SNDRV_PCM_STREAM_PLAYBACK ? "playback" : "capture ",
+           f, taps);
+    if (taps > 0)
+        printf("THD+N %6.1f dB, %5.1f ns/frame, %ld -> %ld frames, expected %.0f%s\n",
+               thd_n(out, out_pos, dst_rate / 10, f, dst_rate), t / out_pos,
+               in_pos, out_pos, (double)in_pos * dst_rate / src_rate,
+               mismatches ? ", size mismatch" : "");
+    else
+        printf("%5.1f ns/frame, %ld -> %ld frames\n", t / out_pos, in_pos, out_pos);
+
+    if (plugin->private_free)
+        plugin->private_free(plugin);
+    free(plugin);
+    free(out);
+    free(in);
+    return mismatches;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int pairs[][2] = {
+        { 44100, 48000 }, { 48000, 44100 }, { 48000, 16000 },
+        { 16000, 48000 }, { 44100, 16000 }, { 16000, 44100 },
+    };
+    static const double freqs[] = { 1000, 5000 };
+    int taps[8] = { 16, 32 };
+    unsigned int ntaps = 2;
+    unsigned int period = 1024, periods = 200;
+    unsigned int i, j, k;
+    int stream, ret = 0;
+
+    argv += 1;
+    while (*argv) {
+        if (strcmp(*argv, "-t") == 0) {
+            argv++;
+            if (*argv) {
+                char *p = *argv;
+
+                /* comma separated tap counts */
+                for (ntaps = 0; ntaps < 8 && *p; ntaps++) {
+                    taps[ntaps] = strtol(p, &p, 0);
+                    if (*p == ',')
+                        p++;
+                }
+            }
+        } else if (strcmp(*argv, "-p") == 0) {
+            argv++;
+            if (*argv)
+                period = atoi(*argv);
+        } else if (strcmp(*argv, "-n") == 0) {
+            argv++;
+            if (*argv)
+                periods = atoi(*argv);
+        } else {
+            fprintf(stderr, "Usage: tinyratebench [-t taps[,taps...]] [-p period_frames] "
+                    "[-n periods]\n");
+            return 1;
+        }
+        if (*argv)
+            argv++;
+    }
+    if (!period || periods < 20) {
+        fprintf(stderr, "need a period and at least 20 periods\n");
+        return 1;
+    }
+
+    for (stream = SNDRV_PCM_STREAM_PLAYBACK; stream <= SNDRV_PCM_STREAM_CAPTURE; stream++)
+        for (i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++)
+            for (j = 0; j < sizeof(freqs) / sizeof(freqs[0]); j++) {
+                /* keep the tone well inside both bands */
+                if (freqs[j] > 0.4 * (pairs[i][0] < pairs[i][1] ? pairs[i][0] : pairs[i][1]))
+                    continue;
+                for (k = 0; k < ntaps; k++)
+                    if (run(pairs[i][0], pairs[i][1], freqs[j], taps[k], period,
+                            periods, stream))
+                        ret = 1;
+            }
+    return ret;
+}
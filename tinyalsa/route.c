@@ -0,0 +1,271 @@
+/* route.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#define ROUTE_DEFAULT_DEPTH 4
+
+struct pcm_route {
+    struct pcm *in;
+    struct pcm *out;
+    struct pcm_config in_config;
+    struct pcm_config out_config;
+
+    /* ring of depth periods in capture layout.  tail is only written by the
+     * capture thread, head only by the playback thread; both run freely and
+     * fill is their difference. */
+    char *ring;
+    unsigned int depth;
+    unsigned int in_period_bytes;
+    unsigned int tail;
+    unsigned int head;
+
+    /* capture target for periods dropped while the ring is full */
+    char *scratch;
+
+    /* one period in playback layout */
+    char *out_buffer;
+    unsigned int out_period_bytes;
+
+    volatile int active;
+    int started;
+    pthread_t capture_thread;
+    pthread_t playback_thread;
+
+    struct pcm_route_stats stats;
+};
+
+static inline unsigned int route_load(const unsigned int *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void route_store(unsigned int *p, unsigned int val)
+{
+    __atomic_store_n(p, val, __ATOMIC_RELEASE);
+}
+
+static inline void route_count(unsigned int *counter)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void *route_capture_func(void *arg)
+{
+    struct pcm_route *route = arg;
+    unsigned int tail = route->tail;
+
+    while (route->active) {
+        unsigned int fill = tail - route_load(&route->head);
+        char *slot;
+
+        /* when the ring is full the next slot is the one playback is reading,
+         * so the period has to go somewhere else */
+        if (fill >= route->depth)
+            slot = route->scratch;
+        else
+            slot = route->ring + (tail % route->depth) * route->in_period_bytes;
+
+        if (pcm_read(route->in, slot, route->in_period_bytes)) {
+            route_count(&route->stats.pcm_errors);
+            continue;
+        }
+        route->stats.periods_in++;
+
+        if (slot == route->scratch) {
+            /* playback is not keeping up: drop this period rather than let the
+             * latency grow */
+            route_count(&route->stats.overruns);
+            continue;
+        }
+
+        route_store(&route->tail, ++tail);
+        if (fill + 1 > route->stats.max_fill)
+            route->stats.max_fill = fill + 1;
+    }
+    return NULL;
+}
+
+static void *route_playback_func(void *arg)
+{
+    struct pcm_route *route = arg;
+    unsigned int head = route->head;
+    unsigned int prefill = (route->depth + 1) / 2;
+    int primed = 0;
+
+    while (route->active) {
+        unsigned int fill = route_load(&route->tail) - head;
+
+        if (!primed && fill < prefill) {
+            /* nothing is running on this side yet, so there is no clock to
+             * pace on; give the capture side a fraction of a period */
+            usleep(route->in_config.period_size * 250000ULL / route->in_config.rate);
+            continue;
+        }
+        primed = 1;
+
+        if (fill) {
+            pcm_convert_fanout(route->out_config.format, route->out_buffer,
+                               route->out_config.channels,
+                               route->ring + (head % route->depth) * route->in_period_bytes,
+                               route->in_config.channels, route->in_config.period_size);
+            route_store(&route->head, ++head);
+        } else {
+            /* keep the playback clock running and the latency fixed */
+            memset(route->out_buffer, 0, route->out_period_bytes);
+            route_count(&route->stats.underruns);
+        }
+
+        if (pcm_write(route->out, route->out_buffer, route->out_period_bytes))
+            route_count(&route->stats.pcm_errors);
+        else
+            route->stats.periods_out++;
+    }
+    return NULL;
+}
+
+struct pcm_route *pcm_route_open(struct pcm *in, struct pcm *out,
+                                 unsigned int depth)
+{
+    struct pcm_route *route;
+
+    if (!in || !out || !pcm_is_ready(in) || !pcm_is_ready(out))
+        return NULL;
+
+    route = calloc(1, sizeof(*route));
+    if (!route)
+        return NULL;
+
+    route->in = in;
+    route->out = out;
+    pcm_get_config(in, &route->in_config);
+    pcm_get_config(out, &route->out_config);
+
+    if (route->in_config.format != route->out_config.format ||
+        route->in_config.rate != route->out_config.rate ||
+        route->in_config.period_size != route->out_config.period_size ||
+        route->in_config.channels > PCM_CONVERT_MAX_CHANNELS ||
+        route->out_config.channels > PCM_CONVERT_MAX_CHANNELS) {
+        fprintf(stderr, "route: capture and playback configs do not match\n");
+        goto err;
+    }
+
+    route->depth = depth ? depth : ROUTE_DEFAULT_DEPTH;
+    route->in_period_bytes = pcm_frames_to_bytes(in, route->in_config.period_size);
+    route->out_period_bytes = pcm_frames_to_bytes(out, route->out_config.period_size);
+
+    route->ring = malloc((size_t)route->depth * route->in_period_bytes);
+    route->scratch = malloc(route->in_period_bytes);
+    route->out_buffer = malloc(route->out_period_bytes);
+    if (!route->ring || !route->scratch || !route->out_buffer) {
+        fprintf(stderr, "route: unable to allocate %u periods\n", route->depth);
+        goto err;
+    }
+
+    route->stats.depth = route->depth;
+    return route;
+
+err:
+    free(route->out_buffer);
+    free(route->scratch);
+    free(route->ring);
+    free(route);
+    return NULL;
+}
+
+void pcm_route_close(struct pcm_route *route)
+{
+    if (!route)
+        return;
+
+    pcm_route_stop(route);
+    free(route->out_buffer);
+    free(route->scratch);
+    free(route->ring);
+    free(route);
+}
+
+int pcm_route_start(struct pcm_route *route)
+{
+    int ret;
+
+    if (route->started)
+        return -EBUSY;
+
+    route->head = route->tail = 0;
+    route->active = 1;
+
+    ret = pthread_create(&route->capture_thread, NULL, route_capture_func, route);
+    if (ret) {
+        route->active = 0;
+        return -ret;
+    }
+    ret = pthread_create(&route->playback_thread, NULL, route_playback_func, route);
+    if (ret) {
+        route->active = 0;
+        pthread_join(route->capture_thread, NULL);
+        return -ret;
+    }
+
+    route->started = 1;
+    return 0;
+}
+
+int pcm_route_stop(struct pcm_route *route)
+{
+    if (!route->started)
+        return 0;
+
+    route->active = 0;
+    /* both threads return within a period once their pcm call completes */
+    pthread_join(route->capture_thread, NULL);
+    pthread_join(route->playback_thread, NULL);
+    route->started = 0;
+
+    pcm_stop(route->in);
+    pcm_stop(route->out);
+    return 0;
+}
+
+int pcm_route_get_stats(struct pcm_route *route, struct pcm_route_stats *stats)
+{
+    if (!route || !stats)
+        return -EINVAL;
+
+    *stats = route->stats;
+    stats->fill = route_load(&route->tail) - route_load(&route->head);
+    return 0;
+}
@@ -0,0 +1,156 @@
+/* tinyconvbench.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <tinyalsa/asoundlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
+#endif
+
+/* Compares the conversion kernels against the loop fmplay used to upmix its
+ * 2 channel fm capture to the 8 channel speaker. */
+
+static const char * const impls[] = { "scalar", "sse2", "avx2", "neon" };
+
+struct bench_case {
+    const char *name;
+    enum pcm_format format;
+    unsigned int bytes;
+    unsigned int in_channels;
+    unsigned int out_channels;
+    int mix;
+};
+
+static const struct bench_case cases[] = {
+    { "fanout S16 2->8", PCM_FORMAT_S16_LE, 2, 2, 8, 0 },
+    { "fanout S16 2->6", PCM_FORMAT_S16_LE, 2, 2, 6, 0 },
+    { "fanout S32 2->8", PCM_FORMAT_S32_LE, 4, 2, 8, 0 },
+    { "fanout S24_3LE 2->8", PCM_FORMAT_S24_3LE, 3, 2, 8, 0 },
+    { "mix S16 2->8", PCM_FORMAT_S16_LE, 2, 2, 8, 1 },
+    { "mix S24 6->8", PCM_FORMAT_S24_LE, 4, 6, 8, 1 },
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* the fmplay loop: each 32 bit stereo s16 frame copied to 4 slots */
+static void legacy_upmix(int *out, const int *in, unsigned int frames)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < frames; i++)
+        for (j = 0; j < 4; j++)
+            out[i * 4 + j] = in[i];
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int frames = 1024;
+    unsigned int loops = 20000;
+    float gains[PCM_CONVERT_MAX_CHANNELS * PCM_CONVERT_MAX_CHANNELS];
+    char *src, *dst;
+    unsigned int c, i, n;
+    double t;
+
+    argv += 1;
+    while (*argv) {
+        if (strcmp(*argv, "-p") == 0) {
+            argv++;
+            if (*argv)
+                frames = atoi(*argv);
+        } else if (strcmp(*argv, "-n") == 0) {
+            argv++;
+            if (*argv)
+                loops = atoi(*argv);
+        } else {
+            fprintf(stderr, "Usage: tinyconvbench [-p period_size] [-n loops]\n");
+            return 1;
+        }
+        if (*argv)
+            argv++;
+    }
+    if (!frames || !loops) {
+        fprintf(stderr, "period size and loops must be non zero\n");
+        return 1;
+    }
+
+    src = calloc(frames, 4 * PCM_CONVERT_MAX_CHANNELS);
+    dst = calloc(frames, 4 * PCM_CONVERT_MAX_CHANNELS);
+    if (!src || !dst) {
+        fprintf(stderr, "Unable to allocate buffers\n");
+        return 1;
+    }
+    for (i = 0; i < frames * 4 * PCM_CONVERT_MAX_CHANNELS; i++)
+        src[i] = rand();
+    for (i = 0; i < ARRAY_SIZE(gains); i++)
+        gains[i] = 0.5f;
+
+    printf("default kernels: %s, %u frames x %u loops\n",
+           pcm_convert_get_impl(), frames, loops);
+
+    t = now_ns();
+    for (n = 0; n < loops; n++)
+        legacy_upmix((int *)dst, (const int *)src, frames);
+    t = now_ns() - t;
+    printf("%-22s %-7s %8.3f ns/frame\n", "fmplay loop S16 2->8", "", t / loops / frames);
+
+    for (c = 0; c < ARRAY_SIZE(cases); c++) {
+        for (i = 0; i < ARRAY_SIZE(impls); i++) {
+            if (pcm_convert_set_impl(impls[i]))
+                continue;
+
+            t = now_ns();
+            for (n = 0; n < loops; n++) {
+                if (cases[c].mix)
+                    pcm_convert_mix(cases[c].format, dst, cases[c].out_channels,
+                                    src, cases[c].in_channels, gains, frames);
+                else
+                    pcm_convert_fanout(cases[c].format, dst, cases[c].out_channels,
+                                       src, cases[c].in_channels, frames);
+            }
+            t = now_ns() - t;
+            printf("%-22s %-7s %8.3f ns/frame %8.2f MB/s out\n", cases[c].name, impls[i],
+                   t / loops / frames,
+                   (double)loops * frames * cases[c].out_channels * cases[c].bytes * 1e3 / t);
+        }
+    }
+
+    free(dst);
+    free(src);
+    return 0;
+}
@@ -0,0 +1,168 @@
+/* tinyctlbench.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <sound/asound.h>
+
+/* Times the kernel control lookup behind ELEM_INFO and ELEM_READ, once with
+ * the ids given by numid and once by name, over all controls of a card in a
+ * random order.  Load snd-dummy with bench_ctls=N to get a card with N extra
+ * controls; with the lookup indexed the cost should not grow with N. */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* ns per call of an ioctl on every id, ids looked up by numid or by name */
+static double time_lookups(int fd, unsigned long request,
+                           const struct snd_ctl_elem_id *ids, const unsigned int *order,
+                           unsigned int count, unsigned int loops, int by_name)
+{
+    struct snd_ctl_elem_info info;
+    struct snd_ctl_elem_value value;
+    struct snd_ctl_elem_id *id;
+    unsigned int i, l, failed = 0;
+    double t;
+
+    id = request == SNDRV_CTL_IOCTL_ELEM_INFO ? &info.id : &value.id;
+    t = now_ns();
+    for (l = 0; l < loops; l++) {
+        for (i = 0; i < count; i++) {
+            memset(&info, 0, sizeof(info));
+            memset(&value, 0, sizeof(value));
+            *id = ids[order[i]];
+            if (by_name)
+                id->numid = 0;
+            else
+                memset(id->name, 0, sizeof(id->name));
+            if (ioctl(fd, request, request == SNDRV_CTL_IOCTL_ELEM_INFO ?
+                      (void *)&info : (void *)&value) < 0)
+                failed++;
+        }
+    }
+    t = now_ns() - t;
+    if (failed)
+        fprintf(stderr, "%u lookups failed\n", failed);
+    return t / ((double)count * loops);
+}
+
+int main(int argc, char **argv)
+{
+    struct snd_ctl_elem_list list;
+    struct snd_ctl_elem_id *ids;
+    unsigned int *order;
+    unsigned int card = 0, loops = 10;
+    unsigned int i, count;
+    char path[32];
+    int fd;
+
+    argv += 1;
+    while (*argv) {
+        if (strcmp(*argv, "-D") == 0) {
+            argv++;
+            if (*argv)
+                card = atoi(*argv);
+        } else if (strcmp(*argv, "-l") == 0) {
+            argv++;
+            if (*argv)
+                loops = atoi(*argv);
+        } else {
+            fprintf(stderr, "Usage: tinyctlbench [-D card] [-l loops]\n");
+            return 1;
+        }
+        if (*argv)
+            argv++;
+    }
+    if (!loops)
+        loops = 1;
+
+    snprintf(path, sizeof(path), "/dev/snd/controlC%u", card);
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "unable to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    memset(&list, 0, sizeof(list));
+    if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_LIST, &list) < 0 || !list.count) {
+        fprintf(stderr, "unable to list the controls of card %u\n", card);
+        return 1;
+    }
+    count = list.count;
+    ids = calloc(count, sizeof(*ids));
+    order = calloc(count, sizeof(*order));
+    if (!ids || !order) {
+        fprintf(stderr, "unable to allocate %u ids\n", count);
+        return 1;
+    }
+    list.space = count;
+    list.pids = ids;
+    if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_LIST, &list) < 0) {
+        fprintf(stderr, "unable to list the controls of card %u\n", card);
+        return 1;
+    }
+    count = list.used;
+
+    /* a random order so neither end of the list is favoured */
+    srand(1);
+    for (i = 0; i < count; i++)
+        order[i] = i;
+    for (i = count - 1; i > 0; i--) {
+        unsigned int j = rand() % (i + 1), tmp = order[i];
+
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    printf("card %u: %u controls, %u loops\n", card, count, loops);
+    printf("info by numid %8.0f ns\n",
+           time_lookups(fd, SNDRV_CTL_IOCTL_ELEM_INFO, ids, order, count, loops, 0));
+    printf("info by name  %8.0f ns\n",
+           time_lookups(fd, SNDRV_CTL_IOCTL_ELEM_INFO, ids, order, count, loops, 1));
+    printf("read by numid %8.0f ns\n",
+           time_lookups(fd, SNDRV_CTL_IOCTL_ELEM_READ, ids, order, count, loops, 0));
+    printf("read by name  %8.0f ns\n",
+           time_lookups(fd, SNDRV_CTL_IOCTL_ELEM_READ, ids, order, count, loops, 1));
+
+    free(order);
+    free(ids);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,339 @@
+/* tinypcmbench.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#define _GNU_SOURCE
+#include <tinyalsa/asoundlib.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sound/asound.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
+#endif
+
+/* Measures the cost of the PCM core per frame and per period for each access
+ * mode.  Meant to run against snd-dummy loaded with vclock=1, where the
+ * position follows the application instead of the wall clock, so the numbers
+ * are those of the transfer path alone.
+ *
+ * With -s the playback modes also fill the whole buffer ahead with silence on
+ * every hw_ptr update; load snd-dummy with fake_buffer=0 so there is a real
+ * buffer to fill.  Silence is only non-zero for the unsigned formats, picked
+ * with -f (e.g. -f U16_LE); snd-dummy offers U8 and S16_LE alone unless its
+ * formats are widened through /proc/asound/cardN/dummy_pcm, e.g.
+ *
+ *   echo "formats 0x400001115" > /proc/asound/card0/dummy_pcm
+ *
+ * for U8, S16_LE, U16_LE, U24_LE, U32_LE and U24_3LE.  The system time column
+ * is the kernel time spent in this process, which also makes the tool usable
+ * on clocked devices: reading an snd-aloop capture with nothing playing
+ * measures its silence clearing. */
+
+/* Every syscall the library makes for a transfer goes through ioctl() or
+ * poll(), so they are counted by interposing both here and forwarding to the
+ * libc versions. */
+static unsigned int ioctls;
+static unsigned int polls;
+
+#ifdef __BIONIC__
+int ioctl(int fd, int request, ...)
+#else
+int ioctl(int fd, unsigned long request, ...)
+#endif
+{
+    static int (*real_ioctl)(int, unsigned long, void *);
+    va_list ap;
+    void *arg;
+
+    if (!real_ioctl)
+        real_ioctl = (int (*)(int, unsigned long, void *))dlsym(RTLD_NEXT, "ioctl");
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+    ioctls++;
+    return real_ioctl(fd, request, arg);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    static int (*real_poll)(struct pollfd *, nfds_t, int);
+
+    if (!real_poll)
+        real_poll = (int (*)(struct pollfd *, nfds_t, int))dlsym(RTLD_NEXT, "poll");
+    polls++;
+    return real_poll(fds, nfds, timeout);
+}
+
+struct bench_mode {
+    const char *name;
+    unsigned int flags;
+    int (*write)(struct pcm *pcm, const void *data, unsigned int count);
+    int (*read)(struct pcm *pcm, void *data, unsigned int count);
+};
+
+/* one period per call like the modes above, but with the stream state that
+ * would otherwise take a STATUS ioctl per period */
+static int writev_period(struct pcm *pcm, const void *data, unsigned int count)
+{
+    struct pcm_xfer_seg seg = { (void *)data, count };
+    struct pcm_xfer_status status;
+
+    return pcm_writev(pcm, &seg, 1, &status);
+}
+
+static int readv_period(struct pcm *pcm, void *data, unsigned int count)
+{
+    struct pcm_xfer_seg seg = { data, count };
+    struct pcm_xfer_status status;
+
+    return pcm_readv(pcm, &seg, 1, &status);
+}
+
+/* Where the status record is mapped (x86 among others), tinyalsa never asks
+ * the driver for the position in the mmap modes, and the vclock would only
+ * move on its one jiffy tick; hwsync once per period as a real mmap client
+ * waking up on its own would, so that these modes measure the core too. */
+static int mmap_write_period(struct pcm *pcm, const void *data, unsigned int count)
+{
+    pcm_ioctl(pcm, SNDRV_PCM_IOCTL_HWSYNC);
+    return pcm_mmap_write(pcm, data, count);
+}
+
+static int mmap_read_period(struct pcm *pcm, void *data, unsigned int count)
+{
+    pcm_ioctl(pcm, SNDRV_PCM_IOCTL_HWSYNC);
+    return pcm_mmap_read(pcm, data, count);
+}
+
+static const struct bench_mode modes[] = {
+    { "write", PCM_OUT, pcm_write, NULL },
+    { "read", PCM_IN, NULL, pcm_read },
+    { "mmap_write", PCM_OUT | PCM_MMAP, mmap_write_period, NULL },
+    { "mmap_read", PCM_IN | PCM_MMAP, NULL, mmap_read_period },
+    { "writev", PCM_OUT, writev_period, NULL },
+    { "readv", PCM_IN, NULL, readv_period },
+};
+
+static const char * const format_names[PCM_FORMAT_MAX] = {
+    [PCM_FORMAT_S16_LE] = "S16_LE",
+    [PCM_FORMAT_S32_LE] = "S32_LE",
+    [PCM_FORMAT_S8] = "S8",
+    [PCM_FORMAT_S24_LE] = "S24_LE",
+    [PCM_FORMAT_S24_3LE] = "S24_3LE",
+    [PCM_FORMAT_U8] = "U8",
+    [PCM_FORMAT_U16_LE] = "U16_LE",
+    [PCM_FORMAT_U24_LE] = "U24_LE",
+    [PCM_FORMAT_U24_3LE] = "U24_3LE",
+    [PCM_FORMAT_U32_LE] = "U32_LE",
+};
+
+/* takes a format name or its enum pcm_format value */
+static enum pcm_format parse_format(const char *arg)
+{
+    unsigned long i;
+    char *end;
+
+    for (i = 0; i < ARRAY_SIZE(format_names); i++)
+        if (format_names[i] && strcasecmp(arg, format_names[i]) == 0)
+            return i;
+    i = strtoul(arg, &end, 0);
+    if (*arg == '\0' || *end != '\0' || i >= PCM_FORMAT_MAX)
+        return PCM_FORMAT_INVALID;
+    return i;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double sys_ns(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_stime.tv_sec * 1e9 + ru.ru_stime.tv_usec * 1e3;
+}
+
+static int run(const struct bench_mode *mode, unsigned int card, unsigned int device,
+               struct pcm_config *config, unsigned int periods)
+{
+    struct pcm *pcm;
+    char *buffer;
+    unsigned int bytes, n;
+    int ret = 0;
+    double t, st;
+
+    pcm = pcm_open(card, device, mode->flags, config);
+    if (!pcm || !pcm_is_ready(pcm)) {
+        fprintf(stderr, "%s: unable to open PCM device (%s)\n", mode->name,
+                pcm_get_error(pcm));
+        pcm_close(pcm);
+        return -1;
+    }
+
+    bytes = pcm_frames_to_bytes(pcm, config->period_size);
+    buffer = calloc(1, bytes);
+    if (!buffer) {
+        fprintf(stderr, "%s: unable to allocate %u bytes\n", mode->name, bytes);
+        pcm_close(pcm);
+        return -1;
+    }
+
+    ioctls = polls = 0;
+    st = sys_ns();
+    t = now_ns();
+    for (n = 0; n < periods; n++) {
+        if (mode->write)
+            ret = mode->write(pcm, buffer, bytes);
+        else
+            ret = mode->read(pcm, buffer, bytes);
+        if (ret) {
+            fprintf(stderr, "%s: transfer failed after %u periods (%s)\n", mode->name,
+                    n, pcm_get_error(pcm));
+            break;
+        }
+    }
+    t = now_ns() - t;
+    st = sys_ns() - st;
+
+    if (n)
+        printf("%-11s %8.3f ns/frame %8.3f sys ns/frame %6.2f syscalls/period "
+               "(%u ioctl, %u poll)\n",
+               mode->name, t / n / config->period_size, st / n / config->period_size,
+               (double)(ioctls + polls) / n, ioctls, polls);
+
+    free(buffer);
+    pcm_close(pcm);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    struct pcm_config config;
+    unsigned int card = 0;
+    unsigned int device = 0;
+    unsigned int periods = 100000;
+    const char *name = NULL;
+    int silence = 0;
+    unsigned int i;
+    int ret = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.channels = 2;
+    config.rate = 48000;
+    config.period_size = 1024;
+    config.period_count = 4;
+    config.format = PCM_FORMAT_S16_LE;
+
+    argv += 1;
+    while (*argv) {
+        if (strcmp(*argv, "-D") == 0) {
+            argv++;
+            if (*argv)
+                card = atoi(*argv);
+        } else if (strcmp(*argv, "-d") == 0) {
+            argv++;
+            if (*argv)
+                device = atoi(*argv);
+        } else if (strcmp(*argv, "-m") == 0) {
+            argv++;
+            if (*argv)
+                name = *argv;
+        } else if (strcmp(*argv, "-c") == 0) {
+            argv++;
+            if (*argv)
+                config.channels = atoi(*argv);
+        } else if (strcmp(*argv, "-r") == 0) {
+            argv++;
+            if (*argv)
+                config.rate = atoi(*argv);
+        } else if (strcmp(*argv, "-p") == 0) {
+            argv++;
+            if (*argv)
+                config.period_size = atoi(*argv);
+        } else if (strcmp(*argv, "-n") == 0) {
+            argv++;
+            if (*argv)
+                config.period_count = atoi(*argv);
+        } else if (strcmp(*argv, "-f") == 0) {
+            argv++;
+            if (*argv)
+                config.format = parse_format(*argv);
+        } else if (strcmp(*argv, "-s") == 0) {
+            silence = 1;
+        } else if (strcmp(*argv, "-l") == 0) {
+            argv++;
+            if (*argv)
+                periods = atoi(*argv);
+        } else {
+            fprintf(stderr, "Usage: tinypcmbench [-D card] [-d device] "
+                    "[-m write|read|mmap_write|mmap_read|writev|readv] [-c channels] [-r rate] "
+                    "[-f format] [-p period_size] [-n n_periods] [-l loops] [-s]\n");
+            return 1;
+        }
+        if (*argv)
+            argv++;
+    }
+    if (!config.period_size || config.period_count < 2 || !periods) {
+        fprintf(stderr, "need a period size, at least 2 periods and loops\n");
+        return 1;
+    }
+    if (config.format == PCM_FORMAT_INVALID) {
+        fprintf(stderr, "unknown format\n");
+        return 1;
+    }
+    if (silence) {
+        /* silence everything past the application pointer */
+        config.silence_threshold = config.period_size * config.period_count;
+        config.silence_size = config.silence_threshold;
+    }
+
+    printf("card %u device %u: %u ch, %u Hz, %s, %u x %u frames, %u periods per mode%s\n",
+           card, device, config.channels, config.rate, format_names[config.format],
+           config.period_count,
+           config.period_size, periods, silence ? ", silence fill" : "");
+
+    for (i = 0; i < ARRAY_SIZE(modes); i++) {
+        if (name && strcmp(name, modes[i].name))
+            continue;
+        if (run(&modes[i], card, device, &config, periods))
+            ret = 1;
+    }
+    return ret;
+}
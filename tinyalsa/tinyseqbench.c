@@ -0,0 +1,634 @@
+/* tinyseqbench.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+
+#include <sound/asound.h>
+#include <sound/asequencer.h>
+
+/* Measures the sequencer cost of sending a SysEx event to the subscribers of
+ * a port, for 1, 8 and 64 subscribers or the counts given with -s.  Every
+ * subscriber is a client of its own that is drained after each burst, and
+ * the send and receive sides are timed separately, so the numbers show what
+ * the fan-out costs per event and per subscriber.
+ *
+ * With -m the SysEx stream is instead written as bytes to a virmidi device
+ * and read back as events from its sequencer port given with -p, which
+ * times the MIDI byte to event coder of the kernel.  Then note events are
+ * sent to that port and read back as bytes from the device, which times
+ * the event to byte decoder.
+ *
+ * With -q a large number of events is scheduled on one stopped queue at
+ * random ticks by many clients, which stresses the queue's priority queue,
+ * and then the queue is started and every client reads its events back.
+ * Enqueue and dispatch are timed and the delivery order is checked. */
+
+#define SEQ_POOL_CELLS 2000 /* SNDRV_SEQ_MAX_CLIENT_EVENTS */
+#define SEQ_QUEUE_EVENTS_PER_CLIENT 1800 /* below the pool, leaves room */
+#define SEQ_MIDI_NOTES 256 /* per loop, fits the rawmidi input buffer */
+
+struct seq_client {
+    int fd;
+    int client;
+    int port;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double sys_ns(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_stime.tv_sec * 1e9 + ru.ru_stime.tv_usec * 1e3;
+}
+
+static int seq_client_open(struct seq_client *c, unsigned int caps)
+{
+    struct snd_seq_client_pool pool;
+    struct snd_seq_port_info port;
+
+    c->fd = open("/dev/snd/seq", O_RDWR | O_NONBLOCK);
+    if (c->fd < 0)
+        return -1;
+    if (ioctl(c->fd, SNDRV_SEQ_IOCTL_CLIENT_ID, &c->client) < 0)
+        goto fail;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.client = c->client;
+    pool.output_pool = SEQ_POOL_CELLS;
+    pool.input_pool = SEQ_POOL_CELLS;
+    pool.output_room = SEQ_POOL_CELLS / 2;
+    if (ioctl(c->fd, SNDRV_SEQ_IOCTL_SET_CLIENT_POOL, &pool) < 0)
+        goto fail;
+
+    memset(&port, 0, sizeof(port));
+    port.addr.client = c->client;
+    strcpy(port.name, "tinyseqbench");
+    port.capability = caps;
+    port.type = SNDRV_SEQ_PORT_TYPE_APPLICATION;
+    if (ioctl(c->fd, SNDRV_SEQ_IOCTL_CREATE_PORT, &port) < 0)
+        goto fail;
+    c->port = port.addr.port;
+    return 0;
+
+fail:
+    close(c->fd);
+    c->fd = -1;
+    return -1;
+}
+
+/* read everything queued for a client, returns the number of events and
+ * adds the SysEx bytes to *sysex if given */
+static int seq_client_drain(struct seq_client *c, char *buf, size_t size,
+                            unsigned long long *sysex)
+{
+    struct snd_seq_event *ev;
+    ssize_t n, pos;
+    int events = 0;
+
+    while ((n = read(c->fd, buf, size)) > 0) {
+        for (pos = 0; pos + (ssize_t)sizeof(*ev) <= n; events++) {
+            ev = (struct snd_seq_event *)(buf + pos);
+            pos += sizeof(*ev);
+            if ((ev->flags & SNDRV_SEQ_EVENT_LENGTH_MASK) == SNDRV_SEQ_EVENT_LENGTH_VARIABLE) {
+                pos += (ev->data.ext.len + sizeof(*ev) - 1) / sizeof(*ev) * sizeof(*ev);
+                if (sysex && ev->type == SNDRV_SEQ_EVENT_SYSEX)
+                    *sysex += ev->data.ext.len;
+            }
+        }
+    }
+    return events;
+}
+
+static int run(unsigned int subscribers, unsigned int bytes, unsigned int burst,
+               unsigned int loops)
+{
+    struct seq_client src, *dst;
+    struct snd_seq_port_subscribe sub;
+    struct snd_seq_event *ev;
+    char *msg, *buf;
+    size_t msg_size, buf_size;
+    double t, st, send_t = 0, send_st = 0, recv_t = 0, recv_st = 0;
+    unsigned int i, l, b, received = 0;
+    int ret = -1;
+
+    dst = calloc(subscribers, sizeof(*dst));
+    msg_size = sizeof(*ev) + bytes;
+    msg = calloc(1, msg_size);
+    buf_size = 64 * 1024;
+    buf = malloc(buf_size);
+    if (!dst || !msg || !buf) {
+        fprintf(stderr, "out of memory\n");
+        goto out_free;
+    }
+
+    if (seq_client_open(&src, SNDRV_SEQ_PORT_CAP_READ | SNDRV_SEQ_PORT_CAP_SUBS_READ) < 0) {
+        fprintf(stderr, "unable to open the sequencer: %s\n", strerror(errno));
+        goto out_free;
+    }
+    for (i = 0; i < subscribers; i++) {
+        if (seq_client_open(&dst[i], SNDRV_SEQ_PORT_CAP_WRITE |
+                            SNDRV_SEQ_PORT_CAP_SUBS_WRITE) < 0) {
+            fprintf(stderr, "unable to open subscriber %u: %s\n", i, strerror(errno));
+            subscribers = i;
+            goto out_close;
+        }
+        memset(&sub, 0, sizeof(sub));
+        sub.sender.client = src.client;
+        sub.sender.port = src.port;
+        sub.dest.client = dst[i].client;
+        sub.dest.port = dst[i].port;
+        if (ioctl(src.fd, SNDRV_SEQ_IOCTL_SUBSCRIBE_PORT, &sub) < 0) {
+            fprintf(stderr, "unable to subscribe %u: %s\n", i, strerror(errno));
+            subscribers = i + 1;
+            goto out_close;
+        }
+    }
+
+    /* a SysEx message of the given size, sent directly to the subscribers */
+    ev = (struct snd_seq_event *)msg;
+    ev->type = SNDRV_SEQ_EVENT_SYSEX;
+    ev->flags = SNDRV_SEQ_EVENT_LENGTH_VARIABLE;
+    ev->queue = SNDRV_SEQ_QUEUE_DIRECT;
+    ev->source.port = src.port;
+    ev->dest.client = SNDRV_SEQ_ADDRESS_SUBSCRIBERS;
+    ev->data.ext.len = bytes;
+    memset(msg + sizeof(*ev), 0x7f, bytes);
+    msg[sizeof(*ev)] = 0xf0;
+    msg[msg_size - 1] = 0xf7;
+
+    for (l = 0; l < loops; l++) {
+        st = sys_ns();
+        t = now_ns();
+        for (b = 0; b < burst; b++)
+            if (write(src.fd, msg, msg_size) != (ssize_t)msg_size) {
+                fprintf(stderr, "write failed: %s\n", strerror(errno));
+                goto out_close;
+            }
+        send_t += now_ns() - t;
+        send_st += sys_ns() - st;
+
+        st = sys_ns();
+        t = now_ns();
+        for (i = 0; i < subscribers; i++)
+            received += seq_client_drain(&dst[i], buf, buf_size, NULL);
+        recv_t += now_ns() - t;
+        recv_st += sys_ns() - st;
+    }
+
+    printf("%3u subscribers: send %9.0f ns/event (%9.0f sys), receive %7.0f ns/event "
+           "per subscriber (%7.0f sys), %u of %u delivered\n",
+           subscribers, send_t / loops / burst, send_st / loops / burst,
+           recv_t / loops / burst / subscribers, recv_st / loops / burst / subscribers,
+           received, loops * burst * subscribers);
+    ret = received == loops * burst * subscribers ? 0 : -1;
+
+out_close:
+    for (i = 0; i < subscribers; i++)
+        close(dst[i].fd);
+    close(src.fd);
+out_free:
+    free(buf);
+    free(msg);
+    free(dst);
+    return ret;
+}
+
+/* note events sent to the port of a virmidi device, decoded to bytes by the
+ * kernel and read back from the device */
+static int run_midi_decode(const char *midi, struct seq_client *src, int client, int port,
+                           unsigned int loops)
+{
+    struct snd_seq_event ev[SEQ_MIDI_NOTES];
+    unsigned char buf[4096];
+    unsigned long long data = 0, total = (unsigned long long)SEQ_MIDI_NOTES * loops;
+    double t, st, send_t = 0, send_st = 0, recv_t = 0, recv_st = 0;
+    unsigned int l, i;
+    ssize_t n;
+    int fd, ret = -1;
+
+    memset(ev, 0, sizeof(ev));
+    for (i = 0; i < SEQ_MIDI_NOTES; i++) {
+        ev[i].type = SNDRV_SEQ_EVENT_NOTEON;
+        ev[i].queue = SNDRV_SEQ_QUEUE_DIRECT;
+        ev[i].source.port = src->port;
+        ev[i].dest.client = client;
+        ev[i].dest.port = port;
+        ev[i].data.note.note = i & 0x7f;
+        ev[i].data.note.velocity = 64;
+    }
+
+    fd = open(midi, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        fprintf(stderr, "unable to open %s: %s\n", midi, strerror(errno));
+        return -1;
+    }
+    /* the first read starts the input, events arriving before are dropped */
+    if (read(fd, buf, sizeof(buf)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "read failed: %s\n", strerror(errno));
+        goto out;
+    }
+
+    for (l = 0; l < loops; l++) {
+        st = sys_ns();
+        t = now_ns();
+        if (write(src->fd, ev, sizeof(ev)) != (ssize_t)sizeof(ev)) {
+            fprintf(stderr, "event write failed: %s\n", strerror(errno));
+            goto out;
+        }
+        send_t += now_ns() - t;
+        send_st += sys_ns() - st;
+
+        /* direct events are decoded by the time write() returns */
+        st = sys_ns();
+        t = now_ns();
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            for (i = 0; i < n; i++)
+                data += buf[i] < 0x80;
+        recv_t += now_ns() - t;
+        recv_st += sys_ns() - st;
+    }
+
+    printf("%s: send %6.2f ns/event (%6.2f sys), read %6.2f ns/event (%6.2f sys), "
+           "%llu of %llu notes delivered\n",
+           midi, send_t / total, send_st / total, recv_t / total, recv_st / total,
+           data / 2, total);
+    ret = data / 2 == total ? 0 : -1;
+out:
+    close(fd);
+    return ret;
+}
+
+/* SysEx bytes written to a virmidi device, coded to events by the kernel */
+static int run_midi(const char *midi, int client, int port, unsigned int bytes,
+                    unsigned int burst, unsigned int loops)
+{
+    struct seq_client dst;
+    struct snd_seq_port_subscribe sub;
+    unsigned char *msg;
+    char *buf;
+    size_t buf_size = 64 * 1024;
+    unsigned long long sysex = 0, total = (unsigned long long)bytes * burst * loops;
+    double t, st, send_t = 0, send_st = 0, recv_t = 0, recv_st = 0;
+    unsigned int l, b, events = 0;
+    int fd, ret = -1;
+
+    msg = malloc(bytes);
+    buf = malloc(buf_size);
+    if (!msg || !buf) {
+        fprintf(stderr, "out of memory\n");
+        goto out_free;
+    }
+    memset(msg, 0x7f, bytes);
+    msg[0] = 0xf0;
+    msg[bytes - 1] = 0xf7;
+
+    fd = open(midi, O_WRONLY);
+    if (fd < 0) {
+        fprintf(stderr, "unable to open %s: %s\n", midi, strerror(errno));
+        goto out_free;
+    }
+    if (seq_client_open(&dst, SNDRV_SEQ_PORT_CAP_WRITE | SNDRV_SEQ_PORT_CAP_SUBS_WRITE) < 0) {
+        fprintf(stderr, "unable to open the sequencer: %s\n", strerror(errno));
+        goto out_close_midi;
+    }
+    memset(&sub, 0, sizeof(sub));
+    sub.sender.client = client;
+    sub.sender.port = port;
+    sub.dest.client = dst.client;
+    sub.dest.port = dst.port;
+    if (ioctl(dst.fd, SNDRV_SEQ_IOCTL_SUBSCRIBE_PORT, &sub) < 0) {
+        fprintf(stderr, "unable to subscribe %d:%d: %s\n", client, port, strerror(errno));
+        goto out_close;
+    }
+
+    for (l = 0; l < loops; l++) {
+        st = sys_ns();
+        t = now_ns();
+        for (b = 0; b < burst; b++)
+            if (write(fd, msg, bytes) != (ssize_t)bytes) {
+                fprintf(stderr, "write failed: %s\n", strerror(errno));
+                goto out_close;
+            }
+        send_t += now_ns() - t;
+        send_st += sys_ns() - st;
+
+        st = sys_ns();
+        t = now_ns();
+        events += seq_client_drain(&dst, buf, buf_size, &sysex);
+        recv_t += now_ns() - t;
+        recv_st += sys_ns() - st;
+    }
+
+    printf("%s: write %6.2f ns/byte (%6.2f sys) %7.1f MB/s, receive %6.2f ns/byte "
+           "(%6.2f sys), %u events, %llu of %llu bytes delivered\n",
+           midi, send_t / total, send_st / total, total * 1e3 / send_t,
+           recv_t / total, recv_st / total, events, sysex, total);
+    ret = sysex == total ? 0 : -1;
+    if (run_midi_decode(midi, &dst, client, port, loops))
+        ret = -1;
+
+out_close:
+    close(dst.fd);
+out_close_midi:
+    close(fd);
+out_free:
+    free(buf);
+    free(msg);
+    return ret;
+}
+
+/* read the scheduled events of one client back and check their order:
+ * ticks never go backwards, equal ticks keep the order of sending */
+static int queue_client_drain(struct seq_client *c, struct snd_seq_event *buf,
+                              unsigned int size, unsigned int *last_tick,
+                              int *last_seq, unsigned int *misordered)
+{
+    ssize_t n;
+    int i, events = 0;
+
+    while ((n = read(c->fd, buf, size * sizeof(*buf))) > 0) {
+        for (i = 0; i < n / (ssize_t)sizeof(*buf); i++, events++) {
+            unsigned int tick = buf[i].data.raw32.d[1];
+            int seq = buf[i].data.raw32.d[0];
+
+            if (tick < *last_tick || (tick == *last_tick && seq < *last_seq))
+                (*misordered)++;
+            *last_tick = tick;
+            *last_seq = seq;
+        }
+    }
+    return events;
+}
+
+static int run_queue(unsigned int events, unsigned int spread)
+{
+    struct seq_client *c;
+    struct snd_seq_queue_info qinfo;
+    struct snd_seq_queue_tempo tempo;
+    struct snd_seq_event *evs, start;
+    unsigned int nclients, per, i, j, sent = 0, received = 0, misordered = 0;
+    unsigned int *last_tick;
+    int *last_seq;
+    double t, st, in_t, in_st, out_t, out_st;
+    int ret = -1;
+
+    nclients = (events + SEQ_QUEUE_EVENTS_PER_CLIENT - 1) / SEQ_QUEUE_EVENTS_PER_CLIENT;
+    per = (events + nclients - 1) / nclients;
+    c = calloc(nclients, sizeof(*c));
+    evs = calloc(per, sizeof(*evs));
+    last_tick = calloc(nclients, sizeof(*last_tick));
+    last_seq = calloc(nclients, sizeof(*last_seq));
+    if (!c || !evs || !last_tick || !last_seq) {
+        fprintf(stderr, "out of memory\n");
+        goto out_free;
+    }
+
+    /* every client sends to itself, so no input pool has to take more
+     * than its own events */
+    for (i = 0; i < nclients; i++) {
+        if (seq_client_open(&c[i], SNDRV_SEQ_PORT_CAP_WRITE) < 0) {
+            fprintf(stderr, "unable to open client %u of %u: %s\n", i, nclients,
+                    strerror(errno));
+            nclients = i;
+            goto out_close;
+        }
+        last_seq[i] = -1;
+    }
+
+    memset(&qinfo, 0, sizeof(qinfo));
+    qinfo.owner = c[0].client;
+    strcpy(qinfo.name, "tinyseqbench");
+    if (ioctl(c[0].fd, SNDRV_SEQ_IOCTL_CREATE_QUEUE, &qinfo) < 0) {
+        fprintf(stderr, "unable to create a queue: %s\n", strerror(errno));
+        goto out_close;
+    }
+    /* 100 ns per tick, so the whole spread plays within a few timer ticks */
+    memset(&tempo, 0, sizeof(tempo));
+    tempo.queue = qinfo.queue;
+    tempo.tempo = 100;
+    tempo.ppq = 1000;
+    if (ioctl(c[0].fd, SNDRV_SEQ_IOCTL_SET_QUEUE_TEMPO, &tempo) < 0) {
+        fprintf(stderr, "unable to set the queue tempo: %s\n", strerror(errno));
+        goto out_queue;
+    }
+
+    srand(1);
+    in_t = in_st = 0;
+    for (i = 0; i < nclients && sent < events; i++) {
+        unsigned int n = events - sent < per ? events - sent : per;
+        ssize_t size = n * sizeof(*evs);
+
+        for (j = 0; j < n; j++) {
+            struct snd_seq_event *ev = &evs[j];
+
+            memset(ev, 0, sizeof(*ev));
+            ev->type = SNDRV_SEQ_EVENT_USR0;
+            ev->flags = SNDRV_SEQ_TIME_STAMP_TICK | SNDRV_SEQ_TIME_MODE_ABS;
+            ev->queue = qinfo.queue;
+            ev->time.tick = 1 + rand() % spread;
+            ev->source.port = c[i].port;
+            ev->dest.client = c[i].client;
+            ev->dest.port = c[i].port;
+            ev->data.raw32.d[0] = j;
+            ev->data.raw32.d[1] = ev->time.tick;
+        }
+        st = sys_ns();
+        t = now_ns();
+        if (write(c[i].fd, evs, size) != size) {
+            fprintf(stderr, "write failed: %s\n", strerror(errno));
+            goto out_queue;
+        }
+        in_t += now_ns() - t;
+        in_st += sys_ns() - st;
+        sent += n;
+    }
+
+    memset(&start, 0, sizeof(start));
+    start.type = SNDRV_SEQ_EVENT_START;
+    start.queue = SNDRV_SEQ_QUEUE_DIRECT;
+    start.source.port = c[0].port;
+    start.dest.client = SNDRV_SEQ_CLIENT_SYSTEM;
+    start.dest.port = SNDRV_SEQ_PORT_SYSTEM_TIMER;
+    start.data.queue.queue = qinfo.queue;
+
+    st = sys_ns();
+    t = now_ns();
+    if (write(c[0].fd, &start, sizeof(start)) != sizeof(start)) {
+        fprintf(stderr, "unable to start the queue: %s\n", strerror(errno));
+        goto out_queue;
+    }
+    /* give up if nothing arrives for a second */
+    for (j = 0; received < sent && j < 1000; j++) {
+        unsigned int got = 0;
+
+        for (i = 0; i < nclients; i++)
+            got += queue_client_drain(&c[i], evs, per, &last_tick[i], &last_seq[i],
+                                      &misordered);
+        if (got) {
+            received += got;
+            j = 0;
+        } else {
+            struct timespec ts = { 0, 1000000 };
+
+            nanosleep(&ts, NULL);
+        }
+    }
+    out_t = now_ns() - t;
+    out_st = sys_ns() - st;
+
+    printf("%u events from %u clients over %u ticks: enqueue %6.0f ns/event (%6.0f sys), "
+           "dispatch and read %6.0f ns/event (%6.0f sys), %u of %u delivered, "
+           "%u out of order\n", sent, nclients, spread, in_t / sent, in_st / sent,
+           out_t / sent, out_st / sent, received, sent, misordered);
+    ret = received == sent && !misordered ? 0 : -1;
+
+out_queue:
+    ioctl(c[0].fd, SNDRV_SEQ_IOCTL_DELETE_QUEUE, &qinfo);
+out_close:
+    for (i = 0; i < nclients; i++)
+        close(c[i].fd);
+out_free:
+    free(last_seq);
+    free(last_tick);
+    free(evs);
+    free(c);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int counts[16] = { 1, 8, 64 };
+    unsigned int ncounts = 3;
+    unsigned int bytes = 1024;
+    unsigned int burst = 16;
+    unsigned int loops = 2000;
+    unsigned int i;
+    const char *midi = NULL;
+    int client = -1, port = 0;
+    unsigned int queue_events = 0, queue_spread = 0;
+    int ret = 0;
+
+    argv += 1;
+    while (*argv) {
+        if (strcmp(*argv, "-s") == 0) {
+            argv++;
+            if (*argv) {
+                char *p = *argv;
+
+                /* comma separated subscriber counts */
+                for (ncounts = 0; ncounts < 16 && *p; ncounts++) {
+                    counts[ncounts] = strtoul(p, &p, 0);
+                    if (*p == ',')
+                        p++;
+                }
+            }
+        } else if (strcmp(*argv, "-b") == 0) {
+            argv++;
+            if (*argv)
+                bytes = atoi(*argv);
+        } else if (strcmp(*argv, "-n") == 0) {
+            argv++;
+            if (*argv)
+                burst = atoi(*argv);
+        } else if (strcmp(*argv, "-l") == 0) {
+            argv++;
+            if (*argv)
+                loops = atoi(*argv);
+        } else if (strcmp(*argv, "-m") == 0) {
+            argv++;
+            if (*argv)
+                midi = *argv;
+        } else if (strcmp(*argv, "-p") == 0) {
+            argv++;
+            if (*argv && sscanf(*argv, "%d:%d", &client, &port) < 1)
+                client = -1;
+        } else if (strcmp(*argv, "-q") == 0) {
+            argv++;
+            if (*argv && sscanf(*argv, "%u:%u", &queue_events, &queue_spread) == 1)
+                queue_spread = queue_events;
+        } else {
+            fprintf(stderr, "Usage: tinyseqbench [-s subscribers[,subscribers...]] "
+                    "[-b sysex_bytes] [-n events_per_burst] [-l loops] "
+                    "[-m virmidi_device -p client:port] [-q events[:ticks]]\n");
+            return 1;
+        }
+        if (*argv)
+            argv++;
+    }
+    if (queue_events) {
+        if (!queue_spread)
+            queue_spread = 1;
+        return run_queue(queue_events, queue_spread) ? 1 : 0;
+    }
+
+    if (bytes < 2 || !burst || !loops) {
+        fprintf(stderr, "need at least 2 bytes, events and loops\n");
+        return 1;
+    }
+    /* a burst must fit the subscriber pools even as private copies */
+    if (burst * ((bytes + sizeof(struct snd_seq_event) - 1) / sizeof(struct snd_seq_event) + 1) >
+        SEQ_POOL_CELLS) {
+        fprintf(stderr, "a burst of %u events of %u bytes doesn't fit %u cells\n", burst,
+                bytes, SEQ_POOL_CELLS);
+        return 1;
+    }
+
+    if (midi) {
+        if (client < 0) {
+            fprintf(stderr, "-m needs the sequencer port of the device with -p\n");
+            return 1;
+        }
+        printf("%u byte SysEx, %u messages per burst, %u bursts\n", bytes, burst, loops);
+        return run_midi(midi, client, port, bytes, burst, loops) ? 1 : 0;
+    }
+
+    printf("%u byte SysEx, %u events per burst, %u bursts\n", bytes, burst, loops);
+    for (i = 0; i < ncounts; i++) {
+        if (!counts[i])
+            continue;
+        if (run(counts[i], bytes, burst, loops))
+            ret = 1;
+    }
+    return ret;
+}
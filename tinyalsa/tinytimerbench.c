@@ -0,0 +1,283 @@
+/* tinytimerbench.c
+**
+** Copyright 2011, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of The Android Open Source Project nor the names of
+**       its contributors may be used to endorse or promote products derived
+**       from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY The Android Open Source Project ``AS IS'' AND
+** ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL The Android Open Source Project BE LIABLE
+** FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+** DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+** SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+** CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+** OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+** DAMAGE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+
+#include <sound/asound.h>
+
+/* Stresses the timer core with many instances on one global timer.  Every
+ * instance runs periodically with its own period; a part of them is stopped
+ * and restarted from this process the whole time, which is what costs a
+ * reschedule in the kernel.  The interrupt and tasklet time is taken from
+ * /proc/stat, so it covers the whole system and wants an otherwise idle
+ * machine.  At the end the ticks every undisturbed instance was called back
+ * for are checked against the elapsed time. */
+
+struct instance {
+    int fd;
+    unsigned int ticks;
+    int churn;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* system, irq and softirq time of all cpus in USER_HZ */
+static int cpu_time(unsigned long long *sys, unsigned long long *irq)
+{
+    unsigned long long user, nice, system, idle, iowait, hardirq, softirq;
+    FILE *f;
+    int n;
+
+    f = fopen("/proc/stat", "r");
+    if (!f)
+        return -1;
+    n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice,
+               &system, &idle, &iowait, &hardirq, &softirq);
+    fclose(f);
+    if (n != 7)
+        return -1;
+    *sys = system;
+    *irq = hardirq + softirq;
+    return 0;
+}
+
+static int instance_open(struct instance *in, int timer, unsigned int ticks)
+{
+    struct snd_timer_select sel;
+    struct snd_timer_params params;
+
+    in->fd = open("/dev/snd/timer", O_RDONLY | O_NONBLOCK);
+    if (in->fd < 0)
+        return -1;
+    memset(&sel, 0, sizeof(sel));
+    sel.id.dev_class = SNDRV_TIMER_CLASS_GLOBAL;
+    sel.id.dev_sclass = SNDRV_TIMER_SCLASS_NONE;
+    sel.id.card = -1;
+    sel.id.device = timer;
+    if (ioctl(in->fd, SNDRV_TIMER_IOCTL_SELECT, &sel) < 0)
+        goto fail;
+    memset(&params, 0, sizeof(params));
+    params.flags = SNDRV_TIMER_PSFLG_AUTO;
+    params.ticks = ticks;
+    /* a short queue is enough, the ticks of a full one accumulate */
+    params.queue_size = 2;
+    if (ioctl(in->fd, SNDRV_TIMER_IOCTL_PARAMS, &params) < 0)
+        goto fail;
+    in->ticks = ticks;
+    return 0;
+
+fail:
+    close(in->fd);
+    in->fd = -1;
+    return -1;
+}
+
+/* sum of the ticks queued for an instance */
+static unsigned long long instance_ticks(struct instance *in)
+{
+    struct snd_timer_read r[16];
+    unsigned long long ticks = 0;
+    ssize_t n;
+    int i;
+
+    while ((n = read(in->fd, r, sizeof(r))) > 0)
+        for (i = 0; i < n / (ssize_t)sizeof(r[0]); i++)
+            ticks += r[i].ticks;
+    return ticks;
+}
+
+int main(int argc, char **argv)
+{
+    struct snd_timer_info info;
+    struct instance *ins;
+    struct rlimit rl;
+    unsigned int count = 2000;
+    unsigned int seconds = 10;
+    unsigned int min_us = 1000, max_us = 20000;
+    unsigned int churn_pct = 10;
+    int timer = SNDRV_TIMER_GLOBAL_HRTIMER;
+    unsigned long long sys0, irq0, sys1, irq1;
+    unsigned long long restarts = 0;
+    double t, end, restart_ns = 0, worst = 0, res = 1;
+    unsigned int i, checked = 0;
+    int ret = 0;
+
+    memset(&info, 0, sizeof(info));
+    argv += 1;
+    while (*argv) {
+        if (strcmp(*argv, "-t") == 0) {
+            argv++;
+            if (*argv)
+                timer = strcmp(*argv, "system") == 0 ? SNDRV_TIMER_GLOBAL_SYSTEM :
+                        strcmp(*argv, "hrtimer") == 0 ? SNDRV_TIMER_GLOBAL_HRTIMER :
+                        atoi(*argv);
+        } else if (strcmp(*argv, "-n") == 0) {
+            argv++;
+            if (*argv)
+                count = atoi(*argv);
+        } else if (strcmp(*argv, "-s") == 0) {
+            argv++;
+            if (*argv)
+                seconds = atoi(*argv);
+        } else if (strcmp(*argv, "-p") == 0) {
+            argv++;
+            if (*argv && sscanf(*argv, "%u:%u", &min_us, &max_us) == 1)
+                max_us = min_us;
+        } else if (strcmp(*argv, "-c") == 0) {
+            argv++;
+            if (*argv)
+                churn_pct = atoi(*argv);
+        } else {
+            fprintf(stderr, "Usage: tinytimerbench [-t system|hrtimer|device] "
+                    "[-n instances] [-s seconds] [-p min_us[:max_us]] [-c churn_percent]\n");
+            return 1;
+        }
+        if (*argv)
+            argv++;
+    }
+    if (!count || !seconds || !min_us || max_us < min_us || churn_pct > 100) {
+        fprintf(stderr, "need instances, seconds and a valid period range\n");
+        return 1;
+    }
+
+    /* one file per instance */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < count + 16) {
+        rl.rlim_cur = count + 16;
+        if (rl.rlim_max < rl.rlim_cur)
+            rl.rlim_max = rl.rlim_cur;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+            fprintf(stderr, "unable to raise the file limit to %u: %s\n",
+                    count + 16, strerror(errno));
+    }
+
+    ins = calloc(count, sizeof(*ins));
+    if (!ins) {
+        fprintf(stderr, "unable to allocate %u instances\n", count);
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < count; i++) {
+        unsigned int us = min_us + rand() % (max_us - min_us + 1);
+
+        if (i == 0) {
+            /* all instances share the timer and so its resolution */
+            if (instance_open(&ins[i], timer, 1) < 0 ||
+                ioctl(ins[i].fd, SNDRV_TIMER_IOCTL_INFO, &info) < 0) {
+                fprintf(stderr, "unable to open timer %d: %s\n", timer, strerror(errno));
+                return 1;
+            }
+            close(ins[i].fd);
+            res = info.resolution ? info.resolution : 1;
+        }
+        if (instance_open(&ins[i], timer, us * 1000.0 / res > 1 ? us * 1000.0 / res : 1) < 0) {
+            fprintf(stderr, "unable to open instance %u: %s\n", i, strerror(errno));
+            count = i;
+            ret = 1;
+            break;
+        }
+        ins[i].churn = i < count * churn_pct / 100;
+    }
+
+    printf("timer %d (%s, %.0f ns/tick): %u instances, %u-%u us, %u%% restarted, %u s\n",
+           timer, info.name, res, count, min_us, max_us, churn_pct, seconds);
+
+    for (i = 0; i < count; i++)
+        if (ioctl(ins[i].fd, SNDRV_TIMER_IOCTL_START) < 0) {
+            fprintf(stderr, "unable to start instance %u: %s\n", i, strerror(errno));
+            ret = 1;
+        }
+    if (cpu_time(&sys0, &irq0) < 0) {
+        fprintf(stderr, "unable to read /proc/stat\n");
+        sys0 = irq0 = 0;
+    }
+    t = now_ns();
+    end = t + seconds * 1e9;
+
+    /* restart the churned instances round robin until the time is up,
+     * sleeping in between so the timer gets some interrupts in */
+    while (now_ns() < end) {
+        struct timespec ts = { 0, 1000000 };
+
+        for (i = 0; i < count && ins[i].churn; i++) {
+            double r = now_ns();
+
+            ioctl(ins[i].fd, SNDRV_TIMER_IOCTL_STOP);
+            ioctl(ins[i].fd, SNDRV_TIMER_IOCTL_START);
+            restart_ns += now_ns() - r;
+            restarts++;
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    for (i = 0; i < count; i++)
+        ioctl(ins[i].fd, SNDRV_TIMER_IOCTL_STOP);
+    t = now_ns() - t;
+    if (cpu_time(&sys1, &irq1) < 0)
+        sys1 = irq1 = 0;
+
+    for (i = 0; i < count; i++) {
+        unsigned long long ticks = instance_ticks(&ins[i]);
+        double err;
+
+        if (!ins[i].churn) {
+            /* the last callback is at most one period before the stop */
+            err = (t / res - ticks) / ins[i].ticks;
+            if (err > worst || -err > worst)
+                worst = err < 0 ? -err : err;
+            if (err < -1.0 || err > 2.0) {
+                fprintf(stderr, "instance %u: %llu ticks of %u for %.0f ns\n", i,
+                        ticks, ins[i].ticks, t);
+                ret = 1;
+            }
+            checked++;
+        }
+        close(ins[i].fd);
+    }
+    free(ins);
+
+    printf("irq %.2f%% sys %.2f%% of all cpus, %.0f ns per restart, "
+           "worst drift %.2f periods over %u instances\n",
+           (irq1 - irq0) * 1e11 / sysconf(_SC_CLK_TCK) / t / sysconf(_SC_NPROCESSORS_ONLN),
+           (sys1 - sys0) * 1e11 / sysconf(_SC_CLK_TCK) / t / sysconf(_SC_NPROCESSORS_ONLN),
+           restarts ? restart_ns / restarts : 0, worst, checked);
+    return ret;
+}